@@ -0,0 +1,142 @@
+// Benchmark of the WGS84 to OSGB36 datum shift that RMProjection's OSGB projection does. It is
+// plain C and builds on any POSIX system against the Proj4 sources, for example from this
+// directory:
+//
+//   cc -O2 -DHAVE_CONFIG_H -I../../Proj4 -o datumbench RMDatumShiftBenchmark.c `ls ../../Proj4/*.c | grep -v -e /cs2cs.c -e /geod.c -e /nad2 -e /proj.c` -lm -lpthread
+//   ./datumbench [points] [rounds]
+//
+// The points are a grid over Great Britain. "four calls" runs the stages pj_datum_transform()
+// used to run one after the other: to geocentric, to WGS84, from WGS84 and back to geodetic.
+// "one call" runs pj_geodetic_datum_shift(), which pj_datum_transform() calls now; it runs the
+// same stages and only sets the ellipsoids up once. "transform" and "plan" run the whole latlong
+// to OSGB grid projection through pj_transform() and through a plan made once with
+// pj_plan_create(). Each pair must give the same bits, which is checked.
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "projects.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define kBenchPoints 5000
+#define kBenchRounds 200
+
+static const char *kBenchLatLong = "+proj=latlong +datum=WGS84";
+static const char *kBenchOSGB = "+proj=tmerc +lat_0=49 +lon_0=-2 +k=0.999601 +x_0=400000 +y_0=-100000 +ellps=airy +datum=OSGB36 +units=m +no_defs";
+
+static double BenchNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void BenchFill(long count, double *x, double *y, double *z)
+{
+	for (long i = 0; i < count; i++) {
+		x[i] = (-8.0 + (i % 100) * 0.1) * DEG_TO_RAD;
+		y[i] = (50.0 + (i / 100 % 100) * 0.1) * DEG_TO_RAD;
+		if (z != NULL)
+			z[i] = 0;
+	}
+}
+
+static int BenchShifted(const PJ *P)
+{
+	return P->datum_type == PJD_3PARAM || P->datum_type == PJD_7PARAM;
+}
+
+static void BenchFourCalls(PJ *src, PJ *dst, long count, double *x, double *y, double *z)
+{
+	pj_geodetic_to_geocentric(src->a_orig, src->es_orig, count, 1, x, y, z);
+	if (BenchShifted(src))
+		pj_geocentric_to_wgs84(src, count, 1, x, y, z);
+	if (BenchShifted(dst))
+		pj_geocentric_from_wgs84(dst, count, 1, x, y, z);
+	pj_geocentric_to_geodetic(dst->a_orig, dst->es_orig, count, 1, x, y, z);
+}
+
+static void BenchOneCall(PJ *src, PJ *dst, long count, double *x, double *y, double *z)
+{
+	pj_geodetic_datum_shift(src->a_orig, src->es_orig, BenchShifted(src) ? src : NULL,
+							BenchShifted(dst) ? dst : NULL, dst->a_orig, dst->es_orig, count, 1, x, y, z);
+}
+
+static void BenchReport(const char *name, long points, int rounds, double seconds)
+{
+	printf("%-12s %8.3f ms per %ld points %8.1f ns/point\n", name, seconds * 1e3 / rounds, points,
+		   seconds * 1e9 / ((double)rounds * points));
+}
+
+static int BenchSame(long count, const double *a, const double *b)
+{
+	return memcmp(a, b, count * sizeof(double)) == 0;
+}
+
+int main(int argc, char **argv)
+{
+	long points = argc > 1 ? atol(argv[1]) : kBenchPoints;
+	int rounds = argc > 2 ? atoi(argv[2]) : kBenchRounds;
+	PJ *latLong = pj_init_plus(kBenchLatLong), *osgb = pj_init_plus(kBenchOSGB);
+	projPlan plan;
+	double *x[2], *y[2], *z[2];
+	double seconds[4] = { 0, 0, 0, 0 };
+	int failed = 0;
+
+	if (latLong == NULL || osgb == NULL || (plan = pj_plan_create(latLong, osgb)) == NULL) {
+		fprintf(stderr, "cannot set up the projections: %s\n", pj_strerrno(pj_errno));
+		return 1;
+	}
+	for (int i = 0; i < 2; i++) {
+		x[i] = malloc(points * sizeof(double));
+		y[i] = malloc(points * sizeof(double));
+		z[i] = malloc(points * sizeof(double));
+	}
+
+	for (int round = 0; round < rounds; round++) {
+		double start;
+
+		BenchFill(points, x[0], y[0], z[0]);
+		start = BenchNow();
+		BenchFourCalls(latLong, osgb, points, x[0], y[0], z[0]);
+		seconds[0] += BenchNow() - start;
+
+		BenchFill(points, x[1], y[1], z[1]);
+		start = BenchNow();
+		BenchOneCall(latLong, osgb, points, x[1], y[1], z[1]);
+		seconds[1] += BenchNow() - start;
+
+		failed |= !BenchSame(points, x[0], x[1]) || !BenchSame(points, y[0], y[1]) || !BenchSame(points, z[0], z[1]);
+
+		BenchFill(points, x[0], y[0], NULL);
+		start = BenchNow();
+		failed |= pj_transform(latLong, osgb, points, 1, x[0], y[0], NULL) != 0;
+		seconds[2] += BenchNow() - start;
+
+		BenchFill(points, x[1], y[1], NULL);
+		start = BenchNow();
+		failed |= pj_plan_execute(plan, points, 1, x[1], y[1], NULL) != 0;
+		seconds[3] += BenchNow() - start;
+
+		failed |= !BenchSame(points, x[0], x[1]) || !BenchSame(points, y[0], y[1]);
+	}
+
+	BenchReport("four calls", points, rounds, seconds[0]);
+	BenchReport("one call", points, rounds, seconds[1]);
+	BenchReport("transform", points, rounds, seconds[2]);
+	BenchReport("plan", points, rounds, seconds[3]);
+	if (failed)
+		printf("results differ\n");
+
+	for (int i = 0; i < 2; i++) {
+		free(x[i]);
+		free(y[i]);
+		free(z[i]);
+	}
+	pj_plan_free(plan);
+	pj_free(osgb);
+	pj_free(latLong);
+	return failed;
+}
@@ -0,0 +1,137 @@
+// Hit rates of the memory cache with and without TinyLFU admission. It is plain C and builds
+// on any POSIX system, for example from this directory:
+//
+//   cc -std=c99 -O2 -I../Map -o admissionbench RMTileAdmissionBenchmark.c ../Map/RMTileLRU.c ../Map/RMTileSketch.c
+//   ./admissionbench [capacity]
+//
+// The workload goes back and forth between a home area, looked at over and over, and long pans
+// over tiles that are seen once, some of which are looked at again on the way back. The caches
+// are split and admitted to the way RMMemoryCache does it.
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "RMTileLRU.h"
+#include "RMTileSketch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Same layout as RMTileKey(), without pulling CoreGraphics in through RMTile.h.
+static uint64_t BenchTileKey(uint32_t x, uint32_t y, short zoom)
+{
+	return ((uint64_t)(zoom & 0xFF) << 56) | ((uint64_t)(x & 0xFFFFFFF) << 28) | (uint64_t)(y & 0xFFFFFFF);
+}
+
+static double BenchNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef struct {
+	size_t lookups, hits, rejections;
+} BenchResult;
+
+typedef struct {
+	RMTileLRU *main, *window;
+	RMTileSketch *sketch;
+	int offering;			// set while the window evicts, clear while it is freed
+	BenchResult result;
+} BenchCache;
+
+// What the window evicts goes to the main cache if it is asked for more often than the victim.
+static void BenchLeaveWindow(void *context, uint64_t key, void *value)
+{
+	BenchCache *cache = context;
+	uint64_t victim;
+
+	if (!cache->offering)
+		return;
+	if (RMTileLRUVictim(cache->main, 1, &victim) && !RMTileSketchAdmit(cache->sketch, key, victim)) {
+		cache->result.rejections++;
+		return;
+	}
+	RMTileLRUPut(cache->main, key, value, 1);
+}
+
+// Looks a tile up, and adds it on a miss as RMCachedTileSource does after asking the source.
+static void BenchLookup(BenchCache *cache, uint64_t key)
+{
+	cache->result.lookups++;
+	if (cache->window != NULL) {
+		RMTileSketchIncrement(cache->sketch, key);
+		if (RMTileLRUGet(cache->window, key) != NULL) {
+			cache->result.hits++;
+			return;
+		}
+	}
+	if (RMTileLRUGet(cache->main, key) != NULL) {
+		cache->result.hits++;
+		return;
+	}
+
+	cache->offering = 1;
+	RMTileLRUPut(cache->window != NULL ? cache->window : cache->main, key, (void *)1, 1);
+	cache->offering = 0;
+}
+
+static BenchResult BenchRun(size_t capacity, int admission, double *seconds)
+{
+	BenchCache cache = { NULL, NULL, NULL, 0, { 0, 0, 0 } };
+	size_t windowCapacity = admission ? (capacity / 4 > 0 ? capacity / 4 : 1) : 0;
+	uint32_t homeSide = 1, panX = 100000;
+
+	cache.main = RMTileLRUCreate(0, capacity - windowCapacity, NULL, NULL);
+	if (admission) {
+		cache.window = RMTileLRUCreate(0, windowCapacity, BenchLeaveWindow, &cache);
+		cache.sketch = RMTileSketchCreate(20 * capacity);
+	}
+
+	while ((size_t)(homeSide + 1) * (homeSide + 1) <= capacity * 2 / 3)
+		homeSide++;
+
+	double start = BenchNow();
+	for (int round = 0; round < 200; round++) {
+		// the home area, a few times over while the user looks around
+		for (int look = 0; look < 3; look++)
+			for (uint32_t y = 0; y < homeSide; y++)
+				for (uint32_t x = 0; x < homeSide; x++)
+					BenchLookup(&cache, BenchTileKey(20000 + x, 20000 + y, 16));
+
+		// a long pan somewhere else over three rows of tiles, then a little way back
+		for (uint32_t x = 0; x < capacity * 2; x++, panX++)
+			for (uint32_t y = 0; y < 3; y++)
+				BenchLookup(&cache, BenchTileKey(panX, 30000 + y, 16));
+		for (uint32_t x = 1; x <= 8; x++)
+			for (uint32_t y = 0; y < 3; y++)
+				BenchLookup(&cache, BenchTileKey(panX - x, 30000 + y, 16));
+	}
+	*seconds = BenchNow() - start;
+
+	RMTileSketchFree(cache.sketch);
+	if (cache.window != NULL)
+		RMTileLRUFree(cache.window);
+	RMTileLRUFree(cache.main);
+	return cache.result;
+}
+
+static void BenchReport(const char *name, BenchResult result, double seconds)
+{
+	printf("%-20s %8lu lookups %6.1f%% hits %8lu rejected %6.1f ns/lookup\n", name,
+		   (unsigned long)result.lookups, 100.0 * result.hits / result.lookups,
+		   (unsigned long)result.rejections, seconds * 1e9 / result.lookups);
+}
+
+int main(int argc, char **argv)
+{
+	size_t capacity = argc > 1 ? (size_t)strtoul(argv[1], NULL, 10) : 96;
+	double seconds;
+	BenchResult result;
+
+	result = BenchRun(capacity, 0, &seconds);
+	BenchReport("LRU", result, seconds);
+	result = BenchRun(capacity, 1, &seconds);
+	BenchReport("W-TinyLFU", result, seconds);
+	return 0;
+}
@@ -0,0 +1,238 @@
+//
+//  RMTileCacheDAOBenchmark.c
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Insert benchmark for the SQLite tile cache, using the statements RMTileCacheDAO runs.
+// Builds on any system with SQLite, for example from this directory:
+//
+//   cc -std=c99 -O2 -o daobench RMTileCacheDAOBenchmark.c -lsqlite3
+//   ./daobench [tiles [capacity [database]]]
+//   ./daobench 20000 0 /tmp/old.sqlite count
+//
+// Each line is the average insert time over the last window of tiles. By default the
+// running count is used and purges down to the low watermark run in batches, on a thread
+// of their own, whenever the high watermark is reached; the "count" argument instead
+// runs SELECT COUNT before every insert and purges inline, as the cache used to.
+//
+// Synchronous writes are off so that disk flushes do not hide the cost of the statements.
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <sqlite3.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define kWindow 10000
+#define kPurgeBatch 256
+
+static sqlite3 *db;
+static pthread_mutex_t dbLock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long tileCount, capacity, lowWatermark;
+static int maintenanceRunning;
+static pthread_t maintenanceThread;
+static double purgeSeconds;
+
+static double BenchNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void BenchExec(const char *sql)
+{
+	char *error = NULL;
+	if (sqlite3_exec(db, sql, NULL, NULL, &error) != SQLITE_OK) {
+		fprintf(stderr, "%s: %s\n", sql, error);
+		exit(1);
+	}
+}
+
+static sqlite3_stmt *BenchPrepare(const char *sql)
+{
+	sqlite3_stmt *statement;
+	if (sqlite3_prepare_v2(db, sql, -1, &statement, NULL) != SQLITE_OK) {
+		fprintf(stderr, "%s: %s\n", sql, sqlite3_errmsg(db));
+		exit(1);
+	}
+	return statement;
+}
+
+static unsigned long BenchCount(sqlite3_stmt *count)
+{
+	unsigned long result = 0;
+	if (sqlite3_step(count) == SQLITE_ROW)
+		result = (unsigned long)sqlite3_column_int64(count, 0);
+	sqlite3_reset(count);
+	return result;
+}
+
+static unsigned long BenchPurge(sqlite3_stmt *purge, unsigned long tiles)
+{
+	sqlite3_bind_int64(purge, 1, (sqlite3_int64)tiles);
+	sqlite3_step(purge);
+	sqlite3_reset(purge);
+	return (unsigned long)sqlite3_changes(db);
+}
+
+// RMDatabaseCache -performMaintenance
+static void *BenchMaintenance(void *unused)
+{
+	sqlite3_stmt *purge = BenchPrepare("DELETE FROM ZCACHE WHERE ztileHash IN (SELECT ztileHash FROM ZCACHE ORDER BY zlastUsed LIMIT ?)");
+	double start = BenchNow();
+
+	for (;;) {
+		pthread_mutex_lock(&dbLock);
+		if (tileCount <= lowWatermark) {
+			pthread_mutex_unlock(&dbLock);
+			break;
+		}
+		unsigned long batch = tileCount - lowWatermark < kPurgeBatch ? tileCount - lowWatermark : kPurgeBatch;
+		unsigned long deleted = BenchPurge(purge, batch);
+		tileCount -= deleted < tileCount ? deleted : tileCount;
+		pthread_mutex_unlock(&dbLock);
+		if (deleted == 0)
+			break;
+	}
+
+	sqlite3_finalize(purge);
+	pthread_mutex_lock(&dbLock);
+	purgeSeconds += BenchNow() - start;
+	maintenanceRunning = 0;
+	pthread_mutex_unlock(&dbLock);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long tiles = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+	const char *path = argc > 3 ? argv[3] : "daobench.sqlite";
+	int countEveryInsert = argc > 4 && strcmp(argv[4], "count") == 0;
+	sqlite3_stmt *insert, *update, *count, *purge;
+	unsigned char blob[512];
+	double windowStart, worst = 0, best = 1e9;
+
+	capacity = argc > 2 ? strtoul(argv[2], NULL, 10) : tiles * 3 / 4;
+	lowWatermark = capacity - capacity / 10;
+
+	remove(path);
+	if (sqlite3_open(path, &db) != SQLITE_OK) {
+		fprintf(stderr, "cannot open %s\n", path);
+		return 1;
+	}
+	BenchExec("PRAGMA synchronous = OFF");
+	BenchExec("CREATE TABLE IF NOT EXISTS ZCACHE (ztileHash INTEGER PRIMARY KEY, zlastUsed DOUBLE, zdata BLOB)");
+	BenchExec("CREATE INDEX IF NOT EXISTS zlastUsedIndex ON ZCACHE(zLastUsed)");
+	BenchExec("ALTER TABLE ZCACHE ADD COLUMN zInserted DOUBLE");
+	BenchExec("CREATE INDEX IF NOT EXISTS zInsertedIndex ON ZCACHE(zInserted)");
+
+	insert = BenchPrepare(countEveryInsert
+		? "INSERT OR REPLACE INTO ZCACHE (ztileHash, zlastUsed, zInserted, zdata) VALUES (?, ?, ?, ?)"
+		: "INSERT OR IGNORE INTO ZCACHE (ztileHash, zlastUsed, zInserted, zdata) VALUES (?, ?, ?, ?)");
+	update = BenchPrepare("UPDATE ZCACHE SET zlastUsed = ?, zInserted = ?, zdata = ? WHERE ztileHash = ?");
+	count = BenchPrepare("SELECT COUNT(ztileHash) FROM ZCACHE");
+	purge = BenchPrepare("DELETE FROM ZCACHE WHERE ztileHash IN (SELECT ztileHash FROM ZCACHE ORDER BY zlastUsed LIMIT ?)");
+	tileCount = BenchCount(count);
+
+	memset(blob, 0x5a, sizeof blob);
+	printf("%lu tiles, capacity %lu, %s\n", tiles, capacity,
+		   countEveryInsert ? "SELECT COUNT and inline purge" : "running count and background purge");
+
+	windowStart = BenchNow();
+	for (unsigned long i = 0; i < tiles; i++) {
+		// zoom 16 tiles in RMTileKey() layout, a few of them loaded twice
+		unsigned long n = i % 97 == 0 && i > 0 ? i / 2 : i;
+		sqlite3_int64 key = ((sqlite3_int64)16 << 56) | ((sqlite3_int64)(34000 + n % 512) << 28) | (sqlite3_int64)(21000 + n / 512);
+		double now = (double)i;
+
+		pthread_mutex_lock(&dbLock);
+		if (countEveryInsert && capacity != 0) {
+			unsigned long tilesInDb = BenchCount(count);
+			if (capacity <= tilesInDb) {
+				unsigned long wanted = 1 + tilesInDb - capacity;
+				BenchPurge(purge, wanted > capacity / 10 ? wanted : capacity / 10);
+			}
+		}
+
+		sqlite3_bind_int64(insert, 1, key);
+		sqlite3_bind_double(insert, 2, now);
+		sqlite3_bind_double(insert, 3, now);
+		sqlite3_bind_blob(insert, 4, blob, sizeof blob, SQLITE_STATIC);
+		sqlite3_step(insert);
+		sqlite3_reset(insert);
+		if (!countEveryInsert) {
+			if (sqlite3_changes(db) == 0) {
+				sqlite3_bind_double(update, 1, now);
+				sqlite3_bind_double(update, 2, now);
+				sqlite3_bind_blob(update, 3, blob, sizeof blob, SQLITE_STATIC);
+				sqlite3_bind_int64(update, 4, key);
+				sqlite3_step(update);
+				sqlite3_reset(update);
+			} else {
+				tileCount++;
+			}
+			if (capacity != 0 && tileCount >= capacity && !maintenanceRunning) {
+				if (maintenanceThread)
+					pthread_join(maintenanceThread, NULL);
+				maintenanceRunning = 1;
+				pthread_create(&maintenanceThread, NULL, BenchMaintenance, NULL);
+			}
+		}
+		pthread_mutex_unlock(&dbLock);
+
+		if ((i + 1) % kWindow == 0) {
+			double perInsert = (BenchNow() - windowStart) * 1e6 / kWindow;
+			printf("%8lu tiles  %8.2f us/insert\n", i + 1, perInsert);
+			if (perInsert > worst)
+				worst = perInsert;
+			if (perInsert < best)
+				best = perInsert;
+			windowStart = BenchNow();
+		}
+	}
+
+	if (maintenanceThread)
+		pthread_join(maintenanceThread, NULL);
+	if (!countEveryInsert && tileCount != BenchCount(count)) {
+		fprintf(stderr, "running count %lu, table has %lu\n", tileCount, BenchCount(count));
+		return 1;
+	}
+	printf("windows %.2f to %.2f us/insert, %lu tiles left", best, worst, BenchCount(count));
+	if (!countEveryInsert)
+		printf(", %.2f s purging in the background", purgeSeconds);
+	printf("\n");
+
+	sqlite3_finalize(insert);
+	sqlite3_finalize(update);
+	sqlite3_finalize(count);
+	sqlite3_finalize(purge);
+	sqlite3_close(db);
+	remove(path);
+	return 0;
+}
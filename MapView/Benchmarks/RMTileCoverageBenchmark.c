@@ -0,0 +1,472 @@
+// Replays pan and zoom sessions through the bookkeeping of RMTileImageSet, to time how it decides
+// which tiles to keep. It is plain C and builds on any POSIX system, for example from this
+// directory:
+//
+//   cc -std=c99 -O2 -I../Map -o coveragebench RMTileCoverageBenchmark.c ../Map/RMTileCoverage.c ../Map/RMTileIndex.c ../Map/RMTile.c -lm
+//   ./coveragebench [session...]
+//
+// A session file has one line per update of the tile loader: the zoom level and the tile
+// coordinates of the centre of the screen at that level, "16 35210.4 21492.8" for instance.
+// Lines starting with # are skipped. Without files, three built-in sessions are replayed: a long
+// pan, pinching in and out, and browsing about with both.
+//
+// Each update sets the zoom level, adds the tiles of a screen of kBenchScreenWidth by
+// kBenchScreenHeight tiles at it and at the tileDepth levels above, and removes the tiles
+// outside of it, as RMTileLoader does. Some tiles load right away, as from a cache; the others
+// load a few updates later, unless they were removed in the meantime. Three ways of finding the
+// worse tiles are compared, and must all end up with the same tiles:
+//
+//   scan      every loaded tile is tried, as RMTileImageSet did with an NSMutableSet;
+//   index     only the overlapping tiles are tried, found through RMTileIndex;
+//   coverage  whether a better loaded tile exists is a lookup per zoom level in RMTileCoverage,
+//             and setZoom: takes one pass over the tiles instead of one per loaded tile.
+
+#define _XOPEN_SOURCE 600
+
+#include "RMTileCoverage.h"
+#include "RMTileIndex.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define kBenchScreenWidth 5
+#define kBenchScreenHeight 7
+#define kBenchTileDepth 2
+#define kBenchMaxZoom 18
+
+enum { BenchScan, BenchIndex, BenchCoverage };
+static const char *kBenchModeNames[] = { "scan", "index", "coverage" };
+
+typedef struct {
+	short zoom;
+	double x, y;
+} BenchFrame;
+
+typedef struct {
+	BenchFrame *frames;
+	size_t count, capacity;
+	char name[64];
+} BenchSession;
+
+typedef struct {
+	RMTile tile;
+	int loaded;
+	unsigned serial;
+} BenchImage;
+
+typedef struct {
+	BenchImage **items;
+	size_t count, capacity;
+} BenchList;
+
+typedef struct {
+	RMTile tile;
+	unsigned serial;
+	size_t frame;
+} BenchLoad;
+
+typedef struct {
+	int mode;
+	RMTileIndex *images;
+	RMTileCoverage *loadedTiles;
+	short zoom, tileDepth;
+	unsigned serial;
+	BenchList removed;		// freed after each update, like autoreleased images
+	BenchLoad *loads;
+	size_t loadCount, loadCapacity;
+	size_t tried;			// tiles looked at for being worse
+} BenchSet;
+
+static double BenchNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void BenchAppend(BenchList *list, BenchImage *image)
+{
+	if (list->count == list->capacity) {
+		list->capacity = list->capacity ? list->capacity * 2 : 64;
+		list->items = realloc(list->items, list->capacity * sizeof(BenchImage *));
+	}
+	list->items[list->count++] = image;
+}
+
+static void BenchCollect(void *context, RMTile tile, void *value)
+{
+	BenchAppend(context, value);
+}
+
+static void BenchAll(BenchSet *set, BenchList *list)
+{
+	list->count = 0;
+	RMTileIndexForEach(set->images, BenchCollect, list);
+}
+
+// Whether a tile comes from a cache right away, and otherwise how many updates it takes.
+static unsigned BenchLatency(RMTile tile)
+{
+	uint64_t hash = RMTileKey(tile) * 0x9E3779B97F4A7C15ULL;
+	return (hash >> 60) < 5 ? 0 : 2 + (unsigned)(hash >> 58) % 4;
+}
+
+// isTile:worseThanTile:
+static int BenchWorse(const BenchSet *set, RMTile subject, RMTile object)
+{
+	short zoom = set->zoom;
+	uint32_t sx = subject.x, sy = subject.y, ox = object.x, oy = object.y;
+
+	if (object.zoom > zoom)
+		return 0;
+	if (subject.zoom + set->tileDepth >= zoom && subject.zoom <= zoom)
+		return 0;
+	if (subject.zoom < object.zoom) {
+		ox >>= object.zoom - subject.zoom;
+		oy >>= object.zoom - subject.zoom;
+	} else {
+		sx >>= subject.zoom - object.zoom;
+		sy >>= subject.zoom - object.zoom;
+	}
+	if (sx != ox || sy != oy)
+		return 0;
+	return abs(zoom - subject.zoom) >= abs(zoom - object.zoom);
+}
+
+// isTileCoveredByBetterTile:countingItself:
+static int BenchCovered(BenchSet *set, RMTile subject, int countItself)
+{
+	short zoom = set->zoom, minZ;
+
+	set->tried++;
+	if (subject.zoom + set->tileDepth >= zoom && subject.zoom <= zoom)
+		return 0;
+	minZ = zoom - abs(zoom - subject.zoom);
+	if (!countItself && minZ == subject.zoom)
+		minZ++;
+	return RMTileCoverageCovers(set->loadedTiles, subject, minZ, zoom);
+}
+
+static void BenchRemoveTile(BenchSet *set, RMTile tile)
+{
+	BenchImage *image = RMTileIndexRemove(set->images, tile);
+	if (image == NULL)
+		return;
+	if (set->loadedTiles != NULL)
+		RMTileCoverageRemove(set->loadedTiles, tile);
+	BenchAppend(&set->removed, image);
+}
+
+static void BenchRemoveWorseThan(BenchSet *set, BenchImage *newImage)
+{
+	BenchList list = { NULL, 0, 0 };
+
+	if (newImage->tile.zoom > set->zoom)
+		return;
+	if (set->mode == BenchScan)
+		BenchAll(set, &list);
+	else
+		RMTileIndexForEachOverlapping(set->images, newImage->tile, BenchCollect, &list);
+	for (size_t i = 0; i < list.count; i++) {
+		if (list.items[i] == newImage)
+			continue;
+		set->tried++;
+		if (BenchWorse(set, list.items[i]->tile, newImage->tile))
+			BenchRemoveTile(set, list.items[i]->tile);
+	}
+	free(list.items);
+}
+
+static void BenchMarkLoaded(BenchSet *set, BenchImage *image)
+{
+	image->loaded = 1;
+	if (set->loadedTiles != NULL)
+		RMTileCoverageAdd(set->loadedTiles, image->tile);
+}
+
+// addTile:WithImage:At:, returning the image if it was needed
+static BenchImage *BenchAddTileWithImage(BenchSet *set, RMTile tile, int loaded)
+{
+	if (set->mode == BenchCoverage) {
+		if (BenchCovered(set, tile, 1))
+			return NULL;
+	} else {
+		BenchList list = { NULL, 0, 0 };
+		int needed = 1;
+		if (set->mode == BenchScan)
+			BenchAll(set, &list);
+		else
+			RMTileIndexForEachOverlapping(set->images, tile, BenchCollect, &list);
+		for (size_t i = 0; i < list.count && needed; i++) {
+			if (!list.items[i]->loaded)
+				continue;
+			set->tried++;
+			needed = !BenchWorse(set, tile, list.items[i]->tile);
+		}
+		free(list.items);
+		if (!needed)
+			return NULL;
+	}
+
+	BenchImage *image = malloc(sizeof(BenchImage));
+	image->tile = tile;
+	image->loaded = loaded;
+	image->serial = ++set->serial;
+	if (loaded)
+		BenchRemoveWorseThan(set, image);
+	RMTileIndexInsert(set->images, tile, image);
+	if (loaded && set->loadedTiles != NULL)
+		RMTileCoverageAdd(set->loadedTiles, tile);
+	return image;
+}
+
+// addTile:At:, with a tile source that may take a while
+static void BenchAddTile(BenchSet *set, RMTile tile, size_t frame)
+{
+	if (RMTileIndexGet(set->images, tile) != NULL)
+		return;
+
+	unsigned latency = BenchLatency(tile);
+	BenchImage *image = BenchAddTileWithImage(set, tile, latency == 0);
+	if (image == NULL || latency == 0)
+		return;
+	if (set->loadCount == set->loadCapacity) {
+		set->loadCapacity = set->loadCapacity ? set->loadCapacity * 2 : 256;
+		set->loads = realloc(set->loads, set->loadCapacity * sizeof(BenchLoad));
+	}
+	set->loads[set->loadCount].tile = tile;
+	set->loads[set->loadCount].serial = image->serial;
+	set->loads[set->loadCount].frame = frame + latency;
+	set->loadCount++;
+}
+
+// tileImage:didLoadData: for the images whose time has come
+static void BenchLoadTiles(BenchSet *set, size_t frame)
+{
+	size_t kept = 0;
+
+	for (size_t i = 0; i < set->loadCount; i++) {
+		BenchLoad load = set->loads[i];
+		if (load.frame > frame) {
+			set->loads[kept++] = load;
+			continue;
+		}
+		BenchImage *image = RMTileIndexGet(set->images, load.tile);
+		if (image == NULL || image->serial != load.serial)
+			continue;		// removed, and cancelled
+		BenchMarkLoaded(set, image);
+		BenchRemoveWorseThan(set, image);
+	}
+	set->loadCount = kept;
+}
+
+static void BenchSetZoom(BenchSet *set, short zoom)
+{
+	BenchList list = { NULL, 0, 0 };
+
+	if (set->zoom == zoom)
+		return;
+	set->zoom = zoom;
+	BenchAll(set, &list);
+	if (set->mode == BenchCoverage) {
+		size_t obsolete = 0;
+		for (size_t i = 0; i < list.count; i++)
+			if (BenchCovered(set, list.items[i]->tile, 0))
+				list.items[obsolete++] = list.items[i];
+		for (size_t i = 0; i < obsolete; i++)
+			BenchRemoveTile(set, list.items[i]->tile);
+	} else {
+		for (size_t i = 0; i < list.count; i++)
+			if (list.items[i]->loaded)
+				BenchRemoveWorseThan(set, list.items[i]);
+	}
+	free(list.items);
+}
+
+// addTiles:ToDisplayIn: and removeTilesOutsideOf:, without the wrapping around
+static void BenchUpdate(BenchSet *set, BenchFrame frame, size_t number)
+{
+	uint32_t minX = (uint32_t)fmax(0, floor(frame.x - kBenchScreenWidth / 2.0));
+	uint32_t minY = (uint32_t)fmax(0, floor(frame.y - kBenchScreenHeight / 2.0));
+	uint32_t maxX = (uint32_t)fmax(0, floor(frame.x + kBenchScreenWidth / 2.0));
+	uint32_t maxY = (uint32_t)fmax(0, floor(frame.y + kBenchScreenHeight / 2.0));
+	short minimumZoom = frame.zoom - set->tileDepth - 1;
+	RMTile tile;
+
+	BenchSetZoom(set, frame.zoom);
+	for (tile.zoom = frame.zoom; tile.zoom > minimumZoom && tile.zoom >= 0; tile.zoom--) {
+		unsigned dz = frame.zoom - tile.zoom;
+		for (tile.x = minX >> dz; tile.x <= maxX >> dz; tile.x++)
+			for (tile.y = minY >> dz; tile.y <= maxY >> dz; tile.y++)
+				BenchAddTile(set, tile, number);
+	}
+
+	BenchList outside = { NULL, 0, 0 };
+	RMTileIndexForEachOutside(set->images, frame.zoom, minX, maxX, minY, maxY, BenchCollect, &outside);
+	for (size_t i = 0; i < outside.count; i++)
+		BenchRemoveTile(set, outside.items[i]->tile);
+	free(outside.items);
+
+	BenchLoadTiles(set, number);
+
+	for (size_t i = 0; i < set->removed.count; i++)
+		free(set->removed.items[i]);
+	set->removed.count = 0;
+}
+
+static void BenchHash(void *context, RMTile tile, void *value)
+{
+	uint64_t *hash = context;
+	*hash += RMTileKey(tile) * 0x9E3779B97F4A7C15ULL + ((BenchImage *)value)->loaded;
+}
+
+static void BenchFree(void *context, RMTile tile, void *value)
+{
+	free(value);
+}
+
+static void BenchReplay(const BenchSession *session)
+{
+	uint64_t hashes[3];
+
+	for (int mode = BenchScan; mode <= BenchCoverage; mode++) {
+		BenchSet set;
+		size_t resident = 0;
+
+		memset(&set, 0, sizeof(set));
+		set.mode = mode;
+		set.images = RMTileIndexCreate();
+		set.loadedTiles = mode == BenchCoverage ? RMTileCoverageCreate() : NULL;
+		set.tileDepth = kBenchTileDepth;
+		set.zoom = -1;
+
+		double start = BenchNow();
+		for (size_t i = 0; i < session->count; i++) {
+			BenchUpdate(&set, session->frames[i], i);
+			resident += RMTileIndexCount(set.images);
+		}
+		double seconds = BenchNow() - start;
+
+		hashes[mode] = 0;
+		RMTileIndexForEach(set.images, BenchHash, &hashes[mode]);
+		printf("%-10s %-9s %6lu updates %8.2f us/update %9.1f tried/update %6.1f resident\n",
+			   session->name, kBenchModeNames[mode], (unsigned long)session->count,
+			   seconds * 1e6 / session->count, (double)set.tried / session->count,
+			   (double)resident / session->count);
+
+		RMTileIndexForEach(set.images, BenchFree, NULL);
+		RMTileIndexFree(set.images);
+		RMTileCoverageFree(set.loadedTiles);
+		free(set.removed.items);
+		free(set.loads);
+	}
+	if (hashes[BenchIndex] != hashes[BenchScan] || hashes[BenchCoverage] != hashes[BenchScan])
+		printf("%-10s ended up with different tiles!\n", session->name);
+}
+
+static void BenchAddFrame(BenchSession *session, short zoom, double x, double y)
+{
+	if (session->count == session->capacity) {
+		session->capacity = session->capacity ? session->capacity * 2 : 256;
+		session->frames = realloc(session->frames, session->capacity * sizeof(BenchFrame));
+	}
+	session->frames[session->count].zoom = zoom;
+	session->frames[session->count].x = x;
+	session->frames[session->count].y = y;
+	session->count++;
+}
+
+// Zooms in or out by one level around the centre, staying between zoom levels 10 and 18.
+static void BenchZoom(short *zoom, double *x, double *y, int in)
+{
+	if (in && *zoom < kBenchMaxZoom) {
+		(*zoom)++;
+		*x *= 2;
+		*y *= 2;
+	} else if (!in && *zoom > 10) {
+		(*zoom)--;
+		*x /= 2;
+		*y /= 2;
+	}
+}
+
+// Built-in sessions: pan drags the map with some momentum, pinch zooms in and out a few levels
+// at a time, browse does both at random.
+static void BenchGenerate(BenchSession *session, const char *name, int pans, int pinches)
+{
+	short zoom = 15;
+	double x = 17600.5, y = 10750.5, vx = 0, vy = 0;
+
+	strncpy(session->name, name, sizeof(session->name) - 1);
+	srand(1);
+	for (int i = 0; i < 3000; i++) {
+		if (pans) {
+			if (i % 40 == 0) {
+				vx = (rand() % 200 - 100) / 250.0;
+				vy = (rand() % 200 - 100) / 250.0;
+			}
+			x += vx;
+			y += vy;
+			vx *= 0.97;
+			vy *= 0.97;
+		}
+		if (pinches && i % 6 == 0) {
+			// pinch in to zoom level 17 and out to 12, or at random while browsing
+			short target = (i / 30) % 2 ? 12 : 17;
+			if (pans)
+				BenchZoom(&zoom, &x, &y, rand() % 2);
+			else if (zoom != target)
+				BenchZoom(&zoom, &x, &y, zoom < target);
+		}
+		BenchAddFrame(session, zoom, x, y);
+	}
+}
+
+static int BenchRead(BenchSession *session, const char *path)
+{
+	FILE *file = fopen(path, "r");
+	char line[256];
+
+	if (file == NULL) {
+		perror(path);
+		return 0;
+	}
+	strncpy(session->name, strrchr(path, '/') ? strrchr(path, '/') + 1 : path, sizeof(session->name) - 1);
+	while (fgets(line, sizeof(line), file) != NULL) {
+		int zoom;
+		double x, y;
+		if (line[0] == '#' || sscanf(line, "%d %lf %lf", &zoom, &x, &y) != 3)
+			continue;
+		BenchAddFrame(session, (short)zoom, x, y);
+	}
+	fclose(file);
+	return session->count > 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1) {
+		for (int i = 1; i < argc; i++) {
+			BenchSession session;
+			memset(&session, 0, sizeof(session));
+			if (BenchRead(&session, argv[i]))
+				BenchReplay(&session);
+			free(session.frames);
+		}
+		return 0;
+	}
+
+	static const struct { const char *name; int pans, pinches; } builtIn[] = {
+		{ "pan", 1, 0 }, { "pinch", 0, 1 }, { "browse", 1, 1 }
+	};
+	for (size_t i = 0; i < sizeof(builtIn) / sizeof(builtIn[0]); i++) {
+		BenchSession session;
+		memset(&session, 0, sizeof(session));
+		BenchGenerate(&session, builtIn[i].name, builtIn[i].pans, builtIn[i].pinches);
+		BenchReplay(&session);
+		free(session.frames);
+	}
+	return 0;
+}
@@ -0,0 +1,199 @@
+//
+//  RMTileDecodeBenchmark.c
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Times database hits that decode the PNG every time against hits that go through
+// RMTileBitmapCache, on map-like 256x256 tiles where most hits go to the tiles in view.
+// Builds on any POSIX system with zlib, e.g.:
+//
+//   cc -std=c99 -O2 -I../Map -o decodebench RMTileDecodeBenchmark.c ../Map/RMTileBitmapCache.c ../Map/RMTileDecoder.c ../Map/RMTileLRU.c -lz -lpthread
+//   ./decodebench [byte budget]
+
+#define _XOPEN_SOURCE 600
+
+#include "RMTileBitmapCache.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <zlib.h>
+
+#define kSide 256
+#define kTiles 256
+#define kHotTiles 48		// a screenful and its neighbours
+#define kHotShare 80		// percent of hits that go to the hot tiles
+#define kHits 20000
+
+static unsigned long BenchChecksum;
+
+static double BenchNow(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec + now.tv_usec * 1e-6;
+}
+
+static unsigned char *BenchPut32(unsigned char *p, uint32_t value)
+{
+	p[0] = (unsigned char)(value >> 24);
+	p[1] = (unsigned char)(value >> 16);
+	p[2] = (unsigned char)(value >> 8);
+	p[3] = (unsigned char)value;
+	return p + 4;
+}
+
+static unsigned char *BenchChunk(unsigned char *p, const char *type, const unsigned char *data, uint32_t length)
+{
+	unsigned char *start = p + 4;
+	p = BenchPut32(p, length);
+	memcpy(p, type, 4);
+	if (length > 0)
+		memcpy(p + 4, data, length);
+	p += 4 + length;
+	return BenchPut32(p, (uint32_t)crc32(0, start, length + 4));
+}
+
+// An RGB tile: land with a grid of streets and a diagonal road, Sub filtered like most encoders do.
+static unsigned char *BenchTile(unsigned seed, size_t *length)
+{
+	size_t rowLength = kSide * 3 + 1, rawLength = rowLength * kSide;
+	unsigned char *raw = malloc(rawLength);
+	uLongf packedLength = compressBound(rawLength);
+	unsigned char *png = malloc(packedLength + 64), *p, header[13];
+	unsigned x, y, c;
+
+	for (y = 0; y < kSide; y++) {
+		unsigned char *row = raw + y * rowLength, *pixel = row + 1;
+		row[0] = 1;
+		for (x = 0; x < kSide; x++, pixel += 3) {
+			int street = (x + seed * 7) % 64 < 3 || (y + seed * 13) % 48 < 3;
+			int road = (x + y + seed) % 200 < 6;
+			pixel[0] = road ? 250 : street ? 255 : 242 - (unsigned char)(seed % 8);
+			pixel[1] = road ? 200 : street ? 255 : 239;
+			pixel[2] = road ? 120 : street ? 255 : 233;
+		}
+		for (c = rowLength - 1; c > 3; c--)
+			row[c] = (unsigned char)(row[c] - row[c - 3]);
+	}
+
+	p = png;
+	memcpy(p, "\211PNG\r\n\032\n", 8);
+	p += 8;
+	BenchPut32(header, kSide);
+	BenchPut32(header + 4, kSide);
+	header[8] = 8;
+	header[9] = 2;
+	header[10] = header[11] = header[12] = 0;
+	p = BenchChunk(p, "IHDR", header, 13);
+	compress2(p + 8, &packedLength, raw, rawLength, 6);
+	{
+		unsigned char *start = p + 4;
+		p = BenchPut32(p, (uint32_t)packedLength);
+		memcpy(p, "IDAT", 4);
+		p += 4 + packedLength;
+		p = BenchPut32(p, (uint32_t)crc32(0, start, (uInt)packedLength + 4));
+	}
+	p = BenchChunk(p, "IEND", NULL, 0);
+
+	free(raw);
+	*length = p - png;
+	return png;
+}
+
+// Reads every pixel, as uploading the bitmap would.
+static void BenchConsume(const void *pixels, size_t length)
+{
+	const uint32_t *word = pixels, *end = word + length / 4;
+	uint32_t sum = 0;
+	while (word < end)
+		sum += *word++;
+	BenchChecksum += sum;
+}
+
+static unsigned *BenchHits(void)
+{
+	unsigned *hits = malloc(kHits * sizeof(unsigned)), i;
+	srand(1);
+	for (i = 0; i < kHits; i++)
+		hits[i] = rand() % 100 < kHotShare ? (unsigned)rand() % kHotTiles : (unsigned)rand() % kTiles;
+	return hits;
+}
+
+int main(int argc, char **argv)
+{
+	size_t budget = argc > 1 ? (size_t)atol(argv[1]) : 16 * 1024 * 1024;
+	unsigned char *tiles[kTiles];
+	size_t lengths[kTiles], pngBytes = 0;
+	unsigned *hits = BenchHits(), i;
+	RMTilePixelFormat format;
+	double start;
+
+	for (i = 0; i < kTiles; i++) {
+		tiles[i] = BenchTile(i, &lengths[i]);
+		pngBytes += lengths[i];
+	}
+	printf("%d tiles of %dx%d, %.1f kB of PNG each, %d hits, %.1f MB budget\n",
+		   kTiles, kSide, kSide, pngBytes / 1024.0 / kTiles, kHits, budget / 1048576.0);
+
+	for (format = RMTilePixelFormatRGBA8888; format <= RMTilePixelFormatRGB555; format++) {
+		size_t rowBytes = kSide * RMTilePixelFormatBytesPerPixel(format);
+		const char *name = format == RMTilePixelFormatRGB555 ? "RGB555" : "RGBA8888";
+		RMTileBitmapCache *cache = RMTileBitmapCacheCreate(budget);
+		unsigned decodes = 0;
+
+		start = BenchNow();
+		for (i = 0; i < kHits; i++) {
+			void *pixels = malloc(rowBytes * kSide);
+			if (!RMTileDecoderDecode(tiles[hits[i]], lengths[hits[i]], format, pixels, rowBytes))
+				return 1;
+			BenchConsume(pixels, rowBytes * kSide);
+			free(pixels);
+		}
+		printf("%-8s decode every hit   %8.1f us/hit\n", name, (BenchNow() - start) * 1e6 / kHits);
+
+		start = BenchNow();
+		for (i = 0; i < kHits; i++) {
+			RMTileBitmap bitmap;
+			if (!RMTileBitmapCacheGet(cache, hits[i], format, &bitmap)) {
+				if (!RMTileBitmapCacheDecode(cache, hits[i], format, tiles[hits[i]], lengths[hits[i]], &bitmap))
+					return 1;
+				decodes++;
+			}
+			BenchConsume(bitmap.pixels, bitmap.rowBytes * bitmap.height);
+			RMTileBitmapRelease(bitmap.handle);
+		}
+		printf("%-8s bitmap cache       %8.1f us/hit, %u decodes, %.1f MB of slabs\n", name,
+			   (BenchNow() - start) * 1e6 / kHits, decodes, RMTileBitmapCacheSlabBytes(cache) / 1048576.0);
+
+		RMTileBitmapCacheFree(cache);
+	}
+
+	for (i = 0; i < kTiles; i++)
+		free(tiles[i]);
+	free(hits);
+	return BenchChecksum == 0;
+}
@@ -0,0 +1,722 @@
+// Fetches tiles with RMTileFetcher from a stand-in tile server running in the same process, first
+// to check its behaviour and then to compare its throughput with and without kept-alive and
+// pipelined connections. It is plain C and builds on any POSIX system, for example from this
+// directory:
+//
+//   cc -std=c99 -O2 -I../Map -o fetcherbench RMTileFetcherBenchmark.c ../Map/RMTileFetcher.c -lm -lpthread
+//   ./fetcherbench [latency milliseconds]
+//
+// The server listens on 127.0.0.1 and answers each request a latency after it arrived, as a
+// distant server would, and a new connection a latency after it was opened, for its handshake.
+// It answers requests on a connection in turn, so requests pipelined together are answered
+// together. What it sends depends on the path:
+//
+//   /tile/...       a tile with a Content-Length
+//   /chunked/...    the same, in chunks
+//   /nolength/...   the same as an HTTP/1.0 response that ends with the connection
+//   /close/...      the same, closing the connection after it
+//   /missing/...    404 Not Found
+//   /flaky/n/...    503 Service Unavailable the first n times, then the tile
+//   /slow/...       the tile, a quarter of a second later
+//
+// The checks print "ok" or "FAILED" and the program fails if any did. The comparison fetches
+// kBenchTiles tiles, the last kBenchVisible of them visible and the others prefetched, from one
+// host with 4 connections at most, and prints the time until all were fetched and until the
+// visible ones were, the mean time from asking to receiving a tile, and the connections opened.
+
+#define _XOPEN_SOURCE 600
+
+#include "RMTileFetcher.h"
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define kBenchTileBytes 12000
+#define kBenchChunkBytes 1000
+#define kBenchSlowSeconds 0.25
+#define kBenchMaxPaths 1024
+#define kBenchMaxHits 8
+#define kBenchMaxConnections 256
+#define kBenchTiles 256
+#define kBenchVisible 32
+
+typedef struct {
+	char path[128];
+	unsigned count;
+	double times[kBenchMaxHits];
+} BenchHits;
+
+typedef struct {
+	int listener;
+	unsigned short port;
+	pthread_t thread;
+	double latency;
+	unsigned keepAliveLimit;		// requests answered on a connection before it is dropped, 0 for any
+
+	pthread_mutex_t lock;
+	pthread_cond_t closed;
+	int stopping;
+	int fds[kBenchMaxConnections];
+	unsigned live;
+	unsigned long connections, requests;
+	unsigned answering, maxAnswering;
+	BenchHits hits[kBenchMaxPaths];
+	size_t pathCount;
+} BenchServer;
+
+typedef struct {
+	BenchServer *server;
+	int fd;
+	size_t slot;
+} BenchConnection;
+
+typedef struct {
+	const char *path;
+	int status;
+	int calls;
+	int intact;
+	double asked, received;
+} BenchCall;
+
+static pthread_mutex_t gCallLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gCallDone = PTHREAD_COND_INITIALIZER;
+static int gFailures;
+
+static double BenchNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void BenchSleep(double seconds)
+{
+	struct timespec ts;
+	if (seconds <= 0)
+		return;
+	ts.tv_sec = (time_t)seconds;
+	ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+	nanosleep(&ts, NULL);
+}
+
+static void BenchCheck(int passed, const char *what)
+{
+	printf("%-64s %s\n", what, passed ? "ok" : "FAILED");
+	if (!passed)
+		gFailures++;
+}
+
+// The tile body for a path, the same every time.
+static unsigned char BenchByte(const char *path, size_t i)
+{
+	unsigned hash = 5381;
+	while (*path)
+		hash = hash * 33 + (unsigned char)*path++;
+	return (unsigned char)(hash + i * 31);
+}
+
+static int BenchSendAll(int fd, const char *data, size_t length)
+{
+	while (length > 0) {
+		ssize_t sent = send(fd, data, length, 0);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+		data += sent;
+		length -= sent;
+	}
+	return 1;
+}
+
+// Counts a request for path, and returns how many there were before.
+static unsigned BenchRecord(BenchServer *server, const char *path)
+{
+	BenchHits *hits = NULL;
+	unsigned before;
+
+	pthread_mutex_lock(&server->lock);
+	for (size_t i = 0; i < server->pathCount; i++) {
+		if (strcmp(server->hits[i].path, path) == 0)
+			hits = &server->hits[i];
+	}
+	if (hits == NULL && server->pathCount < kBenchMaxPaths) {
+		hits = &server->hits[server->pathCount++];
+		snprintf(hits->path, sizeof(hits->path), "%s", path);
+	}
+	before = hits != NULL ? hits->count : 0;
+	if (hits != NULL) {
+		if (hits->count < kBenchMaxHits)
+			hits->times[hits->count] = BenchNow();
+		hits->count++;
+	}
+	server->requests++;
+	if (++server->answering > server->maxAnswering)
+		server->maxAnswering = server->answering;
+	pthread_mutex_unlock(&server->lock);
+	return before;
+}
+
+static BenchHits BenchHitsFor(BenchServer *server, const char *path)
+{
+	BenchHits hits;
+
+	memset(&hits, 0, sizeof(hits));
+	pthread_mutex_lock(&server->lock);
+	for (size_t i = 0; i < server->pathCount; i++) {
+		if (strcmp(server->hits[i].path, path) == 0)
+			hits = server->hits[i];
+	}
+	pthread_mutex_unlock(&server->lock);
+	return hits;
+}
+
+// Answers a request, and returns whether the connection stays open.
+static int BenchRespond(int fd, const char *path, unsigned before, int close)
+{
+	char response[kBenchTileBytes * 2], body[kBenchTileBytes];
+	size_t used = 0;
+	unsigned failures = 0;
+
+	for (size_t i = 0; i < kBenchTileBytes; i++)
+		body[i] = (char)BenchByte(path, i);
+
+	if (strncmp(path, "/missing/", 9) == 0) {
+		used = snprintf(response, sizeof(response), "HTTP/1.1 404 Not Found\r\nContent-Length: 9\r\n%s\r\nnot found", close ? "Connection: close\r\n" : "");
+		return BenchSendAll(fd, response, used) && !close;
+	}
+	if (sscanf(path, "/flaky/%u/", &failures) == 1 && before < failures) {
+		used = snprintf(response, sizeof(response), "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 4\r\n%s\r\nbusy", close ? "Connection: close\r\n" : "");
+		return BenchSendAll(fd, response, used) && !close;
+	}
+	if (strncmp(path, "/chunked/", 9) == 0) {
+		used = snprintf(response, sizeof(response), "HTTP/1.1 200 OK\r\nContent-Type: image/png\r\nTransfer-Encoding: chunked\r\n%s\r\n", close ? "Connection: close\r\n" : "");
+		for (size_t i = 0; i < kBenchTileBytes; i += kBenchChunkBytes) {
+			used += snprintf(response + used, sizeof(response) - used, "%x; name=value\r\n", kBenchChunkBytes);
+			memcpy(response + used, body + i, kBenchChunkBytes);
+			used += kBenchChunkBytes;
+			used += snprintf(response + used, sizeof(response) - used, "\r\n");
+		}
+		used += snprintf(response + used, sizeof(response) - used, "0\r\nX-Trailer: done\r\n\r\n");
+		return BenchSendAll(fd, response, used) && !close;
+	}
+	if (strncmp(path, "/nolength/", 10) == 0) {
+		used = snprintf(response, sizeof(response), "HTTP/1.0 200 OK\r\nContent-Type: image/png\r\n\r\n");
+		close = 1;
+	} else {
+		if (strncmp(path, "/close/", 7) == 0)
+			close = 1;
+		used = snprintf(response, sizeof(response), "HTTP/1.1 200 OK\r\nContent-Type: image/png\r\nContent-Length: %d\r\n%s\r\n",
+						kBenchTileBytes, close ? "Connection: close\r\n" : "");
+	}
+	memcpy(response + used, body, kBenchTileBytes);
+	used += kBenchTileBytes;
+	return BenchSendAll(fd, response, used) && !close;
+}
+
+static void *BenchServe(void *argument)
+{
+	BenchConnection *connection = argument;
+	BenchServer *server = connection->server;
+	char buffer[65536];
+	size_t used = 0;
+	unsigned answered = 0;
+	double arrived = BenchNow(), lastReply = 0;
+
+	// the handshake
+	BenchSleep(server->latency);
+	for (;;) {
+		char path[128], *end;
+		unsigned before;
+		size_t length;
+		int close, open;
+
+		buffer[used] = '\0';
+		end = strstr(buffer, "\r\n\r\n");
+		if (end == NULL) {
+			ssize_t got = recv(connection->fd, buffer + used, sizeof(buffer) - 1 - used, 0);
+			if (got <= 0)
+				break;
+			used += got;
+			arrived = BenchNow();
+			continue;
+		}
+		length = end + 4 - buffer;
+		if (sscanf(buffer, "GET %127s HTTP/1.1", path) != 1)
+			break;
+		buffer[length - 2] = '\0';
+		close = strstr(buffer, "\r\nConnection: close\r\n") != NULL;
+		memmove(buffer, buffer + length, used - length);
+		used -= length;
+
+		// a server that stops keeping a connection alive may close it as the next request comes
+		if (server->keepAliveLimit > 0 && answered == server->keepAliveLimit)
+			break;
+		answered++;
+
+		before = BenchRecord(server, path);
+		BenchSleep((arrived + server->latency > lastReply ? arrived + server->latency : lastReply) +
+				   (strncmp(path, "/slow/", 6) == 0 ? kBenchSlowSeconds : 0) - BenchNow());
+		open = BenchRespond(connection->fd, path, before, close);
+		lastReply = BenchNow();
+		pthread_mutex_lock(&server->lock);
+		server->answering--;
+		pthread_mutex_unlock(&server->lock);
+		if (!open)
+			break;
+	}
+
+	close(connection->fd);
+	pthread_mutex_lock(&server->lock);
+	server->fds[connection->slot] = -1;
+	server->live--;
+	pthread_cond_broadcast(&server->closed);
+	pthread_mutex_unlock(&server->lock);
+	free(connection);
+	return NULL;
+}
+
+static void *BenchAccept(void *argument)
+{
+	BenchServer *server = argument;
+
+	for (;;) {
+		int fd = accept(server->listener, NULL, NULL);
+		BenchConnection *connection;
+		pthread_t thread;
+		size_t slot;
+
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;
+		}
+		pthread_mutex_lock(&server->lock);
+		for (slot = 0; slot < kBenchMaxConnections && server->fds[slot] >= 0; slot++)
+			;
+		if (server->stopping || slot == kBenchMaxConnections) {
+			pthread_mutex_unlock(&server->lock);
+			close(fd);
+			continue;
+		}
+		connection = malloc(sizeof(BenchConnection));
+		connection->server = server;
+		connection->fd = fd;
+		connection->slot = slot;
+		server->fds[slot] = fd;
+		server->live++;
+		server->connections++;
+		pthread_mutex_unlock(&server->lock);
+
+		pthread_create(&thread, NULL, BenchServe, connection);
+		pthread_detach(thread);
+	}
+	return NULL;
+}
+
+static BenchServer *BenchServerStart(double latency, unsigned keepAliveLimit)
+{
+	BenchServer *server = calloc(1, sizeof(BenchServer));
+	struct sockaddr_in address;
+	socklen_t size = sizeof(address);
+	int one = 1;
+
+	server->latency = latency;
+	server->keepAliveLimit = keepAliveLimit;
+	for (size_t i = 0; i < kBenchMaxConnections; i++)
+		server->fds[i] = -1;
+	pthread_mutex_init(&server->lock, NULL);
+	pthread_cond_init(&server->closed, NULL);
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	server->listener = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(server->listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(server->listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(server->listener, 128) != 0) {
+		perror("stand-in server");
+		exit(1);
+	}
+	getsockname(server->listener, (struct sockaddr *)&address, &size);
+	server->port = ntohs(address.sin_port);
+	pthread_create(&server->thread, NULL, BenchAccept, server);
+	return server;
+}
+
+static void BenchServerStop(BenchServer *server)
+{
+	pthread_mutex_lock(&server->lock);
+	server->stopping = 1;
+	for (size_t i = 0; i < kBenchMaxConnections; i++) {
+		if (server->fds[i] >= 0)
+			shutdown(server->fds[i], SHUT_RDWR);
+	}
+	while (server->live > 0)
+		pthread_cond_wait(&server->closed, &server->lock);
+	pthread_mutex_unlock(&server->lock);
+
+	shutdown(server->listener, SHUT_RDWR);
+	close(server->listener);
+	pthread_join(server->thread, NULL);
+	pthread_cond_destroy(&server->closed);
+	pthread_mutex_destroy(&server->lock);
+	free(server);
+}
+
+static void BenchReceive(void *context, int status, const void *body, size_t length)
+{
+	BenchCall *call = context;
+	int intact = length == kBenchTileBytes;
+
+	for (size_t i = 0; intact && i < length; i++)
+		intact = ((const unsigned char *)body)[i] == BenchByte(call->path, i);
+
+	pthread_mutex_lock(&gCallLock);
+	call->status = status;
+	call->intact = intact;
+	call->received = BenchNow();
+	call->calls++;
+	pthread_cond_broadcast(&gCallDone);
+	pthread_mutex_unlock(&gCallLock);
+}
+
+static void BenchURL(char *url, size_t size, BenchServer *server, const char *path)
+{
+	snprintf(url, size, "http://127.0.0.1:%u%s", server->port, path);
+}
+
+static int BenchGet(RMTileFetcher *fetcher, BenchServer *server, BenchCall *call, RMTileRequestKind kind)
+{
+	char url[256];
+
+	BenchURL(url, sizeof(url), server, call->path);
+	call->asked = BenchNow();
+	return RMTileFetcherGet(fetcher, url, kind, BenchReceive, call);
+}
+
+// Waits until each call was called back, or for 10 seconds.
+static int BenchWait(BenchCall *calls, size_t count)
+{
+	double deadline = BenchNow() + 10;
+	size_t done = 0;
+
+	pthread_mutex_lock(&gCallLock);
+	while (done < count && BenchNow() < deadline) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += 10000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&gCallDone, &gCallLock, &ts);
+		for (done = 0; done < count && calls[done].calls > 0; done++)
+			;
+	}
+	pthread_mutex_unlock(&gCallLock);
+	return done == count;
+}
+
+static int BenchAllFetched(BenchCall *calls, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		if (calls[i].calls != 1 || calls[i].status != 200 || !calls[i].intact)
+			return 0;
+	}
+	return 1;
+}
+
+static RMTileFetcherOptions BenchOptions(unsigned perHost, unsigned depth)
+{
+	RMTileFetcherOptions options;
+
+	RMTileFetcherDefaultOptions(&options);
+	options.maxPerHost = perHost;
+	options.pipelineDepth = depth;
+	options.backoffBase = 0.05;
+	options.timeout = 5;
+	options.userAgent = "RMTileFetcherBenchmark";
+	return options;
+}
+
+static BenchCall *BenchCalls(const char *format, size_t count)
+{
+	BenchCall *calls = calloc(count, sizeof(BenchCall));
+
+	for (size_t i = 0; i < count; i++) {
+		char *path = malloc(64);
+		snprintf(path, 64, format, (unsigned)i);
+		calls[i].path = path;
+	}
+	return calls;
+}
+
+static void BenchFreeCalls(BenchCall *calls, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		free((char *)calls[i].path);
+	free(calls);
+}
+
+static void BenchCheckCoalescing(void)
+{
+	BenchServer *server = BenchServerStart(0.05, 0);
+	RMTileFetcherOptions options = BenchOptions(4, 1);
+	RMTileFetcher *fetcher = RMTileFetcherCreate(&options);
+	BenchCall calls[10];
+	RMTileFetcherStatistics statistics;
+
+	memset(calls, 0, sizeof(calls));
+	for (size_t i = 0; i < 10; i++) {
+		calls[i].path = "/tile/16/35210/21492";
+		BenchGet(fetcher, server, &calls[i], RMTileRequestVisible);
+	}
+	BenchWait(calls, 10);
+	statistics = RMTileFetcherGetStatistics(fetcher);
+	BenchCheck(BenchAllFetched(calls, 10), "every get of the same URL is called back with the tile");
+	BenchCheck(BenchHitsFor(server, calls[0].path).count == 1 && statistics.coalesced == 9, "gets of the same URL share one request");
+
+	RMTileFetcherFree(fetcher);
+	BenchServerStop(server);
+}
+
+static void BenchCheckConnections(unsigned depth)
+{
+	BenchServer *server = BenchServerStart(0.005, 0);
+	RMTileFetcherOptions options = BenchOptions(4, depth);
+	RMTileFetcher *fetcher = RMTileFetcherCreate(&options);
+	BenchCall *calls = BenchCalls("/tile/16/%u/1", 64);
+	RMTileFetcherStatistics statistics;
+	char what[128];
+
+	for (size_t i = 0; i < 64; i++)
+		BenchGet(fetcher, server, &calls[i], RMTileRequestVisible);
+	BenchWait(calls, 64);
+	statistics = RMTileFetcherGetStatistics(fetcher);
+
+	snprintf(what, sizeof(what), "pipelining %u: every tile is fetched", depth);
+	BenchCheck(BenchAllFetched(calls, 64), what);
+	snprintf(what, sizeof(what), "pipelining %u: at most 4 connections, answered 4 at a time", depth);
+	BenchCheck(statistics.connections <= 4 && server->connections <= 4 && server->maxAnswering <= 4, what);
+	snprintf(what, sizeof(what), "pipelining %u: connections are kept alive and reused", depth);
+	BenchCheck(statistics.reused >= 60, what);
+	if (depth > 1) {
+		snprintf(what, sizeof(what), "pipelining %u: requests are pipelined", depth);
+		BenchCheck(statistics.pipelined > 0, what);
+	}
+
+	RMTileFetcherFree(fetcher);
+	BenchServerStop(server);
+	BenchFreeCalls(calls, 64);
+}
+
+static void BenchCheckResponses(void)
+{
+	BenchServer *server = BenchServerStart(0.005, 0);
+	RMTileFetcherOptions options = BenchOptions(2, 4);
+	RMTileFetcher *fetcher = RMTileFetcherCreate(&options);
+	BenchCall calls[4];
+	RMTileFetcherStatistics statistics;
+
+	memset(calls, 0, sizeof(calls));
+	calls[0].path = "/chunked/1";
+	calls[1].path = "/nolength/1";
+	calls[2].path = "/close/1";
+	calls[3].path = "/missing/1";
+	for (size_t i = 0; i < 4; i++)
+		BenchGet(fetcher, server, &calls[i], RMTileRequestVisible);
+	BenchWait(calls, 4);
+	statistics = RMTileFetcherGetStatistics(fetcher);
+
+	BenchCheck(BenchAllFetched(calls, 3), "chunked, unsized and closing responses are read whole");
+	BenchCheck(calls[3].calls == 1 && calls[3].status == 404 && BenchHitsFor(server, "/missing/1").count == 1,
+			   "404 is given back without retrying");
+	BenchCheck(statistics.failed == 1, "404 counts as failed");
+
+	RMTileFetcherFree(fetcher);
+	BenchServerStop(server);
+}
+
+static void BenchCheckBackoff(void)
+{
+	BenchServer *server = BenchServerStart(0.001, 0);
+	RMTileFetcherOptions options = BenchOptions(4, 1);
+	RMTileFetcher *fetcher = RMTileFetcherCreate(&options);
+	BenchCall call, refused;
+	BenchHits hits;
+	char url[64];
+	int listener;
+	struct sockaddr_in address;
+	socklen_t size = sizeof(address);
+	int passed = 1;
+
+	memset(&call, 0, sizeof(call));
+	call.path = "/flaky/3/1";
+	BenchGet(fetcher, server, &call, RMTileRequestVisible);
+	BenchWait(&call, 1);
+	hits = BenchHitsFor(server, call.path);
+	BenchCheck(BenchAllFetched(&call, 1) && hits.count == 4, "503 is retried until the tile comes");
+	for (unsigned i = 1; i < hits.count; i++) {
+		double gap = hits.times[i] - hits.times[i - 1];
+		double longest = ldexp(options.backoffBase, i - 1);
+		passed = passed && gap >= longest / 2 && gap <= longest + 0.05;
+	}
+	BenchCheck(passed, "retries wait between half and all of a doubling backoff");
+	BenchCheck(RMTileFetcherGetStatistics(fetcher).retries == 3, "retries are counted");
+
+	// a port nobody listens on
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	bind(listener, (struct sockaddr *)&address, sizeof(address));
+	getsockname(listener, (struct sockaddr *)&address, &size);
+	close(listener);
+	snprintf(url, sizeof(url), "http://127.0.0.1:%u/tile/1", ntohs(address.sin_port));
+	memset(&refused, 0, sizeof(refused));
+	refused.path = "/tile/1";
+	RMTileFetcherGet(fetcher, url, RMTileRequestVisible, BenchReceive, &refused);
+	BenchWait(&refused, 1);
+	BenchCheck(refused.calls == 1 && refused.status == kRMTileFetchNetworkError, "a refused connection is a network error after the retries");
+
+	RMTileFetcherFree(fetcher);
+	BenchServerStop(server);
+}
+
+static void BenchCheckDroppedConnections(void)
+{
+	BenchServer *server = BenchServerStart(0.002, 3);
+	RMTileFetcherOptions options = BenchOptions(2, 1);
+	RMTileFetcher *fetcher = RMTileFetcherCreate(&options);
+	BenchCall *calls = BenchCalls("/tile/17/%u/2", 24);
+	RMTileFetcherStatistics statistics;
+
+	for (size_t i = 0; i < 24; i++)
+		BenchGet(fetcher, server, &calls[i], RMTileRequestVisible);
+	BenchWait(calls, 24);
+	statistics = RMTileFetcherGetStatistics(fetcher);
+	BenchCheck(BenchAllFetched(calls, 24), "requests a kept-alive connection dropped go again");
+	BenchCheck(statistics.retries == 0 && statistics.connections >= 8, "and do not count as retries");
+
+	RMTileFetcherFree(fetcher);
+	BenchServerStop(server);
+	BenchFreeCalls(calls, 24);
+}
+
+static void BenchCheckCancelling(void)
+{
+	BenchServer *server = BenchServerStart(0.005, 0);
+	RMTileFetcherOptions options = BenchOptions(1, 1);
+	RMTileFetcher *fetcher = RMTileFetcherCreate(&options);
+	BenchCall calls[4], late;
+	char url[256];
+	int cancelled;
+
+	memset(calls, 0, sizeof(calls));
+	calls[0].path = calls[1].path = "/slow/1";
+	calls[2].path = "/slow/2";
+	calls[3].path = "/slow/3";
+	for (size_t i = 0; i < 4; i++)
+		BenchGet(fetcher, server, &calls[i], RMTileRequestVisible);
+
+	BenchURL(url, sizeof(url), server, "/slow/1");
+	cancelled = RMTileFetcherCancel(fetcher, url, &calls[0]);
+	BenchURL(url, sizeof(url), server, "/slow/2");
+	cancelled = cancelled && RMTileFetcherCancel(fetcher, url, &calls[2]);
+	cancelled = cancelled && !RMTileFetcherCancel(fetcher, url, &calls[2]);
+	BenchWait(&calls[3], 1);
+	BenchWait(&calls[1], 1);
+
+	BenchCheck(cancelled, "cancelling gives back whether the get was waiting");
+	BenchCheck(calls[0].calls == 0 && calls[2].calls == 0, "cancelled gets are not called back");
+	BenchCheck(BenchAllFetched(&calls[1], 1) && BenchAllFetched(&calls[3], 1), "other gets of the same URL still are");
+	BenchCheck(BenchHitsFor(server, "/slow/2").count == 0, "a fetch nobody waits for is dropped before it is sent");
+
+	memset(&late, 0, sizeof(late));
+	late.path = "/slow/4";
+	BenchCheck(BenchGet(fetcher, server, &late, RMTileRequestVisible) && late.calls == 0, "a get is taken");
+	RMTileFetcherFree(fetcher);
+	BenchCheck(late.calls == 1 && late.status == kRMTileFetchCancelled, "freeing the fetcher calls back what is left as cancelled");
+	BenchServerStop(server);
+}
+
+static void BenchCheckURLs(void)
+{
+	RMTileFetcher *fetcher = RMTileFetcherCreate(NULL);
+	BenchCall call;
+
+	memset(&call, 0, sizeof(call));
+	BenchCheck(!RMTileFetcherGet(fetcher, "https://tile.example.com/1/1/1.png", RMTileRequestVisible, BenchReceive, &call) &&
+			   !RMTileFetcherGet(fetcher, "file:///tmp/1.png", RMTileRequestVisible, BenchReceive, &call) &&
+			   !RMTileFetcherGet(fetcher, "http://:80/1.png", RMTileRequestVisible, BenchReceive, &call),
+			   "URLs other than http:// are refused");
+	RMTileFetcherFree(fetcher);
+}
+
+static void BenchCompare(const char *name, double latency, unsigned perHost, unsigned depth, double idleTimeout)
+{
+	BenchServer *server = BenchServerStart(latency, 0);
+	RMTileFetcherOptions options = BenchOptions(perHost, depth);
+	RMTileFetcher *fetcher;
+	BenchCall *calls = BenchCalls("/tile/18/%u/3", kBenchTiles);
+	RMTileFetcherStatistics statistics;
+	double start, all = 0, visible = 0, wait = 0;
+
+	options.idleTimeout = idleTimeout;
+	fetcher = RMTileFetcherCreate(&options);
+	start = BenchNow();
+	for (size_t i = 0; i < kBenchTiles; i++)
+		BenchGet(fetcher, server, &calls[i], i < kBenchTiles - kBenchVisible ? RMTileRequestPrefetch : RMTileRequestVisible);
+	if (!BenchWait(calls, kBenchTiles) || !BenchAllFetched(calls, kBenchTiles)) {
+		BenchCheck(0, name);
+	}
+	statistics = RMTileFetcherGetStatistics(fetcher);
+
+	for (size_t i = 0; i < kBenchTiles; i++) {
+		double took = calls[i].received - start;
+		if (took > all)
+			all = took;
+		if (i >= kBenchTiles - kBenchVisible && took > visible)
+			visible = took;
+		wait += calls[i].received - calls[i].asked;
+	}
+	printf("%-24s all %6.0f ms   visible %6.0f ms   mean %6.0f ms   connections %4lu   pipelined %4lu\n",
+		   name, all * 1e3, visible * 1e3, wait * 1e3 / kBenchTiles, statistics.connections, statistics.pipelined);
+
+	RMTileFetcherFree(fetcher);
+	BenchServerStop(server);
+	BenchFreeCalls(calls, kBenchTiles);
+}
+
+int main(int argc, char **argv)
+{
+	double latency = argc > 1 ? atof(argv[1]) / 1e3 : 0.02;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	BenchCheckURLs();
+	BenchCheckCoalescing();
+	BenchCheckConnections(1);
+	BenchCheckConnections(4);
+	BenchCheckResponses();
+	BenchCheckBackoff();
+	BenchCheckDroppedConnections();
+	BenchCheckCancelling();
+	printf("\n");
+
+	BenchCompare("connection per request", latency, 4, 1, 0);
+	BenchCompare("kept alive", latency, 4, 1, 15);
+	BenchCompare("kept alive, pipelined 4", latency, 4, 4, 15);
+
+	return gFailures > 0;
+}
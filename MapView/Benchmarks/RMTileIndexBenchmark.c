@@ -0,0 +1,248 @@
+// Micro-benchmark of the RMTileIndex that RMTileImageSet keeps its images in. It is plain C and
+// builds on any POSIX system, for example from this directory:
+//
+//   cc -std=c99 -O2 -I../Map -o indexbench RMTileIndexBenchmark.c ../Map/RMTileIndex.c ../Map/RMTile.c -lm
+//   ./indexbench [tiles]
+//
+// The resident tiles are spread over 6 zoom levels around one spot, the way they pile up while
+// zooming in with a tileDepth. The "set" lines stand in for the NSMutableSet the image set used
+// before: every membership test allocates a dummy image to probe with, and every query copies
+// all images out and tests each of them.
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "RMTileIndex.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define kBenchZoomLevels 6
+#define kBenchZoom 17			// the finest level, where the screen is
+
+typedef struct {
+	RMTile tile;
+	char rest[88];			// about the size of an RMTileImage
+} BenchImage;
+
+static double BenchNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void BenchReport(const char *name, size_t operations, double seconds, size_t visited)
+{
+	printf("%-28s %8lu ops %10.1f ns/op %10lu tiles visited\n", name, (unsigned long)operations,
+		   seconds * 1e9 / operations, (unsigned long)visited);
+}
+
+// The set: a hash of image pointers, like NSMutableSet with RMTileImage's hash and isEqual:.
+
+typedef struct {
+	BenchImage **slots;
+	size_t mask, count;
+} BenchSet;
+
+static size_t BenchSetSlot(const BenchSet *set, RMTile tile)
+{
+	return (size_t)(RMTileHash(tile) * 0x9E3779B97F4A7C15ULL >> 20) & set->mask;
+}
+
+static void BenchSetAdd(BenchSet *set, BenchImage *image)
+{
+	size_t slot = BenchSetSlot(set, image->tile);
+	while (set->slots[slot] != NULL)
+		slot = (slot + 1) & set->mask;
+	set->slots[slot] = image;
+	set->count++;
+}
+
+static BenchImage *BenchSetMember(const BenchSet *set, RMTile tile)
+{
+	// [RMTileImage dummyTile:tile], then [images member:dummyTile]
+	BenchImage *dummy = malloc(sizeof(BenchImage)), *found = NULL;
+	dummy->tile = tile;
+	for (size_t slot = BenchSetSlot(set, tile); set->slots[slot] != NULL; slot = (slot + 1) & set->mask) {
+		if (RMTilesEqual(set->slots[slot]->tile, dummy->tile)) {
+			found = set->slots[slot];
+			break;
+		}
+	}
+	free(dummy);
+	return found;
+}
+
+// [images allObjects]
+static BenchImage **BenchSetAll(const BenchSet *set)
+{
+	BenchImage **all = malloc(set->count * sizeof(BenchImage *));
+	size_t n = 0;
+	for (size_t slot = 0; slot <= set->mask; slot++)
+		if (set->slots[slot] != NULL)
+			all[n++] = set->slots[slot];
+	return all;
+}
+
+// The tests of removeTilesOutsideOf: and isTile:worseThanTile:, without the zoom limits.
+
+static int BenchOutside(RMTile tile, short zoom, uint32_t minX, uint32_t maxX, uint32_t minY, uint32_t maxY)
+{
+	uint32_t x = tile.x, y = tile.y;
+	if (tile.zoom < zoom) {
+		unsigned dz = zoom - tile.zoom;
+		minX >>= dz;
+		maxX >>= dz;
+		minY >>= dz;
+		maxY >>= dz;
+	} else {
+		unsigned dz = tile.zoom - zoom;
+		x >>= dz;
+		y >>= dz;
+	}
+	return !(y >= minY && y <= maxY && x >= minX && x <= maxX);
+}
+
+static int BenchOverlaps(RMTile subject, RMTile object)
+{
+	uint32_t sx = subject.x, sy = subject.y, ox = object.x, oy = object.y;
+	if (subject.zoom < object.zoom) {
+		ox >>= object.zoom - subject.zoom;
+		oy >>= object.zoom - subject.zoom;
+	} else {
+		sx >>= subject.zoom - object.zoom;
+		sy >>= subject.zoom - object.zoom;
+	}
+	return sx == ox && sy == oy;
+}
+
+static void BenchCount(void *context, RMTile tile, void *value)
+{
+	(*(size_t *)context)++;
+}
+
+int main(int argc, char **argv)
+{
+	size_t count = argc > 1 ? (size_t)strtoul(argv[1], NULL, 10) : 2000;
+	size_t perZoom = (count + kBenchZoomLevels - 1) / kBenchZoomLevels, side = 1;
+	BenchImage *images = calloc(count, sizeof(BenchImage));
+	RMTile *probes = malloc(2 * count * sizeof(RMTile));
+	RMTileIndex *index = RMTileIndexCreate();
+	BenchSet set;
+	size_t n = 0, visited, operations;
+	double start;
+
+	while (side * side < perZoom * 2)
+		side++;
+	for (set.mask = 1; set.mask < count * 2; set.mask <<= 1)
+		;
+	set.slots = calloc(set.mask, sizeof(BenchImage *));
+	set.mask--;
+	set.count = 0;
+
+	// each level holds about perZoom tiles out of a square of side by side around the spot
+	srand(42);
+	for (short zoom = kBenchZoom - kBenchZoomLevels + 1; zoom <= kBenchZoom && n < count; zoom++) {
+		uint32_t centre = 70000u >> (kBenchZoom - zoom);
+		for (size_t i = 0; i < perZoom && n < count; i++) {
+			RMTile tile;
+			tile.zoom = zoom;
+			do {
+				tile.x = centre - side / 2 + rand() % side;
+				tile.y = centre - side / 2 + rand() % side;
+			} while (RMTileIndexGet(index, tile) != NULL);
+			images[n].tile = tile;
+			RMTileIndexInsert(index, tile, &images[n]);
+			BenchSetAdd(&set, &images[n]);
+			probes[2 * n] = tile;
+			tile.x += side;		// a miss
+			probes[2 * n + 1] = tile;
+			n++;
+		}
+	}
+	printf("%lu tiles over %d zoom levels\n", (unsigned long)n, kBenchZoomLevels);
+
+	// membership, as in addTile:At:, removeTile: and imageWithTile:
+	operations = 200 * 2 * n;
+	visited = 0;
+	start = BenchNow();
+	for (int round = 0; round < 200; round++)
+		for (size_t i = 0; i < 2 * n; i++)
+			visited += BenchSetMember(&set, probes[i]) != NULL;
+	BenchReport("member (set)", operations, BenchNow() - start, visited);
+
+	visited = 0;
+	start = BenchNow();
+	for (int round = 0; round < 200; round++)
+		for (size_t i = 0; i < 2 * n; i++)
+			visited += RMTileIndexGet(index, probes[i]) != NULL;
+	BenchReport("member (index)", operations, BenchNow() - start, visited);
+
+	// tiles outside of the finest level's square, panned a few tiles each way, and outside of
+	// a screen of 5 by 7 tiles there
+	operations = 20000;
+	visited = 0;
+	start = BenchNow();
+	for (size_t q = 0; q < operations; q++) {
+		uint32_t minX = 70000 - side / 2 - 4 + q % 8, minY = 70000 - side / 2 - 4 + (q / 8) % 8;
+		BenchImage **all = BenchSetAll(&set);
+		for (size_t i = 0; i < n; i++)
+			visited += BenchOutside(all[i]->tile, kBenchZoom, minX, minX + side - 1, minY, minY + side - 1);
+		free(all);
+	}
+	BenchReport("outside panned (set)", operations, BenchNow() - start, visited);
+
+	visited = 0;
+	start = BenchNow();
+	for (size_t q = 0; q < operations; q++) {
+		uint32_t minX = 70000 - side / 2 - 4 + q % 8, minY = 70000 - side / 2 - 4 + (q / 8) % 8;
+		RMTileIndexForEachOutside(index, kBenchZoom, minX, minX + side - 1, minY, minY + side - 1, BenchCount, &visited);
+	}
+	BenchReport("outside panned (index)", operations, BenchNow() - start, visited);
+
+	visited = 0;
+	start = BenchNow();
+	for (size_t q = 0; q < operations; q++) {
+		uint32_t minX = 70000 - 8 + q % 16, minY = 70000 - 8 + (q / 16) % 16;
+		BenchImage **all = BenchSetAll(&set);
+		for (size_t i = 0; i < n; i++)
+			visited += BenchOutside(all[i]->tile, kBenchZoom, minX, minX + 4, minY, minY + 6);
+		free(all);
+	}
+	BenchReport("outside screen (set)", operations, BenchNow() - start, visited);
+
+	visited = 0;
+	start = BenchNow();
+	for (size_t q = 0; q < operations; q++) {
+		uint32_t minX = 70000 - 8 + q % 16, minY = 70000 - 8 + (q / 16) % 16;
+		RMTileIndexForEachOutside(index, kBenchZoom, minX, minX + 4, minY, minY + 6, BenchCount, &visited);
+	}
+	BenchReport("outside screen (index)", operations, BenchNow() - start, visited);
+
+	// tiles overlapping a newly loaded tile, as in removeTilesWorseThan:
+	operations = 100 * n;
+	visited = 0;
+	start = BenchNow();
+	for (int round = 0; round < 100; round++) {
+		for (size_t i = 0; i < n; i++) {
+			BenchImage **all = BenchSetAll(&set);
+			for (size_t j = 0; j < n; j++)
+				visited += BenchOverlaps(all[j]->tile, images[i].tile);
+			free(all);
+		}
+	}
+	BenchReport("overlapping (set)", operations, BenchNow() - start, visited);
+
+	visited = 0;
+	start = BenchNow();
+	for (int round = 0; round < 100; round++)
+		for (size_t i = 0; i < n; i++)
+			RMTileIndexForEachOverlapping(index, images[i].tile, BenchCount, &visited);
+	BenchReport("overlapping (index)", operations, BenchNow() - start, visited);
+
+	RMTileIndexFree(index);
+	free(set.slots);
+	free(probes);
+	free(images);
+	return 0;
+}
@@ -0,0 +1,170 @@
+
+// Micro-benchmark of the RMTileLRU memory cache core. It is plain C and builds on any
+// POSIX system, for example from this directory:
+//
+//   cc -std=c99 -O2 -I../Map -o lrubench RMTileLRUBenchmark.c ../Map/RMTileLRU.c
+//   ./lrubench [entries]
+//
+// The "scan" line times the eviction RMMemoryCache used before, which looked through
+// every entry for the least recently used one.
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "RMTileLRU.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Same layout as RMTileKey(), without pulling CoreGraphics in through RMTile.h.
+static uint64_t BenchTileKey(uint32_t x, uint32_t y, short zoom)
+{
+	return ((uint64_t)(zoom & 0xFF) << 56) | ((uint64_t)(x & 0xFFFFFFF) << 28) | (uint64_t)(y & 0xFFFFFFF);
+}
+
+static double BenchNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void BenchReport(const char *name, size_t operations, double seconds)
+{
+	printf("%-28s %10lu ops %10.1f ns/op\n", name, (unsigned long)operations, seconds * 1e9 / operations);
+}
+
+static size_t releasedCount;
+
+static void BenchRelease(void *context, uint64_t key, void *value)
+{
+	releasedCount++;
+}
+
+// A map view's worth of tiles: square blocks at zoom 16, then shuffled.
+static uint64_t *BenchKeys(size_t count, uint32_t originX)
+{
+	uint64_t *keys = malloc(count * sizeof(uint64_t));
+	uint32_t side = 1;
+	while ((size_t)side * side < count)
+		side++;
+
+	for (size_t i = 0; i < count; i++)
+		keys[i] = BenchTileKey(originX + (uint32_t)(i % side), 21000 + (uint32_t)(i / side), 16);
+	for (size_t i = count - 1; i > 0; i--) {
+		size_t j = (size_t)rand() % (i + 1);
+		uint64_t swap = keys[i];
+		keys[i] = keys[j];
+		keys[j] = swap;
+	}
+	return keys;
+}
+
+typedef struct {
+	uint64_t key;
+	double lastUsed;
+} BenchScanEntry;
+
+// The old RMMemoryCache eviction: find the least recently used entry by looking at all of them.
+static double BenchScanEviction(size_t count, size_t evictions)
+{
+	BenchScanEntry *entries = malloc(count * sizeof(BenchScanEntry));
+	for (size_t i = 0; i < count; i++) {
+		entries[i].key = i;
+		entries[i].lastUsed = (double)((i * 7919) % count);
+	}
+
+	double start = BenchNow();
+	for (size_t e = 0; e < evictions; e++) {
+		size_t oldest = 0;
+		for (size_t i = 1; i < count; i++)
+			if (entries[i].lastUsed < entries[oldest].lastUsed)
+				oldest = i;
+		entries[oldest].lastUsed = (double)(count + e);
+	}
+	double seconds = BenchNow() - start;
+
+	free(entries);
+	return seconds;
+}
+
+int main(int argc, char **argv)
+{
+	size_t count = argc > 1 ? (size_t)strtoul(argv[1], NULL, 10) : 100000;
+	const size_t tileBytes = 256 * 256 * 4;
+	uint64_t *keys, *moreKeys;
+	RMTileLRU *lru;
+	double start;
+	size_t hits = 0;
+
+	if (count < 2) {
+		fprintf(stderr, "usage: %s [entries >= 2]\n", argv[0]);
+		return 1;
+	}
+
+	srand(1);
+	keys = BenchKeys(count, 34000);
+	moreKeys = BenchKeys(count, 34000 + 4096);
+
+	printf("%lu entries\n", (unsigned long)count);
+
+	// put into an unlimited cache, growing the table as it goes
+	lru = RMTileLRUCreate(0, 0, BenchRelease, NULL);
+	start = BenchNow();
+	for (size_t i = 0; i < count; i++)
+		RMTileLRUPut(lru, keys[i], &keys[i], tileBytes);
+	BenchReport("put (insert)", count, BenchNow() - start);
+
+	start = BenchNow();
+	for (size_t i = 0; i < count; i++)
+		hits += RMTileLRUGet(lru, keys[count - 1 - i]) != NULL;
+	BenchReport("get (hit)", count, BenchNow() - start);
+
+	start = BenchNow();
+	for (size_t i = 0; i < count; i++)
+		hits += RMTileLRUGet(lru, moreKeys[i]) != NULL;
+	BenchReport("get (miss)", count, BenchNow() - start);
+
+	start = BenchNow();
+	for (size_t i = 0; i < count; i++)
+		RMTileLRUPut(lru, keys[i], &keys[i], tileBytes);
+	BenchReport("put (replace)", count, BenchNow() - start);
+	RMTileLRUFree(lru);
+
+	// a full cache limited by bytes: every put evicts the least recently used tile
+	lru = RMTileLRUCreate(count * tileBytes, 0, BenchRelease, NULL);
+	for (size_t i = 0; i < count; i++)
+		RMTileLRUPut(lru, keys[i], &keys[i], tileBytes);
+	releasedCount = 0;
+	start = BenchNow();
+	for (size_t i = 0; i < count; i++)
+		RMTileLRUPut(lru, moreKeys[i], &moreKeys[i], tileBytes);
+	BenchReport("put (evict by bytes)", count, BenchNow() - start);
+	if (releasedCount != count || RMTileLRUCount(lru) != count || RMTileLRUCost(lru) != count * tileBytes) {
+		fprintf(stderr, "unexpected eviction: %lu released, %lu cached\n",
+				(unsigned long)releasedCount, (unsigned long)RMTileLRUCount(lru));
+		return 1;
+	}
+	RMTileLRUFree(lru);
+
+	// the same through the count limit, with a working set that half fits
+	lru = RMTileLRUCreate(0, count / 2, BenchRelease, NULL);
+	start = BenchNow();
+	for (size_t i = 0; i < count; i++) {
+		uint64_t key = keys[(size_t)rand() % count];
+		if (RMTileLRUGet(lru, key) != NULL)
+			hits++;
+		else
+			RMTileLRUPut(lru, key, NULL, tileBytes);
+	}
+	BenchReport("get or put (half fits)", count, BenchNow() - start);
+	RMTileLRUFree(lru);
+
+	{
+		size_t evictions = count < 1000 ? count : 1000;
+		BenchReport("scan eviction (old)", evictions, BenchScanEviction(count, evictions));
+	}
+
+	free(keys);
+	free(moreKeys);
+	return hits == 0;
+}
@@ -0,0 +1,168 @@
+//
+//  RMTilePackBenchmark.c
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Compares RMTileStore with tile data in the ZCACHE rows and in pack files: disk space with
+// a share of identical (sea) tiles, lookup time with and without copying, and the space
+// left after purging half the tiles. Builds on any POSIX system with SQLite, e.g.:
+//
+//   cc -std=c99 -O2 -I../Map -o packbench RMTilePackBenchmark.c ../Map/RMTileStore.c ../Map/RMTilePack.c ../Map/RMTileLRU.c -lsqlite3 -lpthread
+//   ./packbench [directory]
+
+#define _XOPEN_SOURCE 600
+
+#include "RMTileStore.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define kTiles 20000
+#define kSeaShare 30		// percent of tiles that are the same sea tile
+#define kLookups 200000
+
+static unsigned long BenchChecksum;
+
+static double BenchNow(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec + now.tv_usec * 1e-6;
+}
+
+// bytes in all files of the directory whose names start with prefix
+static double BenchMegabytes(const char *directory, const char *prefix)
+{
+	DIR *dir = opendir(directory);
+	struct dirent *entry;
+	char path[2048];
+	double bytes = 0;
+
+	while (dir != NULL && (entry = readdir(dir)) != NULL) {
+		struct stat status;
+		if (strncmp(entry->d_name, prefix, strlen(prefix)) != 0)
+			continue;
+		snprintf(path, sizeof path, "%s/%s", directory, entry->d_name);
+		if (stat(path, &status) == 0)
+			bytes += status.st_size;
+	}
+	if (dir != NULL)
+		closedir(dir);
+	return bytes / (1024 * 1024);
+}
+
+// 8 to 20 kB, like PNG tiles; the same bytes every time for a key
+static size_t BenchTile(unsigned key, unsigned char *tile, const unsigned char *sea, size_t seaLength)
+{
+	unsigned seed = key;
+	size_t length;
+
+	if (rand_r(&seed) % 100 < kSeaShare) {
+		memcpy(tile, sea, seaLength);
+		return seaLength;
+	}
+	length = 8192 + rand_r(&seed) % 12288;
+	for (size_t i = 0; i < length; i++)
+		tile[i] = (unsigned char)rand_r(&seed);
+	return length;
+}
+
+// reads every byte, as decoding a tile would
+static void BenchConsume(const void *data, size_t length)
+{
+	const unsigned char *bytes = data;
+	for (size_t i = 0; i < length; i++)
+		BenchChecksum += bytes[i];
+}
+
+static void BenchRun(const char *directory, size_t segmentSize)
+{
+	static unsigned char tile[20480], sea[12000];
+	const char *name = segmentSize ? "packed" : "in rows";
+	char path[1024], command[2 * sizeof path + 16];
+	RMTileStoreOptions options = RMTileStoreDefaultOptions();
+	RMTileStore *store;
+	unsigned seed = 1;
+	double start, copied, mapped;
+
+	snprintf(path, sizeof path, "%s/packbench.sqlite", directory);
+	snprintf(command, sizeof command, "rm -f '%s' '%s'-*", path, path);
+	system(command);
+	options.segmentSize = segmentSize;
+	store = RMTileStoreOpen(path, &options);
+	if (store == NULL) {
+		fprintf(stderr, "cannot open %s\n", path);
+		exit(1);
+	}
+
+	memset(sea, 0x33, sizeof sea);
+	start = BenchNow();
+	for (unsigned key = 0; key < kTiles; key++) {
+		size_t length = BenchTile(key, tile, sea, sizeof sea);
+		RMTileStorePut(store, key, tile, length, key, key);
+	}
+	RMTileStoreFlush(store);
+	printf("%-8s %5.1f s to store %u tiles, %6.1f MB on disk\n", name, BenchNow() - start, kTiles, BenchMegabytes(directory, "packbench.sqlite"));
+
+	start = BenchNow();
+	for (unsigned i = 0; i < kLookups; i++) {
+		void *data;
+		size_t length;
+		if (RMTileStoreGet(store, rand_r(&seed) % kTiles, &data, &length) == 1)
+			BenchConsume(data, length);
+		free(data);
+	}
+	copied = (BenchNow() - start) / kLookups;
+	start = BenchNow();
+	for (unsigned i = 0; i < kLookups; i++) {
+		RMTileStoreData data;
+		if (RMTileStoreGetData(store, rand_r(&seed) % kTiles, &data) == 1) {
+			BenchConsume(data.bytes, data.length);
+			RMTileStoreReleaseData(&data);
+		}
+	}
+	mapped = (BenchNow() - start) / kLookups;
+	printf("%-8s %5.1f us per copied lookup, %5.1f us per lookup without copy\n", name, copied * 1e6, mapped * 1e6);
+
+	start = BenchNow();
+	RMTileStorePurge(store, kTiles / 2);
+	RMTileStoreCompact(store, 0.5);
+	printf("%-8s %5.1f s to purge half and compact, %6.1f MB on disk\n", name, BenchNow() - start, BenchMegabytes(directory, "packbench.sqlite"));
+
+	RMTileStoreClose(store);
+	system(command);
+}
+
+int main(int argc, char **argv)
+{
+	const char *directory = argc > 1 ? argv[1] : ".";
+
+	BenchRun(directory, 0);
+	BenchRun(directory, 4 * 1024 * 1024);
+	return BenchChecksum == 0;
+}
@@ -0,0 +1,358 @@
+// Replays drags, flings and pinches in simulated time, to measure how much prefetching the tiles
+// that RMTilePrefetchPredict() expects helps the screen fill in. It is plain C and builds on any
+// POSIX system, for example from this directory:
+//
+//   cc -std=c99 -O2 -I../Map -o prefetchbench RMTilePrefetchBenchmark.c ../Map/RMTilePrefetch.c ../Map/RMTileIndex.c ../Map/RMTile.c -lm
+//   ./prefetchbench
+//
+// The map behaves as RMMapView does: every kBenchTick seconds a finger moves it, or it
+// decelerates by kBenchDecelerationFactor after a flick. Tiles for the screen are only loaded
+// once kBenchResumeDelay seconds have passed since a finger last moved, as expensive operations
+// are suspended until then. A tile source reads a few tiles at a time, each taking its latency,
+// and reads the tiles on screen before prefetched ones; a tile read once stays cached. Without
+// prefetching, nothing is read until loading resumes. With it, the tiles predicted for the next
+// 0.3 to 1 second are asked for on every move, up to the budget, the way RMTileImageSet does.
+//
+// For each source and budget: the share of the tiles that were loaded already when they came on
+// screen, the mean wait for a tile to load once on screen, counting those as 0, the reads, and
+// the prefetched tiles with the share of them that came on screen (the hit rate) and those let
+// go of before.
+
+#define _XOPEN_SOURCE 600
+
+#include "RMTileIndex.h"
+#include "RMTilePrefetch.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define kBenchTick 0.01
+#define kBenchResumeDelay 0.4
+#define kBenchDecelerationFactor 0.88
+#define kBenchSmoothing 0.5
+#define kBenchTilePixels 256.0
+#define kBenchScreenWidth 5.0
+#define kBenchScreenHeight 7.0
+#define kBenchMaxTiles 4096
+
+enum { BenchDrag, BenchFling, BenchPause, BenchPinch };
+
+typedef struct {
+	int kind;
+	double seconds;
+	double vx, vy;			// screen tiles per second
+	double zoomRate;		// levels per second
+} BenchPhase;
+
+typedef struct {
+	const char *name;
+	const BenchPhase *phases;
+	size_t count;
+} BenchSession;
+
+typedef struct {
+	const char *name;
+	int slots;
+	double latency;
+} BenchSource;
+
+enum { BenchUnread, BenchQueued, BenchRunning, BenchLoaded };
+
+typedef struct {
+	RMTile tile;
+	int state;
+	int visible;			// queued for the screen rather than ahead of time
+	unsigned long sequence;
+	double done, shown;
+	int onScreen, prefetched;
+} BenchTile;
+
+typedef struct {
+	const BenchSource *source;
+	RMTileIndex *tiles;
+	BenchTile *all[kBenchMaxTiles];
+	size_t count;
+	BenchTile *screen[kBenchMaxTiles], *ahead[kBenchMaxTiles];
+	size_t screenCount, aheadCount;
+	int running;
+	unsigned long sequence;
+	double now;
+
+	unsigned long shownTiles, ready, waited, reads;
+	double waitSum;
+	RMTilePrefetchStatistics prefetch;
+} BenchMap;
+
+static BenchTile *BenchTileFor(BenchMap *map, RMTile tile)
+{
+	BenchTile *t = RMTileIndexGet(map->tiles, tile);
+
+	if (t == NULL && map->count < kBenchMaxTiles) {
+		t = calloc(1, sizeof(BenchTile));
+		t->tile = tile;
+		RMTileIndexInsert(map->tiles, tile, t);
+		map->all[map->count++] = t;
+	}
+	return t;
+}
+
+static void BenchRequest(BenchMap *map, BenchTile *t, int visible)
+{
+	if (t->state == BenchUnread) {
+		t->state = BenchQueued;
+		t->visible = visible;
+		t->sequence = map->sequence++;
+	} else if (t->state == BenchQueued && visible) {
+		t->visible = 1;
+	}
+}
+
+static void BenchCancel(BenchTile *t)
+{
+	if (t->state == BenchQueued)
+		t->state = BenchUnread;
+}
+
+// Finishes the reads that are due, and starts the most urgent queued ones.
+static void BenchAdvance(BenchMap *map)
+{
+	for (size_t i = 0; i < map->count; i++) {
+		BenchTile *t = map->all[i];
+		if (t->state == BenchRunning && t->done <= map->now) {
+			t->state = BenchLoaded;
+			map->running--;
+			if (t->onScreen) {
+				map->waited++;
+				map->waitSum += t->done - t->shown;
+			}
+		}
+	}
+
+	while (map->running < map->source->slots) {
+		BenchTile *next = NULL;
+		for (size_t i = 0; i < map->count; i++) {
+			BenchTile *t = map->all[i];
+			if (t->state == BenchQueued && (next == NULL || t->visible > next->visible
+											|| (t->visible == next->visible && t->sequence < next->sequence)))
+				next = t;
+		}
+		if (next == NULL)
+			break;
+		next->state = BenchRunning;
+		next->done = map->now + map->source->latency;
+		map->running++;
+		map->reads++;
+	}
+}
+
+// The screen at the given centre, in level 0 tiles, and zoom.
+static RMTileRect BenchScreen(double x0, double y0, double zoom)
+{
+	short level = (short)floor(zoom + 0.5);
+	double scale = ldexp(1.0, level), size = exp2(level - zoom);
+	double left = x0 * scale - kBenchScreenWidth * size / 2, top = y0 * scale - kBenchScreenHeight * size / 2;
+	RMTileRect rect;
+
+	rect.origin.tile.zoom = level;
+	rect.origin.tile.x = (uint32_t)floor(left);
+	rect.origin.tile.y = (uint32_t)floor(top);
+	rect.origin.offset.x = left - floor(left);
+	rect.origin.offset.y = top - floor(top);
+	rect.size.width = kBenchScreenWidth * size;
+	rect.size.height = kBenchScreenHeight * size;
+	return rect;
+}
+
+static void BenchLoadScreen(BenchMap *map, RMTileRect rect)
+{
+	RMTileRect rounded = RMTileRectRound(rect);
+	BenchTile *wanted[kBenchMaxTiles];
+	size_t count = 0;
+	RMTile tile;
+
+	tile.zoom = rect.origin.tile.zoom;
+	for (tile.x = rounded.origin.tile.x; tile.x < rounded.origin.tile.x + (uint32_t)rounded.size.width; tile.x++) {
+		for (tile.y = rounded.origin.tile.y; tile.y < rounded.origin.tile.y + (uint32_t)rounded.size.height; tile.y++) {
+			BenchTile *t = BenchTileFor(map, tile);
+			if (t == NULL)
+				continue;
+			if (!t->onScreen) {
+				t->onScreen = 1;
+				t->shown = map->now;
+				map->shownTiles++;
+				if (t->state == BenchLoaded)
+					map->ready++;
+				if (t->prefetched) {
+					t->prefetched = 0;
+					map->prefetch.hits++;
+					map->prefetch.ready += t->state == BenchLoaded;
+				}
+				BenchRequest(map, t, 1);
+			}
+			wanted[count++] = t;
+		}
+	}
+
+	// the tiles that left the screen are cancelled
+	for (size_t i = 0; i < map->screenCount; i++) {
+		BenchTile *t = map->screen[i];
+		size_t j;
+		for (j = 0; j < count && wanted[j] != t; j++)
+			;
+		if (j == count) {
+			t->onScreen = 0;
+			BenchCancel(t);
+		}
+	}
+	memcpy(map->screen, wanted, count * sizeof(BenchTile *));
+	map->screenCount = count;
+}
+
+static void BenchPrefetch(BenchMap *map, RMTileRect rect, RMTileMotion motion, size_t budget)
+{
+	RMTile predicted[kBenchMaxTiles];
+	BenchTile *kept[kBenchMaxTiles];
+	size_t count, keptCount = 0;
+
+	count = RMTilePrefetchPredict(rect, motion, 0.3, 1.0, 0, 18, predicted, budget);
+
+	for (size_t i = 0; i < map->aheadCount; i++) {
+		BenchTile *t = map->ahead[i];
+		size_t j;
+		if (!t->prefetched)
+			continue;			// came on screen
+		for (j = 0; j < count && !RMTilesEqual(predicted[j], t->tile); j++)
+			;
+		if (j == count) {
+			t->prefetched = 0;
+			map->prefetch.wasted++;
+			BenchCancel(t);
+		} else {
+			kept[keptCount++] = t;
+		}
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		BenchTile *t = BenchTileFor(map, predicted[i]);
+		if (t == NULL || t->onScreen || t->prefetched)
+			continue;
+		t->prefetched = 1;
+		map->prefetch.prefetched++;
+		BenchRequest(map, t, 0);
+		kept[keptCount++] = t;
+	}
+	memcpy(map->ahead, kept, keptCount * sizeof(BenchTile *));
+	map->aheadCount = keptCount;
+}
+
+static void BenchRun(const BenchSession *session, const BenchSource *source, size_t budget)
+{
+	BenchMap *map = calloc(1, sizeof(BenchMap));
+	double x0 = 35210.5 / 65536, y0 = 21492.5 / 65536, zoom = 16;
+	double lastTouch = -1.0, vx = 0, vy = 0, zoomRate = 0;
+
+	map->source = source;
+	map->tiles = RMTileIndexCreate();
+	BenchLoadScreen(map, BenchScreen(x0, y0, zoom));
+
+	for (size_t p = 0; p < session->count; p++) {
+		const BenchPhase *phase = &session->phases[p];
+		double end = map->now + phase->seconds;
+		double dx = phase->vx * kBenchTick, dy = phase->vy * kBenchTick;
+
+		if (phase->kind == BenchFling) {
+			// carries on from the last move of the finger
+			dx = vx * kBenchTick;
+			dy = vy * kBenchTick;
+		}
+
+		while (phase->kind == BenchFling ? fabs(dx) * kBenchTilePixels >= 0.01 || fabs(dy) * kBenchTilePixels >= 0.01 : map->now < end) {
+			double scale = exp2(zoom);
+			RMTileMotion motion;
+
+			map->now += kBenchTick;
+			memset(&motion, 0, sizeof(motion));
+
+			if (phase->kind == BenchDrag || phase->kind == BenchPinch) {
+				double dz = phase->zoomRate * kBenchTick;
+				x0 += dx / scale;
+				y0 += dy / scale;
+				zoom = fmin(18, fmax(0, zoom + dz));
+				lastTouch = map->now;
+				vx += kBenchSmoothing * (phase->vx - vx);
+				vy += kBenchSmoothing * (phase->vy - vy);
+				zoomRate += kBenchSmoothing * (phase->zoomRate - zoomRate);
+				motion.vx = vx;
+				motion.vy = vy;
+				motion.zoomRate = zoomRate;
+			} else if (phase->kind == BenchFling) {
+				x0 += dx / scale;
+				y0 += dy / scale;
+				motion.vx = dx / kBenchTick;
+				motion.vy = dy / kBenchTick;
+				motion.decay = -log(kBenchDecelerationFactor) / kBenchTick;
+				dx *= kBenchDecelerationFactor;
+				dy *= kBenchDecelerationFactor;
+			} else {
+				vx = vy = zoomRate = 0;
+			}
+
+			RMTileRect rect = BenchScreen(x0, y0, zoom);
+			if (budget > 0 && phase->kind != BenchPause)
+				BenchPrefetch(map, rect, motion, budget);
+			if (map->now - lastTouch >= kBenchResumeDelay)
+				BenchLoadScreen(map, rect);
+			BenchAdvance(map);
+		}
+	}
+
+	printf("%-6s %-4s budget %3zu   ready %5.1f%%   wait %6.1f ms   reads %5lu   prefetched %5lu hit %5.1f%% wasted %5lu\n",
+		   session->name, source->name, budget,
+		   map->shownTiles ? 100.0 * map->ready / map->shownTiles : 0,
+		   map->waited + map->ready ? map->waitSum * 1e3 / (map->waited + map->ready) : 0,
+		   map->reads, map->prefetch.prefetched,
+		   map->prefetch.prefetched ? 100.0 * map->prefetch.hits / map->prefetch.prefetched : 0,
+		   map->prefetch.wasted);
+
+	for (size_t i = 0; i < map->count; i++)
+		free(map->all[i]);
+	RMTileIndexFree(map->tiles);
+	free(map);
+}
+
+int main(void)
+{
+	// drags of 2 to 3 tiles a second with rests in between
+	static const BenchPhase drag[] = {
+		{ BenchDrag, 1.5, 2.5, 0.5, 0 }, { BenchPause, 1.0, 0, 0, 0 },
+		{ BenchDrag, 1.0, -1.0, 2.0, 0 }, { BenchPause, 1.0, 0, 0, 0 },
+		{ BenchDrag, 2.0, 3.0, -1.0, 0 }, { BenchPause, 1.0, 0, 0, 0 },
+	};
+	// flicks: a short drag, then letting go at 6 to 8 tiles a second
+	static const BenchPhase fling[] = {
+		{ BenchDrag, 0.15, 8.0, 2.0, 0 }, { BenchFling, 0, 0, 0, 0 }, { BenchPause, 1.0, 0, 0, 0 },
+		{ BenchDrag, 0.15, -6.0, 5.0, 0 }, { BenchFling, 0, 0, 0, 0 }, { BenchPause, 1.0, 0, 0, 0 },
+		{ BenchDrag, 0.15, 7.0, -3.0, 0 }, { BenchFling, 0, 0, 0, 0 }, { BenchPause, 1.0, 0, 0, 0 },
+	};
+	// pinching in by about a level and out again
+	static const BenchPhase pinch[] = {
+		{ BenchPinch, 0.8, 0.3, 0, 1.5 }, { BenchPause, 1.0, 0, 0, 0 },
+		{ BenchPinch, 0.8, 0, 0.3, -1.5 }, { BenchPause, 1.0, 0, 0, 0 },
+		{ BenchPinch, 0.8, 0.2, 0.2, 1.5 }, { BenchPause, 1.0, 0, 0, 0 },
+	};
+	static const BenchSession sessions[] = {
+		{ "drag", drag, sizeof(drag) / sizeof(drag[0]) },
+		{ "fling", fling, sizeof(fling) / sizeof(fling[0]) },
+		{ "pinch", pinch, sizeof(pinch) / sizeof(pinch[0]) },
+	};
+	// an MBTiles file read one tile at a time, and a tile server over a mobile network
+	static const BenchSource sources[] = { { "db", 1, 0.004 }, { "web", 4, 0.150 } };
+	static const size_t budgets[] = { 0, 16, 32, 64 };
+
+	for (size_t s = 0; s < sizeof(sessions) / sizeof(sessions[0]); s++)
+		for (size_t r = 0; r < sizeof(sources) / sizeof(sources[0]); r++)
+			for (size_t b = 0; b < sizeof(budgets) / sizeof(budgets[0]); b++)
+				BenchRun(&sessions[s], &sources[r], budgets[b]);
+	return 0;
+}
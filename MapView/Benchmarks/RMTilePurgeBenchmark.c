@@ -0,0 +1,146 @@
+//
+//  RMTilePurgeBenchmark.c
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Compares what the LRU and CLOCK purge strategies of RMTileStore write: hits on a working
+// set of tiles, as RMDatabaseCache reports them, then purges down to a low watermark.
+// Bytes written are read from /proc/self/io, so this builds and runs on Linux only, e.g.:
+//
+//   cc -std=c99 -O2 -I../Map -o purgebench RMTilePurgeBenchmark.c ../Map/RMTileStore.c ../Map/RMTilePack.c ../Map/RMTileLRU.c -lsqlite3 -lpthread
+//   ./purgebench [directory]
+
+#define _XOPEN_SOURCE 600
+
+#include "RMTileStore.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define kTiles 20000
+#define kTileBytes 4096
+#define kHot 2000
+#define kRounds 50
+#define kHitsPerRound 1000
+#define kPurge 2000
+
+static double BenchNow(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec + now.tv_usec * 1e-6;
+}
+
+// bytes this process has handed to write(2) so far
+static unsigned long long BenchBytesWritten(void)
+{
+	FILE *io = fopen("/proc/self/io", "r");
+	char line[128];
+	unsigned long long bytes = 0;
+
+	while (io != NULL && fgets(line, sizeof line, io) != NULL) {
+		if (sscanf(line, "wchar: %llu", &bytes) == 1)
+			break;
+	}
+	if (io != NULL)
+		fclose(io);
+	return bytes;
+}
+
+static void BenchRun(const char *directory, int clock)
+{
+	unsigned char tile[kTileBytes];
+	char path[1024], command[2 * sizeof path + 16];
+	RMTileStore *store;
+	unsigned seed = 1;
+	size_t hot = 0;
+	double now = BenchNow(), start;
+	unsigned long long written;
+
+	snprintf(path, sizeof path, "%s/purgebench.sqlite", directory);
+	snprintf(command, sizeof command, "rm -f '%s' '%s'-*", path, path);
+	system(command);
+	store = RMTileStoreOpen(path, NULL);
+	if (store == NULL) {
+		fprintf(stderr, "cannot open %s\n", path);
+		exit(1);
+	}
+
+	// a day's worth of tiles, oldest first
+	memset(tile, 0x5a, sizeof tile);
+	for (unsigned i = 0; i < kTiles; i++)
+		RMTileStorePut(store, i, tile, kTileBytes, now - 86400.0 * (kTiles - i) / kTiles, now);
+	RMTileStoreFlush(store);
+
+	// hits, mostly on the oldest tiles: the ones a purge would take first
+	written = BenchBytesWritten();
+	start = BenchNow();
+	for (unsigned round = 0; round < kRounds; round++) {
+		for (unsigned i = 0; i < kHitsPerRound; i++) {
+			uint64_t key = rand_r(&seed) % 10 < 8 ? rand_r(&seed) % kHot : rand_r(&seed) % kTiles;
+			if (clock)
+				RMTileStoreReference(store, key);
+			else
+				RMTileStoreTouch(store, key, now + round);
+		}
+		RMTileStoreFlush(store);
+	}
+	printf("%-6s hits:  %8.1f bytes written per hit, %6.2f s\n", clock ? "CLOCK" : "LRU",
+		   (double)(BenchBytesWritten() - written) / (kRounds * kHitsPerRound), BenchNow() - start);
+
+	written = BenchBytesWritten();
+	start = BenchNow();
+	size_t purged = clock ? RMTileStorePurgeClock(store, kPurge) : RMTileStorePurge(store, kPurge);
+	double elapsed = BenchNow() - start;
+	unsigned long long purgeBytes = BenchBytesWritten() - written;
+
+	for (uint64_t key = 0; key < kHot; key++) {
+		void *data;
+		size_t length;
+		hot += RMTileStoreGet(store, key, &data, &length) == 1;
+		free(data);
+	}
+	printf("%-6s purge: %5zu tiles in %6.1f ms, %8.0f kB written, %4zu of %u hot tiles kept\n", clock ? "CLOCK" : "LRU",
+		   purged, elapsed * 1e3, purgeBytes / 1024.0, hot, kHot);
+
+	RMTileStoreClose(store);
+	system(command);
+}
+
+int main(int argc, char **argv)
+{
+	const char *directory = argc > 1 ? argv[1] : ".";
+	FILE *io = fopen("/proc/self/io", "r");
+
+	if (io == NULL)
+		fprintf(stderr, "warning: /proc/self/io is not readable, bytes written will show as 0\n");
+	else
+		fclose(io);
+
+	BenchRun(directory, 0);
+	BenchRun(directory, 1);
+	return 0;
+}
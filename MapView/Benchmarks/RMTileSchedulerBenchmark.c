@@ -0,0 +1,338 @@
+// Replays pan and zoom sessions against a tile source with slow reads, to compare reading the
+// tiles on the main thread, as RMDBMapSource and RMMBTilesTileSource did, with queueing them on
+// RMTileScheduler. It is plain C and builds on any POSIX system, for example from this directory:
+//
+//   cc -std=c99 -O2 -I../Map -o schedulerbench RMTileSchedulerBenchmark.c ../Map/RMTileScheduler.c ../Map/RMTileIndex.c ../Map/RMTile.c -lm -lpthread
+//   ./schedulerbench [read milliseconds]
+//
+// Each frame lasts kBenchFrameSeconds of real time. It asks for the tiles of a screen of
+// kBenchScreenWidth by kBenchScreenHeight tiles at the zoom level and at the kBenchTileDepth
+// levels above, current zoom level first, as RMTileImageSet does, and lets go of the tiles that
+// left the screen. A read sleeps for the read time while holding a lock, as the sources serialize
+// the reads from their database. Three ways of loading are compared:
+//
+//   sync      every new tile is read before the frame goes on, blocking the main thread;
+//   queue     new tiles are submitted to the scheduler, focused on the centre of the screen, and
+//             those that left the screen are read anyway;
+//   schedule  as queue, but tiles that left the screen are cancelled while queued.
+//
+// For each, the time the main thread spends updating per frame, how long the tiles at the centre
+// of the screen, at the current zoom level and at the fallback levels took from the start of the
+// frame that asked for them to being read, and the reads of tiles that were off screen by then.
+
+#define _XOPEN_SOURCE 600
+
+#include "RMTileIndex.h"
+#include "RMTileScheduler.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define kBenchScreenWidth 5
+#define kBenchScreenHeight 7
+#define kBenchTileDepth 2
+#define kBenchWorkers 2
+#define kBenchFrameSeconds (1.0 / 60)
+
+enum { BenchSync, BenchQueue, BenchSchedule };
+static const char *kBenchModeNames[] = { "sync", "queue", "schedule" };
+
+typedef struct {
+	short zoom;
+	double x, y;
+} BenchFrame;
+
+typedef struct {
+	BenchFrame *frames;
+	size_t count;
+	const char *name;
+} BenchSession;
+
+typedef struct BenchRequest {
+	RMTile tile;
+	size_t frame;			// last frame that wanted the tile
+	double asked, read;
+	int centre, fallback;
+	int done, abandoned;	// touched by the main thread only
+	struct BenchRequest *next;
+} BenchRequest;
+
+typedef struct {
+	double sum, max;
+	size_t count;
+} BenchStat;
+
+typedef struct {
+	int mode;
+	RMTileIndex *requests;
+	RMTileScheduler *scheduler;
+	pthread_mutex_t lock;	// guards finished, as the main thread's run loop would
+	BenchRequest *finished;
+	BenchStat update, centre, visible, fallback;
+	size_t reads, wasted, cancelled;
+} BenchLoader;
+
+static double gReadSeconds = 0.002;
+static pthread_mutex_t gReadLock = PTHREAD_MUTEX_INITIALIZER;
+
+static double BenchNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void BenchSleep(double seconds)
+{
+	struct timespec ts;
+	if (seconds <= 0)
+		return;
+	ts.tv_sec = (time_t)seconds;
+	ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+	nanosleep(&ts, NULL);
+}
+
+static void BenchAdd(BenchStat *stat, double value)
+{
+	stat->sum += value;
+	stat->count++;
+	if (value > stat->max)
+		stat->max = value;
+}
+
+static void BenchRead(BenchRequest *request)
+{
+	pthread_mutex_lock(&gReadLock);
+	BenchSleep(gReadSeconds);
+	pthread_mutex_unlock(&gReadLock);
+	request->read = BenchNow();
+}
+
+// The main thread's side of a read: the tile shows if it is still wanted.
+static void BenchFinish(BenchLoader *loader, BenchRequest *request)
+{
+	loader->reads++;
+	if (request->abandoned) {
+		loader->wasted++;
+		free(request);
+		return;
+	}
+	request->done = 1;
+	if (request->centre)
+		BenchAdd(&loader->centre, request->read - request->asked);
+	BenchAdd(request->fallback ? &loader->fallback : &loader->visible, request->read - request->asked);
+}
+
+static void BenchWork(void *context, RMTile tile, void *request)
+{
+	BenchLoader *loader = context;
+	BenchRequest *r = request;
+
+	BenchRead(r);
+	pthread_mutex_lock(&loader->lock);
+	r->next = loader->finished;
+	loader->finished = r;
+	pthread_mutex_unlock(&loader->lock);
+}
+
+static void BenchDrop(void *context, RMTile tile, void *request)
+{
+	free(request);
+}
+
+static void BenchDrain(BenchLoader *loader)
+{
+	BenchRequest *list;
+
+	pthread_mutex_lock(&loader->lock);
+	list = loader->finished;
+	loader->finished = NULL;
+	pthread_mutex_unlock(&loader->lock);
+
+	while (list != NULL) {
+		BenchRequest *next = list->next;
+		BenchFinish(loader, list);
+		list = next;
+	}
+}
+
+static void BenchAsk(BenchLoader *loader, RMTile tile, size_t frame, double asked, int centre, int fallback)
+{
+	BenchRequest *request = RMTileIndexGet(loader->requests, tile);
+
+	if (request != NULL) {
+		request->frame = frame;
+		return;
+	}
+
+	request = calloc(1, sizeof(*request));
+	request->tile = tile;
+	request->frame = frame;
+	request->centre = centre;
+	request->fallback = fallback;
+	request->asked = asked;
+	RMTileIndexInsert(loader->requests, tile, request);
+
+	if (loader->mode == BenchSync) {
+		BenchRead(request);
+		BenchFinish(loader, request);
+	} else if (!RMTileSchedulerSubmit(loader->scheduler, loader, tile, RMTileRequestVisible, request)) {
+		// an abandoned request for the tile is still running
+		BenchRead(request);
+		BenchFinish(loader, request);
+	}
+}
+
+typedef struct {
+	BenchRequest **items;
+	size_t count;
+	size_t frame;
+} BenchStale;
+
+static void BenchCollectStale(void *context, RMTile tile, void *value)
+{
+	BenchStale *stale = context;
+	BenchRequest *request = value;
+
+	if (request->frame != stale->frame)
+		stale->items[stale->count++] = request;
+}
+
+static void BenchLetGo(BenchLoader *loader, size_t frame)
+{
+	BenchStale stale;
+
+	stale.items = malloc((RMTileIndexCount(loader->requests) + 1) * sizeof(BenchRequest *));
+	stale.count = 0;
+	stale.frame = frame;
+	RMTileIndexForEach(loader->requests, BenchCollectStale, &stale);
+
+	for (size_t i = 0; i < stale.count; i++) {
+		BenchRequest *request = stale.items[i];
+
+		RMTileIndexRemove(loader->requests, request->tile);
+		if (request->done) {
+			free(request);
+		} else if (loader->mode == BenchSchedule && RMTileSchedulerCancel(loader->scheduler, loader, request->tile, request)) {
+			loader->cancelled++;
+			free(request);
+		} else {
+			request->abandoned = 1;
+		}
+	}
+	free(stale.items);
+}
+
+static void BenchUpdate(BenchLoader *loader, const BenchFrame *frame, size_t number, double asked)
+{
+	for (int level = 0; level <= kBenchTileDepth && level <= frame->zoom; level++) {
+		double scale = ldexp(1.0, -level);
+		double cx = frame->x * scale, cy = frame->y * scale;
+		double halfWidth = kBenchScreenWidth * scale / 2, halfHeight = kBenchScreenHeight * scale / 2;
+		RMTile tile;
+
+		tile.zoom = frame->zoom - level;
+		for (double x = floor(cx - halfWidth); x <= floor(cx + halfWidth); x++) {
+			for (double y = floor(cy - halfHeight); y <= floor(cy + halfHeight); y++) {
+				tile.x = (uint32_t)x;
+				tile.y = (uint32_t)y;
+				BenchAsk(loader, tile, number, asked, level == 0 && x == floor(cx) && y == floor(cy), level > 0);
+			}
+		}
+	}
+	BenchLetGo(loader, number);
+}
+
+static void BenchRun(const BenchSession *session, int mode)
+{
+	BenchLoader loader;
+
+	memset(&loader, 0, sizeof(loader));
+	loader.mode = mode;
+	loader.requests = RMTileIndexCreate();
+	pthread_mutex_init(&loader.lock, NULL);
+	if (mode != BenchSync)
+		loader.scheduler = RMTileSchedulerCreate(kBenchWorkers, BenchWork, BenchDrop, &loader);
+
+	double next = BenchNow();
+	for (size_t i = 0; i < session->count; i++) {
+		const BenchFrame *frame = &session->frames[i];
+		double start = BenchNow();
+
+		BenchDrain(&loader);
+		if (loader.scheduler != NULL)
+			RMTileSchedulerSetFocus(loader.scheduler, &loader, frame->zoom, frame->x, frame->y);
+		BenchUpdate(&loader, frame, i + 1, start);
+		BenchAdd(&loader.update, BenchNow() - start);
+
+		next += kBenchFrameSeconds;
+		BenchSleep(next - BenchNow());
+	}
+
+	if (loader.scheduler != NULL) {
+		RMTileSchedulerWait(loader.scheduler);
+		RMTileSchedulerFree(loader.scheduler);
+	}
+	BenchDrain(&loader);
+	BenchLetGo(&loader, 0);
+	RMTileIndexFree(loader.requests);
+	pthread_mutex_destroy(&loader.lock);
+
+	printf("%-8s %-9s update %6.2f ms mean %6.1f max   centre %6.1f ms   visible %6.1f ms   fallback %6.1f ms   reads %4zu wasted %4zu cancelled %4zu\n",
+		   session->name, kBenchModeNames[mode],
+		   loader.update.sum * 1e3 / loader.update.count, loader.update.max * 1e3,
+		   loader.centre.count ? loader.centre.sum * 1e3 / loader.centre.count : 0,
+		   loader.visible.count ? loader.visible.sum * 1e3 / loader.visible.count : 0,
+		   loader.fallback.count ? loader.fallback.sum * 1e3 / loader.fallback.count : 0,
+		   loader.reads, loader.wasted, loader.cancelled);
+}
+
+// pan: a steady drag; fling: a fast swipe slowing down; zoom: pinching a level in and out.
+static void BenchGenerate(BenchSession *session, const char *name)
+{
+	const size_t count = 120;
+	double x = 35210.5, y = 21492.5;
+	short zoom = 16;
+
+	session->frames = malloc(count * sizeof(BenchFrame));
+	session->count = count;
+	session->name = name;
+
+	for (size_t i = 0; i < count; i++) {
+		if (strcmp(name, "pan") == 0) {
+			x += 0.15;
+			y += 0.05;
+		} else if (strcmp(name, "fling") == 0) {
+			x += 1.2 * (1.0 - (double)i / count);
+		} else if (i > 0 && i % 30 == 0) {
+			short target = (i / 30) % 2 ? 17 : 16;
+			double scale = ldexp(1.0, target - zoom);
+			x *= scale;
+			y *= scale;
+			zoom = target;
+		}
+		session->frames[i].zoom = zoom;
+		session->frames[i].x = x;
+		session->frames[i].y = y;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static const char *names[] = { "pan", "fling", "zoom" };
+
+	if (argc > 1)
+		gReadSeconds = atof(argv[1]) / 1e3;
+
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		BenchSession session;
+		BenchGenerate(&session, names[i]);
+		for (int mode = BenchSync; mode <= BenchSchedule; mode++)
+			BenchRun(&session, mode);
+		free(session.frames);
+	}
+	return 0;
+}
@@ -0,0 +1,294 @@
+//
+//  RMTileStoreBenchmark.c
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Stress benchmark of RMTileStore: reader threads look up tiles while one writer thread
+// stores new tiles and purges the oldest ones, as RMDatabaseCache does while panning.
+// Builds on any POSIX system with SQLite, for example from this directory:
+//
+//   cc -std=c99 -O2 -I../Map -o storebench RMTileStoreBenchmark.c ../Map/RMTileStore.c ../Map/RMTilePack.c ../Map/RMTileLRU.c -lsqlite3 -lpthread
+//   ./storebench [readers [seconds [shards [directory]]]]
+//
+// The same load is then run against a single connection behind one lock, the way
+// RMDatabaseCache used FMDatabase under @synchronized.
+
+#define _XOPEN_SOURCE 600
+
+#include "RMTileStore.h"
+#include <sqlite3.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define kTiles 20000
+#define kTileBytes 4096
+#define kPurgeEvery 2000
+#define kPurgeCount 1000
+#define kMaxSamples 200000
+
+static double BenchNow(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec + now.tv_usec * 1e-6;
+}
+
+static uint64_t BenchKey(unsigned i)
+{
+	return ((uint64_t)16 << 56) | ((uint64_t)(34000 + i % 256) << 28) | (uint64_t)(21000 + i / 256);
+}
+
+// One of the two engines under test.
+typedef struct {
+	RMTileStore *store;
+	sqlite3 *db;		// the single locked connection, if no store
+	pthread_mutex_t lock;
+	sqlite3_stmt *select, *insert, *purge;
+} BenchCache;
+
+static int BenchGet(BenchCache *cache, uint64_t key)
+{
+	void *data;
+	size_t length;
+	int found;
+
+	if (cache->store != NULL) {
+		found = RMTileStoreGet(cache->store, key, &data, &length);
+		free(data);
+		return found;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	sqlite3_bind_int64(cache->select, 1, (sqlite3_int64)key);
+	found = sqlite3_step(cache->select) == SQLITE_ROW;
+	if (found)
+		free(malloc((size_t)sqlite3_column_bytes(cache->select, 0)));
+	sqlite3_reset(cache->select);
+	pthread_mutex_unlock(&cache->lock);
+	return found;
+}
+
+static void BenchPut(BenchCache *cache, uint64_t key, const void *data, double when)
+{
+	if (cache->store != NULL) {
+		RMTileStorePut(cache->store, key, data, kTileBytes, when, when);
+		return;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	sqlite3_bind_int64(cache->insert, 1, (sqlite3_int64)key);
+	sqlite3_bind_double(cache->insert, 2, when);
+	sqlite3_bind_double(cache->insert, 3, when);
+	sqlite3_bind_blob(cache->insert, 4, data, kTileBytes, SQLITE_STATIC);
+	sqlite3_step(cache->insert);
+	sqlite3_reset(cache->insert);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+static void BenchPurge(BenchCache *cache)
+{
+	if (cache->store != NULL) {
+		RMTileStorePurge(cache->store, kPurgeCount);
+		return;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	sqlite3_bind_int(cache->purge, 1, kPurgeCount);
+	sqlite3_step(cache->purge);
+	sqlite3_reset(cache->purge);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+typedef struct {
+	BenchCache *cache;
+	unsigned seed;
+	double until;
+	double *samples;
+	size_t sampleCount;
+	unsigned long lookups, hits;
+} BenchReader;
+
+static void *BenchRead(void *context)
+{
+	BenchReader *reader = context;
+
+	while (BenchNow() < reader->until) {
+		uint64_t key = BenchKey((unsigned)rand_r(&reader->seed) % (kTiles * 2));
+		double start = BenchNow();
+		reader->hits += BenchGet(reader->cache, key) == 1;
+		double elapsed = BenchNow() - start;
+		if (reader->sampleCount < kMaxSamples)
+			reader->samples[reader->sampleCount++] = elapsed;
+		reader->lookups++;
+	}
+	return NULL;
+}
+
+typedef struct {
+	BenchCache *cache;
+	double until;
+	unsigned long writes;
+} BenchWriter;
+
+static void *BenchWrite(void *context)
+{
+	BenchWriter *writer = context;
+	unsigned char tile[kTileBytes];
+	unsigned i = kTiles;
+
+	memset(tile, 0x5a, sizeof tile);
+	while (BenchNow() < writer->until) {
+		BenchPut(writer->cache, BenchKey(i % (kTiles * 2)), tile, (double)i);
+		i++;
+		writer->writes++;
+		if (writer->writes % kPurgeEvery == 0)
+			BenchPurge(writer->cache);
+	}
+	return NULL;
+}
+
+static int BenchCompare(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void BenchRun(const char *name, BenchCache *cache, unsigned readerCount, double seconds)
+{
+	BenchReader *readers = calloc(readerCount, sizeof(BenchReader));
+	pthread_t *threads = calloc(readerCount + 1, sizeof(pthread_t));
+	BenchWriter writer = { cache, BenchNow() + seconds, 0 };
+	unsigned long lookups = 0, hits = 0;
+	size_t sampleCount = 0;
+	double *samples;
+
+	for (unsigned i = 0; i < readerCount; i++) {
+		readers[i].cache = cache;
+		readers[i].seed = i + 1;
+		readers[i].until = writer.until;
+		readers[i].samples = malloc(kMaxSamples * sizeof(double));
+		pthread_create(&threads[i], NULL, BenchRead, &readers[i]);
+	}
+	pthread_create(&threads[readerCount], NULL, BenchWrite, &writer);
+	for (unsigned i = 0; i <= readerCount; i++)
+		pthread_join(threads[i], NULL);
+
+	for (unsigned i = 0; i < readerCount; i++)
+		sampleCount += readers[i].sampleCount;
+	samples = malloc(sampleCount * sizeof(double));
+	sampleCount = 0;
+	for (unsigned i = 0; i < readerCount; i++) {
+		memcpy(samples + sampleCount, readers[i].samples, readers[i].sampleCount * sizeof(double));
+		sampleCount += readers[i].sampleCount;
+		lookups += readers[i].lookups;
+		hits += readers[i].hits;
+		free(readers[i].samples);
+	}
+	qsort(samples, sampleCount, sizeof(double), BenchCompare);
+
+	printf("%-22s %9.0f lookups/s (%2.0f%% hits)  p50 %7.1f us  p99 %8.1f us  max %8.1f ms  %7.0f writes/s\n",
+		   name, lookups / seconds, 100.0 * hits / (lookups ? lookups : 1),
+		   samples[sampleCount / 2] * 1e6, samples[sampleCount * 99 / 100] * 1e6,
+		   samples[sampleCount - 1] * 1e3, writer.writes / seconds);
+
+	free(samples);
+	free(readers);
+	free(threads);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned readerCount = argc > 1 ? (unsigned)atoi(argv[1]) : 16;
+	double seconds = argc > 2 ? atof(argv[2]) : 5;
+	unsigned shards = argc > 3 ? (unsigned)atoi(argv[3]) : 4;
+	const char *directory = argc > 4 ? argv[4] : ".";
+	unsigned char tile[kTileBytes];
+	char path[1024], command[2 * sizeof path + 16];
+	BenchCache cache;
+
+	if (readerCount < 1 || seconds <= 0 || shards < 1) {
+		fprintf(stderr, "usage: %s [readers [seconds [shards [directory]]]]\n", argv[0]);
+		return 1;
+	}
+	memset(tile, 0x5a, sizeof tile);
+	printf("%u readers, 1 writer, %u tiles to start with, %.0f s per run\n", readerCount, kTiles, seconds);
+
+	for (unsigned bits = 0; (1u << bits) <= shards; bits++) {
+		RMTileStoreOptions options = RMTileStoreDefaultOptions();
+		char name[64];
+
+		options.shardBits = bits;
+		options.readers = readerCount / (1u << bits) + 1;
+		snprintf(path, sizeof path, "%s/storebench-%u.sqlite", directory, bits);
+		snprintf(command, sizeof command, "rm -f '%s' '%s'.*", path, path);
+		system(command);
+
+		memset(&cache, 0, sizeof cache);
+		cache.store = RMTileStoreOpen(path, &options);
+		if (cache.store == NULL) {
+			fprintf(stderr, "cannot open %s\n", path);
+			return 1;
+		}
+		for (unsigned i = 0; i < kTiles; i++)
+			RMTileStorePut(cache.store, BenchKey(i), tile, kTileBytes, (double)i, (double)i);
+		RMTileStoreFlush(cache.store);
+
+		snprintf(name, sizeof name, "store, %u shard%s", 1u << bits, bits ? "s" : "");
+		BenchRun(name, &cache, readerCount, seconds);
+		RMTileStoreClose(cache.store);
+		system(command);
+	}
+
+	// one connection, one lock, one autocommit statement per write
+	snprintf(path, sizeof path, "%s/storebench-locked.sqlite", directory);
+	remove(path);
+	memset(&cache, 0, sizeof cache);
+	pthread_mutex_init(&cache.lock, NULL);
+	if (sqlite3_open(path, &cache.db) != SQLITE_OK) {
+		fprintf(stderr, "cannot open %s\n", path);
+		return 1;
+	}
+	sqlite3_exec(cache.db, "CREATE TABLE ZCACHE (ztileHash INTEGER PRIMARY KEY, zlastUsed DOUBLE, zdata BLOB, zInserted DOUBLE);"
+				 "CREATE INDEX zlastUsedIndex ON ZCACHE(zLastUsed); CREATE INDEX zInsertedIndex ON ZCACHE(zInserted)", NULL, NULL, NULL);
+	sqlite3_prepare_v2(cache.db, "SELECT zdata FROM ZCACHE WHERE ztileHash = ?", -1, &cache.select, NULL);
+	sqlite3_prepare_v2(cache.db, "INSERT OR REPLACE INTO ZCACHE (ztileHash, zlastUsed, zInserted, zdata) VALUES (?, ?, ?, ?)", -1, &cache.insert, NULL);
+	sqlite3_prepare_v2(cache.db, "DELETE FROM ZCACHE WHERE ztileHash IN (SELECT ztileHash FROM ZCACHE ORDER BY zlastUsed LIMIT ?)", -1, &cache.purge, NULL);
+	sqlite3_exec(cache.db, "BEGIN", NULL, NULL, NULL);
+	for (unsigned i = 0; i < kTiles; i++)
+		BenchPut(&cache, BenchKey(i), tile, (double)i);
+	sqlite3_exec(cache.db, "COMMIT", NULL, NULL, NULL);
+
+	BenchRun("one locked connection", &cache, readerCount, seconds);
+
+	sqlite3_finalize(cache.select);
+	sqlite3_finalize(cache.insert);
+	sqlite3_finalize(cache.purge);
+	sqlite3_close(cache.db);
+	remove(path);
+	return 0;
+}
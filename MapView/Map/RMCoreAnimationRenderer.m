@@ -72,11 +72,6 @@
 
 #pragma mark -
 #pragma mark Adding and removing tiles
-/// \bug this is a no-op
--(void)mapImageLoaded: (NSNotification*)notification
-{
-}
-
 - (void)tileAdded: (RMTile) tile WithImage: (RMTileImage*) image
 {
 	NSUInteger min = 0, max = [tiles count];
@@ -29,9 +29,10 @@
 #import "RMTileSource.h"
 #import "RMProjection.h"
 #import "FMDatabase.h"
+#import "RMScheduledTileImage.h"
 
-@interface RMDBMapSource : NSObject<RMTileSource> {
-	// tile database
+@interface RMDBMapSource : NSObject<RMTileSource, RMTileDataReader> {
+	// tile database, also read on the scheduler's workers
 	FMDatabase* db;
 	
 	// projection
@@ -52,6 +53,8 @@
 
 -(int)tileSideLength;
 
+-(NSData *)tileData:(RMTile)tile;
+
 -(float) minZoom;
 -(float) maxZoom;
 
@@ -209,7 +209,27 @@
 
 -(RMTileImage *)tileImage:(RMTile)tile {
 	tile = [tileProjection normaliseTile:tile];
-	return [RMTileImage imageForTile:tile fromDB:db];
+	return [[[RMScheduledTileImage alloc] initWithTile:tile reader:self] autorelease];
+}
+
+-(NSData *)tileData:(RMTile)tile {
+	NSData* data = nil;
+
+	// get the unique key for the tile
+	NSNumber* key = [NSNumber numberWithLongLong:RMTileKey(tile)];
+
+	@synchronized (db) {
+		FMResultSet* rs = [db executeQuery:@"select image from tiles where tilekey = ?", key];
+		if ([db hadError]) {
+			NSLog(@"DB error %d fetching tile %@: %@", [db lastErrorCode], key, [db lastErrorMessage]);
+		}
+		if ([rs next]) {
+			data = [rs dataForColumn:@"image"];
+		}
+		[rs close];
+	}
+
+	return data;
 }
 
 -(id<RMMercatorToTileProjection>) mercatorToTileProjection {
@@ -253,11 +273,13 @@
 -(NSString*)getPreferenceAsString:(NSString*)name {
 	NSString* value = nil;
 	
-	FMResultSet* rs = [db executeQuery:@"select value from preferences where name = ?", name];
-	if ([rs next]) {
-		value = [rs stringForColumn:@"value"];
+	@synchronized (db) {
+		FMResultSet* rs = [db executeQuery:@"select value from preferences where name = ?", name];
+		if ([rs next]) {
+			value = [rs stringForColumn:@"value"];
+		}
+		[rs close];
 	}
-	[rs close];
 	
 	return value;
 }
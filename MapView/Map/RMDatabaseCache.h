@@ -27,27 +27,66 @@
 
 #import <UIKit/UIKit.h>
 #import "RMTileCache.h"
+#import "RMTileStore.h"
+#import "RMTileImage.h"
 
 @class RMTileCacheDAO;
+@class RMDecodedTileCache;
 
-@interface RMDatabaseCache : NSObject<RMTileCache> {
+/*! RMDatabaseCache stores loaded tile images in an SQLite database.
+ 
+ Adding tiles never purges. Once the cache holds capacity tiles (the high watermark), a
+ maintenance pass is started in the background that deletes the oldest tiles in batches,
+ until at most capacity - minimalPurge tiles are left (the low watermark). Which tiles are
+ oldest depends on the purge strategy: FIFO goes by the time tiles were added, LRU by their
+ last use, which every hit writes, and CLOCK by hour-wide buckets of their last use, where a
+ hit only sets a reference bit that spares the tile once.
+
+ Lookups do not wait for each other nor for writes: they run on a pool of read connections
+ per database file, and the tiles can be spread over several files (shards). Writes are
+ queued and written in batches by a writer thread of RMTileCacheDAO; whatever is queued is
+ also flushed when the application terminates or goes to the background, or on a memory
+ warning.
+
+ With a segmentSize in the store options, tile data goes to pack files next to the database,
+ where identical tiles are kept once, and the maintenance pass also compacts those files.
+
+ Hits are decoded through the decodedTileCache, if there is one, so their bitmaps are kept.
+ */
+@interface RMDatabaseCache : NSObject<RMTileCache, RMTileImageObserver> {
 	NSString* databasePath;
 	RMTileCacheDAO *dao;
 	RMCachePurgeStrategy purgeStrategy;
 	NSUInteger capacity;
 	NSUInteger minimalPurge;
+	BOOL maintenanceScheduled;
+	RMDecodedTileCache *decodedTileCache;
 }
 
 @property (retain) NSString* databasePath;
+@property (retain) RMDecodedTileCache* decodedTileCache;
 
 + (NSString*)dbPathForTileSource: (id<RMTileSource>) source usingCacheDir: (BOOL) useCacheDir;
 -(id) initWithDatabase: (NSString*)path;
+/// Spreads the tiles over a number of database files, each read through a pool of connections.
+-(id) initWithDatabase: (NSString*)path shards: (NSUInteger)shards readers: (NSUInteger)readers;
+-(id) initWithDatabase: (NSString*)path options: (const RMTileStoreOptions*)options;
 -(id) initWithTileSource: (id<RMTileSource>) source usingCacheDir: (BOOL) useCacheDir;
 
 -(void) setPurgeStrategy: (RMCachePurgeStrategy) theStrategy;
 -(void) setCapacity: (NSUInteger) theCapacity;
 -(void) setMinimalPurge: (NSUInteger) thePurgeMinimum;
+/// Tiles and LRU touches written per transaction.
+-(void) setWriteBatchSize: (NSUInteger) theBatchSize;
+/// Longest time, in seconds, a tile waits to be written.
+-(void) setWriteDelay: (NSTimeInterval) theDelay;
+
+/// Writes all queued tiles and touches now.
+-(void) flushPendingWrites;
 
 -(void) purgeTilesFromBefore: (NSDate*) date;
 
+/// Purges down to the low watermark if the cache is at or over capacity. Runs in the calling thread.
+-(void) performMaintenance;
+
 @end
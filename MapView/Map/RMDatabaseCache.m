@@ -27,12 +27,17 @@
 
 #import "RMDatabaseCache.h"
 #import "RMTileCacheDAO.h"
+#import "RMDecodedTileCache.h"
 #import "RMTileImage.h"
 #import "RMTile.h"
 
+/// Tiles deleted per transaction by the maintenance pass, which lets queued writes in between.
+static const NSUInteger kRMDatabaseCachePurgeBatch = 256;
+
 @implementation RMDatabaseCache
 
 @synthesize databasePath;
+@synthesize decodedTileCache;
 
 + (NSString*)dbPathForTileSource: (id<RMTileSource>) source usingCacheDir: (BOOL) useCacheDir
 {
@@ -63,16 +68,42 @@
 }
 
 -(id) initWithDatabase: (NSString*)path
+{
+	/// \bug magic numbers
+	return [self initWithDatabase:path shards:1 readers:4];
+}
+
+-(id) initWithDatabase: (NSString*)path shards: (NSUInteger)shards readers: (NSUInteger)readers
+{
+	RMTileStoreOptions options = [RMTileCacheDAO optionsWithShards:shards readers:readers];
+	return [self initWithDatabase:path options:&options];
+}
+
+-(id) initWithDatabase: (NSString*)path options: (const RMTileStoreOptions*)options
 {
 	if (![super init])
 		return nil;
 	
 	
 	self.databasePath = path;
-	dao = [[RMTileCacheDAO alloc] initWithDatabase:path];
+	dao = [[RMTileCacheDAO alloc] initWithDatabase:path options:options];
 
 	if (dao == nil)
+	{
+		[self release];
 		return nil;
+	}
+
+	[[NSNotificationCenter defaultCenter] addObserver:self
+											 selector:@selector(flushPendingWrites)
+												 name:UIApplicationWillTerminateNotification
+											   object:nil];
+	// iOS 4 and later only
+	if (&UIApplicationDidEnterBackgroundNotification != NULL)
+		[[NSNotificationCenter defaultCenter] addObserver:self
+												 selector:@selector(flushPendingWrites)
+													 name:UIApplicationDidEnterBackgroundNotification
+												   object:nil];
 	
 	return self;	
 }
@@ -87,6 +118,7 @@
 	[[NSNotificationCenter defaultCenter] removeObserver:self];
 	[databasePath release];
 	[dao release];
+	[decodedTileCache release];
 	
 	[super dealloc];
 }
@@ -106,36 +138,38 @@
 	minimalPurge = theMinimalPurge;
 }
 
+-(void) setWriteBatchSize: (NSUInteger) theBatchSize
+{
+	[dao setWriteBatchSize: MAX(theBatchSize, 1)];
+}
+
+-(void) setWriteDelay: (NSTimeInterval) theDelay
+{
+	[dao setWriteDelay: theDelay];
+}
+
+-(void) flushPendingWrites
+{
+	[dao flush];
+}
+
 -(void)addTile: (RMTile)tile WithImage: (RMTileImage*)image
 {
 	// The tile probably hasn't loaded any data yet... we must be patient.
-	
-        [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(addImageData:) name:RMMapImageLoadedNotification object:image];
+	[image addObserver:self];
 }
 
--(void) addImageData: (NSNotification *)notification
+-(void) tileImage: (RMTileImage*)image didLoadData: (NSData*)data
 {
-	NSData *data = [[notification userInfo] objectForKey:@"data"];
-	/// \bug magic string literals
-	RMTileImage *image = (RMTileImage*)[notification object];
-	
-	@synchronized (self) {
+	[dao addData:data LastUsed:[image lastUsedTime] ForTile:RMTileKey([image tile])];
 
-		if (capacity != 0) {
-			NSUInteger tilesInDb = [dao count];
-			if (capacity <= tilesInDb) {
-				[dao purgeTiles: MAX(minimalPurge, 1+tilesInDb-capacity)];
-			}
+	@synchronized (self) {
+		if (capacity != 0 && [dao count] >= capacity && !maintenanceScheduled) {
+			maintenanceScheduled = YES;
+			[self performSelectorInBackground:@selector(maintenanceInBackground) withObject:nil];
 		}
-	
-		[dao addData:data LastUsed:[image lastUsedTime] ForTile:RMTileKey([image tile])];
 	}
 	
-	[[NSNotificationCenter defaultCenter] removeObserver:self
-													name:RMMapImageLoadedNotification
-												  object:image];
-	
-	
 //	RMLog(@"%d items in DB", [dao count]);
 }
 
@@ -143,47 +177,73 @@
 {
 //	RMLog(@"Looking for cached image in DB");
 
-	NSData *data = nil;
-	
-	@synchronized (self) {
-	
-		data = [dao dataForTile:RMTileKey(tile)];
-		if (data == nil)
-			return nil;
-	
-		if (capacity != 0 && purgeStrategy == RMCachePurgeStrategyLRU) {
-			[dao touchTile: RMTileKey(tile) withDate: [NSDate date]];
-		}
-		
+	// no lock: the DAO reads on a connection of its own while others read or write
+	NSData *data = [dao dataForTile:RMTileKey(tile)];
+	if (data == nil)
+		return nil;
+
+	if (capacity != 0 && purgeStrategy == RMCachePurgeStrategyLRU) {
+		[dao touchTile: RMTileKey(tile) withDate: [NSDate date]];
+	} else if (capacity != 0 && purgeStrategy == RMCachePurgeStrategyClock) {
+		[dao referenceTile: RMTileKey(tile)];
 	}
 	
-	RMTileImage *image = [RMTileImage imageForTile:tile withData:data];
+	RMTileImage *image;
+	if (decodedTileCache != nil)
+		image = [decodedTileCache imageForTile:tile withData:data];
+	else
+		image = [RMTileImage imageForTile:tile withData:data];
 //	RMLog(@"DB cache hit for tile %d %d %d", tile.x, tile.y, tile.zoom);
 	return image;
 }
 
+-(void) maintenanceInBackground
+{
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	[self performMaintenance];
+	@synchronized (self) {
+		maintenanceScheduled = NO;
+	}
+	[pool release];
+}
+
+-(void) performMaintenance
+{
+	if (capacity == 0 || [dao count] < capacity)
+		return;
+	NSUInteger lowWatermark = capacity - MIN(MAX(minimalPurge, 1), capacity);
+	
+	RMLog(@"purging db cache down to %u tiles", lowWatermark);
+
+	// Lookups go on while the purge runs; the DAO only holds back the writer.
+	for (;;)
+	{
+		NSUInteger tilesInDb = [dao count];
+		if (tilesInDb <= lowWatermark)
+			break;
+		NSUInteger batch = MIN(tilesInDb - lowWatermark, kRMDatabaseCachePurgeBatch);
+		NSUInteger purged = purgeStrategy == RMCachePurgeStrategyClock ? [dao purgeTilesByClock: batch] : [dao purgeTiles: batch];
+		if (purged == 0)
+			break;
+	}
+
+	// reclaims the space of the deleted tiles, if they were packed
+	[dao compactPackFiles];
+}
+
 -(void) purgeTilesFromBefore: (NSDate*) date
 {
-    @synchronized(self)
-    {
-        [dao purgeTilesFromBefore:date];
-    }
+	[dao purgeTilesFromBefore:date];
 }
 
 -(void)didReceiveMemoryWarning
 {
-        @synchronized(self) 
-        {
-		[dao didReceiveMemoryWarning];
-        }
+	[dao didReceiveMemoryWarning];
 }
 
 -(void) removeAllCachedImages 
 {
-        @synchronized(self) 
-        {
-		[dao removeAllCachedImages];
-        }
+	[dao removeAllCachedImages];
 }
 
 @end
@@ -0,0 +1,58 @@
+//
+//  RMDecodedTileCache.h
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#import <UIKit/UIKit.h>
+#import "RMTileCache.h"
+#import "RMTileBitmapCache.h"
+
+/*! RMDecodedTileCache keeps decoded bitmaps of recently read tiles, between the memory cache
+ and the database cache.
+
+ RMDatabaseCache decodes the PNG data of its hits through this cache, with RMTileDecoder into
+ slab memory, so a tile read again later, even after the memory cache has let go of it, is
+ shown without another database read or decode. The images are CGImages straight on top of
+ the cached pixels. Data RMTileDecoder does not handle, like JPEG, is decoded by UIImage and
+ not cached here.
+ */
+@interface RMDecodedTileCache : NSObject<RMTileCache> {
+	RMTileBitmapCache *bitmaps;
+	RMTilePixelFormat pixelFormat;
+	CGColorSpaceRef colorSpace;
+}
+
+-(id)initWithByteBudget: (NSUInteger) byteBudget pixelFormat: (RMTilePixelFormat) format;
+
+/// Returns an image of the tile data, decoded through the cache when possible.
+-(RMTileImage*)imageForTile: (RMTile) tile withData: (NSData*) data;
+
+@property (readonly) RMTilePixelFormat pixelFormat;
+/// Number of cached bitmaps.
+@property (readonly) NSUInteger count;
+/// Bytes of the cached bitmaps.
+@property (readonly) NSUInteger cost;
+
+@end
@@ -0,0 +1,142 @@
+//
+//  RMDecodedTileCache.m
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#import "RMDecodedTileCache.h"
+#import "RMTileImage.h"
+
+static void RMDecodedTileCacheReleasePixels(void *info, const void *data, size_t size)
+{
+	RMTileBitmapRelease(info);
+}
+
+@implementation RMDecodedTileCache
+
+@synthesize pixelFormat;
+
+-(id)initWithByteBudget: (NSUInteger) byteBudget pixelFormat: (RMTilePixelFormat) format
+{
+	if (![super init])
+		return nil;
+
+	RMLog(@"initializing decoded tile cache %@ with byte budget %u", self, byteBudget);
+
+	pixelFormat = format;
+	bitmaps = RMTileBitmapCacheCreate(byteBudget);
+	if (bitmaps == NULL)
+	{
+		[self release];
+		return nil;
+	}
+	colorSpace = CGColorSpaceCreateDeviceRGB();
+
+	return self;
+}
+
+-(void) dealloc
+{
+	LogMethod();
+	// images still on screen keep their bitmaps until they go
+	RMTileBitmapCacheFree(bitmaps);
+	CGColorSpaceRelease(colorSpace);
+	[super dealloc];
+}
+
+// Wraps a pinned bitmap, which the image unpins when it goes.
+-(RMTileImage*) imageForTile: (RMTile) tile withBitmap: (RMTileBitmap*) bitmap
+{
+	CGBitmapInfo info;
+	size_t bitsPerComponent, bitsPerPixel;
+
+	if (bitmap->format == RMTilePixelFormatRGB555) {
+		info = kCGImageAlphaNoneSkipFirst | kCGBitmapByteOrder16Little;
+		bitsPerComponent = 5;
+		bitsPerPixel = 16;
+	} else {
+		info = kCGImageAlphaPremultipliedLast | kCGBitmapByteOrder32Big;
+		bitsPerComponent = 8;
+		bitsPerPixel = 32;
+	}
+
+	CGDataProviderRef provider = CGDataProviderCreateWithData(bitmap->handle, bitmap->pixels, bitmap->rowBytes * bitmap->height, RMDecodedTileCacheReleasePixels);
+	if (provider == NULL) {
+		RMTileBitmapRelease(bitmap->handle);
+		return nil;
+	}
+	CGImageRef cgImage = CGImageCreate(bitmap->width, bitmap->height, bitsPerComponent, bitsPerPixel, bitmap->rowBytes,
+									   colorSpace, info, provider, NULL, false, kCGRenderingIntentDefault);
+	CGDataProviderRelease(provider);
+	if (cgImage == NULL)
+		return nil;
+
+	RMTileImage *image = [[RMTileImage alloc] initWithTile:tile];
+	[image updateImageUsingImage:[UIImage imageWithCGImage:cgImage]];
+	CGImageRelease(cgImage);
+	return [image autorelease];
+}
+
+-(RMTileImage*) cachedImage:(RMTile)tile
+{
+	RMTileBitmap bitmap;
+
+	if (!RMTileBitmapCacheGet(bitmaps, RMTileKey(tile), pixelFormat, &bitmap))
+		return nil;
+
+	return [self imageForTile:tile withBitmap:&bitmap];
+}
+
+-(RMTileImage*)imageForTile: (RMTile) tile withData: (NSData*) data
+{
+	RMTileBitmap bitmap;
+
+	if (!RMTileBitmapCacheDecode(bitmaps, RMTileKey(tile), pixelFormat, [data bytes], [data length], &bitmap))
+		return [RMTileImage imageForTile:tile withData:data];
+
+	return [self imageForTile:tile withBitmap:&bitmap];
+}
+
+-(void)didReceiveMemoryWarning
+{
+	LogMethod();
+	RMTileBitmapCacheRemoveAll(bitmaps);
+}
+
+-(void)removeAllCachedImages
+{
+	RMTileBitmapCacheRemoveAll(bitmaps);
+}
+
+-(NSUInteger) count
+{
+	return RMTileBitmapCacheCount(bitmaps);
+}
+
+-(NSUInteger) cost
+{
+	return RMTileBitmapCacheCost(bitmaps);
+}
+
+@end
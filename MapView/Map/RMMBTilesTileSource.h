@@ -38,6 +38,7 @@
 
 #import <Foundation/Foundation.h>
 #import "RMTileSource.h"
+#import "RMScheduledTileImage.h"
 
 @class RMFractalTileProjection;
 @class FMDatabase;
@@ -53,16 +54,19 @@ typedef enum {
     RMMBTilesLayerTypeOverlay   = 1,
 } RMMBTilesLayerType;
 
-@interface RMMBTilesTileSource : NSObject <RMTileSource>
+@interface RMMBTilesTileSource : NSObject <RMTileSource, RMTileDataReader>
 {
     RMFractalTileProjection *tileProjection;
     FMDatabase *db;
+    /// A second connection, for the tiles read on the scheduler's workers
+    FMDatabase *tileDb;
 }
 
 - (id)initWithTileSetURL:(NSURL *)tileSetURL;
 - (int)tileSideLength;
 - (void)setTileSideLength:(NSUInteger)aTileSideLength;
 - (RMTileImage *)tileImage:(RMTile)tile;
+- (NSData *)tileData:(RMTile)tile;
 - (NSString *)tileURL:(RMTile)tile;
 - (NSString *)tileFile:(RMTile)tile;
 - (NSString *)tilePath;
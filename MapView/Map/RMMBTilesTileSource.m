@@ -56,6 +56,11 @@
     if ( ! [db open])
         return nil;
     
+    tileDb = [[FMDatabase alloc] initWithPath:[tileSetURL relativePath]];
+    
+    if ( ! [tileDb open])
+        return nil;
+    
 	return self;
 }
 
@@ -66,6 +71,9 @@
     [db close];
     [db release];
     
+    [tileDb close];
+    [tileDb release];
+    
 	[super dealloc];
 }
 
@@ -85,33 +93,34 @@
 			  @"%@ tried to retrieve tile with zoomLevel %d, outside source's defined range %f to %f", 
 			  self, tile.zoom, self.minZoom, self.maxZoom);
 
+    return [[[RMScheduledTileImage alloc] initWithTile:tile reader:self] autorelease];
+}
+
+- (NSData *)tileData:(RMTile)tile
+{
     NSInteger zoom = tile.zoom;
     NSInteger x    = tile.x;
     NSInteger y    = pow(2, zoom) - tile.y - 1;
 
-    FMResultSet *results = [db executeQuery:@"select tile_data from tiles where zoom_level = ? and tile_column = ? and tile_row = ?", 
-                               [NSNumber numberWithFloat:zoom], 
-                               [NSNumber numberWithFloat:x], 
-                               [NSNumber numberWithFloat:y]];
-    
-    if ([db hadError])
-        return [RMTileImage dummyTile:tile];
-    
-    [results next];
-    
-    NSData *data = [results dataForColumn:@"tile_data"];
+    NSData *data = nil;
 
-    RMTileImage *image;
-    
-    if ( ! data)
-        image = [RMTileImage dummyTile:tile];
-    
-    else
-        image = [RMTileImage imageForTile:tile withData:data];
-    
-    [results close];
+    @synchronized (tileDb)
+    {
+        FMResultSet *results = [tileDb executeQuery:@"select tile_data from tiles where zoom_level = ? and tile_column = ? and tile_row = ?", 
+                                   [NSNumber numberWithFloat:zoom], 
+                                   [NSNumber numberWithFloat:x], 
+                                   [NSNumber numberWithFloat:y]];
+        
+        if ([tileDb hadError])
+            return nil;
+        
+        if ([results next])
+            data = [results dataForColumn:@"tile_data"];
+        
+        [results close];
+    }
     
-    return image;
+    return data;
 }
 
 - (NSString *)tileURL:(RMTile)tile
@@ -39,29 +39,15 @@
 
 	content = _contents;
 	
-	[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(mapImageLoaded:) name:RMMapImageLoadedNotification object:nil];
-	
 	return self;
 }
 
--(void) dealloc
-{
-	[[NSNotificationCenter defaultCenter] removeObserver:self];
-	[super dealloc];
-}
-
 /// \bug no-op
 - (void) setNeedsDisplay
 {
 	
 }
 
-/// \bug calls a no-op
--(void)mapImageLoaded: (NSNotification*)notification
-{
-	[self setNeedsDisplay];
-}
-
 /// \bug no-op
 - (void)drawRect:(CGRect)rect
 { }
@@ -147,6 +147,11 @@ typedef struct {
 	NSTimer *_decelerationTimer;
 	CGSize _decelerationDelta;
 	
+	// how the fingers move the map, smoothed, for prefetching tiles
+	NSTimeInterval _lastGestureTime;
+	CGSize _gestureVelocity;
+	float _gestureZoomRate;
+	
 	BOOL _constrainMovement;
 	RMProjectedPoint NEconstraint, SWconstraint;
 	
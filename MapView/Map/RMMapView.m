@@ -41,6 +41,8 @@
 - (void)startDecelerationWithDelta:(CGSize)delta;
 - (void)incrementDeceleration:(NSTimer *)timer;
 - (void)stopDeceleration;
+- (void)trackGestureMovedBy:(CGSize)delta zoomFactor:(double)zoomFactor at:(NSTimeInterval)time;
+- (void)prefetchDecelerating;
 - (void)performInitialSetup;
 @end
 
@@ -48,6 +50,9 @@
 #pragma mark Constants
 #define kDefaultDecelerationFactor .88f
 #define kMinDecelerationDelta 0.01f
+#define kDecelerationInterval 0.01f
+/// Weight of the newest touch in the smoothed gesture speed.
+#define kGestureSmoothing 0.5f
 
 @implementation RMMapView
 #pragma mark -
@@ -499,6 +504,9 @@
 	
 	//	RMLog(@"touchesBegan %d", [[event allTouches] count]);
 	lastGesture = [self gestureDetails:[event allTouches]];
+	_lastGestureTime = event.timestamp;
+	_gestureVelocity = CGSizeZero;
+	_gestureZoomRate = 0.0f;
 
 	if(deceleration)
 	{
@@ -675,10 +683,12 @@
 			
 			[self moveBy:delta];
 			[self zoomByFactor: zoomFactor near: newGesture.center];
+			[self trackGestureMovedBy:delta zoomFactor:zoomFactor at:event.timestamp];
 		}
 		else
 		{
 			[self moveBy:delta];
+			[self trackGestureMovedBy:delta zoomFactor:1.0 at:event.timestamp];
 		}
 	}
 	
@@ -693,13 +703,38 @@
     return YES;
 }
 
+#pragma mark -
+#pragma mark Prefetching
+- (void)trackGestureMovedBy:(CGSize)delta zoomFactor:(double)zoomFactor at:(NSTimeInterval)time {
+	NSTimeInterval interval = time - _lastGestureTime;
+
+	_lastGestureTime = time;
+	if (interval <= 0.0)
+		return;
+
+	_gestureVelocity.width += kGestureSmoothing * (delta.width / interval - _gestureVelocity.width);
+	_gestureVelocity.height += kGestureSmoothing * (delta.height / interval - _gestureVelocity.height);
+	_gestureZoomRate += kGestureSmoothing * (log2(zoomFactor) / interval - _gestureZoomRate);
+
+	[self.contents.tileLoader prefetchMoving:_gestureVelocity decay:0.0f zooming:_gestureZoomRate];
+}
+
+/// Prefetches where the deceleration will take the map: it moves _decelerationDelta per interval,
+/// shrinking by decelerationFactor each time.
+- (void)prefetchDecelerating {
+	CGSize velocity = CGSizeMake(_decelerationDelta.width / kDecelerationInterval, _decelerationDelta.height / kDecelerationInterval);
+
+	[self.contents.tileLoader prefetchMoving:velocity decay:-logf([self decelerationFactor]) / kDecelerationInterval zooming:0.0f];
+}
+
 #pragma mark -
 #pragma mark Deceleration
 - (void)startDecelerationWithDelta:(CGSize)delta {
 	if (ABS(delta.width) >= 1.0f && ABS(delta.height) >= 1.0f) {
 		_decelerationDelta = delta;
+		[self prefetchDecelerating];
         if ( !_decelerationTimer ) {
-            _decelerationTimer = [NSTimer scheduledTimerWithTimeInterval:0.01f 
+            _decelerationTimer = [NSTimer scheduledTimerWithTimeInterval:kDecelerationInterval 
                                                                  target:self
                                                                selector:@selector(incrementDeceleration:) 
                                                                userInfo:nil 
@@ -723,6 +758,9 @@
 
 	_decelerationDelta.width *= [self decelerationFactor];
 	_decelerationDelta.height *= [self decelerationFactor];
+
+	// the prefetched tiles stay put after the map stops, until they come on screen
+	[self prefetchDecelerating];
 }
 
 - (void)stopDeceleration {
@@ -28,15 +28,52 @@
 #import <Foundation/Foundation.h>
 #import "RMTile.h"
 #import "RMTileCache.h"
+#import "RMTileLRU.h"
+#import "RMTileSketch.h"
+#import "RMTileImage.h"
 
-@interface RMMemoryCache : NSObject<RMTileCache> {
-	NSMutableDictionary *cache;
+/*! RMMemoryCache keeps recently used tile images in memory.
+ 
+ The cache is bounded both by a number of tiles and by the bytes of their decoded bitmaps, and
+ evicts the least recently used tiles first. Lookups, additions and evictions take constant time.
 
-	int capacity;
+ With an admission sample size the cache becomes a W-TinyLFU cache. New tiles go into a window
+ of a quarter of the capacity, and a TinyLFU sketch counts how often each tile is looked up. A
+ tile pushed out of the window only moves into the rest of the cache if it is asked for more
+ often than the tile it would evict there, so that the one-off tiles of a long pan do not push
+ out the ones around home. The sample should span the time it takes to come back to a tile
+ worth keeping; twenty times the capacity is a good start.
+ */
+@interface RMMemoryCache : NSObject<RMTileCache, RMTileImageObserver> {
+	/// main cache, or all of it without admission
+	RMTileLRU *cache;
+	/// admission window, NULL without admission
+	RMTileLRU *window;
+
+	NSUInteger capacity;
+	NSUInteger byteBudget;
+
+	RMTileSketch *sketch;
+	NSUInteger admissionRejections;
+	/// set while the window evicts into the main cache
+	BOOL offering;
 }
 
 -(id)initWithCapacity: (NSUInteger) _capacity;
-/// Remove the least-recently used image from cache, if cache is at or over capacity. Removes only 1 image.
+/// A byte budget of 0 limits the cache by tile count only.
+-(id)initWithCapacity: (NSUInteger) _capacity byteBudget: (NSUInteger) _byteBudget;
+/// A sample size of 0 turns admission off; it needs a capacity of at least 2.
+-(id)initWithCapacity: (NSUInteger) _capacity byteBudget: (NSUInteger) _byteBudget admissionSampleSize: (NSUInteger) sampleSize;
+
+/// Remove least-recently used images from cache until one more tile fits in the capacity and byte budget.
 -(void)makeSpaceInCache;
 
+/// Bytes taken by the decoded bitmap of an image, or by a standard tile if it is not loaded yet.
++(NSUInteger)costOfImage: (RMTileImage*)image;
+
+@property (readonly) NSUInteger count;
+@property (readonly) NSUInteger cost;
+/// Tiles turned away by admission since the cache was created.
+@property (readonly) NSUInteger admissionRejections;
+
 @end
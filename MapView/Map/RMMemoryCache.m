@@ -27,26 +27,72 @@
 
 #import "RMMemoryCache.h"
 #import "RMTileImage.h"
+#import <QuartzCore/QuartzCore.h>
+
+/// Decoded size of a 256x256 RGBA tile, charged for images that are not loaded yet.
+static const NSUInteger kRMStandardTileCost = 256 * 256 * 4;
+
+static void RMMemoryCacheRelease(void *context, uint64_t key, void *value)
+{
+	[(RMTileImage *)value release];
+}
+
+@interface RMMemoryCache (Admission)
+-(void)imageLeftWindow: (RMTileImage*)image forKey: (uint64_t)key;
+@end
+
+static void RMMemoryCacheLeaveWindow(void *context, uint64_t key, void *value)
+{
+	[(RMMemoryCache *)context imageLeftWindow:(RMTileImage *)value forKey:key];
+}
 
 @implementation RMMemoryCache
 
+@synthesize admissionRejections;
+
 -(id)initWithCapacity: (NSUInteger) _capacity
+{
+	return [self initWithCapacity:_capacity byteBudget:0];
+}
+
+-(id)initWithCapacity: (NSUInteger) _capacity byteBudget: (NSUInteger) _byteBudget
+{
+	return [self initWithCapacity:_capacity byteBudget:_byteBudget admissionSampleSize:0];
+}
+
+-(id)initWithCapacity: (NSUInteger) _capacity byteBudget: (NSUInteger) _byteBudget admissionSampleSize: (NSUInteger) sampleSize
 {
 	if (![super init])
 		return nil;
 
-	RMLog(@"initializing memory cache %@ with capacity %d", self, _capacity);
-	
-	cache = [[NSMutableDictionary alloc] initWithCapacity:_capacity];
+	RMLog(@"initializing memory cache %@ with capacity %d, byte budget %u, admission sample %u", self, _capacity, _byteBudget, sampleSize);
 	
 	if (_capacity < 1)
 		_capacity = 1;
 	capacity = _capacity;
-	
-	[[NSNotificationCenter defaultCenter] addObserver:self
-											 selector:@selector(imageLoadingCancelled:)
-												 name:RMMapImageLoadingCancelledNotification
-											   object:nil];
+	byteBudget = _byteBudget;
+
+	// a quarter of the cache is the window that new tiles go to first
+	NSUInteger windowCapacity = 0, windowBudget = 0;
+	if (sampleSize > 0 && capacity >= 2)
+	{
+		windowCapacity = MAX(capacity / 4, 1);
+		windowBudget = byteBudget / 4;
+		sketch = RMTileSketchCreate(sampleSize);
+		window = RMTileLRUCreate(windowBudget, windowCapacity, RMMemoryCacheLeaveWindow, self);
+		if (sketch == NULL || window == NULL)
+		{
+			[self release];
+			return nil;
+		}
+	}
+
+	cache = RMTileLRUCreate(byteBudget - windowBudget, capacity - windowCapacity, RMMemoryCacheRelease, self);
+	if (cache == NULL)
+	{
+		[self release];
+		return nil;
+	}
 	
 	return self;
 }
@@ -60,61 +106,100 @@
 -(void) dealloc
 {
 	LogMethod();
-	[[NSNotificationCenter defaultCenter] removeObserver:self];
-	[cache release];
+	if (window != NULL)
+		RMTileLRUFree(window);
+	if (cache != NULL)
+		RMTileLRUFree(cache);
+	RMTileSketchFree(sketch);
 	[super dealloc];
 }
 
 -(void) didReceiveMemoryWarning
 {
 	LogMethod();		
-	[cache removeAllObjects];
+	[self removeAllCachedImages];
 }
 
 -(void) removeTile: (RMTile) tile
 {
 //	RMLog(@"tile %d %d %d removed from cache", tile.x, tile.y, tile.zoom);
-	[cache removeObjectForKey:[RMTileCache tileHash: tile]];
+	if (window != NULL)
+		RMTileLRURemove(window, RMTileKey(tile));
+	RMTileLRURemove(cache, RMTileKey(tile));
+}
+
+/// Drops an image that will not load, unless it has been replaced in the cache already.
+-(void) forgetImage: (RMTileImage*)image
+{
+	uint64_t key = RMTileKey([image tile]);
+
+	if (window != NULL && RMTileLRUPeek(window, key) == image)
+		RMTileLRURemove(window, key);
+	if (RMTileLRUPeek(cache, key) == image)
+		RMTileLRURemove(cache, key);
+}
+
+/// Charges an image that was added before it had loaded for its bitmap.
+-(void) tileImage: (RMTileImage*)image didLoadData: (NSData*)data
+{
+	uint64_t key = RMTileKey([image tile]);
+	NSUInteger cost = [RMMemoryCache costOfImage:image];
+
+	if (window != NULL && RMTileLRUPeek(window, key) == image)
+	{
+		// what the window evicts is offered to the main cache
+		offering = YES;
+		RMTileLRUSetCost(window, key, cost);
+		offering = NO;
+	}
+	else if (RMTileLRUPeek(cache, key) == image)
+	{
+		RMTileLRUSetCost(cache, key, cost);
+	}
+}
+
+-(void) tileImageDidCancelLoading: (RMTileImage*)image
+{
+	[self forgetImage:image];
 }
 
--(void) imageLoadingCancelled: (NSNotification*)notification
+-(void) tileImage: (RMTileImage*)image didFailWithError: (NSError*)error
 {
-	[self removeTile: [[notification object] tile]];
+	[self forgetImage:image];
 }
 
 -(RMTileImage*) cachedImage:(RMTile)tile
 {
-	NSNumber *key = [RMTileCache tileHash: tile];
-	RMTileImage *image = [cache objectForKey:key];
+	uint64_t key = RMTileKey(tile);
+	RMTileImage *image = nil;
+
+	if (window != NULL)
+	{
+		// misses count too: a tile asked for again and again earns its place
+		RMTileSketchIncrement(sketch, key);
+		image = (RMTileImage *)RMTileLRUGet(window, key);
+	}
+	if (image == nil)
+		image = (RMTileImage *)RMTileLRUGet(cache, key);
+
 	return image;
 }
 
-/// Remove the least-recently used image from cache, if cache is at or over capacity. Removes only 1 image.
++(NSUInteger)costOfImage: (RMTileImage*)image
+{
+	CGImageRef bitmap = (CGImageRef)[[image layer] contents];
+	if (bitmap == NULL)
+		return kRMStandardTileCost;
+
+	return CGImageGetBytesPerRow(bitmap) * CGImageGetHeight(bitmap);
+}
+
+/// Remove least-recently used images from cache until one more tile fits in the capacity and byte budget.
 -(void)makeSpaceInCache
 {
-	while ([cache count] >= capacity)
-	{
-		// Rather than scanning I would really like to be using a priority queue
-		// backed by a heap here.
-		
-		NSEnumerator *enumerator = [cache objectEnumerator];
-		RMTileImage *image;
-		
-		NSDate *oldestDate = nil;
-		RMTileImage *oldestImage = nil;
-		
-		while ((image = (RMTileImage*)[enumerator nextObject]))
-		{
-			if (oldestDate == nil
-				|| ([oldestDate timeIntervalSinceReferenceDate] > [[image lastUsedTime] timeIntervalSinceReferenceDate]))
-			{
-				oldestDate = [image lastUsedTime];
-				oldestImage = image;
-			}
-		}
-		
-		if(oldestImage) [self removeTile:[oldestImage tile]];
-	}
+	if (window != NULL)
+		RMTileLRUMakeSpace(window, kRMStandardTileCost);
+	RMTileLRUMakeSpace(cache, kRMStandardTileCost);
 }
 
 -(void)addTile: (RMTile)tile WithImage: (RMTileImage*)image
@@ -124,15 +209,72 @@
 	
 	//	RMLog(@"cache add %@", key);
 
-	[self makeSpaceInCache];
-	
-	NSNumber *key = [RMTileCache tileHash: tile];
-	[cache setObject:image forKey:key];
+	uint64_t key = RMTileKey(tile);
+	NSUInteger cost = [RMMemoryCache costOfImage:image];
+
+	// evicts as needed; the image is released again when it leaves the cache
+	if (window == NULL || RMTileLRUPeek(cache, key) != NULL)
+	{
+		RMTileLRUPut(cache, key, [image retain], cost);
+	}
+	else
+	{
+		// what the window evicts is offered to the main cache
+		RMTileLRURemove(window, key);
+		offering = YES;
+		RMTileLRUPut(window, key, [image retain], cost);
+		offering = NO;
+	}
+
+	// an image that is still loading is dropped again if it never does
+	[image addObserver:self];
 }
 
 -(void) removeAllCachedImages 
 {
-	[cache removeAllObjects];
+	if (window != NULL)
+	{
+		RMTileLRURemoveAll(window);
+		RMTileSketchClear(sketch);
+	}
+	RMTileLRURemoveAll(cache);
+}
+
+-(NSUInteger) count
+{
+	return RMTileLRUCount(cache) + (window != NULL ? RMTileLRUCount(window) : 0);
+}
+
+-(NSUInteger) cost
+{
+	return RMTileLRUCost(cache) + (window != NULL ? RMTileLRUCost(window) : 0);
+}
+
+@end
+
+@implementation RMMemoryCache (Admission)
+
+/// Moves an image the window evicted into the main cache if it is asked for more often than
+/// the image it would evict there. Lets go of it otherwise, and of images removed from the window.
+-(void)imageLeftWindow: (RMTileImage*)image forKey: (uint64_t)key
+{
+	NSUInteger cost = [RMMemoryCache costOfImage:image];
+	uint64_t victim;
+
+	if (!offering)
+	{
+		[image release];
+		return;
+	}
+
+	if (RMTileLRUVictim(cache, cost, &victim) && !RMTileSketchAdmit(sketch, key, victim))
+	{
+		admissionRejections++;
+		[image release];
+		return;
+	}
+
+	RMTileLRUPut(cache, key, image, cost);
 }
 
 @end
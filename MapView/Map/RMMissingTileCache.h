@@ -0,0 +1,71 @@
+//
+//  RMMissingTileCache.h
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#import <UIKit/UIKit.h>
+#import "RMTileCache.h"
+#import "RMTileMissSet.h"
+#import "RMTileImage.h"
+
+/*! RMMissingTileCache remembers the tiles a tile source does not have, so that they are not
+ asked for again on every pan.
+
+ A tile counts as missing when the source hands out a dummy tile for it (an RMTileImage that
+ has no image), when RMMBTilesTileSource or RMDBMapSource find no such tile in their database
+ for an RMScheduledTileImage, or when the server answers 404 for an RMWebTileImage. Later lookups of a missing tile return a
+ dummy tile straight away, without touching the other caches or the source, until the miss
+ expires after the time to live. A miss is forgotten early if the tile turns up after all.
+
+ RMTileCache puts this cache at the head of its chain. With a path, the misses are saved next to
+ the database cache when the application terminates or goes to the background, and read back
+ when the cache is created.
+ */
+@interface RMMissingTileCache : NSObject<RMTileCache, RMTileImageObserver> {
+	RMTileMissSet *misses;
+	NSString *path;
+	NSTimeInterval timeToLive;
+}
+
+/// Path of the file that keeps the misses of a tile source, next to its database cache.
++ (NSString*)pathForTileSource: (id<RMTileSource>) source usingCacheDir: (BOOL) useCacheDir;
+
+/// A nil path keeps the misses in memory only.
+-(id)initWithTimeToLive: (NSTimeInterval) theTimeToLive path: (NSString*) thePath;
+
+/// Records that the source has no such tile.
+-(void)addMissingTile: (RMTile)tile;
+/// Returns YES if the source is known not to have the tile.
+-(BOOL)isMissingTile: (RMTile)tile;
+
+/// Writes the misses to the file. Returns NO on failure or without a path.
+-(BOOL)save;
+
+@property (readonly) NSString *path;
+@property (readonly) NSTimeInterval timeToLive;
+/// Number of misses that have not expired.
+@property (readonly) NSUInteger count;
+
+@end
@@ -0,0 +1,178 @@
+//
+//  RMMissingTileCache.m
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#import "RMMissingTileCache.h"
+#import "RMDatabaseCache.h"
+#import "RMTileImage.h"
+#import "RMWebTileImage.h"
+#import "RMScheduledTileImage.h"
+
+@implementation RMMissingTileCache
+
+@synthesize path;
+@synthesize timeToLive;
+
++ (NSString*)pathForTileSource: (id<RMTileSource>) source usingCacheDir: (BOOL) useCacheDir
+{
+	/// \bug magic string literals
+	return [[RMDatabaseCache dbPathForTileSource:source usingCacheDir:useCacheDir] stringByAppendingString:@".missing"];
+}
+
+-(id)initWithTimeToLive: (NSTimeInterval) theTimeToLive path: (NSString*) thePath
+{
+	if (![super init])
+		return nil;
+
+	timeToLive = theTimeToLive;
+	misses = RMTileMissSetCreate((unsigned)theTimeToLive, time(NULL));
+	if (misses == NULL)
+	{
+		[self release];
+		return nil;
+	}
+
+	path = [thePath copy];
+	if (path != nil)
+	{
+		if (RMTileMissSetLoad(misses, [path fileSystemRepresentation], time(NULL)))
+			RMLog(@"read %u missing tiles from %@", (unsigned)RMTileMissSetCount(misses, time(NULL)), path);
+
+		[[NSNotificationCenter defaultCenter] addObserver:self
+												 selector:@selector(save)
+													 name:UIApplicationWillTerminateNotification
+												   object:nil];
+		// iOS 4 and later only
+		if (&UIApplicationDidEnterBackgroundNotification != NULL)
+			[[NSNotificationCenter defaultCenter] addObserver:self
+													 selector:@selector(save)
+														 name:UIApplicationDidEnterBackgroundNotification
+													   object:nil];
+	}
+
+	return self;
+}
+
+-(void) dealloc
+{
+	[[NSNotificationCenter defaultCenter] removeObserver:self];
+	[self save];
+	RMTileMissSetFree(misses);
+	[path release];
+	[super dealloc];
+}
+
+-(BOOL)save
+{
+	if (path == nil)
+		return NO;
+
+	@synchronized (self) {
+		return RMTileMissSetSave(misses, [path fileSystemRepresentation], time(NULL)) != 0;
+	}
+}
+
+-(void)addMissingTile: (RMTile)tile
+{
+	@synchronized (self) {
+		if (!RMTileMissSetAdd(misses, tile, time(NULL)))
+			RMLog(@"out of memory for missing tiles");
+	}
+}
+
+-(BOOL)isMissingTile: (RMTile)tile
+{
+	@synchronized (self) {
+		return RMTileMissSetContains(misses, tile, time(NULL)) != 0;
+	}
+}
+
+-(NSUInteger)count
+{
+	@synchronized (self) {
+		return RMTileMissSetCount(misses, time(NULL));
+	}
+}
+
+-(RMTileImage*) cachedImage:(RMTile)tile
+{
+	if (![self isMissingTile:tile])
+		return nil;
+
+	return [RMTileImage dummyTile:tile];
+}
+
+-(void)addTile: (RMTile)tile WithImage: (RMTileImage*)image
+{
+	if (image == nil)
+		return;
+
+	// dummy tiles are plain RMTileImages without an image
+	if ([image isMemberOfClass:[RMTileImage class]] && ![image isLoaded])
+	{
+		[self addMissingTile:tile];
+		return;
+	}
+
+	// a scheduled tile read on the spot already knows
+	if ([image isKindOfClass:[RMScheduledTileImage class]] && [(RMScheduledTileImage*)image isMissing])
+	{
+		[self addMissingTile:tile];
+		return;
+	}
+
+	@synchronized (self) {
+		RMTileMissSetRemove(misses, tile);
+	}
+
+	// web and scheduled tiles only find out whether the source has them later on
+	if (([image isKindOfClass:[RMWebTileImage class]] || [image isKindOfClass:[RMScheduledTileImage class]]) && ![image isLoaded])
+		[image addObserver:self];
+}
+
+-(void) tileImage: (RMTileImage*)image didFailWithError: (NSError*)error
+{
+	if ([[error domain] isEqualToString:RMWebTileImageErrorDomain] && [error code] == RMWebTileImageErrorNotFoundResponse)
+		[self addMissingTile:[image tile]];
+	else if ([[error domain] isEqualToString:RMScheduledTileImageErrorDomain] && [error code] == RMScheduledTileImageErrorNotFound)
+		[self addMissingTile:[image tile]];
+}
+
+-(void)didReceiveMemoryWarning
+{
+	// a few bytes per miss, and dropping them would cost requests to the source
+}
+
+-(void)removeAllCachedImages
+{
+	@synchronized (self) {
+		RMTileMissSetRemoveAll(misses);
+	}
+	if (path != nil)
+		[[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+}
+
+@end
@@ -50,7 +50,8 @@ NS_INLINE RMLatLong RMPixelPointAsLatLong(RMProjectedPoint xypoint) {
 	if (![super init])
 		return nil;
 	
-	internalProjection = pj_init_plus([params UTF8String]);
+	// projections are shared between instances with the same definition
+	internalProjection = pj_init_plus_cached([params UTF8String]);
 	if (internalProjection == NULL)
 	{
 		RMLog(@"Unhandled error creating projection. String is %@", params);
@@ -80,7 +81,7 @@ NS_INLINE RMLatLong RMPixelPointAsLatLong(RMProjectedPoint xypoint) {
 -(void)dealloc
 {
 	if (internalProjection)
-		pj_free(internalProjection);
+		pj_free_cached(internalProjection);
 	
 	[super dealloc];
 }
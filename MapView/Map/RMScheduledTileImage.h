@@ -0,0 +1,73 @@
+//
+//  RMScheduledTileImage.h
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#import <Foundation/Foundation.h>
+#import "RMTileImage.h"
+#import "RMTileScheduler.h"
+
+extern NSString *RMScheduledTileImageErrorDomain;
+enum {
+	/// the reader has no data for the tile
+	RMScheduledTileImageErrorNotFound
+};
+
+/// Reads the data of tiles for RMScheduledTileImage, on the scheduler's worker threads.
+@protocol RMTileDataReader<NSObject>
+/// Returns the image data of the tile, or nil if there is none. Must be thread safe.
+-(NSData*) tileData: (RMTile) tile;
+@end
+
+/*! RMTileImage subclass: a tile image read in the background by a shared RMTileScheduler.
+
+ Creating one returns at once; the data is read on a worker thread, most urgent tiles first, and
+ the image is updated and its observers called back on the main thread. Cancelling an image that
+ is still queued takes it off the queue, so tiles that went off screen are never read. Requests
+ are kept apart by reader, so sources that show the same tile, like an overlay or a second map
+ view, each have theirs read in the background.
+ */
+@interface RMScheduledTileImage : RMTileImage {
+	id<RMTileDataReader> reader;
+	/// waiting in the scheduler, which holds a reference to the image until it is done
+	BOOL queued;
+	BOOL cancelled;
+	BOOL missing;
+}
+
+-(id) initWithTile: (RMTile) tile reader: (id<RMTileDataReader>) reader;
+
+/// YES once the reader has returned no data for the tile, which fails the image with
+/// RMScheduledTileImageErrorNotFound.
+-(BOOL) isMissing;
+
+/// The scheduler shared by all scheduled images.
++(RMTileScheduler*) scheduler;
+
+/// Reads the tiles of the reader nearest to the centre of rect first, and those of its zoom level
+/// before others. Every reader has its own focus.
++(void) focusOnTileRect: (RMTileRect) rect forReader: (id<RMTileDataReader>) reader;
+
+@end
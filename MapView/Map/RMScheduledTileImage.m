@@ -0,0 +1,178 @@
+//
+//  RMScheduledTileImage.m
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#import "RMScheduledTileImage.h"
+
+/// Workers reading tiles at once. Each source serializes the reads from its database, so a second
+/// worker helps when the tiles of more than one source are on screen, as with overlays.
+static const unsigned kRMScheduledTileImageWorkers = 2;
+
+NSString *RMScheduledTileImageErrorDomain = @"RMScheduledTileImageErrorDomain";
+
+static RMTileScheduler *sharedScheduler = NULL;
+
+@interface RMScheduledTileImage (Loading)
+-(NSData*) readData;
+-(void) finishLoadingWithData: (NSData*) data;
+@end
+
+static void RMScheduledTileImageWork(void *context, RMTile tile, void *request)
+{
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	RMScheduledTileImage *image = (RMScheduledTileImage *)request;
+	NSData *data = [image readData];
+
+	// retains the image until it has finished on the main thread
+	[image performSelectorOnMainThread:@selector(finishLoadingWithData:) withObject:data waitUntilDone:NO];
+	[image release];
+	[pool release];
+}
+
+static void RMScheduledTileImageDrop(void *context, RMTile tile, void *request)
+{
+	RMScheduledTileImage *image = (RMScheduledTileImage *)request;
+
+	[image performSelectorOnMainThread:@selector(cancelLoading) withObject:nil waitUntilDone:NO];
+	[image release];
+}
+
+@implementation RMScheduledTileImage
+
++(RMTileScheduler*) scheduler
+{
+	@synchronized ([RMScheduledTileImage class]) {
+		if (sharedScheduler == NULL)
+			sharedScheduler = RMTileSchedulerCreate(kRMScheduledTileImageWorkers, RMScheduledTileImageWork, RMScheduledTileImageDrop, NULL);
+	}
+	return sharedScheduler;
+}
+
++(void) focusOnTileRect: (RMTileRect) rect forReader: (id<RMTileDataReader>) reader
+{
+	RMTileScheduler *scheduler = [self scheduler];
+
+	if (scheduler != NULL)
+		RMTileSchedulerSetFocus(scheduler, reader, rect.origin.tile.zoom,
+								rect.origin.tile.x + rect.origin.offset.x + rect.size.width / 2,
+								rect.origin.tile.y + rect.origin.offset.y + rect.size.height / 2);
+}
+
+-(id) initWithTile: (RMTile) _tile reader: (id<RMTileDataReader>) _reader
+{
+	RMTileScheduler *scheduler;
+
+	if (![super initWithTile:_tile])
+		return nil;
+
+	reader = [_reader retain];
+	queued = NO;
+	cancelled = NO;
+	missing = NO;
+
+	[[NSNotificationCenter defaultCenter] postNotificationName:RMTileRequested object:self];
+
+	scheduler = [RMScheduledTileImage scheduler];
+	[self retain];
+	if (scheduler != NULL && RMTileSchedulerSubmit(scheduler, reader, tile, [RMTileImage isPrefetching] ? RMTileRequestPrefetch : RMTileRequestVisible, self))
+	{
+		queued = YES;
+	}
+	else
+	{
+		// another image of the tile from the same reader is being read, or there are no workers:
+		// read it here
+		[self release];
+		[self finishLoadingWithData:[self readData]];
+	}
+
+	return self;
+}
+
+-(void) dealloc
+{
+	[reader release];
+	reader = nil;
+	[super dealloc];
+}
+
+-(NSData*) readData
+{
+	return [reader tileData:tile];
+}
+
+-(void) finishLoadingWithData: (NSData*) data
+{
+	queued = NO;
+	if (cancelled)
+		return;
+
+	[[NSNotificationCenter defaultCenter] postNotificationName:RMTileRetrieved object:self];
+
+	if (data != nil)
+	{
+		[self updateImageUsingData:data];
+		return;
+	}
+
+	missing = YES;
+	[self failWithError:[NSError errorWithDomain:RMScheduledTileImageErrorDomain
+											code:RMScheduledTileImageErrorNotFound
+										userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+												  NSLocalizedString(@"The tile source has no such tile", @""), NSLocalizedDescriptionKey, nil]]];
+}
+
+-(BOOL) isMissing
+{
+	return missing;
+}
+
+-(void) prioritize
+{
+	// promotes the request while it is queued, and does nothing once it runs
+	if (queued && !cancelled)
+		RMTileSchedulerSubmit(sharedScheduler, reader, tile, RMTileRequestVisible, self);
+}
+
+-(void) cancelLoading
+{
+	if (queued && !cancelled)
+	{
+		cancelled = YES;
+		[[NSNotificationCenter defaultCenter] postNotificationName:RMTileRetrieved object:self];
+
+		// a running read finishes, and is ignored
+		if (RMTileSchedulerCancel(sharedScheduler, reader, tile, self))
+		{
+			queued = NO;
+			[self autorelease];
+		}
+	}
+
+	[super cancelLoading];
+}
+
+@end
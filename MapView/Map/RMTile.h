@@ -28,7 +28,15 @@
 #ifndef _TILE_H_
 #define _TILE_H_
 
+#ifdef __APPLE__
 #include <CoreGraphics/CGGeometry.h>
+#else
+// Just what the tile structures need, so the plain C parts build elsewhere, like the benchmarks on Linux.
+typedef double CGFloat;
+typedef struct { CGFloat x, y; } CGPoint;
+typedef struct { CGFloat width, height; } CGSize;
+static const CGPoint CGPointZero = { 0, 0 };
+#endif
 //#include <Quartz/Quartz.h>
 #include <stdint.h>
 /*! \file RMTile.h
@@ -0,0 +1,372 @@
+//
+//  RMTileBitmapCache.c
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+#include "RMTileBitmapCache.h"
+#include "RMTileLRU.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+typedef struct RMTileBitmapSizeClass RMTileBitmapSizeClass;
+typedef struct RMTileBitmapSlab RMTileBitmapSlab;
+
+typedef struct RMTileBitmapBlock {
+	RMTileBitmapSlab *slab;
+	unsigned char *pixels;
+	unsigned width, height;
+	size_t rowBytes;
+	RMTilePixelFormat format;
+	unsigned pins;			// one for the cache while the block is in it, one per bitmap handed out
+	struct RMTileBitmapBlock *nextFree;
+} RMTileBitmapBlock;
+
+struct RMTileBitmapSlab {
+	RMTileBitmapSizeClass *sizeClass;
+	RMTileBitmapSlab *next;
+	unsigned used, count;
+	unsigned char *memory;
+	RMTileBitmapBlock blocks[1];	// count of them
+};
+
+// All slabs of one block size.
+struct RMTileBitmapSizeClass {
+	RMTileBitmapCache *cache;
+	size_t blockSize;
+	RMTileBitmapSlab *slabs;
+	RMTileBitmapBlock *free;
+	unsigned emptySlabs;
+	RMTileBitmapSizeClass *next;
+};
+
+struct RMTileBitmapCache {
+	pthread_mutex_t lock;		// everything below
+	RMTileLRU *lru;
+	RMTileBitmapSizeClass *sizeClasses;
+	size_t byteBudget;
+	size_t slabBytes;
+	size_t blocks;			// blocks in use, cached or pinned
+	int freed;			// waiting for the last pinned block
+};
+
+#define kRMTileBitmapSlabBytes (1024 * 1024)
+#define kRMTileBitmapAlignment 64
+
+// RMTileKey() leaves the top bit to zoom levels over 127, which tile sources do not have.
+static uint64_t RMTileBitmapCacheKey(uint64_t key, RMTilePixelFormat format)
+{
+	return key ^ ((uint64_t)format << 63);
+}
+
+static void RMTileBitmapCacheDestroy(RMTileBitmapCache *cache)
+{
+	RMTileBitmapSizeClass *sizeClass, *nextClass;
+	RMTileBitmapSlab *slab, *nextSlab;
+
+	RMTileLRUFree(cache->lru);
+	for (sizeClass = cache->sizeClasses; sizeClass != NULL; sizeClass = nextClass)
+	{
+		nextClass = sizeClass->next;
+		for (slab = sizeClass->slabs; slab != NULL; slab = nextSlab)
+		{
+			nextSlab = slab->next;
+			free(slab->memory);
+			free(slab);
+		}
+		free(sizeClass);
+	}
+	pthread_mutex_destroy(&cache->lock);
+	free(cache);
+}
+
+// Frees a slab none of whose blocks is in use. Called with the lock held.
+static void RMTileBitmapSlabFree(RMTileBitmapSlab *slab)
+{
+	RMTileBitmapSizeClass *sizeClass = slab->sizeClass;
+	RMTileBitmapSlab **link;
+	RMTileBitmapBlock **freeLink;
+
+	for (link = &sizeClass->slabs; *link != slab; link = &(*link)->next)
+		;
+	*link = slab->next;
+
+	for (freeLink = &sizeClass->free; *freeLink != NULL; )
+	{
+		if ((*freeLink)->slab == slab)
+			*freeLink = (*freeLink)->nextFree;
+		else
+			freeLink = &(*freeLink)->nextFree;
+	}
+
+	sizeClass->cache->slabBytes -= sizeClass->blockSize * slab->count;
+	free(slab->memory);
+	free(slab);
+}
+
+// Takes a free block of the given size, adding a slab if there is none. Called with the lock held.
+static RMTileBitmapBlock *RMTileBitmapBlockAllocate(RMTileBitmapCache *cache, size_t blockSize)
+{
+	RMTileBitmapSizeClass *sizeClass;
+	RMTileBitmapBlock *block;
+
+	for (sizeClass = cache->sizeClasses; sizeClass != NULL && sizeClass->blockSize != blockSize; sizeClass = sizeClass->next)
+		;
+	if (sizeClass == NULL)
+	{
+		sizeClass = calloc(1, sizeof(RMTileBitmapSizeClass));
+		if (sizeClass == NULL)
+			return NULL;
+		sizeClass->cache = cache;
+		sizeClass->blockSize = blockSize;
+		sizeClass->next = cache->sizeClasses;
+		cache->sizeClasses = sizeClass;
+	}
+
+	if (sizeClass->free == NULL)
+	{
+		unsigned count = blockSize >= kRMTileBitmapSlabBytes ? 1 : (unsigned)(kRMTileBitmapSlabBytes / blockSize), i;
+		RMTileBitmapSlab *slab = malloc(sizeof(RMTileBitmapSlab) + (count - 1) * sizeof(RMTileBitmapBlock));
+		if (slab == NULL)
+			return NULL;
+		slab->memory = malloc(blockSize * count);
+		if (slab->memory == NULL)
+		{
+			free(slab);
+			return NULL;
+		}
+		slab->sizeClass = sizeClass;
+		slab->used = 0;
+		slab->count = count;
+		slab->next = sizeClass->slabs;
+		sizeClass->slabs = slab;
+		sizeClass->emptySlabs++;
+		cache->slabBytes += blockSize * count;
+
+		for (i = count; i-- > 0; )
+		{
+			slab->blocks[i].slab = slab;
+			slab->blocks[i].pixels = slab->memory + blockSize * i;
+			slab->blocks[i].nextFree = sizeClass->free;
+			sizeClass->free = &slab->blocks[i];
+		}
+	}
+
+	block = sizeClass->free;
+	sizeClass->free = block->nextFree;
+	if (block->slab->used++ == 0)
+		sizeClass->emptySlabs--;
+	block->pins = 1;
+	cache->blocks++;
+	return block;
+}
+
+// Drops a pin, putting the block back on the free list after the last one. Empty slabs are
+// freed, except for one per block size. Called with the lock held.
+static void RMTileBitmapBlockUnpin(RMTileBitmapBlock *block)
+{
+	RMTileBitmapSlab *slab = block->slab;
+	RMTileBitmapSizeClass *sizeClass = slab->sizeClass;
+
+	if (--block->pins > 0)
+		return;
+
+	block->nextFree = sizeClass->free;
+	sizeClass->free = block;
+	sizeClass->cache->blocks--;
+
+	if (--slab->used == 0)
+	{
+		if (sizeClass->emptySlabs > 0)
+			RMTileBitmapSlabFree(slab);
+		else
+			sizeClass->emptySlabs++;
+	}
+}
+
+static void RMTileBitmapCacheEvicted(void *context, uint64_t key, void *value)
+{
+	RMTileBitmapBlockUnpin(value);
+}
+
+static void RMTileBitmapFill(RMTileBitmap *bitmap, RMTileBitmapBlock *block)
+{
+	bitmap->pixels = block->pixels;
+	bitmap->width = block->width;
+	bitmap->height = block->height;
+	bitmap->rowBytes = block->rowBytes;
+	bitmap->format = block->format;
+	bitmap->handle = block;
+}
+
+RMTileBitmapCache *RMTileBitmapCacheCreate(size_t byteBudget)
+{
+	RMTileBitmapCache *cache = calloc(1, sizeof(RMTileBitmapCache));
+	if (cache == NULL)
+		return NULL;
+
+	cache->byteBudget = byteBudget;
+	cache->lru = RMTileLRUCreate(byteBudget, 0, RMTileBitmapCacheEvicted, cache);
+	if (cache->lru == NULL || pthread_mutex_init(&cache->lock, NULL) != 0)
+	{
+		RMTileLRUFree(cache->lru);
+		free(cache);
+		return NULL;
+	}
+	return cache;
+}
+
+void RMTileBitmapCacheFree(RMTileBitmapCache *cache)
+{
+	int destroy;
+
+	if (cache == NULL)
+		return;
+
+	pthread_mutex_lock(&cache->lock);
+	cache->freed = 1;
+	RMTileLRURemoveAll(cache->lru);
+	destroy = cache->blocks == 0;
+	pthread_mutex_unlock(&cache->lock);
+
+	if (destroy)
+		RMTileBitmapCacheDestroy(cache);
+}
+
+int RMTileBitmapCacheGet(RMTileBitmapCache *cache, uint64_t key, RMTilePixelFormat format, RMTileBitmap *bitmap)
+{
+	RMTileBitmapBlock *block;
+
+	pthread_mutex_lock(&cache->lock);
+	block = RMTileLRUGet(cache->lru, RMTileBitmapCacheKey(key, format));
+	if (block != NULL)
+	{
+		block->pins++;
+		RMTileBitmapFill(bitmap, block);
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return block != NULL;
+}
+
+int RMTileBitmapCacheDecode(RMTileBitmapCache *cache, uint64_t key, RMTilePixelFormat format, const void *data, size_t length, RMTileBitmap *bitmap)
+{
+	RMTileBitmapBlock *block;
+	unsigned width, height;
+	size_t rowBytes, blockSize;
+
+	if (!RMTileDecoderImageSize(data, length, &width, &height))
+		return 0;
+
+	rowBytes = width * RMTilePixelFormatBytesPerPixel(format);
+	blockSize = (rowBytes * height + kRMTileBitmapAlignment - 1) & ~(size_t)(kRMTileBitmapAlignment - 1);
+	if (blockSize > cache->byteBudget)
+		return 0;
+
+	// evict first, so the block of the least recently used tile is the one reused
+	pthread_mutex_lock(&cache->lock);
+	RMTileLRUMakeSpace(cache->lru, blockSize);
+	block = RMTileBitmapBlockAllocate(cache, blockSize);
+	pthread_mutex_unlock(&cache->lock);
+	if (block == NULL)
+		return 0;
+
+	block->width = width;
+	block->height = height;
+	block->rowBytes = rowBytes;
+	block->format = format;
+
+	// the block is ours alone until it goes into the cache, so decode without the lock
+	if (!RMTileDecoderDecode(data, length, format, block->pixels, rowBytes))
+	{
+		pthread_mutex_lock(&cache->lock);
+		RMTileBitmapBlockUnpin(block);
+		pthread_mutex_unlock(&cache->lock);
+		return 0;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	if (!cache->freed)
+	{
+		block->pins++;
+		// a block that does not fit comes straight back through RMTileBitmapCacheEvicted()
+		RMTileLRUPut(cache->lru, RMTileBitmapCacheKey(key, format), block, blockSize);
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	RMTileBitmapFill(bitmap, block);
+	return 1;
+}
+
+void RMTileBitmapRelease(void *handle)
+{
+	RMTileBitmapBlock *block = handle;
+	RMTileBitmapCache *cache;
+	int destroy;
+
+	if (block == NULL)
+		return;
+	cache = block->slab->sizeClass->cache;
+
+	pthread_mutex_lock(&cache->lock);
+	RMTileBitmapBlockUnpin(block);
+	destroy = cache->freed && cache->blocks == 0;
+	pthread_mutex_unlock(&cache->lock);
+
+	if (destroy)
+		RMTileBitmapCacheDestroy(cache);
+}
+
+void RMTileBitmapCacheRemoveAll(RMTileBitmapCache *cache)
+{
+	pthread_mutex_lock(&cache->lock);
+	RMTileLRURemoveAll(cache->lru);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+size_t RMTileBitmapCacheCount(RMTileBitmapCache *cache)
+{
+	size_t count;
+	pthread_mutex_lock(&cache->lock);
+	count = RMTileLRUCount(cache->lru);
+	pthread_mutex_unlock(&cache->lock);
+	return count;
+}
+
+size_t RMTileBitmapCacheCost(RMTileBitmapCache *cache)
+{
+	size_t cost;
+	pthread_mutex_lock(&cache->lock);
+	cost = RMTileLRUCost(cache->lru);
+	pthread_mutex_unlock(&cache->lock);
+	return cost;
+}
+
+size_t RMTileBitmapCacheSlabBytes(RMTileBitmapCache *cache)
+{
+	size_t bytes;
+	pthread_mutex_lock(&cache->lock);
+	bytes = cache->slabBytes;
+	pthread_mutex_unlock(&cache->lock);
+	return bytes;
+}
@@ -0,0 +1,86 @@
+//
+//  RMTileBitmapCache.h
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+#ifndef _RMTILEBITMAPCACHE_H_
+#define _RMTILEBITMAPCACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "RMTileDecoder.h"
+
+/*! \file RMTileBitmapCache.h
+ */
+/*! \struct RMTileBitmapCache
+ \brief Decoded tile bitmaps, keyed by tile and pixel format, under a byte budget.
+
+ The bitmaps live in blocks cut from slabs of about a megabyte, one kind of slab per block
+ size, so tiles of the usual size are recycled in place rather than going through malloc, and
+ the memory of a slab goes back to the system once all its blocks are free again (one empty
+ slab per block size is kept for the next tile). The least recently used bitmaps are evicted
+ when the blocks in the cache go over the byte budget.
+
+ A bitmap handed out is pinned: its block stays valid, even after it has been evicted or the
+ cache freed, until RMTileBitmapRelease(), so the pixels can back a CGImage directly. Pinned
+ blocks left the cache do not count against the budget.
+
+ Plain C without any framework dependency; thread safe. RMTileBitmapRelease() in particular
+ may be called from any thread.
+ */
+typedef struct RMTileBitmapCache RMTileBitmapCache;
+
+typedef struct {
+	const void *pixels;
+	unsigned width, height;
+	size_t rowBytes;
+	RMTilePixelFormat format;
+	void *handle;			// for RMTileBitmapRelease()
+} RMTileBitmap;
+
+/// Creates an empty cache. Returns NULL if out of memory.
+RMTileBitmapCache *RMTileBitmapCacheCreate(size_t byteBudget);
+/// Frees the cache. Pinned bitmaps stay valid until they are released.
+void RMTileBitmapCacheFree(RMTileBitmapCache *cache);
+
+/// Looks up the bitmap of a tile (by RMTileKey()) in a format and pins it. Returns 0 if it is
+/// not cached.
+int RMTileBitmapCacheGet(RMTileBitmapCache *cache, uint64_t key, RMTilePixelFormat format, RMTileBitmap *bitmap);
+/// Decodes tile data with RMTileDecoderDecode() into a new block, caches and pins it. Returns 0,
+/// caching nothing, if the decoder does not handle the data or there is no memory.
+int RMTileBitmapCacheDecode(RMTileBitmapCache *cache, uint64_t key, RMTilePixelFormat format, const void *data, size_t length, RMTileBitmap *bitmap);
+/// Unpins a bitmap from RMTileBitmapCacheGet() or RMTileBitmapCacheDecode().
+void RMTileBitmapRelease(void *handle);
+
+/// Evicts all bitmaps.
+void RMTileBitmapCacheRemoveAll(RMTileBitmapCache *cache);
+
+/// Number of cached bitmaps.
+size_t RMTileBitmapCacheCount(RMTileBitmapCache *cache);
+/// Bytes of the blocks of the cached bitmaps.
+size_t RMTileBitmapCacheCost(RMTileBitmapCache *cache);
+/// Bytes of all slabs, with pinned, free and spare blocks.
+size_t RMTileBitmapCacheSlabBytes(RMTileBitmapCache *cache);
+
+#endif
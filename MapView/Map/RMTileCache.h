@@ -34,6 +34,8 @@
 typedef enum {
 	RMCachePurgeStrategyLRU,
 	RMCachePurgeStrategyFIFO,
+	/// CLOCK over coarse time buckets: hits set a reference bit instead of rewriting zlastUsed
+	RMCachePurgeStrategyClock,
 } RMCachePurgeStrategy;
 
 
@@ -52,9 +54,36 @@ typedef enum {
 @end
 
 
+/// What one tier of an RMTileCache has seen since its statistics were last reset.
+typedef struct {
+	/// lookups the tier answered
+	unsigned long long hits;
+	/// lookups passed on to the next tier
+	unsigned long long misses;
+	/// images copied into the tier after a hit further down
+	unsigned long long promotions;
+	/// time spent looking up tiles in the tier, in seconds
+	double seconds;
+} RMTileCacheTierStatistics;
+
+typedef struct {
+	RMTileCacheTierStatistics statistics;
+	BOOL promoteHits;
+} RMTileCacheTier;
+
+/*! RMTileCache chains the caches configured in the cacheConfiguration of routeme.plist, fastest
+ first. A lookup goes down the chain until a cache has the tile. The image is then copied into
+ every cache above it that has "promote" set, which by default is the memory cache, so a tile
+ read from the database is found in memory next time.
+
+ New tiles are added to every cache. The memory cache may turn them away with TinyLFU admission,
+ and the database cache writes them on a thread of its own.
+ */
 @interface RMTileCache : NSObject<RMTileCache>
 {
 	NSMutableArray *caches;
+	/// one for every cache, in the same order
+	RMTileCacheTier *tiers;
 }
 
 -(id)initWithTileSource: (id<RMTileSource>) tileSource;
@@ -63,14 +92,22 @@ typedef enum {
 
 /// Add tile to cache
 /*! 
- \bug Calls -makeSpaceInCache for every tile/image addition. -makeSpaceInCache does a linear scan of its contents at each call.
-
  \bug Since RMTileImage has an RMTile ivar, this API should be simplified to just -addImage:.
  */
 -(void)addTile: (RMTile)tile WithImage: (RMTileImage*)image;
 
 /// Add another cache to the chain
 -(void)addCache: (id<RMTileCache>)cache;
+/// Add another cache to the end of the chain, into which hits further down are copied if promoteHits.
+-(void)addCache: (id<RMTileCache>)cache promoteHits: (BOOL)promoteHits;
+
+/// Number of caches in the chain.
+@property (readonly) NSUInteger tierCount;
+/// The cache at a position of the chain, 0 being the first asked.
+-(id<RMTileCache>)cacheAtTier: (NSUInteger)tier;
+/// Hits, misses, promotions and lookup time of a cache of the chain.
+-(RMTileCacheTierStatistics)statisticsForTier: (NSUInteger)tier;
+-(void)resetStatistics;
 
 -(void)didReceiveMemoryWarning;
 
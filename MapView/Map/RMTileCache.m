@@ -29,16 +29,29 @@
 
 #import "RMMemoryCache.h"
 #import "RMDatabaseCache.h"
+#import "RMMissingTileCache.h"
+#import "RMDecodedTileCache.h"
+#import "RMTileCacheDAO.h"
 
 #import "RMConfiguration.h"
 
 #import "RMTileSource.h"
 
 
+@interface RMTileCache ( Tiers )
+
+-(void)insertCache: (id<RMTileCache>)cache atTier: (NSUInteger)tier promoteHits: (BOOL)promoteHits;
+-(void)promoteImage: (RMTileImage*)image ofTile: (RMTile)tile aboveTier: (NSUInteger)tier;
+
+@end
+
+
 @interface RMTileCache ( Configuration ) 
 
 - (id<RMTileCache>) newMemoryCacheWithConfig: (NSDictionary*) cfg;
 - (id<RMTileCache>) newDatabaseCacheWithConfig: (NSDictionary*) cfg tileSource: (id<RMTileSource>) tileSource;
+- (id<RMTileCache>) newMissingTileCacheWithConfig: (NSDictionary*) cfg tileSource: (id<RMTileSource>) tileSource;
+- (id<RMTileCache>) newDecodedTileCacheWithConfig: (NSDictionary*) cfg;
 
 @end
 
@@ -51,6 +64,7 @@
 		return nil;
 	
 	caches = [[NSMutableArray alloc] init];
+	tiers = NULL;
 
 	id cacheCfg = [[RMConfiguration configuration] cacheConfiguration];
 	
@@ -58,7 +72,9 @@
 	{
 		cacheCfg = [NSArray arrayWithObjects:
 					/// \bug magic string literals
+			[NSDictionary dictionaryWithObject: @"missing-cache" forKey: @"type"],
 			[NSDictionary dictionaryWithObject: @"memory-cache" forKey: @"type"],
+			[NSDictionary dictionaryWithObject: @"decoded-cache" forKey: @"type"],
 			[NSDictionary dictionaryWithObject: @"db-cache"     forKey: @"type"],
 			nil
 		];
@@ -78,8 +94,23 @@
 			if ([@"db-cache" isEqualToString: type]) 
 				newCache = [self newDatabaseCacheWithConfig: cfg tileSource: tileSource];				
 
+			if ([@"missing-cache" isEqualToString: type]) 
+				newCache = [self newMissingTileCacheWithConfig: cfg tileSource: tileSource];
+
+			if ([@"decoded-cache" isEqualToString: type]) 
+				newCache = [self newDecodedTileCacheWithConfig: cfg];
+
 			if (newCache) {
-				[caches addObject: newCache];
+				// hits further down are copied into memory, unless configured otherwise
+				BOOL promoteHits = [newCache isKindOfClass:[RMMemoryCache class]];
+				NSNumber* promoteNumber = [cfg objectForKey:@"promote"];
+				if (promoteNumber != nil) promoteHits = [promoteNumber boolValue];
+
+				// known misses are answered before any other cache or the source is asked
+				if ([newCache isKindOfClass:[RMMissingTileCache class]])
+					[self insertCache: newCache atTier: 0 promoteHits: promoteHits];
+				else
+					[self insertCache: newCache atTier: [caches count] promoteHits: promoteHits];
 				[newCache release];
 			} else {
 				RMLog(@"failed to create cache of type %@", type);
@@ -90,18 +121,67 @@
 		}
 				
 	}
+
+	// database hits are decoded through the first decoded tile cache
+	RMDecodedTileCache *decodedCache = nil;
+	for (id<RMTileCache> cache in caches)
+	{
+		if (decodedCache == nil && [cache isKindOfClass:[RMDecodedTileCache class]])
+			decodedCache = (RMDecodedTileCache*)cache;
+	}
+	for (id<RMTileCache> cache in caches)
+	{
+		if ([cache isKindOfClass:[RMDatabaseCache class]])
+			[(RMDatabaseCache*)cache setDecodedTileCache: decodedCache];
+	}
+
 	return self;
 }
 
 -(void) dealloc
 {
 	[caches release];
+	free(tiers);
 	[super dealloc];
 }
 
 -(void)addCache: (id<RMTileCache>)cache
 {
-	[caches addObject:cache];
+	[self addCache:cache promoteHits:NO];
+}
+
+-(void)addCache: (id<RMTileCache>)cache promoteHits: (BOOL)promoteHits
+{
+	[self insertCache:cache atTier:[caches count] promoteHits:promoteHits];
+}
+
+-(NSUInteger) tierCount
+{
+	return [caches count];
+}
+
+-(id<RMTileCache>)cacheAtTier: (NSUInteger)tier
+{
+	return [caches objectAtIndex:tier];
+}
+
+-(RMTileCacheTierStatistics)statisticsForTier: (NSUInteger)tier
+{
+	RMTileCacheTierStatistics statistics;
+
+	NSAssert(tier < [caches count], @"no such tier");
+	@synchronized (self) {
+		statistics = tiers[tier].statistics;
+	}
+	return statistics;
+}
+
+-(void)resetStatistics
+{
+	@synchronized (self) {
+		for (NSUInteger i = 0; i < [caches count]; i++)
+			memset(&tiers[i].statistics, 0, sizeof(RMTileCacheTierStatistics));
+	}
 }
 
 +(NSNumber*) tileHash: (RMTile)tile
@@ -112,11 +192,27 @@
 // Returns the cached image if it exists. nil otherwise.
 -(RMTileImage*) cachedImage:(RMTile)tile
 {
-	for (id<RMTileCache> cache in caches)
+	NSUInteger count = [caches count];
+
+	for (NSUInteger i = 0; i < count; i++)
 	{
-		RMTileImage *image = [cache cachedImage:tile];
+		CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+		RMTileImage *image = [[caches objectAtIndex:i] cachedImage:tile];
+		CFAbsoluteTime elapsed = CFAbsoluteTimeGetCurrent() - start;
+
+		@synchronized (self) {
+			tiers[i].statistics.seconds += elapsed;
+			if (image != nil)
+				tiers[i].statistics.hits++;
+			else
+				tiers[i].statistics.misses++;
+		}
+
 		if (image != nil)
+		{
+			[self promoteImage:image ofTile:tile aboveTier:i];
 			return image;
+		}
 	}
 	
 	return nil;
@@ -151,6 +247,46 @@
 }
 @end
 
+@implementation RMTileCache ( Tiers )
+
+-(void)insertCache: (id<RMTileCache>)cache atTier: (NSUInteger)tier promoteHits: (BOOL)promoteHits
+{
+	@synchronized (self) {
+		NSUInteger count = [caches count];
+		RMTileCacheTier *grown = realloc(tiers, (count + 1) * sizeof(RMTileCacheTier));
+
+		if (grown == NULL)
+		{
+			RMLog(@"out of memory adding cache %@", cache);
+			return;
+		}
+		tiers = grown;
+
+		memmove(&tiers[tier + 1], &tiers[tier], (count - tier) * sizeof(RMTileCacheTier));
+		memset(&tiers[tier], 0, sizeof(RMTileCacheTier));
+		tiers[tier].promoteHits = promoteHits;
+		[caches insertObject:cache atIndex:tier];
+	}
+}
+
+-(void)promoteImage: (RMTileImage*)image ofTile: (RMTile)tile aboveTier: (NSUInteger)tier
+{
+	for (NSUInteger i = 0; i < tier; i++)
+	{
+		id<RMTileCache> cache = [caches objectAtIndex:i];
+
+		if (!tiers[i].promoteHits || ![cache respondsToSelector:@selector(addTile:WithImage:)])
+			continue;
+
+		[cache addTile:tile WithImage:image];
+		@synchronized (self) {
+			tiers[i].statistics.promotions++;
+		}
+	}
+}
+
+@end
+
 @implementation RMTileCache ( Configuration )
 
 /// \bug magic numbers and strings
@@ -158,7 +294,33 @@
 {
 	NSNumber* capacity = [cfg objectForKey:@"capacity"];
 	if (capacity == nil) capacity = [NSNumber numberWithInt: 32];
-	return [[RMMemoryCache alloc] initWithCapacity: [capacity intValue]];	
+
+	// bytes of decoded bitmaps; 0 or absent limits by tile count only
+	NSNumber* byteBudget = [cfg objectForKey:@"byteBudget"];
+	NSUInteger budget = 0;
+	if (byteBudget != nil) {
+		if ([byteBudget intValue] >= 0)
+			budget = [byteBudget unsignedIntValue];
+		else
+			RMLog(@"illegal value for byteBudget: %d", [byteBudget intValue]);
+	}
+
+	// W-TinyLFU by default, with the lookup counts aging every twenty times the capacity
+	NSUInteger sampleSize = 20 * MAX([capacity intValue], 1);
+	NSNumber* sampleSizeNumber = [cfg objectForKey:@"admissionSampleSize"];
+	if (sampleSizeNumber != nil) {
+		if ([sampleSizeNumber intValue] > 0)
+			sampleSize = [sampleSizeNumber unsignedIntValue];
+		else
+			RMLog(@"illegal value for admissionSampleSize: %d", [sampleSizeNumber intValue]);
+	}
+	NSString* admission = [cfg objectForKey:@"admission"];
+	if (admission != nil) {
+		if ([admission caseInsensitiveCompare:@"none"] == NSOrderedSame) sampleSize = 0;
+		else if ([admission caseInsensitiveCompare:@"TinyLFU"] != NSOrderedSame) RMLog(@"unknown admission %@", admission);
+	}
+
+	return [[RMMemoryCache alloc] initWithCapacity: [capacity intValue] byteBudget: budget admissionSampleSize: sampleSize];
 }
 
 /// \bug magic numbers and strings
@@ -186,6 +348,7 @@
 	if (strategyStr != nil) {
 		if ([strategyStr caseInsensitiveCompare:@"FIFO"] == NSOrderedSame) strategy = RMCachePurgeStrategyFIFO;
 		if ([strategyStr caseInsensitiveCompare:@"LRU"] == NSOrderedSame) strategy = RMCachePurgeStrategyLRU;
+		if ([strategyStr caseInsensitiveCompare:@"CLOCK"] == NSOrderedSame) strategy = RMCachePurgeStrategyClock;
 	}
 	
 	/// \bug magic string literals
@@ -202,16 +365,116 @@
 		}
 	}
 	
+	// several database files and read connections let lookups run side by side
+	NSUInteger shards = 1, readers = 4;
+	NSNumber* shardsNumber = [cfg objectForKey:@"shards"];
+	if (shardsNumber != nil) {
+		if ([shardsNumber intValue] >= 1 && [shardsNumber intValue] <= 256)
+			shards = [shardsNumber unsignedIntValue];
+		else
+			RMLog(@"shards must be between 1 and 256");
+	}
+	NSNumber* readersNumber = [cfg objectForKey:@"readers"];
+	if (readersNumber != nil) {
+		if ([readersNumber intValue] >= 1)
+			readers = [readersNumber unsignedIntValue];
+		else
+			RMLog(@"readers must be at least one");
+	}
+	
+	RMTileStoreOptions options = [RMTileCacheDAO optionsWithShards: shards readers: readers];
+	
+	// tile data in pack files, identical tiles stored once
+	NSNumber* packFilesNumber = [cfg objectForKey:@"packFiles"];
+	if (packFilesNumber != nil && [packFilesNumber boolValue])
+		options.segmentSize = 4 * 1024 * 1024;
+	NSNumber* segmentSizeNumber = [cfg objectForKey:@"segmentSize"];
+	if (segmentSizeNumber != nil && options.segmentSize != 0) {
+		if ([segmentSizeNumber intValue] >= 65536)
+			options.segmentSize = [segmentSizeNumber unsignedIntValue];
+		else
+			RMLog(@"segmentSize must be at least 65536");
+	}
+	
 	RMDatabaseCache* dbCache = [[RMDatabaseCache alloc] 
-								initWithTileSource: theTileSource 
-								usingCacheDir: useCacheDir
+								initWithDatabase: [RMDatabaseCache dbPathForTileSource: theTileSource usingCacheDir: useCacheDir]
+								options: &options
 								];
 	
 	[dbCache setCapacity: capacity];
 	[dbCache setPurgeStrategy: strategy];
 	[dbCache setMinimalPurge: minimalPurge];
+
+	NSNumber* writeBatchSizeNumber = [cfg objectForKey:@"writeBatchSize"];
+	if (writeBatchSizeNumber != nil) {
+		if ([writeBatchSizeNumber intValue] > 0)
+			[dbCache setWriteBatchSize: [writeBatchSizeNumber unsignedIntValue]];
+		else
+			RMLog(@"writeBatchSize must be at least one");
+	}
+
+	NSNumber* writeDelayNumber = [cfg objectForKey:@"writeDelay"];
+	if (writeDelayNumber != nil) {
+		if ([writeDelayNumber doubleValue] >= 0)
+			[dbCache setWriteDelay: [writeDelayNumber doubleValue]];
+		else
+			RMLog(@"illegal value for writeDelay: %f", [writeDelayNumber doubleValue]);
+	}
 	
 	return dbCache;
 }
 
+/// \bug magic numbers and strings
+- (id<RMTileCache>) newMissingTileCacheWithConfig: (NSDictionary*) cfg tileSource: (id<RMTileSource>) theTileSource
+{
+	NSTimeInterval timeToLive = 24 * 60 * 60;
+	BOOL persistent = YES, useCacheDir = NO;
+
+	NSNumber* timeToLiveNumber = [cfg objectForKey:@"timeToLive"];
+	if (timeToLiveNumber != nil) {
+		if ([timeToLiveNumber doubleValue] >= 2)
+			timeToLive = [timeToLiveNumber doubleValue];
+		else
+			RMLog(@"timeToLive must be at least 2 seconds");
+	}
+
+	NSNumber* persistentNumber = [cfg objectForKey:@"persistent"];
+	if (persistentNumber != nil) persistent = [persistentNumber boolValue];
+
+	NSNumber* useCacheDirNumber = [cfg objectForKey:@"useCachesDirectory"];
+	if (useCacheDirNumber != nil) useCacheDir = [useCacheDirNumber boolValue];
+
+	NSString* path = nil;
+	if (persistent)
+		path = [RMMissingTileCache pathForTileSource: theTileSource usingCacheDir: useCacheDir];
+
+	return [[RMMissingTileCache alloc] initWithTimeToLive: timeToLive path: path];
+}
+
+/// \bug magic numbers and strings
+- (id<RMTileCache>) newDecodedTileCacheWithConfig: (NSDictionary*) cfg
+{
+	// 32 tiles of 256x256 in RGBA8888, 64 in RGB555
+	NSUInteger byteBudget = 8 * 1024 * 1024;
+	RMTilePixelFormat format = RMTilePixelFormatRGBA8888;
+
+	NSNumber* byteBudgetNumber = [cfg objectForKey:@"byteBudget"];
+	if (byteBudgetNumber != nil) {
+		if ([byteBudgetNumber intValue] > 0)
+			byteBudget = [byteBudgetNumber unsignedIntValue];
+		else
+			RMLog(@"illegal value for byteBudget: %d", [byteBudgetNumber intValue]);
+	}
+
+	// RGB555 halves the memory of opaque tiles
+	NSString* formatStr = [cfg objectForKey:@"pixelFormat"];
+	if (formatStr != nil) {
+		if ([formatStr caseInsensitiveCompare:@"RGBA8888"] == NSOrderedSame) format = RMTilePixelFormatRGBA8888;
+		else if ([formatStr caseInsensitiveCompare:@"RGB555"] == NSOrderedSame) format = RMTilePixelFormatRGB555;
+		else RMLog(@"unknown pixelFormat %@", formatStr);
+	}
+
+	return [[RMDecodedTileCache alloc] initWithByteBudget: byteBudget pixelFormat: format];
+}
+
 @end
@@ -26,23 +26,61 @@
 // POSSIBILITY OF SUCH DAMAGE.
 
 #import <UIKit/UIKit.h>
+#import "RMTileStore.h"
 
-@class FMDatabase;
-
-/// the interface between RMDatabaseCache and FMDB
+/*! the interface between RMDatabaseCache and its SQLite tile store
+ 
+ A thin wrapper around RMTileStore, and as thread safe as it: lookups from several threads
+ run in parallel on a pool of read connections, while tiles added and touched are queued and
+ written by a writer thread in one transaction per writeBatchSize tiles or writeDelay
+ seconds, whichever comes first. Reads see queued tiles. Call -flush to write the queue out
+ at any other time; dealloc does too.
+ */
 @interface RMTileCacheDAO : NSObject {
-	FMDatabase* db;	
+	RMTileStore *store;
+	NSUInteger writeBatchSize;
+	NSTimeInterval writeDelay;
 }
 
+/// Queued tiles after which the queue is written. 1 writes every change right away.
+@property (nonatomic, assign) NSUInteger writeBatchSize;
+/// Longest time a change stays queued.
+@property (nonatomic, assign) NSTimeInterval writeDelay;
+
 -(id) initWithDatabase: (NSString*)path;
+/// Spreads the tiles over shards database files (rounded down to a power of two, at most 256),
+/// each read through readers connections.
+-(id) initWithDatabase: (NSString*)path shards: (NSUInteger)shards readers: (NSUInteger)readers;
+-(id) initWithDatabase: (NSString*)path options: (const RMTileStoreOptions*)options;
+
+/// Default store options, with shards rounded down to a power of two, at most 256.
++(RMTileStoreOptions) optionsWithShards: (NSUInteger)shards readers: (NSUInteger)readers;
 
+/// Number of cached tiles, counting queued tiles as new ones. Does not query the database.
 -(NSUInteger) count;
 -(NSData*) dataForTile: (uint64_t) tileHash;
 -(void) touchTile: (uint64_t) tileHash withDate: (NSDate*) date;
+/// Sets the reference bit of a tile for purgeTilesByClock:. Cheaper than touchTile:withDate:,
+/// as it writes once per purge cycle at most and leaves the indexes alone.
+-(void) referenceTile: (uint64_t) tileHash;
 -(void) addData: (NSData*) data LastUsed: (NSDate*)date ForTile: (uint64_t) tileHash;
--(void) purgeTiles: (NSUInteger) count;
+/// Deletes the count least recently used tiles, returns how many were deleted.
+-(NSUInteger) purgeTiles: (NSUInteger) count;
+/// Deletes count tiles from the oldest time buckets, sparing those referenced since their
+/// bucket was last purged. Returns how many were deleted.
+-(NSUInteger) purgeTilesByClock: (NSUInteger) count;
 -(void) purgeTilesFromBefore: (NSDate*) date;
 -(void) removeAllCachedImages;
 -(void)didReceiveMemoryWarning;
 
+/// YES if there are queued changes.
+-(BOOL) hasPendingWrites;
+/// Writes all queued changes and waits for them to be committed.
+-(void) flush;
+
+/// Rewrites pack segments mostly made of deleted tiles. Returns the number of bytes freed.
+-(unsigned long long) compactPackFiles;
+/// Bytes in pack segments, in use or not.
+-(unsigned long long) packedBytes;
+
 @end
@@ -26,40 +26,89 @@
 // POSSIBILITY OF SUCH DAMAGE.
 
 #import "RMTileCacheDAO.h"
-#import "FMDatabase.h"
 #import "RMTileCache.h"
 #import "RMTileImage.h"
 
 
+/// NSData over the bytes of a packed tile, which stay mapped for as long as it lives.
+@interface RMMappedTileData : NSData {
+	RMTileStoreData tileData;
+}
+-(id) initWithTileData: (RMTileStoreData)theTileData;
+@end
+
+@implementation RMMappedTileData
+
+-(id) initWithTileData: (RMTileStoreData)theTileData
+{
+	if (![super init])
+		return nil;
+	tileData = theTileData;
+	return self;
+}
+
+-(void) dealloc
+{
+	RMTileStoreReleaseData(&tileData);
+	[super dealloc];
+}
+
+-(const void*) bytes
+{
+	return tileData.bytes;
+}
+
+-(NSUInteger) length
+{
+	return tileData.length;
+}
+
+@end
+
+
 @implementation RMTileCacheDAO
 
--(void)configureDBForFirstUse
+@synthesize writeBatchSize, writeDelay;
+
++(RMTileStoreOptions) optionsWithShards: (NSUInteger)shards readers: (NSUInteger)readers
 {
-	[db executeUpdate:@"CREATE TABLE IF NOT EXISTS ZCACHE (ztileHash INTEGER PRIMARY KEY, zlastUsed DOUBLE, zdata BLOB)"];
-    [db executeUpdate:@"CREATE INDEX IF NOT EXISTS zlastUsedIndex ON ZCACHE(zLastUsed)"];
-    // adding more than once does not seem to break anything
-    [db executeUpdate:@"ALTER TABLE ZCACHE ADD COLUMN zInserted DOUBLE"];
-    [db executeUpdate:@"CREATE INDEX IF NOT EXISTS zInsertedIndex ON ZCACHE(zInserted)"];
+	RMTileStoreOptions options = RMTileStoreDefaultOptions();
+	options.shardBits = 0;
+	while (options.shardBits < 8 && (2u << options.shardBits) <= shards)
+		options.shardBits++;
+	options.readers = MAX(readers, 1);
+	return options;
 }
 
 -(id) initWithDatabase: (NSString*)path
+{
+	/// \bug magic numbers
+	return [self initWithDatabase:path shards:1 readers:4];
+}
+
+-(id) initWithDatabase: (NSString*)path shards: (NSUInteger)shards readers: (NSUInteger)readers
+{
+	RMTileStoreOptions options = [RMTileCacheDAO optionsWithShards:shards readers:readers];
+	return [self initWithDatabase:path options:&options];
+}
+
+-(id) initWithDatabase: (NSString*)path options: (const RMTileStoreOptions*)options
 {
 	if (![super init])
 		return nil;
 
-	RMLog(@"Opening database at %@", path);
-	
-	db = [[FMDatabase alloc] initWithPath:path];
-	if (![db open])
+	RMLog(@"Opening database at %@ in %u shard(s)", path, 1u << options->shardBits);
+
+	store = RMTileStoreOpen([path fileSystemRepresentation], options);
+	if (store == NULL)
 	{
-		RMLog(@"Could not connect to database - %@", [db lastErrorMessage]);
+		RMLog(@"Could not open database at %@", path);
+		[self release];
 		return nil;
 	}
-	
-	[db setCrashOnErrors:TRUE];
-        [db setShouldCacheStatements:TRUE];
-	
-	[self configureDBForFirstUse];
+
+	writeBatchSize = options->writeBatchSize;
+	writeDelay = options->writeDelay;
 	
 	return self;
 }
@@ -67,119 +116,117 @@
 - (void)dealloc
 {
 	LogMethod();
-	[db release];
+	RMTileStoreClose(store);
 	[super dealloc];
 }
 
+-(void) setWriteBatchSize: (NSUInteger) theBatchSize
+{
+	writeBatchSize = MAX(theBatchSize, 1);
+	RMTileStoreSetWriteBatch(store, writeBatchSize, writeDelay);
+}
+
+-(void) setWriteDelay: (NSTimeInterval) theDelay
+{
+	writeDelay = theDelay;
+	RMTileStoreSetWriteBatch(store, writeBatchSize, writeDelay);
+}
 
 -(NSUInteger) count
 {
-	FMResultSet *results = [db executeQuery:@"SELECT COUNT(ztileHash) FROM ZCACHE"];
-	
-	NSUInteger count = 0;
-	
-	if ([results next])
-		count = [results intForColumnIndex:0];
-	else
-	{
-		RMLog(@"Unable to count columns");
-	}
-	
-	[results close];
-	
-	return count;
+	return RMTileStoreCount(store);
 }
 
 -(NSData*) dataForTile: (uint64_t) tileHash
 {
-	FMResultSet *results = [db executeQuery:@"SELECT zdata FROM ZCACHE WHERE ztilehash = ?", [NSNumber numberWithUnsignedLongLong:tileHash]];
+	RMTileStoreData tileData;
 	
-	if ([db hadError])
+	int found = RMTileStoreGetData(store, tileHash, &tileData);
+	if (found < 0)
 	{
-		RMLog(@"DB error while fetching tile data: %@", [db lastErrorMessage]);
+		RMLog(@"DB error while fetching tile data");
 		return nil;
 	}
+	if (found == 0)
+		return nil;
 	
-	NSData *data = nil;
-	
-	if ([results next])
-	{
-		data = [results dataForColumnIndex:0];
-	}
-	
-	[results close];
-	
-	return data;
+	// packed tiles are not copied out of their segment
+	if (tileData.pin != NULL)
+		return [[[RMMappedTileData alloc] initWithTileData:tileData] autorelease];
+	return [NSData dataWithBytesNoCopy:(void*)tileData.bytes length:tileData.length freeWhenDone:YES];
 }
 
--(void) purgeTiles: (NSUInteger) count;
+-(NSUInteger) purgeTiles: (NSUInteger) count;
 {
 	RMLog(@"purging %u old tiles from db cache", count);
 	
-	// does not work: "DELETE FROM ZCACHE ORDER BY zlastUsed LIMIT"
+	return RMTileStorePurge(store, count);
+}
 
-	BOOL result = [db executeUpdate: @"DELETE FROM ZCACHE WHERE ztileHash IN (SELECT ztileHash FROM ZCACHE ORDER BY zlastUsed LIMIT ? )", 
-				   [NSNumber numberWithUnsignedInt: count]];
-	if (result == NO) {
-		RMLog(@"Error purging cache");
-	}
+-(NSUInteger) purgeTilesByClock: (NSUInteger) count
+{
+	RMLog(@"purging %u tiles from the oldest buckets of the db cache", count);
 	
+	return RMTileStorePurgeClock(store, count);
 }
 
 -(void) purgeTilesFromBefore: (NSDate*) date;
 {
-    NSUInteger count = 0;
-    FMResultSet *results = [db executeQuery:@"SELECT COUNT(ztileHash) FROM ZCACHE WHERE zInserted < ?", date];
-	if ([results next]) {
-        count = [results intForColumnIndex:0];
-        RMLog(@"Will purge %i tile(s) from before %@", count, date);
-    }
-	[results close];
-    
-    if (count == 0) {
-        return;
-    }
-    
-	BOOL result = [db executeUpdate: @"DELETE FROM ZCACHE WHERE zInserted < ?", 
-				   date];
-	if (result == NO) {
-		RMLog(@"Error purging cache");
-	}
+	NSUInteger count = RMTileStorePurgeInsertedBefore(store, [date timeIntervalSince1970]);
+	RMLog(@"Purged %u tile(s) from before %@", count, date);
 }
 
 -(void) removeAllCachedImages 
 {
-	BOOL result = [db executeUpdate: @"DELETE FROM ZCACHE"];
-	if (result == NO) {
-		RMLog(@"Error purging all cache");
-	}	
+	RMTileStoreRemoveAll(store);
 }
 
 -(void) touchTile: (uint64_t) tileHash withDate: (NSDate*) date
 {
-	BOOL result = [db executeUpdate: @"UPDATE ZCACHE SET zlastUsed = ? WHERE ztileHash = ? ", 
-				   date, [NSNumber numberWithUnsignedInt: tileHash]];
-	
-	if (result == NO) {
-		RMLog(@"Error touching tile");
-	}
+	RMTileStoreTouch(store, tileHash, [date timeIntervalSince1970]);
+}
+
+-(void) referenceTile: (uint64_t) tileHash
+{
+	RMTileStoreReference(store, tileHash);
 }
 
 -(void) addData: (NSData*) data LastUsed: (NSDate*)date ForTile: (uint64_t) tileHash
 {
-	// Fixme
-//	RMLog(@"addData\t%d", tileHash);
-	BOOL result = [db executeUpdate:@"INSERT OR REPLACE INTO ZCACHE (ztileHash, zlastUsed, zInserted, zdata) VALUES (?, ?, ?, ?)", 
-		[NSNumber numberWithUnsignedLongLong:tileHash], date, [NSDate date], data];
-	if (result == NO)
+	if (!RMTileStorePut(store, tileHash, [data bytes], [data length], [date timeIntervalSince1970], [[NSDate date] timeIntervalSince1970]))
 	{
 		RMLog(@"Error occured adding data");
 	}
 }
 
+-(BOOL) hasPendingWrites
+{
+	return RMTileStoreHasPendingWrites(store) != 0;
+}
+
+-(void) flush
+{
+	RMTileStoreFlush(store);
+}
+
+-(unsigned long long) compactPackFiles
+{
+	/// \bug magic numbers
+	unsigned long long freed = RMTileStoreCompact(store, 0.5);
+	if (freed > 0)
+		RMLog(@"Compacted pack files of db cache, %llu bytes freed", freed);
+	return freed;
+}
+
+-(unsigned long long) packedBytes
+{
+	return RMTileStorePackedBytes(store);
+}
+
 -(void)didReceiveMemoryWarning
 {
-	[db clearCachedStatements];
+	// the queue holds tile data
+	RMTileStoreFlush(store);
 }
 
 @end
@@ -0,0 +1,227 @@
+//
+//  RMTileCoverage.c
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "RMTileCoverage.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define kRMTileCoverageMaxZoom 27
+#define kRMTileCoverageInitialSlots 256
+
+typedef struct {
+	uint64_t key;
+	uint32_t count;			// 0 for an empty slot
+} RMTileCoverageSlot;
+
+struct RMTileCoverage {
+	RMTileCoverageSlot *slots;	// open addressing with linear probing, at most half full
+	size_t mask, used;
+	size_t levelCount[kRMTileCoverageMaxZoom + 1];	// tiles per zoom level
+	size_t count;
+};
+
+// The counts of the tiles at zoom level `level' that lie in the tile.
+static uint64_t RMTileCoverageKey(RMTile tile, short level)
+{
+	return ((uint64_t)level << 59) | ((uint64_t)tile.zoom << 54)
+		| ((uint64_t)(tile.x & 0x7FFFFFF) << 27) | (uint64_t)(tile.y & 0x7FFFFFF);
+}
+
+static RMTile RMTileCoverageAncestor(RMTile tile, short zoom)
+{
+	unsigned dz = tile.zoom - zoom;
+	tile.x >>= dz;
+	tile.y >>= dz;
+	tile.zoom = zoom;
+	return tile;
+}
+
+static int RMTileCoveragePlaced(short zoom)
+{
+	return zoom >= 0 && zoom <= kRMTileCoverageMaxZoom;
+}
+
+static size_t RMTileCoverageSlotFor(size_t mask, uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return (size_t)key & mask;
+}
+
+static RMTileCoverageSlot *RMTileCoverageProbe(RMTileCoverageSlot *slots, size_t mask, uint64_t key)
+{
+	size_t slot = RMTileCoverageSlotFor(mask, key);
+	while (slots[slot].count != 0 && slots[slot].key != key)
+		slot = (slot + 1) & mask;
+	return &slots[slot];
+}
+
+static uint32_t RMTileCoverageGet(const RMTileCoverage *coverage, uint64_t key)
+{
+	return RMTileCoverageProbe(coverage->slots, coverage->mask, key)->count;
+}
+
+// Makes room for `more' keys, so that the updates of an Add cannot fail halfway.
+static int RMTileCoverageReserve(RMTileCoverage *coverage, size_t more)
+{
+	size_t slots = coverage->mask + 1;
+
+	while ((coverage->used + more) * 2 > slots)
+		slots *= 2;
+	if (slots == coverage->mask + 1)
+		return 1;
+
+	RMTileCoverageSlot *grown = calloc(slots, sizeof(RMTileCoverageSlot));
+	if (grown == NULL)
+		return 0;
+	for (size_t i = 0; i <= coverage->mask; i++)
+		if (coverage->slots[i].count != 0)
+			*RMTileCoverageProbe(grown, slots - 1, coverage->slots[i].key) = coverage->slots[i];
+	free(coverage->slots);
+	coverage->slots = grown;
+	coverage->mask = slots - 1;
+	return 1;
+}
+
+// Removes an emptied slot and moves later slots of its run back, so that lookups need no tombstones.
+static void RMTileCoverageClear(RMTileCoverage *coverage, RMTileCoverageSlot *emptied)
+{
+	size_t hole = emptied - coverage->slots, slot = hole;
+
+	for (;;) {
+		slot = (slot + 1) & coverage->mask;
+		if (coverage->slots[slot].count == 0)
+			break;
+		size_t home = RMTileCoverageSlotFor(coverage->mask, coverage->slots[slot].key);
+		// the slot may move to the hole unless its home lies cyclically in (hole, slot]
+		if ((slot > hole && (home <= hole || home > slot)) || (slot < hole && home <= hole && home > slot)) {
+			coverage->slots[hole] = coverage->slots[slot];
+			hole = slot;
+		}
+	}
+	coverage->slots[hole].count = 0;
+	coverage->used--;
+}
+
+RMTileCoverage *RMTileCoverageCreate(void)
+{
+	RMTileCoverage *coverage = calloc(1, sizeof(RMTileCoverage));
+	if (coverage == NULL)
+		return NULL;
+	coverage->slots = calloc(kRMTileCoverageInitialSlots, sizeof(RMTileCoverageSlot));
+	if (coverage->slots == NULL) {
+		free(coverage);
+		return NULL;
+	}
+	coverage->mask = kRMTileCoverageInitialSlots - 1;
+	return coverage;
+}
+
+void RMTileCoverageFree(RMTileCoverage *coverage)
+{
+	if (coverage == NULL)
+		return;
+	free(coverage->slots);
+	free(coverage);
+}
+
+int RMTileCoverageAdd(RMTileCoverage *coverage, RMTile tile)
+{
+	if (!RMTileCoveragePlaced(tile.zoom))
+		return 1;
+	if (!RMTileCoverageReserve(coverage, tile.zoom + 1))
+		return 0;
+
+	for (short zoom = 0; zoom <= tile.zoom; zoom++) {
+		uint64_t key = RMTileCoverageKey(RMTileCoverageAncestor(tile, zoom), tile.zoom);
+		RMTileCoverageSlot *slot = RMTileCoverageProbe(coverage->slots, coverage->mask, key);
+		if (slot->count++ == 0) {
+			slot->key = key;
+			coverage->used++;
+		}
+	}
+	coverage->levelCount[tile.zoom]++;
+	coverage->count++;
+	return 1;
+}
+
+void RMTileCoverageRemove(RMTileCoverage *coverage, RMTile tile)
+{
+	if (!RMTileCoverageContains(coverage, tile))
+		return;
+
+	for (short zoom = 0; zoom <= tile.zoom; zoom++) {
+		uint64_t key = RMTileCoverageKey(RMTileCoverageAncestor(tile, zoom), tile.zoom);
+		RMTileCoverageSlot *slot = RMTileCoverageProbe(coverage->slots, coverage->mask, key);
+		if (--slot->count == 0)
+			RMTileCoverageClear(coverage, slot);
+	}
+	coverage->levelCount[tile.zoom]--;
+	coverage->count--;
+}
+
+void RMTileCoverageRemoveAll(RMTileCoverage *coverage)
+{
+	memset(coverage->slots, 0, (coverage->mask + 1) * sizeof(RMTileCoverageSlot));
+	memset(coverage->levelCount, 0, sizeof(coverage->levelCount));
+	coverage->used = 0;
+	coverage->count = 0;
+}
+
+size_t RMTileCoverageCount(const RMTileCoverage *coverage)
+{
+	return coverage->count;
+}
+
+int RMTileCoverageContains(const RMTileCoverage *coverage, RMTile tile)
+{
+	if (!RMTileCoveragePlaced(tile.zoom))
+		return 0;
+	return RMTileCoverageGet(coverage, RMTileCoverageKey(tile, tile.zoom)) != 0;
+}
+
+int RMTileCoverageCovers(const RMTileCoverage *coverage, RMTile tile, short minZoom, short maxZoom)
+{
+	if (!RMTileCoveragePlaced(tile.zoom))
+		return 0;
+	if (minZoom < 0)
+		minZoom = 0;
+	if (maxZoom > kRMTileCoverageMaxZoom)
+		maxZoom = kRMTileCoverageMaxZoom;
+
+	for (short zoom = minZoom; zoom <= maxZoom; zoom++) {
+		if (coverage->levelCount[zoom] == 0)
+			continue;
+		// a coarser tile must be the one the tile lies in, finer ones are counted in the tile
+		RMTile area = zoom <= tile.zoom ? RMTileCoverageAncestor(tile, zoom) : tile;
+		if (RMTileCoverageGet(coverage, RMTileCoverageKey(area, zoom)) != 0)
+			return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,71 @@
+//
+//  RMTileCoverage.h
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _RMTILECOVERAGE_H_
+#define _RMTILECOVERAGE_H_
+
+#include <stddef.h>
+#include "RMTile.h"
+
+/*! \file RMTileCoverage.h
+ */
+/*! \struct RMTileCoverage
+ \brief Which areas a set of tiles covers at each zoom level, for RMTileImageSet's loaded tiles.
+
+ For every tile added, each of its ancestors, the tile itself included, counts the tiles at the
+ tile's zoom level that lie in it. These counts live in one open-addressed hash table, so adding
+ or removing a tile of zoom level z takes z + 1 updates, and whether an added tile at a given
+ zoom level overlaps some tile takes one lookup, whichever of the two is coarser.
+
+ Tiles of zoom levels from 0 to 27 are told apart exactly. Tiles of other zoom levels, like dummy
+ tiles, are never counted.
+
+ Plain C without any framework dependency besides RMTile; not thread safe.
+ */
+typedef struct RMTileCoverage RMTileCoverage;
+
+/// Creates an empty coverage. Returns NULL if out of memory.
+RMTileCoverage *RMTileCoverageCreate(void);
+/// Frees the coverage.
+void RMTileCoverageFree(RMTileCoverage *coverage);
+
+/// Adds the tile, which must not be in the coverage yet. Returns 0 if out of memory.
+int RMTileCoverageAdd(RMTileCoverage *coverage, RMTile tile);
+/// Removes the tile if it is in the coverage.
+void RMTileCoverageRemove(RMTileCoverage *coverage, RMTile tile);
+/// Removes all tiles.
+void RMTileCoverageRemoveAll(RMTileCoverage *coverage);
+
+/// Number of tiles in the coverage.
+size_t RMTileCoverageCount(const RMTileCoverage *coverage);
+/// Returns nonzero if the tile is in the coverage.
+int RMTileCoverageContains(const RMTileCoverage *coverage, RMTile tile);
+/// Returns nonzero if a tile of a zoom level from minZoom to maxZoom is in the coverage and lies
+/// in the given tile or contains it.
+int RMTileCoverageCovers(const RMTileCoverage *coverage, RMTile tile, short minZoom, short maxZoom);
+
+#endif
@@ -0,0 +1,421 @@
+//
+//  RMTileDecoder.c
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+#include "RMTileDecoder.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#define kRMTileDecoderMaxSide 16384
+
+static const unsigned char kRMTileDecoderSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+typedef struct {
+	const unsigned char *data, *end;
+	const unsigned char *chunk;	// the data of the current chunk
+	uint32_t chunkLength;
+	uint32_t chunkType;
+} RMTileDecoderReader;
+
+typedef struct {
+	unsigned width, height;
+	unsigned depth, colorType;
+	unsigned channels;
+	unsigned char palette[256][4];
+	unsigned paletteSize;
+	int hasKey;			// colour key from tRNS for grey and RGB images
+	unsigned key[3];
+} RMTileDecoderHeader;
+
+#define RMTileDecoderChunk(a, b, c, d) (((uint32_t)(a) << 24) | ((uint32_t)(b) << 16) | ((uint32_t)(c) << 8) | (uint32_t)(d))
+
+static uint32_t RMTileDecoderRead32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+size_t RMTilePixelFormatBytesPerPixel(RMTilePixelFormat format)
+{
+	return format == RMTilePixelFormatRGB555 ? 2 : 4;
+}
+
+// Moves to the next chunk. Returns 0 at the end of the data or on a truncated chunk.
+static int RMTileDecoderNextChunk(RMTileDecoderReader *reader)
+{
+	const unsigned char *next = reader->chunk == NULL ? reader->data + 8 : reader->chunk + reader->chunkLength + 4;
+
+	if (next > reader->end || (size_t)(reader->end - next) < 8)
+		return 0;
+	reader->chunkLength = RMTileDecoderRead32(next);
+	reader->chunkType = RMTileDecoderRead32(next + 4);
+	reader->chunk = next + 8;
+	return (size_t)(reader->end - reader->chunk) >= (size_t)reader->chunkLength + 4;
+}
+
+static int RMTileDecoderValidDepth(unsigned colorType, unsigned depth)
+{
+	switch (colorType)
+	{
+		case 0: return depth == 1 || depth == 2 || depth == 4 || depth == 8 || depth == 16;
+		case 3: return depth == 1 || depth == 2 || depth == 4 || depth == 8;
+		case 2: case 4: case 6: return depth == 8 || depth == 16;
+	}
+	return 0;
+}
+
+// Reads the chunks up to the first IDAT, leaving the reader on it.
+static int RMTileDecoderReadHeader(RMTileDecoderReader *reader, RMTileDecoderHeader *header, const void *data, size_t length)
+{
+	static const unsigned channels[7] = { 1, 0, 3, 1, 2, 0, 4 };
+	const unsigned char *p;
+	unsigned i;
+
+	memset(reader, 0, sizeof *reader);
+	memset(header, 0, sizeof *header);
+	reader->data = data;
+	reader->end = reader->data + length;
+
+	if (length < 8 || memcmp(data, kRMTileDecoderSignature, 8) != 0)
+		return 0;
+	if (!RMTileDecoderNextChunk(reader) || reader->chunkType != RMTileDecoderChunk('I', 'H', 'D', 'R') || reader->chunkLength != 13)
+		return 0;
+
+	p = reader->chunk;
+	header->width = RMTileDecoderRead32(p);
+	header->height = RMTileDecoderRead32(p + 4);
+	header->depth = p[8];
+	header->colorType = p[9];
+	// compression and filter method 0, no interlacing
+	if (p[10] != 0 || p[11] != 0 || p[12] != 0)
+		return 0;
+	if (header->width == 0 || header->height == 0 || header->width > kRMTileDecoderMaxSide || header->height > kRMTileDecoderMaxSide)
+		return 0;
+	if (header->colorType > 6 || !RMTileDecoderValidDepth(header->colorType, header->depth))
+		return 0;
+	header->channels = channels[header->colorType];
+
+	while (RMTileDecoderNextChunk(reader))
+	{
+		p = reader->chunk;
+		switch (reader->chunkType)
+		{
+			case RMTileDecoderChunk('P', 'L', 'T', 'E'):
+				if (reader->chunkLength % 3 != 0 || reader->chunkLength > 768)
+					return 0;
+				header->paletteSize = reader->chunkLength / 3;
+				for (i = 0; i < header->paletteSize; i++)
+				{
+					header->palette[i][0] = p[i * 3];
+					header->palette[i][1] = p[i * 3 + 1];
+					header->palette[i][2] = p[i * 3 + 2];
+					header->palette[i][3] = 255;
+				}
+				break;
+
+			case RMTileDecoderChunk('t', 'R', 'N', 'S'):
+				if (header->colorType == 3)
+				{
+					for (i = 0; i < reader->chunkLength && i < header->paletteSize; i++)
+						header->palette[i][3] = p[i];
+				}
+				else if (header->colorType == 0 && reader->chunkLength >= 2)
+				{
+					header->hasKey = 1;
+					header->key[0] = (p[0] << 8) | p[1];
+				}
+				else if (header->colorType == 2 && reader->chunkLength >= 6)
+				{
+					header->hasKey = 1;
+					for (i = 0; i < 3; i++)
+						header->key[i] = (p[i * 2] << 8) | p[i * 2 + 1];
+				}
+				break;
+
+			case RMTileDecoderChunk('I', 'D', 'A', 'T'):
+				return header->colorType != 3 || header->paletteSize > 0;
+
+			case RMTileDecoderChunk('I', 'E', 'N', 'D'):
+				return 0;
+		}
+	}
+	return 0;
+}
+
+int RMTileDecoderImageSize(const void *data, size_t length, unsigned *width, unsigned *height)
+{
+	RMTileDecoderReader reader;
+	RMTileDecoderHeader header;
+
+	if (!RMTileDecoderReadHeader(&reader, &header, data, length))
+		return 0;
+	*width = header.width;
+	*height = header.height;
+	return 1;
+}
+
+static unsigned char RMTileDecoderPaeth(unsigned char a, unsigned char b, unsigned char c)
+{
+	int p = (int)a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	if (pa <= pb && pa <= pc)
+		return a;
+	return pb <= pc ? b : c;
+}
+
+static int RMTileDecoderUnfilter(unsigned char *row, const unsigned char *previous, size_t length, size_t bpp)
+{
+	unsigned filter = row[0];
+	size_t i;
+
+	row++;
+	previous++;
+	switch (filter)
+	{
+		case 0:
+			break;
+		case 1:
+			for (i = bpp; i < length; i++)
+				row[i] += row[i - bpp];
+			break;
+		case 2:
+			for (i = 0; i < length; i++)
+				row[i] += previous[i];
+			break;
+		case 3:
+			for (i = 0; i < length; i++)
+				row[i] += ((i >= bpp ? row[i - bpp] : 0) + previous[i]) >> 1;
+			break;
+		case 4:
+			for (i = 0; i < length; i++)
+				row[i] += RMTileDecoderPaeth(i >= bpp ? row[i - bpp] : 0, previous[i], i >= bpp ? previous[i - bpp] : 0);
+			break;
+		default:
+			return 0;
+	}
+	return 1;
+}
+
+// Sample number i of a row, at full precision.
+static unsigned RMTileDecoderSample(const unsigned char *row, size_t i, unsigned depth)
+{
+	switch (depth)
+	{
+		case 16: return (row[i * 2] << 8) | row[i * 2 + 1];
+		case 8: return row[i];
+		default: return (row[i * depth / 8] >> (8 - depth - (i * depth) % 8)) & ((1 << depth) - 1);
+	}
+}
+
+// Scales a sample to 8 bits.
+static unsigned RMTileDecoderScale(unsigned sample, unsigned depth)
+{
+	switch (depth)
+	{
+		case 16: return sample >> 8;
+		case 8: return sample;
+		default: return sample * 255 / ((1 << depth) - 1);
+	}
+}
+
+// Stores one pixel, premultiplying it, and returns where the next one goes.
+static unsigned char *RMTileDecoderStore(unsigned char *out, RMTilePixelFormat format, unsigned r, unsigned g, unsigned b, unsigned a)
+{
+	if (a != 255)
+	{
+		r = (r * a + 127) / 255;
+		g = (g * a + 127) / 255;
+		b = (b * a + 127) / 255;
+	}
+
+	if (format == RMTilePixelFormatRGB555)
+	{
+		unsigned word = ((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3);
+		out[0] = (unsigned char)word;
+		out[1] = (unsigned char)(word >> 8);
+		return out + 2;
+	}
+
+	out[0] = (unsigned char)r;
+	out[1] = (unsigned char)g;
+	out[2] = (unsigned char)b;
+	out[3] = (unsigned char)a;
+	return out + 4;
+}
+
+static void RMTileDecoderConvertRow(const RMTileDecoderHeader *header, const unsigned char *row, RMTilePixelFormat format, unsigned char *out)
+{
+	unsigned x, depth = header->depth;
+
+	// the kinds of tiles renderers write, without the per sample work below
+	if (depth == 8 && header->colorType == 2 && !header->hasKey)
+	{
+		for (x = 0; x < header->width; x++, row += 3)
+			out = RMTileDecoderStore(out, format, row[0], row[1], row[2], 255);
+		return;
+	}
+	if (depth == 8 && header->colorType == 6)
+	{
+		for (x = 0; x < header->width; x++, row += 4)
+			out = RMTileDecoderStore(out, format, row[0], row[1], row[2], row[3]);
+		return;
+	}
+	if (depth == 8 && header->colorType == 3)
+	{
+		for (x = 0; x < header->width; x++, row++)
+		{
+			const unsigned char *entry = *row < header->paletteSize ? header->palette[*row] : (const unsigned char *)"\0\0\0\377";
+			out = RMTileDecoderStore(out, format, entry[0], entry[1], entry[2], entry[3]);
+		}
+		return;
+	}
+
+	for (x = 0; x < header->width; x++)
+	{
+		size_t sample = (size_t)x * header->channels;
+		unsigned r, g, b, a = 255;
+
+		switch (header->colorType)
+		{
+			case 0:
+				r = RMTileDecoderSample(row, sample, depth);
+				if (header->hasKey && r == header->key[0])
+					a = 0;
+				r = g = b = RMTileDecoderScale(r, depth);
+				break;
+			case 2:
+				r = RMTileDecoderSample(row, sample, depth);
+				g = RMTileDecoderSample(row, sample + 1, depth);
+				b = RMTileDecoderSample(row, sample + 2, depth);
+				if (header->hasKey && r == header->key[0] && g == header->key[1] && b == header->key[2])
+					a = 0;
+				r = RMTileDecoderScale(r, depth);
+				g = RMTileDecoderScale(g, depth);
+				b = RMTileDecoderScale(b, depth);
+				break;
+			case 3:
+			{
+				unsigned index = RMTileDecoderSample(row, sample, depth);
+				// out of range indices are an error; show them black rather than fail
+				const unsigned char *entry = index < header->paletteSize ? header->palette[index] : (const unsigned char *)"\0\0\0\377";
+				r = entry[0];
+				g = entry[1];
+				b = entry[2];
+				a = entry[3];
+				break;
+			}
+			case 4:
+				r = g = b = RMTileDecoderScale(RMTileDecoderSample(row, sample, depth), depth);
+				a = RMTileDecoderScale(RMTileDecoderSample(row, sample + 1, depth), depth);
+				break;
+			default:
+				r = RMTileDecoderScale(RMTileDecoderSample(row, sample, depth), depth);
+				g = RMTileDecoderScale(RMTileDecoderSample(row, sample + 1, depth), depth);
+				b = RMTileDecoderScale(RMTileDecoderSample(row, sample + 2, depth), depth);
+				a = RMTileDecoderScale(RMTileDecoderSample(row, sample + 3, depth), depth);
+				break;
+		}
+
+		out = RMTileDecoderStore(out, format, r, g, b, a);
+	}
+}
+
+int RMTileDecoderDecode(const void *data, size_t length, RMTilePixelFormat format, void *pixels, size_t rowBytes)
+{
+	RMTileDecoderReader reader;
+	RMTileDecoderHeader header;
+	z_stream stream;
+	unsigned char *rows, *row, *previous, *swap;
+	size_t rowLength, bpp;
+	unsigned y;
+	int ok = 1;
+
+	if (!RMTileDecoderReadHeader(&reader, &header, data, length))
+		return 0;
+
+	rowLength = ((size_t)header.width * header.channels * header.depth + 7) / 8;
+	bpp = (header.channels * header.depth + 7) / 8;
+
+	// each row with its filter byte, and the row above, which starts out as zeros
+	rows = calloc(2, rowLength + 1);
+	if (rows == NULL)
+		return 0;
+	row = rows;
+	previous = rows + rowLength + 1;
+
+	memset(&stream, 0, sizeof stream);
+	if (inflateInit(&stream) != Z_OK)
+	{
+		free(rows);
+		return 0;
+	}
+	stream.next_in = (Bytef *)reader.chunk;
+	stream.avail_in = reader.chunkLength;
+
+	for (y = 0; ok && y < header.height; y++)
+	{
+		stream.next_out = row;
+		stream.avail_out = (uInt)(rowLength + 1);
+
+		while (ok && stream.avail_out > 0)
+		{
+			int status;
+
+			// IDAT chunks follow each other without anything in between
+			while (stream.avail_in == 0)
+			{
+				if (!RMTileDecoderNextChunk(&reader) || reader.chunkType != RMTileDecoderChunk('I', 'D', 'A', 'T'))
+				{
+					ok = 0;
+					break;
+				}
+				stream.next_in = (Bytef *)reader.chunk;
+				stream.avail_in = reader.chunkLength;
+			}
+			if (!ok)
+				break;
+
+			status = inflate(&stream, Z_NO_FLUSH);
+			if (status == Z_STREAM_END)
+				ok = stream.avail_out == 0 && y + 1 == header.height;
+			else if (status != Z_OK)
+				ok = 0;
+		}
+
+		if (ok)
+			ok = RMTileDecoderUnfilter(row, previous, rowLength, bpp);
+		if (ok)
+			RMTileDecoderConvertRow(&header, row + 1, format, (unsigned char *)pixels + y * rowBytes);
+
+		swap = row;
+		row = previous;
+		previous = swap;
+	}
+
+	inflateEnd(&stream);
+	free(rows);
+	return ok;
+}
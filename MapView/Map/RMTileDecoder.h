@@ -0,0 +1,60 @@
+//
+//  RMTileDecoder.h
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+#ifndef _RMTILEDECODER_H_
+#define _RMTILEDECODER_H_
+
+#include <stddef.h>
+
+/*! \file RMTileDecoder.h
+ \brief Decodes PNG tiles into bitmaps, in plain C on top of zlib.
+
+ Handles the PNGs tile servers and renderers write: all colour types and bit depths, with
+ palette and colour key transparency, but not interlaced images, which are left to the
+ platform decoder. Colour profiles and gamma are ignored, as they are by tile renderers.
+ Chunk checksums are not verified.
+ */
+
+typedef enum {
+	/// 4 bytes per pixel in the order R, G, B, A, colour premultiplied by alpha:
+	/// kCGImageAlphaPremultipliedLast | kCGBitmapByteOrder32Big
+	RMTilePixelFormatRGBA8888,
+	/// 16 bit little endian words, 5 bits each of R, G and B from the top bit down, composed
+	/// over black: kCGImageAlphaNoneSkipFirst | kCGBitmapByteOrder16Little
+	RMTilePixelFormatRGB555,
+} RMTilePixelFormat;
+
+/// Bytes per pixel of the format.
+size_t RMTilePixelFormatBytesPerPixel(RMTilePixelFormat format);
+
+/// Reads the size of a PNG. Returns 0 if the data is not a PNG this decoder handles.
+int RMTileDecoderImageSize(const void *data, size_t length, unsigned *width, unsigned *height);
+
+/// Decodes a PNG into pixels of the given format, rowBytes apart, which must have room for the
+/// whole image. Returns 0 if the data is not a PNG this decoder handles, or is damaged.
+int RMTileDecoderDecode(const void *data, size_t length, RMTilePixelFormat format, void *pixels, size_t rowBytes);
+
+#endif
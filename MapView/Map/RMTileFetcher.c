@@ -0,0 +1,1030 @@
+//
+//  RMTileFetcher.c
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// sockets, poll() and rand_r() are POSIX, not C99; SO_NOSIGPIPE is Darwin's
+#define _XOPEN_SOURCE 600
+#define _DARWIN_C_SOURCE
+
+#include "RMTileFetcher.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0		// SO_NOSIGPIPE is set on the socket instead
+#endif
+
+#define kRMTileFetchNotSent 0			// status of a request left unanswered on a connection
+#define kRMTileFetcherMaxPipeline 16
+#define kRMTileFetcherMaxLine 8192
+#define kRMTileFetcherReadSize 16384
+
+typedef struct RMTileFetchWaiter {
+	RMTileFetcherCallback callback;
+	void *context;
+	struct RMTileFetchWaiter *next;
+} RMTileFetchWaiter;
+
+typedef struct RMTileFetchConnection {
+	int fd;
+	int pipelines;			// has answered with an HTTP/1.1 keep-alive response
+	double idleSince;
+	struct RMTileFetchConnection *next;
+} RMTileFetchConnection;
+
+typedef struct RMTileFetchHost {
+	char *name, *port, *header;
+	unsigned active;				// connections in use
+	RMTileFetchConnection *idle;	// kept alive, most recently used first
+	struct RMTileFetchHost *next;
+} RMTileFetchHost;
+
+typedef struct RMTileFetchRequest {
+	char *url, *path;
+	RMTileFetchHost *host;
+	RMTileRequestKind kind;
+	unsigned long sequence;
+	unsigned attempts;
+	double notBefore;
+	int running;
+	RMTileFetchWaiter *waiters;
+	int status;
+	char *body;
+	size_t length, capacity;
+	struct RMTileFetchRequest *next;
+} RMTileFetchRequest;
+
+struct RMTileFetcher {
+	RMTileFetcherOptions options;
+	char *userAgent;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_t *threads;
+	unsigned threadCount;
+	int stopping;
+	int wake[2];		// written to when stopping, to break off waiting on sockets
+
+	RMTileFetchRequest *requests;	// queued and running
+	RMTileFetchHost *hosts;
+	unsigned long sequence;
+	unsigned seed;
+
+	RMTileFetcherStatistics statistics;
+};
+
+// Reads responses off a connection, keeping what follows one for the next.
+typedef struct {
+	RMTileFetcher *fetcher;
+	int fd;
+	char *buffer;
+	size_t start, end, capacity;
+	size_t received;
+	double deadline;
+} RMTileFetchStream;
+
+static double RMTileFetcherNow(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec + now.tv_usec * 1e-6;
+}
+
+void RMTileFetcherDefaultOptions(RMTileFetcherOptions *options)
+{
+	options->maxConnections = 8;
+	options->maxPerHost = 4;
+	options->pipelineDepth = 1;
+	options->maxRetries = 5;
+	options->backoffBase = 0.5;
+	options->backoffCap = 30.0;
+	options->timeout = 30.0;
+	options->idleTimeout = 15.0;
+	options->userAgent = NULL;
+}
+
+double RMTileFetcherBackoff(unsigned attempt, double base, double cap, double random)
+{
+	double delay = ldexp(base, attempt < 60 ? (int)attempt : 60);
+
+	if (delay > cap)
+		delay = cap;
+	return delay / 2 + random * delay / 2;
+}
+
+// Splits an http:// URL into its host, port and path, and returns 0 if it is not one. The path is
+// malloced.
+static int RMTileFetcherParse(const char *url, char *name, size_t nameSize, char *port, size_t portSize, char **path)
+{
+	const char *start, *end, *nameEnd, *colon;
+	size_t length;
+
+	if (strncasecmp(url, "http://", 7) != 0)
+		return 0;
+	start = url + 7;
+	end = start + strcspn(start, "/?#");
+	if (memchr(start, '@', end - start) != NULL)
+		return 0;
+
+	if (*start == '[') {
+		// an IPv6 address
+		nameEnd = memchr(start, ']', end - start);
+		if (nameEnd == NULL)
+			return 0;
+		colon = nameEnd + 1 < end && nameEnd[1] == ':' ? nameEnd + 1 : NULL;
+		start++;
+	} else {
+		colon = memchr(start, ':', end - start);
+		nameEnd = colon != NULL ? colon : end;
+	}
+	length = nameEnd - start;
+	if (length == 0 || length >= nameSize)
+		return 0;
+	memcpy(name, start, length);
+	name[length] = '\0';
+
+	if (colon != NULL && colon + 1 < end) {
+		length = end - colon - 1;
+		if (length >= portSize || strspn(colon + 1, "0123456789") < length)
+			return 0;
+		memcpy(port, colon + 1, length);
+		port[length] = '\0';
+	} else {
+		snprintf(port, portSize, "80");
+	}
+
+	length = strcspn(end, "#");
+	*path = malloc(length + 2);
+	if (*path == NULL)
+		return 0;
+	snprintf(*path, length + 2, "%s%.*s", *end == '/' ? "" : "/", (int)length, end);
+	return 1;
+}
+
+// Finds or adds the host. Called with the lock held.
+static RMTileFetchHost *RMTileFetcherHost(RMTileFetcher *fetcher, const char *name, const char *port)
+{
+	RMTileFetchHost *host;
+	size_t size;
+
+	for (host = fetcher->hosts; host != NULL; host = host->next) {
+		if (strcmp(host->name, name) == 0 && strcmp(host->port, port) == 0)
+			return host;
+	}
+
+	host = calloc(1, sizeof(RMTileFetchHost));
+	if (host == NULL)
+		return NULL;
+	size = strlen(name) + strlen(port) + 4;
+	host->name = strdup(name);
+	host->port = strdup(port);
+	host->header = malloc(size);
+	if (host->name == NULL || host->port == NULL || host->header == NULL) {
+		free(host->name);
+		free(host->port);
+		free(host->header);
+		free(host);
+		return NULL;
+	}
+	if (strchr(name, ':') != NULL)
+		snprintf(host->header, size, "[%s]", name);
+	else
+		snprintf(host->header, size, "%s", name);
+	if (strcmp(port, "80") != 0)
+		snprintf(host->header + strlen(host->header), size - strlen(host->header), ":%s", port);
+
+	host->next = fetcher->hosts;
+	fetcher->hosts = host;
+	return host;
+}
+
+static RMTileFetchRequest *RMTileFetcherFind(RMTileFetcher *fetcher, const char *url)
+{
+	RMTileFetchRequest *request;
+
+	for (request = fetcher->requests; request != NULL; request = request->next) {
+		if (strcmp(request->url, url) == 0)
+			return request;
+	}
+	return NULL;
+}
+
+static void RMTileFetcherUnlink(RMTileFetcher *fetcher, RMTileFetchRequest *request)
+{
+	RMTileFetchRequest **link;
+
+	for (link = &fetcher->requests; *link != NULL; link = &(*link)->next) {
+		if (*link == request) {
+			*link = request->next;
+			return;
+		}
+	}
+}
+
+static void RMTileFetcherFreeRequest(RMTileFetchRequest *request)
+{
+	while (request->waiters != NULL) {
+		RMTileFetchWaiter *next = request->waiters->next;
+		free(request->waiters);
+		request->waiters = next;
+	}
+	free(request->url);
+	free(request->path);
+	free(request->body);
+	free(request);
+}
+
+// Calls back everybody waiting for the request, and frees it. Called without the lock.
+static void RMTileFetcherDeliver(RMTileFetchRequest *request, int status)
+{
+	for (RMTileFetchWaiter *waiter = request->waiters; waiter != NULL; waiter = waiter->next)
+		waiter->callback(waiter->context, status, request->body, status == request->status ? request->length : 0);
+	RMTileFetcherFreeRequest(request);
+}
+
+// Waits until fd is ready for events. Returns 0, or the error.
+static int RMTileFetcherPoll(RMTileFetcher *fetcher, int fd, short events, double deadline)
+{
+	struct pollfd fds[2];
+
+	for (;;) {
+		double left = deadline - RMTileFetcherNow();
+		int ready;
+
+		if (left <= 0)
+			return kRMTileFetchTimedOut;
+		fds[0].fd = fd;
+		fds[0].events = events;
+		fds[0].revents = 0;
+		fds[1].fd = fetcher->wake[0];
+		fds[1].events = POLLIN;
+		fds[1].revents = 0;
+		ready = poll(fds, 2, (int)ceil(left * 1e3));
+		if (ready < 0 && errno != EINTR)
+			return kRMTileFetchNetworkError;
+		if (fds[1].revents != 0)
+			return kRMTileFetchCancelled;
+		if (ready > 0 && fds[0].revents != 0)
+			return 0;
+	}
+}
+
+static int RMTileFetcherConnect(RMTileFetcher *fetcher, RMTileFetchHost *host, int *fd)
+{
+	struct addrinfo hints, *addresses, *address;
+	double deadline = RMTileFetcherNow() + fetcher->options.timeout;
+	int error = kRMTileFetchNetworkError, one = 1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host->name, host->port, &hints, &addresses) != 0)
+		return kRMTileFetchNetworkError;
+
+	for (address = addresses; address != NULL; address = address->ai_next) {
+		int s = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+
+		if (s < 0)
+			continue;
+		fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+		setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+		setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+		error = kRMTileFetchNetworkError;
+		if (connect(s, address->ai_addr, address->ai_addrlen) == 0) {
+			error = 0;
+		} else if (errno == EINPROGRESS) {
+			error = RMTileFetcherPoll(fetcher, s, POLLOUT, deadline);
+			if (error == 0) {
+				int failure = 0;
+				socklen_t size = sizeof(failure);
+				if (getsockopt(s, SOL_SOCKET, SO_ERROR, &failure, &size) != 0 || failure != 0)
+					error = kRMTileFetchNetworkError;
+			}
+		}
+		if (error == 0) {
+			*fd = s;
+			break;
+		}
+		close(s);
+		if (error != kRMTileFetchNetworkError)
+			break;
+	}
+	freeaddrinfo(addresses);
+	return error;
+}
+
+static int RMTileFetcherSend(RMTileFetcher *fetcher, int fd, const char *data, size_t length)
+{
+	double deadline = RMTileFetcherNow() + fetcher->options.timeout;
+
+	while (length > 0) {
+		ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+
+		if (sent < 0) {
+			int error;
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return kRMTileFetchNetworkError;
+			if ((error = RMTileFetcherPoll(fetcher, fd, POLLOUT, deadline)) != 0)
+				return error;
+			continue;
+		}
+		data += sent;
+		length -= sent;
+	}
+	return 0;
+}
+
+// Reads more of the connection. Returns the bytes read, 0 at its end, or an error.
+static int RMTileFetcherFill(RMTileFetchStream *stream)
+{
+	ssize_t got;
+	int error;
+
+	if (stream->start > 0) {
+		memmove(stream->buffer, stream->buffer + stream->start, stream->end - stream->start);
+		stream->end -= stream->start;
+		stream->start = 0;
+	}
+	if (stream->capacity - stream->end < kRMTileFetcherReadSize) {
+		size_t capacity = stream->end + kRMTileFetcherReadSize;
+		char *buffer = realloc(stream->buffer, capacity);
+		if (buffer == NULL)
+			return kRMTileFetchNetworkError;
+		stream->buffer = buffer;
+		stream->capacity = capacity;
+	}
+
+	for (;;) {
+		if ((error = RMTileFetcherPoll(stream->fetcher, stream->fd, POLLIN, stream->deadline)) != 0)
+			return error;
+		got = recv(stream->fd, stream->buffer + stream->end, stream->capacity - stream->end, 0);
+		if (got >= 0)
+			break;
+		if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+			return kRMTileFetchNetworkError;
+	}
+	stream->end += got;
+	stream->received += got;
+	return (int)got;
+}
+
+// Reads a line, without its CRLF, into line.
+static int RMTileFetcherReadLine(RMTileFetchStream *stream, char *line, size_t size)
+{
+	for (;;) {
+		char *newline = NULL;
+		int got;
+
+		if (stream->end > stream->start)
+			newline = memchr(stream->buffer + stream->start, '\n', stream->end - stream->start);
+
+		if (newline != NULL) {
+			size_t length = newline - (stream->buffer + stream->start);
+			if (length > 0 && newline[-1] == '\r')
+				length--;
+			if (length >= size)
+				return kRMTileFetchBadResponse;
+			memcpy(line, stream->buffer + stream->start, length);
+			line[length] = '\0';
+			stream->start = newline + 1 - stream->buffer;
+			return 0;
+		}
+		if (stream->end - stream->start >= size)
+			return kRMTileFetchBadResponse;
+		if ((got = RMTileFetcherFill(stream)) <= 0)
+			return got == 0 ? kRMTileFetchNetworkError : got;
+	}
+}
+
+static int RMTileFetcherAppend(RMTileFetchRequest *request, const char *data, size_t length)
+{
+	if (request->capacity - request->length < length) {
+		size_t capacity = request->capacity ? request->capacity : 16384;
+		char *body;
+		while (capacity - request->length < length)
+			capacity *= 2;
+		body = realloc(request->body, capacity);
+		if (body == NULL)
+			return kRMTileFetchNetworkError;
+		request->body = body;
+		request->capacity = capacity;
+	}
+	memcpy(request->body + request->length, data, length);
+	request->length += length;
+	return 0;
+}
+
+// Reads length bytes of body, or up to the end of the connection if toClose.
+static int RMTileFetcherReadBody(RMTileFetchStream *stream, RMTileFetchRequest *request, unsigned long long length, int toClose)
+{
+	while (toClose || length > 0) {
+		size_t available = stream->end - stream->start;
+		int got, error;
+
+		if (available > 0) {
+			if (!toClose && available > length)
+				available = (size_t)length;
+			if ((error = RMTileFetcherAppend(request, stream->buffer + stream->start, available)) != 0)
+				return error;
+			stream->start += available;
+			length -= toClose ? 0 : available;
+			continue;
+		}
+		if ((got = RMTileFetcherFill(stream)) <= 0) {
+			if (got == 0)
+				return toClose ? 0 : kRMTileFetchNetworkError;
+			return got;
+		}
+	}
+	return 0;
+}
+
+// Whether a comma separated header value lists token.
+static int RMTileFetcherHasToken(const char *value, const char *token)
+{
+	size_t size = strlen(token);
+
+	while (*value != '\0') {
+		size_t length;
+		value += strspn(value, " \t,");
+		length = strcspn(value, ",");
+		while (length > 0 && (value[length - 1] == ' ' || value[length - 1] == '\t'))
+			length--;
+		if (length == size && strncasecmp(value, token, size) == 0)
+			return 1;
+		value += strcspn(value, ",");
+	}
+	return 0;
+}
+
+static int RMTileFetcherReadChunks(RMTileFetchStream *stream, RMTileFetchRequest *request)
+{
+	char line[kRMTileFetcherMaxLine];
+	int error;
+
+	for (;;) {
+		char *end;
+		unsigned long size;
+
+		if ((error = RMTileFetcherReadLine(stream, line, sizeof(line))) != 0)
+			return error;
+		size = strtoul(line, &end, 16);
+		if (end == line)
+			return kRMTileFetchBadResponse;
+		if (size == 0)
+			break;
+		if ((error = RMTileFetcherReadBody(stream, request, size, 0)) != 0)
+			return error;
+		if ((error = RMTileFetcherReadLine(stream, line, sizeof(line))) != 0)
+			return error;
+	}
+	// trailers
+	do {
+		if ((error = RMTileFetcherReadLine(stream, line, sizeof(line))) != 0)
+			return error;
+	} while (line[0] != '\0');
+	return 0;
+}
+
+// Reads a response into request. Returns 0 or the error, and whether the connection stays open.
+static int RMTileFetcherReadResponse(RMTileFetchStream *stream, RMTileFetchRequest *request, int *keepAlive, int *http11)
+{
+	char line[kRMTileFetcherMaxLine];
+	unsigned long long length = 0;
+	int status, chunked, sized, error;
+
+	do {
+		int major, minor;
+
+		if ((error = RMTileFetcherReadLine(stream, line, sizeof(line))) != 0)
+			return error;
+		if (sscanf(line, "HTTP/%d.%d %d", &major, &minor, &status) != 3 || status < 100 || status > 999)
+			return kRMTileFetchBadResponse;
+		*http11 = major > 1 || (major == 1 && minor >= 1);
+		*keepAlive = *http11;
+		chunked = sized = 0;
+
+		for (;;) {
+			char *value;
+
+			if ((error = RMTileFetcherReadLine(stream, line, sizeof(line))) != 0)
+				return error;
+			if (line[0] == '\0')
+				break;
+			value = strchr(line, ':');
+			if (value == NULL)
+				continue;
+			*value++ = '\0';
+			value += strspn(value, " \t");
+			if (strcasecmp(line, "Content-Length") == 0) {
+				length = strtoull(value, NULL, 10);
+				sized = 1;
+			} else if (strcasecmp(line, "Transfer-Encoding") == 0) {
+				chunked = RMTileFetcherHasToken(value, "chunked");
+			} else if (strcasecmp(line, "Connection") == 0) {
+				if (RMTileFetcherHasToken(value, "close"))
+					*keepAlive = 0;
+				else if (RMTileFetcherHasToken(value, "keep-alive"))
+					*keepAlive = 1;
+			}
+		}
+	} while (status < 200);		// 100 Continue and the like come before the response
+
+	request->status = status;
+	request->length = 0;
+	if (status == 204 || status == 304)
+		return 0;
+	if (chunked)
+		return RMTileFetcherReadChunks(stream, request);
+	if (sized)
+		return RMTileFetcherReadBody(stream, request, length, 0);
+	*keepAlive = 0;
+	return RMTileFetcherReadBody(stream, request, 0, 1);
+}
+
+static int RMTileFetcherSendRequests(RMTileFetcher *fetcher, int fd, RMTileFetchRequest **batch, size_t count)
+{
+	const char *userAgent = fetcher->userAgent != NULL ? fetcher->userAgent : "";
+	const char *connection = fetcher->options.idleTimeout > 0 ? "" : "Connection: close\r\n";
+	size_t size = 1, used = 0;
+	char *text;
+	int error;
+
+	for (size_t i = 0; i < count; i++)
+		size += strlen(batch[i]->path) + strlen(batch[i]->host->header) + strlen(userAgent) + 96;
+	text = malloc(size);
+	if (text == NULL)
+		return kRMTileFetchNetworkError;
+	for (size_t i = 0; i < count; i++) {
+		used += snprintf(text + used, size - used, "GET %s HTTP/1.1\r\nHost: %s\r\n%s%s%sAccept: */*\r\n%s\r\n",
+						 batch[i]->path, batch[i]->host->header,
+						 *userAgent ? "User-Agent: " : "", userAgent, *userAgent ? "\r\n" : "", connection);
+	}
+	error = RMTileFetcherSend(fetcher, fd, text, used);
+	free(text);
+	return error;
+}
+
+// Sends the requests on *connection, or on a new connection if NULL, and reads their responses
+// into them. Leaves *connection to be kept alive, or NULL if it was closed.
+static void RMTileFetcherExchange(RMTileFetcher *fetcher, RMTileFetchConnection **connection, RMTileFetchRequest **batch, size_t count)
+{
+	RMTileFetchConnection *c = *connection;
+	RMTileFetchStream stream;
+	int reused = c != NULL, keepAlive = 0, http11 = 0, error;
+	size_t answered = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		batch[i]->status = kRMTileFetchNotSent;
+		batch[i]->length = 0;
+	}
+	*connection = NULL;
+
+	if (c == NULL) {
+		int fd;
+		if ((error = RMTileFetcherConnect(fetcher, batch[0]->host, &fd)) != 0) {
+			batch[0]->status = error;
+			return;
+		}
+		c = calloc(1, sizeof(RMTileFetchConnection));
+		if (c == NULL) {
+			close(fd);
+			batch[0]->status = kRMTileFetchNetworkError;
+			return;
+		}
+		c->fd = fd;
+		pthread_mutex_lock(&fetcher->lock);
+		fetcher->statistics.connections++;
+		pthread_mutex_unlock(&fetcher->lock);
+	}
+
+	memset(&stream, 0, sizeof(stream));
+	stream.fetcher = fetcher;
+	stream.fd = c->fd;
+	error = RMTileFetcherSendRequests(fetcher, c->fd, batch, count);
+	while (error == 0 && answered < count) {
+		stream.deadline = RMTileFetcherNow() + fetcher->options.timeout;
+		error = RMTileFetcherReadResponse(&stream, batch[answered], &keepAlive, &http11);
+		if (error != 0)
+			break;
+		answered++;
+		if (!keepAlive)
+			break;
+	}
+	free(stream.buffer);
+
+	// a kept-alive connection that the server closed while it was idle fails before answering
+	// anything; the requests then go again on another without counting an attempt
+	if (error != 0 && !(reused && error == kRMTileFetchNetworkError && stream.received == 0))
+		batch[answered]->status = error;
+
+	if (error == 0 && keepAlive && answered == count && fetcher->options.idleTimeout > 0) {
+		c->pipelines = http11;
+		*connection = c;
+	} else {
+		close(c->fd);
+		free(c);
+	}
+}
+
+// Takes a kept-alive connection to host, closing those that were idle too long or that the
+// server has closed. Called with the lock held.
+static RMTileFetchConnection *RMTileFetcherTakeConnection(RMTileFetcher *fetcher, RMTileFetchHost *host, double now)
+{
+	while (host->idle != NULL) {
+		RMTileFetchConnection *connection = host->idle;
+		struct pollfd fd;
+
+		host->idle = connection->next;
+		fd.fd = connection->fd;
+		fd.events = POLLIN;
+		fd.revents = 0;
+		// an idle connection is readable only if it was closed or is out of step
+		if (now - connection->idleSince < fetcher->options.idleTimeout && poll(&fd, 1, 0) == 0)
+			return connection;
+		close(connection->fd);
+		free(connection);
+	}
+	return NULL;
+}
+
+static void RMTileFetcherKeepConnection(RMTileFetcher *fetcher, RMTileFetchHost *host, RMTileFetchConnection *connection)
+{
+	unsigned idle = 0;
+
+	for (RMTileFetchConnection *c = host->idle; c != NULL; c = c->next)
+		idle++;
+	if (fetcher->stopping || idle >= fetcher->options.maxPerHost) {
+		close(connection->fd);
+		free(connection);
+		return;
+	}
+	connection->idleSince = RMTileFetcherNow();
+	connection->next = host->idle;
+	host->idle = connection;
+}
+
+// The most urgent request that may be sent now, to host if not NULL, or to any host with a
+// connection to spare. Lowers *wakeAt to when the first one backing off may go. Called with the
+// lock held.
+static RMTileFetchRequest *RMTileFetcherNext(RMTileFetcher *fetcher, RMTileFetchHost *host, double now, double *wakeAt)
+{
+	RMTileFetchRequest *best = NULL;
+
+	for (RMTileFetchRequest *request = fetcher->requests; request != NULL; request = request->next) {
+		if (request->running || (host != NULL && request->host != host))
+			continue;
+		if (request->notBefore > now) {
+			if (*wakeAt == 0 || request->notBefore < *wakeAt)
+				*wakeAt = request->notBefore;
+			continue;
+		}
+		if (host == NULL && request->host->active >= fetcher->options.maxPerHost)
+			continue;
+		if (best == NULL || request->kind < best->kind || (request->kind == best->kind && request->sequence < best->sequence))
+			best = request;
+	}
+	return best;
+}
+
+static int RMTileFetcherRetryable(const RMTileFetchRequest *request)
+{
+	switch (request->status) {
+		case kRMTileFetchNetworkError:
+		case kRMTileFetchTimedOut:
+		case kRMTileFetchBadResponse:
+		case 500:
+		case 502:
+		case 503:
+		case 504:
+			return 1;
+		case 200:
+			return request->length == 0;
+		default:
+			return 0;
+	}
+}
+
+static void *RMTileFetcherWorker(void *argument)
+{
+	RMTileFetcher *fetcher = argument;
+	RMTileFetchRequest *batch[kRMTileFetcherMaxPipeline];
+
+	pthread_mutex_lock(&fetcher->lock);
+	while (!fetcher->stopping) {
+		double now = RMTileFetcherNow(), wakeAt = 0;
+		RMTileFetchRequest *request = RMTileFetcherNext(fetcher, NULL, now, &wakeAt), *finished = NULL;
+		RMTileFetchConnection *connection;
+		RMTileFetchHost *host;
+		size_t count = 0;
+
+		if (request == NULL) {
+			if (wakeAt > 0) {
+				struct timespec until;
+				until.tv_sec = (time_t)wakeAt;
+				until.tv_nsec = (long)((wakeAt - until.tv_sec) * 1e9);
+				pthread_cond_timedwait(&fetcher->work, &fetcher->lock, &until);
+			} else {
+				pthread_cond_wait(&fetcher->work, &fetcher->lock);
+			}
+			continue;
+		}
+
+		host = request->host;
+		host->active++;
+		connection = RMTileFetcherTakeConnection(fetcher, host, now);
+		do {
+			request->running = 1;
+			batch[count++] = request;
+			fetcher->statistics.fetches++;
+			fetcher->statistics.retries += request->attempts > 0;
+		} while (connection != NULL && connection->pipelines && count < fetcher->options.pipelineDepth &&
+				 (request = RMTileFetcherNext(fetcher, host, now, &wakeAt)) != NULL);
+		fetcher->statistics.reused += connection != NULL ? count : 0;
+		fetcher->statistics.pipelined += count - 1;
+		pthread_mutex_unlock(&fetcher->lock);
+
+		RMTileFetcherExchange(fetcher, &connection, batch, count);
+
+		pthread_mutex_lock(&fetcher->lock);
+		host->active--;
+		if (connection != NULL)
+			RMTileFetcherKeepConnection(fetcher, host, connection);
+		now = RMTileFetcherNow();
+		for (size_t i = 0; i < count; i++) {
+			request = batch[i];
+			request->running = 0;
+			if (request->waiters == NULL) {
+				// everybody cancelled while it was in flight
+				RMTileFetcherUnlink(fetcher, request);
+				RMTileFetcherFreeRequest(request);
+				continue;
+			}
+			if (request->status == kRMTileFetchNotSent)
+				continue;
+			if (RMTileFetcherRetryable(request) && request->attempts < fetcher->options.maxRetries && !fetcher->stopping) {
+				double random = rand_r(&fetcher->seed) / (RAND_MAX + 1.0);
+				request->notBefore = now + RMTileFetcherBackoff(request->attempts, fetcher->options.backoffBase, fetcher->options.backoffCap, random);
+				request->attempts++;
+				continue;
+			}
+			if (request->status < 0 || request->status >= 400)
+				fetcher->statistics.failed++;
+			RMTileFetcherUnlink(fetcher, request);
+			request->next = finished;
+			finished = request;
+		}
+		// a connection is free, and retries may need waiting for
+		pthread_cond_broadcast(&fetcher->work);
+		pthread_mutex_unlock(&fetcher->lock);
+
+		while (finished != NULL) {
+			RMTileFetchRequest *next = finished->next;
+			RMTileFetcherDeliver(finished, finished->status);
+			finished = next;
+		}
+		pthread_mutex_lock(&fetcher->lock);
+	}
+	pthread_mutex_unlock(&fetcher->lock);
+	return NULL;
+}
+
+RMTileFetcher *RMTileFetcherCreate(const RMTileFetcherOptions *options)
+{
+	RMTileFetcher *fetcher = calloc(1, sizeof(RMTileFetcher));
+
+	if (fetcher == NULL)
+		return NULL;
+	if (options != NULL)
+		fetcher->options = *options;
+	else
+		RMTileFetcherDefaultOptions(&fetcher->options);
+	if (fetcher->options.maxConnections == 0)
+		fetcher->options.maxConnections = 1;
+	if (fetcher->options.maxPerHost == 0)
+		fetcher->options.maxPerHost = 1;
+	if (fetcher->options.pipelineDepth == 0)
+		fetcher->options.pipelineDepth = 1;
+	if (fetcher->options.pipelineDepth > kRMTileFetcherMaxPipeline)
+		fetcher->options.pipelineDepth = kRMTileFetcherMaxPipeline;
+	if (fetcher->options.userAgent != NULL)
+		fetcher->userAgent = strdup(fetcher->options.userAgent);
+	fetcher->options.userAgent = NULL;
+	fetcher->seed = (unsigned)RMTileFetcherNow() ^ (unsigned)(uintptr_t)fetcher;
+
+	fetcher->threads = calloc(fetcher->options.maxConnections, sizeof(pthread_t));
+	if (fetcher->threads == NULL || pipe(fetcher->wake) != 0) {
+		free(fetcher->threads);
+		free(fetcher->userAgent);
+		free(fetcher);
+		return NULL;
+	}
+	pthread_mutex_init(&fetcher->lock, NULL);
+	pthread_cond_init(&fetcher->work, NULL);
+
+	for (; fetcher->threadCount < fetcher->options.maxConnections; fetcher->threadCount++) {
+		if (pthread_create(&fetcher->threads[fetcher->threadCount], NULL, RMTileFetcherWorker, fetcher) != 0) {
+			RMTileFetcherFree(fetcher);
+			return NULL;
+		}
+	}
+	return fetcher;
+}
+
+void RMTileFetcherFree(RMTileFetcher *fetcher)
+{
+	char stop = 0;
+
+	if (fetcher == NULL)
+		return;
+
+	pthread_mutex_lock(&fetcher->lock);
+	fetcher->stopping = 1;
+	pthread_cond_broadcast(&fetcher->work);
+	pthread_mutex_unlock(&fetcher->lock);
+	while (write(fetcher->wake[1], &stop, 1) < 0 && errno == EINTR)
+		;
+
+	for (unsigned i = 0; i < fetcher->threadCount; i++)
+		pthread_join(fetcher->threads[i], NULL);
+
+	while (fetcher->requests != NULL) {
+		RMTileFetchRequest *next = fetcher->requests->next;
+		RMTileFetcherDeliver(fetcher->requests, kRMTileFetchCancelled);
+		fetcher->requests = next;
+	}
+	while (fetcher->hosts != NULL) {
+		RMTileFetchHost *next = fetcher->hosts->next;
+		while (fetcher->hosts->idle != NULL) {
+			RMTileFetchConnection *connection = fetcher->hosts->idle;
+			fetcher->hosts->idle = connection->next;
+			close(connection->fd);
+			free(connection);
+		}
+		free(fetcher->hosts->name);
+		free(fetcher->hosts->port);
+		free(fetcher->hosts->header);
+		free(fetcher->hosts);
+		fetcher->hosts = next;
+	}
+
+	close(fetcher->wake[0]);
+	close(fetcher->wake[1]);
+	pthread_cond_destroy(&fetcher->work);
+	pthread_mutex_destroy(&fetcher->lock);
+	free(fetcher->threads);
+	free(fetcher->userAgent);
+	free(fetcher);
+}
+
+int RMTileFetcherGet(RMTileFetcher *fetcher, const char *url, RMTileRequestKind kind, RMTileFetcherCallback callback, void *context)
+{
+	char name[256], port[8], *path;
+	RMTileFetchWaiter *waiter;
+	RMTileFetchRequest *request;
+	RMTileFetchHost *host;
+	int accepted = 0;
+
+	if (!RMTileFetcherParse(url, name, sizeof(name), port, sizeof(port), &path))
+		return 0;
+	waiter = malloc(sizeof(RMTileFetchWaiter));
+	if (waiter == NULL) {
+		free(path);
+		return 0;
+	}
+	waiter->callback = callback;
+	waiter->context = context;
+
+	pthread_mutex_lock(&fetcher->lock);
+	request = RMTileFetcherFind(fetcher, url);
+	if (request != NULL) {
+		waiter->next = request->waiters;
+		request->waiters = waiter;
+		if (kind < request->kind)
+			request->kind = kind;
+		fetcher->statistics.requests++;
+		fetcher->statistics.coalesced++;
+		free(path);
+		accepted = 1;
+		goto done;
+	}
+
+	host = RMTileFetcherHost(fetcher, name, port);
+	request = calloc(1, sizeof(RMTileFetchRequest));
+	if (host == NULL || request == NULL || (request->url = strdup(url)) == NULL) {
+		free(request);
+		free(path);
+		free(waiter);
+		goto done;
+	}
+	request->path = path;
+	request->host = host;
+	request->kind = kind;
+	request->sequence = fetcher->sequence++;
+	waiter->next = NULL;
+	request->waiters = waiter;
+	request->next = fetcher->requests;
+	fetcher->requests = request;
+	fetcher->statistics.requests++;
+	pthread_cond_signal(&fetcher->work);
+	accepted = 1;
+
+done:
+	pthread_mutex_unlock(&fetcher->lock);
+	return accepted;
+}
+
+void RMTileFetcherPromote(RMTileFetcher *fetcher, const char *url, RMTileRequestKind kind)
+{
+	RMTileFetchRequest *request;
+
+	pthread_mutex_lock(&fetcher->lock);
+	request = RMTileFetcherFind(fetcher, url);
+	if (request != NULL && kind < request->kind)
+		request->kind = kind;
+	pthread_mutex_unlock(&fetcher->lock);
+}
+
+int RMTileFetcherCancel(RMTileFetcher *fetcher, const char *url, void *context)
+{
+	RMTileFetchRequest *request;
+	int cancelled = 0;
+
+	pthread_mutex_lock(&fetcher->lock);
+	request = RMTileFetcherFind(fetcher, url);
+	if (request != NULL) {
+		for (RMTileFetchWaiter **link = &request->waiters; *link != NULL; link = &(*link)->next) {
+			if ((*link)->context == context) {
+				RMTileFetchWaiter *waiter = *link;
+				*link = waiter->next;
+				free(waiter);
+				cancelled = 1;
+				fetcher->statistics.cancelled++;
+				break;
+			}
+		}
+		if (cancelled && request->waiters == NULL && !request->running) {
+			RMTileFetcherUnlink(fetcher, request);
+			RMTileFetcherFreeRequest(request);
+		}
+	}
+	pthread_mutex_unlock(&fetcher->lock);
+	return cancelled;
+}
+
+RMTileFetcherStatistics RMTileFetcherGetStatistics(RMTileFetcher *fetcher)
+{
+	RMTileFetcherStatistics statistics;
+
+	pthread_mutex_lock(&fetcher->lock);
+	statistics = fetcher->statistics;
+	pthread_mutex_unlock(&fetcher->lock);
+	return statistics;
+}
+
+void RMTileFetcherResetStatistics(RMTileFetcher *fetcher)
+{
+	pthread_mutex_lock(&fetcher->lock);
+	memset(&fetcher->statistics, 0, sizeof(fetcher->statistics));
+	pthread_mutex_unlock(&fetcher->lock);
+}
@@ -0,0 +1,128 @@
+//
+//  RMTileFetcher.h
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _RMTILEFETCHER_H_
+#define _RMTILEFETCHER_H_
+
+#include <stddef.h>
+#include "RMTileScheduler.h"
+
+/*! \file RMTileFetcher.h
+ */
+/*! \struct RMTileFetcher
+ \brief Fetches tiles over HTTP/1.1 on a bounded number of kept-alive connections per host.
+
+ Getting a URL that is being fetched already joins that fetch instead of sending another
+ request, and every caller is called back with the same response. Fetches are sent most urgent
+ first, visible tiles before prefetched ones, on at most maxPerHost connections to each host,
+ which are kept alive and reused. Once a connection has answered with an HTTP/1.1 keep-alive
+ response, up to pipelineDepth requests are sent on it back to back.
+
+ Network errors, timeouts, server errors 500, 502, 503 and 504, and empty responses are retried
+ up to maxRetries times, after a backoff that doubles with every attempt and has a random part,
+ so that many failed tiles do not all come back at once.
+
+ Only http:// URLs are fetched; callers use something else for other schemes. Plain C on top of
+ POSIX sockets and pthreads; all functions are thread safe.
+ */
+typedef struct RMTileFetcher RMTileFetcher;
+
+/// Given to the callback instead of an HTTP status.
+enum {
+	/// the host could not be resolved or connected to, or the connection broke
+	kRMTileFetchNetworkError = -1,
+	/// no response within the timeout
+	kRMTileFetchTimedOut = -2,
+	/// the response was not HTTP
+	kRMTileFetchBadResponse = -3,
+	/// the fetcher was freed first
+	kRMTileFetchCancelled = -4,
+};
+
+/// Called once for every get that is not cancelled, on a thread of the fetcher and without it
+/// locked, with the HTTP status or one of the errors above. body is only valid during the call.
+typedef void (*RMTileFetcherCallback)(void *context, int status, const void *body, size_t length);
+
+typedef struct {
+	/// threads fetching, each on one connection at a time; defaults to 8
+	unsigned maxConnections;
+	/// connections to each host at once; defaults to 4
+	unsigned maxPerHost;
+	/// requests in flight on one connection; 1, the default, turns pipelining off
+	unsigned pipelineDepth;
+	/// attempts after the first; defaults to 5
+	unsigned maxRetries;
+	/// the first backoff, and the longest, in seconds; default to 0.5 and 30
+	double backoffBase, backoffCap;
+	/// seconds to connect and to wait for each response; defaults to 30
+	double timeout;
+	/// seconds an idle connection is kept for reuse; 0 closes every connection after a response
+	double idleTimeout;
+	/// sent as the User-Agent header if not NULL
+	const char *userAgent;
+} RMTileFetcherOptions;
+
+/// Counters since the fetcher was created or the statistics were last reset.
+typedef struct {
+	/// gets, and those of them that joined a fetch of the same URL
+	unsigned long requests, coalesced;
+	/// requests sent, and those of them that were retries
+	unsigned long fetches, retries;
+	/// connections opened, and requests sent on a connection that was kept alive
+	unsigned long connections, reused;
+	/// requests sent while another was in flight on the same connection
+	unsigned long pipelined;
+	/// gets cancelled, and fetches given up with an error or an HTTP status of 400 or more
+	unsigned long cancelled, failed;
+} RMTileFetcherStatistics;
+
+void RMTileFetcherDefaultOptions(RMTileFetcherOptions *options);
+
+/// Creates a fetcher with its threads. options may be NULL for the defaults. Returns NULL if the
+/// threads cannot be started or out of memory.
+RMTileFetcher *RMTileFetcherCreate(const RMTileFetcherOptions *options);
+/// Stops the threads, after the responses they are reading, and calls back the gets that are
+/// left with kRMTileFetchCancelled.
+void RMTileFetcherFree(RMTileFetcher *fetcher);
+
+/// Fetches url, and calls back with context. Returns 0, and never calls back, if url is not an
+/// http:// URL or out of memory.
+int RMTileFetcherGet(RMTileFetcher *fetcher, const char *url, RMTileRequestKind kind, RMTileFetcherCallback callback, void *context);
+/// Makes a queued fetch of url as urgent as kind.
+void RMTileFetcherPromote(RMTileFetcher *fetcher, const char *url, RMTileRequestKind kind);
+/// Stops calling back context for url, and returns 1 if it had not been called back yet. The
+/// fetch goes on while other gets wait for it, and is dropped before it is sent otherwise.
+int RMTileFetcherCancel(RMTileFetcher *fetcher, const char *url, void *context);
+
+RMTileFetcherStatistics RMTileFetcherGetStatistics(RMTileFetcher *fetcher);
+void RMTileFetcherResetStatistics(RMTileFetcher *fetcher);
+
+/// Seconds to wait before the given retry, from 0: half of base * 2^attempt, at most half of cap,
+/// plus random, from 0 to 1, times as much again.
+double RMTileFetcherBackoff(unsigned attempt, double base, double cap, double random);
+
+#endif
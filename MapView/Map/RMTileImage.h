@@ -49,11 +49,30 @@ typedef NSImage UIImage;
  RMTileImage will be used in only one UIView. Might see some interesting crashes if you have two RMMapViews
  using the same tile source.
  
- Every RMTileImage will observe for an RMMapImageLoadingCancelledNotification to prevent loading.
- 
- Upon the image being loaded, RMTileImage will also post an RMMapImageLoadedNotification to the default
- notification center.
+ Whoever waits for the image, like the caches that store its data and the image set that shows
+ it, adds itself as an RMTileImageObserver and is called back directly once the image has loaded,
+ failed or been cancelled. Nothing is posted to the notification center for this.
  */
+@protocol RMTileImageObserver<NSObject>
+@optional
+/// The image has loaded from data.
+-(void) tileImage: (RMTileImage*)image didLoadData: (NSData*)data;
+/// The image will not load. error may be nil.
+-(void) tileImage: (RMTileImage*)image didFailWithError: (NSError*)error;
+/// Loading was cancelled, usually because the image went off screen.
+-(void) tileImageDidCancelLoading: (RMTileImage*)image;
+@end
+
+/// Cost of calling back the observers of tile images, over all images since the last reset.
+typedef struct {
+	/// loads, failures and cancellations that had observers
+	unsigned long long dispatches;
+	/// observer methods called
+	unsigned long long callbacks;
+	/// time spent in them, in seconds
+	double seconds;
+} RMTileImageDispatchStatistics;
+
 @interface RMTileImage : NSObject
 {
 	// I know this is a bit nasty.
@@ -67,6 +86,9 @@ typedef NSImage UIImage;
 	/// one UIView. Might see some interesting crashes if you have two RMMapViews using the same tile source.
 	// Only used when appropriate
 	CALayer *layer;
+
+	/// Waiting for the image to load, retained until it has
+	NSMutableArray *observers;
 }
 
 /// Creates an RMTileImage given an RMTile point, but does not load an image.
@@ -99,10 +121,32 @@ typedef NSImage UIImage;
 /// Creates the CALayer accessible with #layer.  See #layer for details.
 - (void)makeLayer;
 
-/// Prevents the tile from loading further.
+/// Prevents the tile from loading further, and tells the observers.
 - (void)cancelLoading;
 
-/// Updates the object with image data, and posts a notification that the image tile was loaded.
+/// While set, new images that load in the background do so after all those that are on screen.
+/// Main thread only.
++ (void)setPrefetching: (BOOL) prefetching;
++ (BOOL)isPrefetching;
+
+/// The image, asked for ahead of time, is needed on screen now. Images that load in the
+/// background move ahead of the prefetched ones; others do nothing.
+- (void)prioritize;
+
+/// Adds an object to call back when the image has loaded, failed or been cancelled. The observer is
+/// retained until then, and called only once; it is not called at all if the image has loaded already.
+- (void)addObserver: (id<RMTileImageObserver>)observer;
+/// Stops calling back an observer, and releases it.
+- (void)removeObserver: (id<RMTileImageObserver>)observer;
+
+/// Tells the observers the image will not load. For subclasses that load images.
+- (void)failWithError: (NSError*) error;
+
+/// Counters for all tile images, read and reset on any thread.
++ (RMTileImageDispatchStatistics)dispatchStatistics;
++ (void)resetDispatchStatistics;
+
+/// Updates the object with image data, and tells the observers that the image tile was loaded.
 - (void)updateImageUsingData: (NSData*) data;
 /// Updates the object with an image, setting the layer contents.
 - (void)updateImageUsingImage: (UIImage*) image;
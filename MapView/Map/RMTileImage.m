@@ -34,6 +34,9 @@
 #import "RMPixel.h"
 #import <QuartzCore/QuartzCore.h>
 
+static RMTileImageDispatchStatistics dispatchStatistics;
+static BOOL prefetchingImages = NO;
+
 @implementation RMTileImage
 
 #pragma mark -
@@ -71,15 +74,12 @@
     layer = nil;
     lastUsedTime = nil;
     screenLocation = CGRectZero;
+    observers = nil;
     
     [self makeLayer];
     
     [self touch];
 	
-    [[NSNotificationCenter defaultCenter] addObserver:self
-                                             selector:@selector(tileRemovedFromScreen:)
-                                                 name:RMMapImageRemovedFromScreenNotification object:self];
-    
 	return self;
 }
 
@@ -94,7 +94,9 @@
 {
 //	RMLog(@"Removing tile image %d %d %d", tile.x, tile.y, tile.zoom);
 	
-	[[NSNotificationCenter defaultCenter] removeObserver:self];
+	// observers do not hold on to the image, so they are not told it is going away
+	[observers release];
+	observers = nil;
 
 	[layer release];
     layer = nil;
@@ -141,30 +143,115 @@
 }
 
 #pragma mark -
-#pragma mark Cancelling image loading
--(void) tileRemovedFromScreen: (NSNotification*) notification
+#pragma mark Observers
+- (void)addObserver: (id<RMTileImageObserver>)observer
+{
+	if (observer == nil || [self isLoaded])
+		return;
+
+	if (observers == nil)
+		observers = [[NSMutableArray alloc] initWithCapacity:4];
+	else if ([observers indexOfObjectIdenticalTo:observer] != NSNotFound)
+		return;
+
+	[observers addObject:observer];
+}
+
+- (void)removeObserver: (id<RMTileImageObserver>)observer
+{
+	[observers removeObjectIdenticalTo:observer];
+}
+
++ (RMTileImageDispatchStatistics)dispatchStatistics
 {
-	[self cancelLoading];
+	RMTileImageDispatchStatistics statistics;
+	@synchronized ([RMTileImage class]) {
+		statistics = dispatchStatistics;
+	}
+	return statistics;
+}
+
++ (void)resetDispatchStatistics
+{
+	@synchronized ([RMTileImage class]) {
+		memset(&dispatchStatistics, 0, sizeof(dispatchStatistics));
+	}
+}
+
+/// Calls selector on every observer that implements it, and lets go of them all; each is called
+/// back only once. The list is taken first, so that observers can add and remove while called.
+- (void)tellObservers: (SEL)selector withObject: (id)object
+{
+	NSArray *called;
+	NSUInteger callbacks = 0;
+	CFAbsoluteTime start;
+
+	if (observers == nil)
+		return;
+
+	called = observers;
+	observers = nil;
+
+	start = CFAbsoluteTimeGetCurrent();
+	for (id<RMTileImageObserver> observer in called)
+	{
+		if (![observer respondsToSelector:selector])
+			continue;
+
+		if (selector == @selector(tileImageDidCancelLoading:))
+			[observer tileImageDidCancelLoading:self];
+		else if (selector == @selector(tileImage:didLoadData:))
+			[observer tileImage:self didLoadData:object];
+		else
+			[observer tileImage:self didFailWithError:object];
+		callbacks++;
+	}
+	
+	@synchronized ([RMTileImage class]) {
+		dispatchStatistics.dispatches++;
+		dispatchStatistics.callbacks += callbacks;
+		dispatchStatistics.seconds += CFAbsoluteTimeGetCurrent() - start;
+	}
+
+	[called release];
 }
 
+#pragma mark -
+#pragma mark Cancelling image loading
 -(void)draw
 {
 }
 
 -(void) cancelLoading
 {
-	[[NSNotificationCenter defaultCenter] postNotificationName:RMMapImageLoadingCancelledNotification
-														object:self];
+	[self tellObservers:@selector(tileImageDidCancelLoading:) withObject:nil];
+}
+
++ (void)setPrefetching: (BOOL) prefetching
+{
+	prefetchingImages = prefetching;
+}
+
++ (BOOL)isPrefetching
+{
+	return prefetchingImages;
+}
+
+- (void)prioritize
+{
+}
+
+- (void)failWithError: (NSError*) error
+{
+	[self tellObservers:@selector(tileImage:didFailWithError:) withObject:error];
 }
 
 #pragma mark -
 #pragma mark Image loading
 - (void)updateImageUsingData: (NSData*) data
 {
-       [self updateImageUsingImage:[UIImage imageWithData:data]];
-
-       NSDictionary *d = [NSDictionary dictionaryWithObject:data forKey:@"data"];
-       [[NSNotificationCenter defaultCenter] postNotificationName:RMMapImageLoadedNotification object:self userInfo:d];
+	[self updateImageUsingImage:[UIImage imageWithData:data]];
+	[self tellObservers:@selector(tileImage:didLoadData:) withObject:data];
 }
 
 - (void)updateImageUsingImage: (UIImage*) rawImage
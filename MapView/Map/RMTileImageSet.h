@@ -32,8 +32,11 @@
 #	import <Cocoa/Cocoa.h>
 #endif
 #import "RMTile.h"
+#import "RMTileImage.h"
+#import "RMTileIndex.h"
+#import "RMTileCoverage.h"
+#import "RMTilePrefetch.h"
 
-@class RMTileImage;
 @protocol RMTileSource;
 
 @protocol RMTileImageSetDelegate<NSObject>
@@ -45,10 +48,14 @@
 
 @end
 
-@interface RMTileImageSet : NSObject {
+@interface RMTileImageSet : NSObject<RMTileImageObserver> {
 	IBOutlet id delegate;
 	id<RMTileSource> tileSource;
-	NSMutableSet *images;
+	RMTileIndex *images;		// retained RMTileImages by tile
+	RMTileCoverage *loadedTiles;	// the tiles of the loaded images among them
+	RMTileIndex *prefetched;	// retained RMTileImages asked for ahead of time, by tile
+	NSUInteger prefetchBudget;
+	RMTilePrefetchStatistics prefetchStatistics;
 	short zoom, tileDepth;
 }
 /// The delegate object that is informed when tiles are added and removed.
@@ -63,6 +70,12 @@
 /// Returns true if every image in the set has loaded.
 @property (readonly) BOOL fullyLoaded;
 
+/// The most tiles asked for ahead of time at once. Defaults to 32; 0 turns prefetching off.
+@property (assign, readwrite) NSUInteger prefetchBudget;
+
+/// How many prefetched tiles came on screen, since the set was made or the counters were reset.
+@property (readonly) RMTilePrefetchStatistics prefetchStatistics;
+
 /// Initializes the object.
 -(id) initWithDelegate: (id) _delegate;
 
@@ -92,6 +105,16 @@
 /// Changes the source of the tile set and clears any loaded tile images.
 - (void) setTileSource: (id<RMTileSource>)newTileSource;
 
+/*! Asks the tile source for the tiles that the screen, rect now, is predicted to show in a
+ second or less if it goes on moving the same way, read after the tiles on screen. Prefetched
+ tiles that are no longer predicted are cancelled, and the ones that come on screen are shown
+ from the prefetched images. Does nothing more than cancel when the screen stands still.
+ */
+- (void) prefetchTiles: (RMTileRect)rect moving: (RMTileMotion)motion;
+/// Cancels the prefetched tiles, which count as wasted.
+- (void) removeAllPrefetchedTiles;
+- (void) resetPrefetchStatistics;
+
 /// The number of images in the image set.
 -(NSUInteger) count;
 
@@ -100,8 +123,10 @@
 
 - (void)cancelLoading;
 
--(void) tileImageLoaded:(NSNotification *)notification;
 -(BOOL) isTile: (RMTile)subject worseThanTile: (RMTile)object;
+/// Returns true if the subject is worse than some loaded tile in the set, or, when countItself
+/// is set, than its own image if that has loaded. Takes a lookup per zoom level, not per tile.
+-(BOOL) isTileCoveredByBetterTile: (RMTile)subject countingItself: (BOOL)countItself;
 -(RMTileImage *) anyTileImage;
 
 - (void) printDebuggingInformation;
@@ -29,23 +29,89 @@
 #import "RMTileImage.h"
 #import "RMPixel.h"
 #import "RMTileSource.h"
+#import "RMScheduledTileImage.h"
+#import "RMCachedTileSource.h"
 
 // For notification strings
 #import "RMTileLoader.h"
 
 #import "RMMercatorToTileProjection.h"
 
+/// How far ahead, in seconds, prefetching looks.
+#define kRMTileImageSetPrefetchFrom 0.3
+#define kRMTileImageSetPrefetchTo 1.0
+#define kRMTileImageSetDefaultPrefetchBudget 32
+
+// Visitors of the tile index, for the loops over the images.
+
+static void RMTileImageSetCollect(void *context, RMTile tile, void *value)
+{
+	[(NSMutableArray *)context addObject:(RMTileImage *)value];
+}
+
+static void RMTileImageSetMove(void *context, RMTile tile, void *value)
+{
+	[(RMTileImage *)value moveBy:*(CGSize *)context];
+}
+
+typedef struct {
+	float factor;
+	CGPoint center;
+} RMTileImageSetZoom;
+
+static void RMTileImageSetZoomImage(void *context, RMTile tile, void *value)
+{
+	RMTileImageSetZoom *zoom = context;
+	[(RMTileImage *)value zoomByFactor:zoom->factor near:zoom->center];
+}
+
+static void RMTileImageSetCancel(void *context, RMTile tile, void *value)
+{
+	[(RMTileImage *)value cancelLoading];
+}
+
+static void RMTileImageSetRelease(void *context, RMTile tile, void *value)
+{
+	[(RMTileImage *)value release];
+}
+
+typedef struct {
+	RMTile *tiles;
+	size_t count;
+} RMTileImageSetTiles;
+
+static void RMTileImageSetCollectTile(void *context, RMTile tile, void *value)
+{
+	RMTileImageSetTiles *tiles = context;
+	tiles->tiles[tiles->count++] = tile;
+}
+
+static void RMTileImageSetCheckLoaded(void *context, RMTile tile, void *value)
+{
+	if (![(RMTileImage *)value isLoaded])
+		*(BOOL *)context = NO;
+}
+
 @implementation RMTileImageSet
 
 #pragma mark -
 #pragma mark Simple Properties
 @synthesize delegate;
 @synthesize tileDepth;
+@synthesize prefetchBudget, prefetchStatistics;
 
 
 -(NSUInteger) count
 {
-	return [images count];
+	return RMTileIndexCount(images);
+}
+
+/// All images in the set, to go through while the set changes.
+-(NSArray *) allImages
+{
+	NSMutableArray *all = [NSMutableArray arrayWithCapacity:RMTileIndexCount(images)];
+	RMTileIndexForEach(images, RMTileImageSetCollect, all);
+	return all;
 }
 #pragma mark -
 #pragma mark Initialization and deallocation
@@ -56,21 +122,28 @@
 	
 	tileSource = nil;
 	self.delegate = _delegate;
-	images = [[NSMutableSet alloc] init];
-	[[NSNotificationCenter defaultCenter]
-		addObserver:self
-		selector:@selector(tileImageLoaded:)
-		name:RMMapImageLoadedNotification
-		object:nil
-	];
+	images = RMTileIndexCreate();
+	loadedTiles = RMTileCoverageCreate();
+	prefetched = RMTileIndexCreate();
+	prefetchBudget = kRMTileImageSetDefaultPrefetchBudget;
+	memset(&prefetchStatistics, 0, sizeof(prefetchStatistics));
+	if (images == NULL || loadedTiles == NULL || prefetched == NULL)
+	{
+		[self release];
+		return nil;
+	}
 	return self;
 }
 
 -(void) dealloc
 {
-	[[NSNotificationCenter defaultCenter] removeObserver:self];
-	[self removeAllTiles];
-	[images release];
+	if (images != NULL && loadedTiles != NULL)
+		[self removeAllTiles];
+	if (prefetched != NULL)
+		[self removeAllPrefetchedTiles];
+	RMTileIndexFree(images);
+	RMTileCoverageFree(loadedTiles);
+	RMTileIndexFree(prefetched);
 	[super dealloc];
 }
 
@@ -87,8 +160,7 @@
 		return;
 	}
 	
-	RMTileImage *dummyTile = [RMTileImage dummyTile:tile];
-	img = [images member:dummyTile];
+	img = RMTileIndexGet(images, tile);
 	if (!img) {
 		return;
 	}
@@ -98,13 +170,16 @@
 		[delegate tileRemoved:tile];
 	}
 
-	[[NSNotificationCenter defaultCenter] postNotificationName:RMMapImageRemovedFromScreenNotification object:img];
-	[images removeObject:dummyTile];
+	RMTileIndexRemove(images, tile);
+	RMTileCoverageRemove(loadedTiles, tile);
+	[img removeObserver:self];
+	[img cancelLoading];
+	[img release];
 }
 
 -(void) removeAllTiles
 {
-	for (RMTileImage * img in [images allObjects]) {
+	for (RMTileImage * img in [self allImages]) {
 		[self removeTile: img.tile];
 	}
 }
@@ -118,7 +193,10 @@
 		return;
 	}
     
-	for (RMTileImage *oldImage in [images allObjects])
+	// only the tiles overlapping the new one can be worse than it
+	NSMutableArray *overlapping = [NSMutableArray array];
+	RMTileIndexForEachOverlapping(images, newTile, RMTileImageSetCollect, overlapping);
+	for (RMTileImage *oldImage in overlapping)
 	{
 		RMTile oldTile = oldImage.tile;
         
@@ -158,54 +236,12 @@
 		maxX = wrappedTile.x;
 	}
     
-	for(RMTileImage *img in [images allObjects])
+	// the index passes over the blocks of tiles within the rect
+	NSMutableArray *outside = [NSMutableArray array];
+	RMTileIndexForEachOutside(images, currentZoom, minX, maxX, minY, maxY, RMTileImageSetCollect, outside);
+	for (RMTileImage *img in outside)
 	{
-		RMTile tile = img.tile;
-		short tileZoom = tile.zoom;
-		uint32_t x, y, zoomedMinX, zoomedMaxX, zoomedMinY, zoomedMaxY;
-        
-		x = tile.x;
-		y = tile.y;
-		zoomedMinX = minX;
-		zoomedMaxX = maxX;
-		zoomedMinY = minY;
-		zoomedMaxY = maxY;
-        
-		if (tileZoom < currentZoom)
-		{
-			// Tile is too large for current zoom level
-			unsigned int dz = currentZoom - tileZoom;
-            
-			zoomedMinX >>= dz;
-			zoomedMaxX >>= dz;
-			zoomedMinY >>= dz;
-			zoomedMaxY >>= dz;
-		}
-		else
-		{
-			// Tile is too small & detailed for current zoom level
-			unsigned int dz = tileZoom - currentZoom;
-            
-			x >>= dz;
-			y >>= dz;
-		}
-        
-		if (y >= zoomedMinY && y <= zoomedMaxY)
-		{
-			if (zoomedMinX <= zoomedMaxX)
-			{
-				if (x >= zoomedMinX && x <= zoomedMaxX)
-					continue;
-			}
-			else
-			{
-				if (x >= zoomedMinX || x <= zoomedMaxX)
-					continue;
-			}
-            
-		}
-		// if haven't continued, tile is outside of rect
-		[self removeTile:tile];
+		[self removeTile:img.tile];
 	}
 }
 
@@ -264,11 +300,32 @@
 	return YES;
 }
 
+-(BOOL) isTileCoveredByBetterTile: (RMTile)subject countingItself: (BOOL)countItself
+{
+	short subjZ = subject.zoom, minZ;
+
+	if (subjZ + tileDepth >= zoom && subjZ <= zoom)
+	{
+		// this tile isn't bad, it's within zoom limits
+		return NO;
+	}
+
+	// a better tile is at most as far from the zoom level as the subject, and not more detailed
+	minZ = zoom - abs(zoom - subjZ);
+	if (!countItself && minZ == subjZ)
+	{
+		// the only loaded tile of its own zoom level that overlaps the subject is the subject
+		minZ++;
+	}
+	return RMTileCoverageCovers(loadedTiles, subject, minZ, zoom);
+}
+
 #pragma mark -
 #pragma mark Changing the tile source
 - (void) setTileSource: (id<RMTileSource>)newTileSource
 {
 	[self removeAllTiles];
+	[self removeAllPrefetchedTiles];
 
 	tileSource = newTileSource;
 }
@@ -277,31 +334,30 @@
 #pragma mark Adding tiles
 -(void) addTile: (RMTile) tile WithImage: (RMTileImage *)image At: (CGRect) screenLocation
 {
-	BOOL tileNeeded;
-
-	tileNeeded = YES;
-	for (RMTileImage *img in images)
-	{
-		if (![img isLoaded])
-		{
-			continue;
-		}
-		if ([self isTile:tile worseThanTile:img.tile])
-		{
-			tileNeeded = NO;
-			break;
-		}
-	}
-	if (!tileNeeded) {
+	if ([self isTileCoveredByBetterTile:tile countingItself:YES]) {
 		return;
 	}
 
 	if ([image isLoaded]) {
 		[self removeTilesWorseThan:image];
+	} else {
+		[image addObserver:self];
 	}
 
 	image.screenLocation = screenLocation;
-	[images addObject:image];
+	// like adding to a set, an image already there for the tile stays
+	if (RMTileIndexGet(images, image.tile) == nil)
+	{
+		if (!RMTileIndexInsert(images, image.tile, image))
+		{
+			RMLog(@"out of memory adding tile %d %d %d", tile.x, tile.y, tile.zoom);
+			[image removeObserver:self];
+			return;
+		}
+		[image retain];
+		if ([image isLoaded] && !RMTileCoverageAdd(loadedTiles, image.tile))
+			RMLog(@"out of memory adding loaded tile %d %d %d", tile.x, tile.y, tile.zoom);
+	}
 	
 	if (!RMTileIsDummy(image.tile))
 	{
@@ -309,8 +365,6 @@
 		{
 			[delegate tileAdded:tile WithImage:image];
 		}
-
-		[[NSNotificationCenter defaultCenter] postNotificationName:RMMapImageAddedToScreenNotification object:image];
 	}
 }
 
@@ -318,13 +372,20 @@
 {
 	//	RMLog(@"addTile: %d %d", tile.x, tile.y);
 	
-	RMTileImage *dummyTile = [RMTileImage dummyTile:tile];
-	RMTileImage *tileImage = [images member:dummyTile];
+	RMTileImage *tileImage = RMTileIndexGet(images, tile);
 	
 	if (tileImage != nil)
 	{
 		[tileImage setScreenLocation:screenLocation];
-		[images addObject:dummyTile];
+	}
+	else if ((tileImage = RMTileIndexRemove(prefetched, tile)) != nil)
+	{
+		prefetchStatistics.hits++;
+		if ([tileImage isLoaded])
+			prefetchStatistics.ready++;
+		[tileImage prioritize];
+		[self addTile:tile WithImage:tileImage At:screenLocation];
+		[tileImage release];
 	}
 	else
 	{
@@ -334,6 +395,88 @@
 	}
 }
 
+#pragma mark -
+#pragma mark Prefetching tiles
+- (void) prefetchTiles: (RMTileRect)rect moving: (RMTileMotion)motion
+{
+	id<RMMercatorToTileProjection> proj = [tileSource mercatorToTileProjection];
+	RMTileImageSetTiles predicted, old;
+	size_t i, j, count = 0;
+
+	if (tileSource == nil || prefetchBudget == 0)
+	{
+		[self removeAllPrefetchedTiles];
+		return;
+	}
+
+	predicted.tiles = malloc(prefetchBudget * sizeof(RMTile));
+	old.tiles = malloc((RMTileIndexCount(prefetched) + 1) * sizeof(RMTile));
+	if (predicted.tiles == NULL || old.tiles == NULL)
+	{
+		free(predicted.tiles);
+		free(old.tiles);
+		return;
+	}
+
+	predicted.count = RMTilePrefetchPredict(rect, motion, kRMTileImageSetPrefetchFrom, kRMTileImageSetPrefetchTo,
+											[tileSource minZoom], [tileSource maxZoom], predicted.tiles, prefetchBudget);
+	for (i = 0; i < predicted.count; i++)
+	{
+		RMTile tile = [proj normaliseTile:predicted.tiles[i]];
+		if (!RMTileIsDummy(tile) && RMTileIndexGet(images, tile) == nil)
+			predicted.tiles[count++] = tile;
+	}
+	predicted.count = count;
+
+	// let go of the tiles the screen is no longer heading for
+	old.count = 0;
+	RMTileIndexForEach(prefetched, RMTileImageSetCollectTile, &old);
+	for (i = 0; i < old.count; i++)
+	{
+		for (j = 0; j < predicted.count && !RMTilesEqual(old.tiles[i], predicted.tiles[j]); j++)
+			;
+		if (j == predicted.count)
+		{
+			RMTileImage *image = RMTileIndexRemove(prefetched, old.tiles[i]);
+			prefetchStatistics.wasted++;
+			[image cancelLoading];
+			[image release];
+		}
+	}
+
+	[RMTileImage setPrefetching:YES];
+	for (i = 0; i < predicted.count; i++)
+	{
+		RMTileImage *image;
+
+		if (RMTileIndexGet(prefetched, predicted.tiles[i]) != nil)
+			continue;
+		image = [tileSource tileImage:predicted.tiles[i]];
+		if (image != nil && RMTileIndexInsert(prefetched, predicted.tiles[i], image))
+		{
+			[image retain];
+			prefetchStatistics.prefetched++;
+		}
+	}
+	[RMTileImage setPrefetching:NO];
+
+	free(predicted.tiles);
+	free(old.tiles);
+}
+
+- (void) removeAllPrefetchedTiles
+{
+	prefetchStatistics.wasted += RMTileIndexCount(prefetched);
+	RMTileIndexForEach(prefetched, RMTileImageSetCancel, NULL);
+	RMTileIndexForEach(prefetched, RMTileImageSetRelease, NULL);
+	RMTileIndexRemoveAll(prefetched);
+}
+
+- (void) resetPrefetchStatistics
+{
+	memset(&prefetchStatistics, 0, sizeof(prefetchStatistics));
+}
+
 // Add tiles inside rect protected to bounds. Return rectangle containing bounds
 // extended to full tile loading area
 -(CGRect) addTiles: (RMTileRect)rect ToDisplayIn:(CGRect)bounds
@@ -348,6 +491,7 @@
 	int tileRegionHeight = (int)roundedRect.size.height;
 	id<RMMercatorToTileProjection> proj = [tileSource mercatorToTileProjection];
 	short minimumZoom = [tileSource minZoom], alternateMinimum;
+	id reader;
 
 	// Now we translate the loaded region back into screen space for loadedBounds.
 	CGRect newLoadedBounds;
@@ -362,6 +506,14 @@
 		minimumZoom = alternateMinimum;
 	}
 
+	// tiles read in the background come in from the middle of the screen out, in the order of
+	// this map view
+	reader = tileSource;
+	if ([reader isKindOfClass:[RMCachedTileSource class]])
+		reader = [reader underlyingTileSource];
+	if ([reader conformsToProtocol:@protocol(RMTileDataReader)])
+		[RMScheduledTileImage focusOnTileRect:rect forReader:reader];
+
 	for (;;)
 	{
 		CGRect screenLocation;
@@ -422,12 +574,17 @@
 	}
     
 	zoom = value;
-	for (RMTileImage *image in [images allObjects])
+	// every tile worse than some loaded tile goes, in one pass over the tiles
+	NSMutableArray *obsolete = [NSMutableArray array];
+	for (RMTileImage *image in [self allImages])
 	{
-		if (![image isLoaded]) {
-			continue;
+		if ([self isTileCoveredByBetterTile:image.tile countingItself:NO]) {
+			[obsolete addObject:image];
 		}
-		[self removeTilesWorseThan:image];
+	}
+	for (RMTileImage *image in obsolete)
+	{
+		[self removeTile:image.tile];
 	}
 }
 
@@ -435,68 +592,51 @@
 #pragma mark RMTile
 -(RMTileImage*) imageWithTile: (RMTile) tile
 {
-	RMTileImage *dummyTile = [RMTileImage dummyTile:tile];
-
-	return [images member:dummyTile];
+	return RMTileIndexGet(images, tile);
 }
 
 - (RMTileImage *)anyTileImage {
-	return [images anyObject];
+	return RMTileIndexAny(images);
 }
 
 #pragma mark -
 #pragma mark Changing the displayed region
 - (void)moveBy: (CGSize) delta
 {
-	for (RMTileImage *image in images)
-	{
-		[image moveBy: delta];
-	}
+	RMTileIndexForEach(images, RMTileImageSetMove, &delta);
 }
 
 - (void)zoomByFactor: (float) zoomFactor near:(CGPoint) center
 {
-	for (RMTileImage *image in images)
-	{
-		[image zoomByFactor:zoomFactor near:center];
-	}
+	RMTileImageSetZoom zoom = { zoomFactor, center };
+	RMTileIndexForEach(images, RMTileImageSetZoomImage, &zoom);
 }
 
 #pragma mark -
 #pragma mark Loading
 - (void)cancelLoading
 {
-	for (RMTileImage *image in images)
-	{
-		[image cancelLoading];
-	}
+	RMTileIndexForEach(images, RMTileImageSetCancel, NULL);
 }
 
 - (BOOL)fullyLoaded
 {
 	BOOL fullyLoaded = YES;
 
-	for (RMTileImage *image in images)
-	{
-		if (![image isLoaded])
-		{
-			fullyLoaded = NO;
-			break;
-		}
-	}
+	RMTileIndexForEach(images, RMTileImageSetCheckLoaded, &fullyLoaded);
 	return fullyLoaded;
 }
 
-- (void)tileImageLoaded:(NSNotification *)notification
+- (void)tileImage:(RMTileImage *)img didLoadData:(NSData *)data
 {
-	RMTileImage *img = (RMTileImage *)[notification object];
-
-	if (!img || img != [images member:img])
+	if (img != RMTileIndexGet(images, img.tile))
 	{
 		// i don't contain img, it may be already removed or in another set
 		return;
 	}
 
+	if (!RMTileCoverageContains(loadedTiles, img.tile) && !RMTileCoverageAdd(loadedTiles, img.tile))
+		RMLog(@"out of memory adding loaded tile %d %d %d", img.tile.x, img.tile.y, img.tile.zoom);
 	[self removeTilesWorseThan:img];
 }
 
@@ -506,8 +646,9 @@
 {
 	float biggestSeamRight = 0.0f;
 	float biggestSeamDown = 0.0f;
+	NSArray *all = [self allImages];
 	
-	for (RMTileImage *image in images)
+	for (RMTileImage *image in all)
 	{
 		CGRect location = [image screenLocation];
         /*		RMLog(@"Image at %f, %f %f %f",
@@ -519,7 +660,7 @@
 		float seamRight = INFINITY;
 		float seamDown = INFINITY;
 		
-		for (RMTileImage *other_image in images)
+		for (RMTileImage *other_image in all)
 		{
 			CGRect other_location = [other_image screenLocation];
 			if (other_location.origin.x > location.origin.x)
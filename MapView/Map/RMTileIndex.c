@@ -0,0 +1,531 @@
+//
+//  RMTileIndex.c
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "RMTileIndex.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define kRMTileIndexNone UINT32_MAX		// no entry or block
+#define kRMTileIndexFree (UINT32_MAX - 1)	// block of an entry on the free list
+#define kRMTileIndexMaxZoom 31
+#define kRMTileIndexInitialSlots 64
+
+typedef struct {
+	RMTile tile;
+	void *value;
+	uint32_t block;			// kRMTileIndexNone outside the placed zoom levels
+	uint32_t next, prev;		// the other entries of the block; next links the free list
+} RMTileIndexEntry;
+
+typedef struct {
+	uint64_t key;			// zoom and block coordinates
+	uint32_t first, count;		// entries in the block
+	uint32_t next, prev;		// the other blocks of the zoom level; next links the free list
+} RMTileIndexBlock;
+
+typedef struct {
+	uint64_t key;
+	uint32_t index;			// entry or block index + 1, 0 for an empty slot
+} RMTileIndexSlot;
+
+// Open addressing with linear probing, kept at most half full.
+typedef struct {
+	RMTileIndexSlot *slots;
+	size_t mask;			// slot count - 1, a power of two minus one
+	size_t used;
+} RMTileIndexTable;
+
+struct RMTileIndex {
+	RMTileIndexEntry *entries;
+	uint32_t entryCapacity, freeEntry, count;
+	RMTileIndexTable tiles;
+
+	RMTileIndexBlock *blocks;
+	uint32_t blockCapacity, freeBlock;
+	RMTileIndexTable blockTable;
+	uint32_t zoomFirst[kRMTileIndexMaxZoom + 1], zoomBlocks[kRMTileIndexMaxZoom + 1];
+	uint32_t unplaced;		// entries without a block, linked like those of a block
+};
+
+
+// Keys put the zoom in the top bits, so mix all of them into the bits the mask keeps.
+static size_t RMTileIndexSlotFor(const RMTileIndexTable *table, uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return (size_t)key & table->mask;
+}
+
+static int RMTileIndexTableInit(RMTileIndexTable *table, size_t slots)
+{
+	table->slots = calloc(slots, sizeof(RMTileIndexSlot));
+	table->mask = slots - 1;
+	table->used = 0;
+	return table->slots != NULL;
+}
+
+// Returns the slot holding the key, or the empty slot where it belongs.
+static RMTileIndexSlot *RMTileIndexTableProbe(const RMTileIndexTable *table, uint64_t key)
+{
+	size_t slot = RMTileIndexSlotFor(table, key);
+	while (table->slots[slot].index != 0 && table->slots[slot].key != key)
+		slot = (slot + 1) & table->mask;
+	return &table->slots[slot];
+}
+
+static uint32_t RMTileIndexTableFind(const RMTileIndexTable *table, uint64_t key)
+{
+	RMTileIndexSlot *slot = RMTileIndexTableProbe(table, key);
+	return slot->index != 0 ? slot->index - 1 : kRMTileIndexNone;
+}
+
+static int RMTileIndexTableAdd(RMTileIndexTable *table, uint64_t key, uint32_t index)
+{
+	if ((table->used + 1) * 2 > table->mask + 1) {
+		RMTileIndexTable grown;
+		if (!RMTileIndexTableInit(&grown, (table->mask + 1) * 2))
+			return 0;
+		for (size_t i = 0; i <= table->mask; i++)
+			if (table->slots[i].index != 0)
+				*RMTileIndexTableProbe(&grown, table->slots[i].key) = table->slots[i];
+		grown.used = table->used;
+		free(table->slots);
+		*table = grown;
+	}
+
+	RMTileIndexSlot *slot = RMTileIndexTableProbe(table, key);
+	slot->key = key;
+	slot->index = index + 1;
+	table->used++;
+	return 1;
+}
+
+// Removes the key and moves later slots of its run back, so that lookups need no tombstones.
+static void RMTileIndexTableRemove(RMTileIndexTable *table, uint64_t key)
+{
+	size_t hole = RMTileIndexTableProbe(table, key) - table->slots, slot = hole;
+
+	if (table->slots[hole].index == 0)
+		return;
+	for (;;) {
+		slot = (slot + 1) & table->mask;
+		if (table->slots[slot].index == 0)
+			break;
+		size_t home = RMTileIndexSlotFor(table, table->slots[slot].key);
+		// the slot may move to the hole unless its home lies cyclically in (hole, slot]
+		if ((slot > hole && (home <= hole || home > slot)) || (slot < hole && home <= hole && home > slot)) {
+			table->slots[hole] = table->slots[slot];
+			hole = slot;
+		}
+	}
+	table->slots[hole].index = 0;
+	table->used--;
+}
+
+
+static uint64_t RMTileIndexBlockKey(short zoom, uint64_t blockX, uint64_t blockY)
+{
+	return ((uint64_t)zoom << 58) | (blockX << 29) | blockY;
+}
+
+static int RMTileIndexPlaced(RMTile tile)
+{
+	return tile.zoom >= 0 && tile.zoom <= kRMTileIndexMaxZoom;
+}
+
+// Returns the block of the tile, adding it if needed, or kRMTileIndexNone if out of memory.
+static uint32_t RMTileIndexBlockOf(RMTileIndex *index, RMTile tile)
+{
+	uint64_t key = RMTileIndexBlockKey(tile.zoom, tile.x >> 3, tile.y >> 3);
+	uint32_t b = RMTileIndexTableFind(&index->blockTable, key);
+	if (b != kRMTileIndexNone)
+		return b;
+
+	if (index->freeBlock == kRMTileIndexNone) {
+		uint32_t capacity = index->blockCapacity * 2;
+		RMTileIndexBlock *grown = realloc(index->blocks, capacity * sizeof(RMTileIndexBlock));
+		if (grown == NULL)
+			return kRMTileIndexNone;
+		for (uint32_t i = index->blockCapacity; i < capacity; i++)
+			grown[i].next = i + 1 < capacity ? i + 1 : kRMTileIndexNone;
+		index->blocks = grown;
+		index->freeBlock = index->blockCapacity;
+		index->blockCapacity = capacity;
+	}
+
+	b = index->freeBlock;
+	if (!RMTileIndexTableAdd(&index->blockTable, key, b))
+		return kRMTileIndexNone;
+
+	RMTileIndexBlock *block = &index->blocks[b];
+	index->freeBlock = block->next;
+	block->key = key;
+	block->first = kRMTileIndexNone;
+	block->count = 0;
+	block->prev = kRMTileIndexNone;
+	block->next = index->zoomFirst[tile.zoom];
+	if (block->next != kRMTileIndexNone)
+		index->blocks[block->next].prev = b;
+	index->zoomFirst[tile.zoom] = b;
+	index->zoomBlocks[tile.zoom]++;
+	return b;
+}
+
+static void RMTileIndexDropBlock(RMTileIndex *index, uint32_t b)
+{
+	RMTileIndexBlock *block = &index->blocks[b];
+	short zoom = (short)(block->key >> 58);
+
+	RMTileIndexTableRemove(&index->blockTable, block->key);
+	if (block->prev != kRMTileIndexNone)
+		index->blocks[block->prev].next = block->next;
+	else
+		index->zoomFirst[zoom] = block->next;
+	if (block->next != kRMTileIndexNone)
+		index->blocks[block->next].prev = block->prev;
+	index->zoomBlocks[zoom]--;
+
+	block->next = index->freeBlock;
+	index->freeBlock = b;
+}
+
+// Head of the list of entries an entry is linked into.
+static uint32_t *RMTileIndexListOf(RMTileIndex *index, const RMTileIndexEntry *entry)
+{
+	if (entry->block == kRMTileIndexNone)
+		return &index->unplaced;
+	return &index->blocks[entry->block].first;
+}
+
+
+static void RMTileIndexReset(RMTileIndex *index)
+{
+	for (uint32_t i = 0; i < index->entryCapacity; i++) {
+		index->entries[i].block = kRMTileIndexFree;
+		index->entries[i].next = i + 1 < index->entryCapacity ? i + 1 : kRMTileIndexNone;
+	}
+	index->freeEntry = 0;
+	index->count = 0;
+	for (uint32_t i = 0; i < index->blockCapacity; i++)
+		index->blocks[i].next = i + 1 < index->blockCapacity ? i + 1 : kRMTileIndexNone;
+	index->freeBlock = 0;
+	for (int zoom = 0; zoom <= kRMTileIndexMaxZoom; zoom++) {
+		index->zoomFirst[zoom] = kRMTileIndexNone;
+		index->zoomBlocks[zoom] = 0;
+	}
+	index->unplaced = kRMTileIndexNone;
+	memset(index->tiles.slots, 0, (index->tiles.mask + 1) * sizeof(RMTileIndexSlot));
+	index->tiles.used = 0;
+	memset(index->blockTable.slots, 0, (index->blockTable.mask + 1) * sizeof(RMTileIndexSlot));
+	index->blockTable.used = 0;
+}
+
+RMTileIndex *RMTileIndexCreate(void)
+{
+	RMTileIndex *index = calloc(1, sizeof(RMTileIndex));
+	if (index == NULL)
+		return NULL;
+
+	index->entryCapacity = kRMTileIndexInitialSlots / 2;
+	index->blockCapacity = kRMTileIndexInitialSlots / 2;
+	index->entries = malloc(index->entryCapacity * sizeof(RMTileIndexEntry));
+	index->blocks = malloc(index->blockCapacity * sizeof(RMTileIndexBlock));
+	if (index->entries == NULL || index->blocks == NULL
+		|| !RMTileIndexTableInit(&index->tiles, kRMTileIndexInitialSlots)
+		|| !RMTileIndexTableInit(&index->blockTable, kRMTileIndexInitialSlots)) {
+		RMTileIndexFree(index);
+		return NULL;
+	}
+	RMTileIndexReset(index);
+	return index;
+}
+
+void RMTileIndexFree(RMTileIndex *index)
+{
+	if (index == NULL)
+		return;
+	free(index->entries);
+	free(index->blocks);
+	free(index->tiles.slots);
+	free(index->blockTable.slots);
+	free(index);
+}
+
+int RMTileIndexInsert(RMTileIndex *index, RMTile tile, void *value)
+{
+	uint64_t key = RMTileKey(tile);
+	uint32_t e = RMTileIndexTableFind(&index->tiles, key);
+
+	if (e != kRMTileIndexNone) {
+		index->entries[e].value = value;
+		return 1;
+	}
+
+	if (index->freeEntry == kRMTileIndexNone) {
+		uint32_t capacity = index->entryCapacity * 2;
+		RMTileIndexEntry *grown = realloc(index->entries, capacity * sizeof(RMTileIndexEntry));
+		if (grown == NULL)
+			return 0;
+		for (uint32_t i = index->entryCapacity; i < capacity; i++) {
+			grown[i].block = kRMTileIndexFree;
+			grown[i].next = i + 1 < capacity ? i + 1 : kRMTileIndexNone;
+		}
+		index->entries = grown;
+		index->freeEntry = index->entryCapacity;
+		index->entryCapacity = capacity;
+	}
+
+	uint32_t block = kRMTileIndexNone;
+	if (RMTileIndexPlaced(tile)) {
+		block = RMTileIndexBlockOf(index, tile);
+		if (block == kRMTileIndexNone)
+			return 0;
+	}
+
+	e = index->freeEntry;
+	if (!RMTileIndexTableAdd(&index->tiles, key, e)) {
+		if (block != kRMTileIndexNone && index->blocks[block].count == 0)
+			RMTileIndexDropBlock(index, block);
+		return 0;
+	}
+
+	RMTileIndexEntry *entry = &index->entries[e];
+	index->freeEntry = entry->next;
+	entry->tile = tile;
+	entry->value = value;
+	entry->block = block;
+
+	uint32_t *list = RMTileIndexListOf(index, entry);
+	entry->prev = kRMTileIndexNone;
+	entry->next = *list;
+	if (entry->next != kRMTileIndexNone)
+		index->entries[entry->next].prev = e;
+	*list = e;
+	if (block != kRMTileIndexNone)
+		index->blocks[block].count++;
+
+	index->count++;
+	return 1;
+}
+
+void *RMTileIndexGet(const RMTileIndex *index, RMTile tile)
+{
+	uint32_t e = RMTileIndexTableFind(&index->tiles, RMTileKey(tile));
+	return e != kRMTileIndexNone ? index->entries[e].value : NULL;
+}
+
+void *RMTileIndexRemove(RMTileIndex *index, RMTile tile)
+{
+	uint64_t key = RMTileKey(tile);
+	uint32_t e = RMTileIndexTableFind(&index->tiles, key);
+	if (e == kRMTileIndexNone)
+		return NULL;
+
+	RMTileIndexEntry *entry = &index->entries[e];
+	void *value = entry->value;
+
+	RMTileIndexTableRemove(&index->tiles, key);
+	if (entry->prev != kRMTileIndexNone)
+		index->entries[entry->prev].next = entry->next;
+	else
+		*RMTileIndexListOf(index, entry) = entry->next;
+	if (entry->next != kRMTileIndexNone)
+		index->entries[entry->next].prev = entry->prev;
+	if (entry->block != kRMTileIndexNone && --index->blocks[entry->block].count == 0)
+		RMTileIndexDropBlock(index, entry->block);
+
+	entry->block = kRMTileIndexFree;
+	entry->value = NULL;
+	entry->next = index->freeEntry;
+	index->freeEntry = e;
+	index->count--;
+	return value;
+}
+
+void RMTileIndexRemoveAll(RMTileIndex *index)
+{
+	RMTileIndexReset(index);
+}
+
+size_t RMTileIndexCount(const RMTileIndex *index)
+{
+	return index->count;
+}
+
+void *RMTileIndexAny(const RMTileIndex *index)
+{
+	for (uint32_t i = 0; i < index->entryCapacity && index->count > 0; i++)
+		if (index->entries[i].block != kRMTileIndexFree)
+			return index->entries[i].value;
+	return NULL;
+}
+
+
+static void RMTileIndexVisitList(const RMTileIndex *index, uint32_t e, RMTileIndexVisitor visit, void *context)
+{
+	while (e != kRMTileIndexNone) {
+		const RMTileIndexEntry *entry = &index->entries[e];
+		e = entry->next;
+		visit(context, entry->tile, entry->value);
+	}
+}
+
+void RMTileIndexForEach(const RMTileIndex *index, RMTileIndexVisitor visit, void *context)
+{
+	for (uint32_t i = 0; i < index->entryCapacity; i++)
+		if (index->entries[i].block != kRMTileIndexFree)
+			visit(context, index->entries[i].tile, index->entries[i].value);
+}
+
+// Visits the tiles of a zoom level within the given ranges of tile coordinates.
+static void RMTileIndexVisitRange(const RMTileIndex *index, short zoom, uint64_t minX, uint64_t maxX, uint64_t minY, uint64_t maxY, RMTileIndexVisitor visit, void *context)
+{
+	uint64_t blocksWide = (maxX >> 3) - (minX >> 3) + 1, blocksHigh = (maxY >> 3) - (minY >> 3) + 1;
+
+	if (blocksWide * blocksHigh <= index->zoomBlocks[zoom]) {
+		// few blocks cover the range: look them up
+		for (uint64_t by = minY >> 3; by <= maxY >> 3; by++) {
+			for (uint64_t bx = minX >> 3; bx <= maxX >> 3; bx++) {
+				uint32_t b = RMTileIndexTableFind(&index->blockTable, RMTileIndexBlockKey(zoom, bx, by));
+				for (uint32_t e = b != kRMTileIndexNone ? index->blocks[b].first : kRMTileIndexNone; e != kRMTileIndexNone; ) {
+					const RMTileIndexEntry *entry = &index->entries[e];
+					e = entry->next;
+					if (entry->tile.x >= minX && entry->tile.x <= maxX && entry->tile.y >= minY && entry->tile.y <= maxY)
+						visit(context, entry->tile, entry->value);
+				}
+			}
+		}
+		return;
+	}
+
+	// the zoom level has fewer blocks than the range: go through them
+	for (uint32_t b = index->zoomFirst[zoom]; b != kRMTileIndexNone; b = index->blocks[b].next) {
+		const RMTileIndexBlock *block = &index->blocks[b];
+		uint64_t bx = (block->key >> 29) & 0x1FFFFFFF, by = block->key & 0x1FFFFFFF;
+		if (bx < minX >> 3 || bx > maxX >> 3 || by < minY >> 3 || by > maxY >> 3)
+			continue;
+		for (uint32_t e = block->first; e != kRMTileIndexNone; ) {
+			const RMTileIndexEntry *entry = &index->entries[e];
+			e = entry->next;
+			if (entry->tile.x >= minX && entry->tile.x <= maxX && entry->tile.y >= minY && entry->tile.y <= maxY)
+				visit(context, entry->tile, entry->value);
+		}
+	}
+}
+
+void RMTileIndexForEachOverlapping(const RMTileIndex *index, RMTile tile, RMTileIndexVisitor visit, void *context)
+{
+	if (!RMTileIndexPlaced(tile))
+		return;
+
+	for (short zoom = 0; zoom <= kRMTileIndexMaxZoom; zoom++) {
+		if (index->zoomBlocks[zoom] == 0)
+			continue;
+
+		if (zoom <= tile.zoom) {
+			// the one tile of this level that contains it
+			RMTile coarser;
+			unsigned dz = tile.zoom - zoom;
+			coarser.x = tile.x >> dz;
+			coarser.y = tile.y >> dz;
+			coarser.zoom = zoom;
+			uint32_t e = RMTileIndexTableFind(&index->tiles, RMTileKey(coarser));
+			if (e != kRMTileIndexNone)
+				visit(context, index->entries[e].tile, index->entries[e].value);
+		} else {
+			unsigned dz = zoom - tile.zoom;
+			uint64_t minX = (uint64_t)tile.x << dz, minY = (uint64_t)tile.y << dz;
+			RMTileIndexVisitRange(index, zoom, minX, minX + (1ULL << dz) - 1, minY, minY + (1ULL << dz) - 1, visit, context);
+		}
+	}
+}
+
+static int RMTileIndexInsideX(uint64_t x, uint64_t minX, uint64_t maxX)
+{
+	if (minX <= maxX)
+		return x >= minX && x <= maxX;
+	return x >= minX || x <= maxX;
+}
+
+void RMTileIndexForEachOutside(const RMTileIndex *index, short zoom, uint32_t minX, uint32_t maxX, uint32_t minY, uint32_t maxY, RMTileIndexVisitor visit, void *context)
+{
+	RMTileIndexVisitList(index, index->unplaced, visit, context);
+
+	for (short level = 0; level <= kRMTileIndexMaxZoom; level++) {
+		uint64_t loX, hiX, loY, hiY;
+
+		if (index->zoomBlocks[level] == 0)
+			continue;
+
+		// the rectangle in tiles of this level
+		if (level <= zoom) {
+			unsigned dz = zoom - level;
+			loX = minX >> dz;
+			hiX = maxX >> dz;
+			loY = minY >> dz;
+			hiY = maxY >> dz;
+		} else {
+			unsigned dz = level - zoom;
+			loX = (uint64_t)minX << dz;
+			hiX = (((uint64_t)maxX + 1) << dz) - 1;
+			loY = (uint64_t)minY << dz;
+			hiY = (((uint64_t)maxY + 1) << dz) - 1;
+		}
+
+		for (uint32_t b = index->zoomFirst[level]; b != kRMTileIndexNone; b = index->blocks[b].next) {
+			const RMTileIndexBlock *block = &index->blocks[b];
+			uint64_t x0 = ((block->key >> 29) & 0x1FFFFFFF) << 3, y0 = (block->key & 0x1FFFFFFF) << 3;
+			uint64_t x1 = x0 + 7, y1 = y0 + 7;
+			int allInside, allOutside;
+
+			if (loX <= hiX) {
+				allInside = x0 >= loX && x1 <= hiX;
+				allOutside = x1 < loX || x0 > hiX;
+			} else {
+				allInside = x0 >= loX || x1 <= hiX;
+				allOutside = x0 > hiX && x1 < loX;
+			}
+			allInside = allInside && y0 >= loY && y1 <= hiY;
+			allOutside = allOutside || y1 < loY || y0 > hiY;
+
+			if (allInside)
+				continue;
+			if (allOutside) {
+				RMTileIndexVisitList(index, block->first, visit, context);
+				continue;
+			}
+			for (uint32_t e = block->first; e != kRMTileIndexNone; ) {
+				const RMTileIndexEntry *entry = &index->entries[e];
+				e = entry->next;
+				if (!(entry->tile.y >= loY && entry->tile.y <= hiY && RMTileIndexInsideX(entry->tile.x, loX, hiX)))
+					visit(context, entry->tile, entry->value);
+			}
+		}
+	}
+}
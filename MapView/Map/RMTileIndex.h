@@ -0,0 +1,86 @@
+//
+//  RMTileIndex.h
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _RMTILEINDEX_H_
+#define _RMTILEINDEX_H_
+
+#include <stddef.h>
+#include "RMTile.h"
+
+/*! \file RMTileIndex.h
+ */
+/*! \struct RMTileIndex
+ \brief A map from tiles to opaque values that also answers where the tiles are.
+
+ Tiles are found through an open-addressed hash table keyed by RMTileKey(), so lookups,
+ insertions and removals take constant time and allocate nothing once the tables have grown.
+
+ Tiles are also grouped per zoom level into blocks of 8x8, kept on a list per zoom level, which
+ makes the index a flat quadtree: the tiles overlapping a given tile at other zoom levels are one
+ lookup per coarser level and a few blocks per finer level away, and a query for the tiles
+ outside of a rectangle passes over the blocks inside of it without looking at their tiles.
+
+ Values must not be NULL. The index never touches them, and visitors must not change the index.
+
+ Plain C without any framework dependency besides RMTile; not thread safe.
+ */
+typedef struct RMTileIndex RMTileIndex;
+
+/// Called for the tiles found by a query.
+typedef void (*RMTileIndexVisitor)(void *context, RMTile tile, void *value);
+
+/// Creates an empty index. Returns NULL if out of memory.
+RMTileIndex *RMTileIndexCreate(void);
+/// Frees the index, without the values.
+void RMTileIndexFree(RMTileIndex *index);
+
+/// Adds or replaces the value for the tile. Returns 0 if out of memory.
+int RMTileIndexInsert(RMTileIndex *index, RMTile tile, void *value);
+/// Returns the value for the tile, or NULL if it is not in the index.
+void *RMTileIndexGet(const RMTileIndex *index, RMTile tile);
+/// Removes the tile and returns its value, or NULL if it was not in the index.
+void *RMTileIndexRemove(RMTileIndex *index, RMTile tile);
+/// Removes all tiles.
+void RMTileIndexRemoveAll(RMTileIndex *index);
+
+/// Number of tiles in the index.
+size_t RMTileIndexCount(const RMTileIndex *index);
+/// Returns the value of some tile in the index, or NULL if it is empty.
+void *RMTileIndexAny(const RMTileIndex *index);
+
+/// Visits all tiles.
+void RMTileIndexForEach(const RMTileIndex *index, RMTileIndexVisitor visit, void *context);
+/// Visits the tiles that cover the same area as the given tile: the tile itself, the coarser
+/// tiles it lies in and the finer tiles that lie in it.
+void RMTileIndexForEachOverlapping(const RMTileIndex *index, RMTile tile, RMTileIndexVisitor visit, void *context);
+/// Visits the tiles that lie outside of the tiles minX to maxX and minY to maxY at the given zoom
+/// level, where maxX below minX wraps around the antimeridian. A coarser tile is inside if it
+/// contains any of those tiles, a finer one if it lies in one of them. Tiles of zoom levels the
+/// index does not place, like dummy tiles, are always outside.
+void RMTileIndexForEachOutside(const RMTileIndex *index, short zoom, uint32_t minX, uint32_t maxX, uint32_t minY, uint32_t maxY, RMTileIndexVisitor visit, void *context);
+
+#endif
@@ -0,0 +1,301 @@
+//
+//  RMTileLRU.c
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "RMTileLRU.h"
+#include <stdlib.h>
+
+typedef struct RMTileLRUEntry {
+	uint64_t key;
+	void *value;
+	size_t cost;
+	struct RMTileLRUEntry *chain;	// next entry in the same bucket
+	struct RMTileLRUEntry *newer, *older;
+} RMTileLRUEntry;
+
+struct RMTileLRU {
+	RMTileLRUEntry **buckets;
+	size_t bucketMask;		// bucket count - 1, a power of two minus one
+	size_t count, cost;
+	size_t countLimit, costLimit;
+	RMTileLRUEntry *newest, *oldest;
+	RMTileLRUEntry *spare;		// unused entries, linked through chain
+	RMTileLRUReleaseCallback release;
+	void *context;
+};
+
+#define kRMTileLRUInitialBuckets 64
+
+// RMTileKey() puts the zoom in the top bits and x, y in the low bits, so mix all of them
+// into the bits the bucket mask keeps.
+static size_t RMTileLRUBucket(const RMTileLRU *lru, uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return (size_t)key & lru->bucketMask;
+}
+
+static RMTileLRUEntry **RMTileLRULink(const RMTileLRU *lru, uint64_t key)
+{
+	RMTileLRUEntry **link = &lru->buckets[RMTileLRUBucket(lru, key)];
+	while (*link != NULL && (*link)->key != key)
+		link = &(*link)->chain;
+	return link;
+}
+
+// Doubles the bucket array. Failing to grow only makes the chains longer.
+static void RMTileLRUGrow(RMTileLRU *lru)
+{
+	size_t oldSize = lru->bucketMask + 1;
+	RMTileLRUEntry **oldBuckets = lru->buckets;
+	RMTileLRUEntry **buckets = calloc(oldSize * 2, sizeof(RMTileLRUEntry *));
+	if (buckets == NULL)
+		return;
+
+	lru->buckets = buckets;
+	lru->bucketMask = oldSize * 2 - 1;
+
+	for (size_t i = 0; i < oldSize; i++) {
+		RMTileLRUEntry *entry = oldBuckets[i];
+		while (entry != NULL) {
+			RMTileLRUEntry *chain = entry->chain;
+			size_t bucket = RMTileLRUBucket(lru, entry->key);
+			entry->chain = buckets[bucket];
+			buckets[bucket] = entry;
+			entry = chain;
+		}
+	}
+	free(oldBuckets);
+}
+
+static void RMTileLRUUnlinkUse(RMTileLRU *lru, RMTileLRUEntry *entry)
+{
+	if (entry->newer != NULL)
+		entry->newer->older = entry->older;
+	else
+		lru->newest = entry->older;
+	if (entry->older != NULL)
+		entry->older->newer = entry->newer;
+	else
+		lru->oldest = entry->newer;
+}
+
+static void RMTileLRULinkNewest(RMTileLRU *lru, RMTileLRUEntry *entry)
+{
+	entry->newer = NULL;
+	entry->older = lru->newest;
+	if (lru->newest != NULL)
+		lru->newest->newer = entry;
+	else
+		lru->oldest = entry;
+	lru->newest = entry;
+}
+
+// Takes the entry found at link out of the cache and releases its value.
+static void RMTileLRUDrop(RMTileLRU *lru, RMTileLRUEntry **link)
+{
+	RMTileLRUEntry *entry = *link;
+	uint64_t key = entry->key;
+	void *value = entry->value;
+
+	*link = entry->chain;
+	RMTileLRUUnlinkUse(lru, entry);
+	lru->count--;
+	lru->cost -= entry->cost;
+
+	entry->chain = lru->spare;
+	lru->spare = entry;
+
+	if (lru->release != NULL)
+		lru->release(lru->context, key, value);
+}
+
+RMTileLRU *RMTileLRUCreate(size_t costLimit, size_t countLimit, RMTileLRUReleaseCallback release, void *context)
+{
+	RMTileLRU *lru = calloc(1, sizeof(RMTileLRU));
+	if (lru == NULL)
+		return NULL;
+
+	lru->buckets = calloc(kRMTileLRUInitialBuckets, sizeof(RMTileLRUEntry *));
+	if (lru->buckets == NULL) {
+		free(lru);
+		return NULL;
+	}
+	lru->bucketMask = kRMTileLRUInitialBuckets - 1;
+	lru->costLimit = costLimit;
+	lru->countLimit = countLimit;
+	lru->release = release;
+	lru->context = context;
+
+	return lru;
+}
+
+void RMTileLRUFree(RMTileLRU *lru)
+{
+	if (lru == NULL)
+		return;
+
+	RMTileLRURemoveAll(lru);
+	while (lru->spare != NULL) {
+		RMTileLRUEntry *entry = lru->spare;
+		lru->spare = entry->chain;
+		free(entry);
+	}
+	free(lru->buckets);
+	free(lru);
+}
+
+void *RMTileLRUGet(RMTileLRU *lru, uint64_t key)
+{
+	RMTileLRUEntry *entry = *RMTileLRULink(lru, key);
+	if (entry == NULL)
+		return NULL;
+
+	if (entry != lru->newest) {
+		RMTileLRUUnlinkUse(lru, entry);
+		RMTileLRULinkNewest(lru, entry);
+	}
+	return entry->value;
+}
+
+void *RMTileLRUPeek(const RMTileLRU *lru, uint64_t key)
+{
+	RMTileLRUEntry *entry = *RMTileLRULink(lru, key);
+	return entry != NULL ? entry->value : NULL;
+}
+
+int RMTileLRUPut(RMTileLRU *lru, uint64_t key, void *value, size_t cost)
+{
+	RMTileLRUEntry *entry;
+
+	RMTileLRURemove(lru, key);
+	RMTileLRUMakeSpace(lru, cost);
+
+	if (lru->spare != NULL) {
+		entry = lru->spare;
+		lru->spare = entry->chain;
+	} else {
+		entry = malloc(sizeof(RMTileLRUEntry));
+		if (entry == NULL) {
+			if (lru->release != NULL)
+				lru->release(lru->context, key, value);
+			return 0;
+		}
+	}
+
+	if (lru->count > lru->bucketMask)
+		RMTileLRUGrow(lru);
+
+	size_t bucket = RMTileLRUBucket(lru, key);
+	entry->key = key;
+	entry->value = value;
+	entry->cost = cost;
+	entry->chain = lru->buckets[bucket];
+	lru->buckets[bucket] = entry;
+	RMTileLRULinkNewest(lru, entry);
+	lru->count++;
+	lru->cost += cost;
+
+	return 1;
+}
+
+void RMTileLRURemove(RMTileLRU *lru, uint64_t key)
+{
+	RMTileLRUEntry **link = RMTileLRULink(lru, key);
+	if (*link != NULL)
+		RMTileLRUDrop(lru, link);
+}
+
+void RMTileLRURemoveAll(RMTileLRU *lru)
+{
+	// one at a time, so a release callback always sees a consistent cache
+	while (lru->oldest != NULL)
+		RMTileLRUDrop(lru, RMTileLRULink(lru, lru->oldest->key));
+}
+
+size_t RMTileLRUSetCost(RMTileLRU *lru, uint64_t key, size_t cost)
+{
+	RMTileLRUEntry *entry = *RMTileLRULink(lru, key);
+	size_t evicted = 0;
+
+	if (entry == NULL)
+		return 0;
+
+	lru->cost = lru->cost - entry->cost + cost;
+	entry->cost = cost;
+
+	while (lru->costLimit != 0 && lru->cost > lru->costLimit) {
+		RMTileLRUEntry *victim = lru->oldest != entry ? lru->oldest : entry->newer;
+		if (victim == NULL)
+			break;
+		RMTileLRUDrop(lru, RMTileLRULink(lru, victim->key));
+		evicted++;
+	}
+	return evicted;
+}
+
+size_t RMTileLRUMakeSpace(RMTileLRU *lru, size_t cost)
+{
+	size_t evicted = 0;
+
+	while (lru->oldest != NULL
+		   && ((lru->countLimit != 0 && lru->count >= lru->countLimit)
+			   || (lru->costLimit != 0 && lru->cost + cost > lru->costLimit)))
+	{
+		RMTileLRUDrop(lru, RMTileLRULink(lru, lru->oldest->key));
+		evicted++;
+	}
+	return evicted;
+}
+
+int RMTileLRUVictim(const RMTileLRU *lru, size_t cost, uint64_t *key)
+{
+	if (lru->oldest == NULL)
+		return 0;
+	if (!((lru->countLimit != 0 && lru->count >= lru->countLimit)
+		  || (lru->costLimit != 0 && lru->cost + cost > lru->costLimit)))
+		return 0;
+
+	*key = lru->oldest->key;
+	return 1;
+}
+
+void RMTileLRUForEach(const RMTileLRU *lru, RMTileLRUVisitor visit, void *context)
+{
+	for (RMTileLRUEntry *entry = lru->oldest; entry != NULL; entry = entry->newer)
+		visit(context, entry->key, entry->value);
+}
+
+size_t RMTileLRUCount(const RMTileLRU *lru)
+{
+	return lru->count;
+}
+
+size_t RMTileLRUCost(const RMTileLRU *lru)
+{
+	return lru->cost;
+}
@@ -0,0 +1,97 @@
+//
+//  RMTileLRU.h
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _RMTILELRU_H_
+#define _RMTILELRU_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*! \file RMTileLRU.h
+ */
+/*! \struct RMTileLRU
+ \brief A least-recently-used map from tile keys to opaque values, with a cost budget.
+
+ Entries are found through a hash table keyed by RMTileKey() and kept on a doubly linked
+ list in order of use, so lookups, insertions and evictions are all O(1). Every entry carries
+ a cost (for tile images, the bytes of the decoded bitmap); the least recently used entries
+ are evicted whenever the total cost or the number of entries goes over its limit.
+
+ The cache never touches the values itself. Every value that leaves the cache, whether
+ evicted, replaced or removed, is handed to the release callback exactly once, after it has
+ been unlinked, so the callback may call back into the cache.
+
+ Plain C without any framework dependency; not thread safe.
+ */
+typedef struct RMTileLRU RMTileLRU;
+
+/// Called for every value that leaves the cache.
+typedef void (*RMTileLRUReleaseCallback)(void *context, uint64_t key, void *value);
+/// Called for every entry by RMTileLRUForEach().
+typedef void (*RMTileLRUVisitor)(void *context, uint64_t key, void *value);
+
+/// Creates an empty cache. A limit of 0 means no limit. Returns NULL if out of memory.
+RMTileLRU *RMTileLRUCreate(size_t costLimit, size_t countLimit, RMTileLRUReleaseCallback release, void *context);
+/// Releases all values and frees the cache.
+void RMTileLRUFree(RMTileLRU *lru);
+
+/// Returns the value for the key and marks it most recently used, or NULL if it is not cached.
+void *RMTileLRUGet(RMTileLRU *lru, uint64_t key);
+/// Returns the value for the key without changing the order of use.
+void *RMTileLRUPeek(const RMTileLRU *lru, uint64_t key);
+
+/// Adds or replaces the value for the key as the most recently used entry, first evicting
+/// entries until it fits. An entry costing more than the whole budget is still added, alone.
+/// Returns 0 if out of memory, in which case the value has been released.
+int RMTileLRUPut(RMTileLRU *lru, uint64_t key, void *value, size_t cost);
+/// Removes the entry for the key, if any.
+void RMTileLRURemove(RMTileLRU *lru, uint64_t key);
+/// Removes all entries.
+void RMTileLRURemoveAll(RMTileLRU *lru);
+
+/// Changes the cost of the entry for the key, if any, without changing the order of use, then
+/// evicts the least recently used other entries until the total cost is within the budget again.
+/// Returns the number of entries evicted.
+size_t RMTileLRUSetCost(RMTileLRU *lru, uint64_t key, size_t cost);
+
+/// Evicts least recently used entries until one more entry of the given cost fits.
+/// Returns the number of entries evicted.
+size_t RMTileLRUMakeSpace(RMTileLRU *lru, size_t cost);
+
+/// Returns 1 and the key of the entry that would be evicted first to make room for one more
+/// entry of the given cost, or 0 if it fits without evicting anything.
+int RMTileLRUVictim(const RMTileLRU *lru, size_t cost, uint64_t *key);
+
+/// Visits all entries from the least to the most recently used. The visitor must not change the cache.
+void RMTileLRUForEach(const RMTileLRU *lru, RMTileLRUVisitor visit, void *context);
+
+/// Number of cached entries.
+size_t RMTileLRUCount(const RMTileLRU *lru);
+/// Total cost of the cached entries.
+size_t RMTileLRUCost(const RMTileLRU *lru);
+
+#endif
@@ -79,6 +79,15 @@
 /// Changes the zoom level, and also the bounds, of the tiles to be displayed.  Updates 
 - (void)zoomByFactor: (float) zoomFactor near:(CGPoint) center;
 
+/*! Asks for the tiles the map is heading for while it moves, ahead of loading them for display.
+
+ velocity is how fast the map moves on screen, in pixels per second, and decay how fast that dies
+ down, per second, or 0 while a finger drags it. zoomRate is in zoom levels per second, positive
+ when zooming in. Prefetching goes on while expensive operations are suspended, since the tiles
+ are read after those on screen; it stops when loading is suppressed.
+ */
+- (void)prefetchMoving: (CGSize) velocity decay: (float) decay zooming: (float) zoomRate;
+
 /// Clears the bounds that designate which area of the screen is guaranteed to have tiles that are loaded.
 - (void)clearLoadedBounds;
 
@@ -186,6 +186,30 @@
 	[self updateLoadedImages];
 }
 
+#pragma mark -
+#pragma mark Prefetching
+- (void)prefetchMoving: (CGSize) velocity decay: (float) decay zooming: (float) zoomRate
+{
+	RMTileRect rect;
+	RMTileMotion motion;
+	float pixelsPerTile;
+
+	if (suppressLoading || [content mercatorToTileProjection] == nil || [content mercatorToScreenProjection] == nil)
+		return;
+
+	rect = [content tileBounds];
+	if (rect.size.width <= 0)
+		return;
+	pixelsPerTile = [content screenBounds].size.width / rect.size.width;
+
+	// moving the map one way moves the screen over the tiles the other way
+	motion.vx = -velocity.width / pixelsPerTile;
+	motion.vy = -velocity.height / pixelsPerTile;
+	motion.decay = decay;
+	motion.zoomRate = zoomRate;
+	[[content imagesOnScreen] prefetchTiles:rect moving:motion];
+}
+
 #pragma mark -
 #pragma mark Toggling the suppression of loading tiles
 - (BOOL) suppressLoading
@@ -0,0 +1,391 @@
+//
+//  RMTileMissSet.c
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+#include "RMTileMissSet.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	uint64_t key;			// zoom and block coordinates, or kRMTileMissSetEmpty
+	uint64_t bits[2];		// one bit per tile of the block, for each generation
+} RMTileMissSetBlock;
+
+struct RMTileMissSet {
+	RMTileMissSetBlock *blocks;	// open addressing with linear probing
+	size_t mask;			// slot count - 1, a power of two minus one
+	size_t used;			// slots holding a block
+	time_t generationStart;		// when the current generation began
+	unsigned timeToLive, generationLength;
+	int current;			// index into bits of the current generation
+};
+
+#define kRMTileMissSetEmpty UINT64_MAX
+#define kRMTileMissSetInitialSlots 64
+#define kRMTileMissSetMaxZoom 32
+
+static const char kRMTileMissSetMagic[4] = { 'R', 'M', 'M', 'S' };
+#define kRMTileMissSetVersion 1
+
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t timeToLive;
+	uint32_t current;
+	int64_t generationStart;
+	uint64_t count;
+} RMTileMissSetFileHeader;
+
+// Zoom in the top bits, then the block column and row. Zoom levels up to 32 keep the key
+// away from kRMTileMissSetEmpty.
+static uint64_t RMTileMissSetKey(RMTile tile)
+{
+	return ((uint64_t)tile.zoom << 58) | ((uint64_t)(tile.x >> 3) << 29) | (uint64_t)(tile.y >> 3);
+}
+
+static uint64_t RMTileMissSetBit(RMTile tile)
+{
+	return 1ULL << (((tile.y & 7) << 3) | (tile.x & 7));
+}
+
+static int RMTileMissSetValid(RMTile tile)
+{
+	return tile.zoom >= 0 && tile.zoom <= kRMTileMissSetMaxZoom;
+}
+
+static size_t RMTileMissSetSlot(const RMTileMissSet *set, uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return (size_t)key & set->mask;
+}
+
+// Returns the slot holding the key, or the empty slot where it belongs.
+static RMTileMissSetBlock *RMTileMissSetProbe(const RMTileMissSet *set, uint64_t key)
+{
+	size_t slot = RMTileMissSetSlot(set, key);
+	while (set->blocks[slot].key != key && set->blocks[slot].key != kRMTileMissSetEmpty)
+		slot = (slot + 1) & set->mask;
+	return &set->blocks[slot];
+}
+
+static RMTileMissSetBlock *RMTileMissSetAllocate(size_t slots)
+{
+	RMTileMissSetBlock *blocks = malloc(slots * sizeof(RMTileMissSetBlock));
+	size_t i;
+	if (blocks == NULL)
+		return NULL;
+	for (i = 0; i < slots; i++)
+		blocks[i].key = kRMTileMissSetEmpty;
+	return blocks;
+}
+
+// Moves the blocks that still hold a miss into a table of the given size.
+static int RMTileMissSetRehash(RMTileMissSet *set, size_t slots)
+{
+	RMTileMissSetBlock *old = set->blocks;
+	size_t oldSlots = set->mask + 1, i;
+	RMTileMissSetBlock *blocks = RMTileMissSetAllocate(slots);
+	if (blocks == NULL)
+		return 0;
+
+	set->blocks = blocks;
+	set->mask = slots - 1;
+	set->used = 0;
+	for (i = 0; i < oldSlots; i++)
+	{
+		if (old[i].key == kRMTileMissSetEmpty || (old[i].bits[0] | old[i].bits[1]) == 0)
+			continue;
+		*RMTileMissSetProbe(set, old[i].key) = old[i];
+		set->used++;
+	}
+	free(old);
+	return 1;
+}
+
+// Smallest table that keeps the given number of blocks at most half full.
+static size_t RMTileMissSetSlotsFor(size_t count)
+{
+	size_t slots = kRMTileMissSetInitialSlots;
+	while (slots < count * 2)
+		slots *= 2;
+	return slots;
+}
+
+static size_t RMTileMissSetLive(const RMTileMissSet *set)
+{
+	size_t live = 0, i;
+	for (i = 0; i <= set->mask; i++)
+	{
+		if (set->blocks[i].key != kRMTileMissSetEmpty && (set->blocks[i].bits[0] | set->blocks[i].bits[1]) != 0)
+			live++;
+	}
+	return live;
+}
+
+// Drops the generations that are over by now. A clock set back starts a new generation there.
+static void RMTileMissSetAdvance(RMTileMissSet *set, time_t now)
+{
+	time_t generations;
+	size_t i;
+
+	if (now < set->generationStart)
+	{
+		set->generationStart = now;
+		return;
+	}
+
+	generations = (now - set->generationStart) / set->generationLength;
+	if (generations == 0)
+		return;
+
+	if (generations >= 2)
+	{
+		RMTileMissSetRemoveAll(set);
+	}
+	else
+	{
+		set->current = !set->current;
+		for (i = 0; i <= set->mask; i++)
+			set->blocks[i].bits[set->current] = 0;
+		// a failed rehash leaves empty blocks in place until the next generation
+		RMTileMissSetRehash(set, RMTileMissSetSlotsFor(RMTileMissSetLive(set)));
+	}
+	set->generationStart += generations * set->generationLength;
+}
+
+RMTileMissSet *RMTileMissSetCreate(unsigned timeToLive, time_t now)
+{
+	RMTileMissSet *set = calloc(1, sizeof(RMTileMissSet));
+	if (set == NULL)
+		return NULL;
+
+	set->blocks = RMTileMissSetAllocate(kRMTileMissSetInitialSlots);
+	if (set->blocks == NULL)
+	{
+		free(set);
+		return NULL;
+	}
+	set->mask = kRMTileMissSetInitialSlots - 1;
+	set->timeToLive = timeToLive < 2 ? 2 : timeToLive;
+	set->generationLength = set->timeToLive / 2;
+	set->generationStart = now;
+	return set;
+}
+
+void RMTileMissSetFree(RMTileMissSet *set)
+{
+	if (set == NULL)
+		return;
+	free(set->blocks);
+	free(set);
+}
+
+int RMTileMissSetAdd(RMTileMissSet *set, RMTile tile, time_t now)
+{
+	RMTileMissSetBlock *block;
+	uint64_t key = RMTileMissSetKey(tile);
+
+	if (!RMTileMissSetValid(tile))
+		return 1;
+
+	RMTileMissSetAdvance(set, now);
+
+	block = RMTileMissSetProbe(set, key);
+	if (block->key == kRMTileMissSetEmpty)
+	{
+		if ((set->used + 1) * 2 > set->mask + 1)
+		{
+			if (!RMTileMissSetRehash(set, RMTileMissSetSlotsFor(RMTileMissSetLive(set) + 1)))
+				return 0;
+			block = RMTileMissSetProbe(set, key);
+		}
+		block->key = key;
+		block->bits[0] = block->bits[1] = 0;
+		set->used++;
+	}
+	block->bits[set->current] |= RMTileMissSetBit(tile);
+	return 1;
+}
+
+int RMTileMissSetContains(RMTileMissSet *set, RMTile tile, time_t now)
+{
+	RMTileMissSetBlock *block;
+
+	if (!RMTileMissSetValid(tile))
+		return 0;
+
+	RMTileMissSetAdvance(set, now);
+
+	block = RMTileMissSetProbe(set, RMTileMissSetKey(tile));
+	return block->key != kRMTileMissSetEmpty && ((block->bits[0] | block->bits[1]) & RMTileMissSetBit(tile)) != 0;
+}
+
+void RMTileMissSetRemove(RMTileMissSet *set, RMTile tile)
+{
+	RMTileMissSetBlock *block;
+
+	if (!RMTileMissSetValid(tile))
+		return;
+
+	// the block itself stays until the next generation, so probe chains are never broken
+	block = RMTileMissSetProbe(set, RMTileMissSetKey(tile));
+	if (block->key != kRMTileMissSetEmpty)
+	{
+		block->bits[0] &= ~RMTileMissSetBit(tile);
+		block->bits[1] &= ~RMTileMissSetBit(tile);
+	}
+}
+
+void RMTileMissSetRemoveAll(RMTileMissSet *set)
+{
+	size_t i;
+	for (i = 0; i <= set->mask; i++)
+		set->blocks[i].key = kRMTileMissSetEmpty;
+	set->used = 0;
+}
+
+static unsigned RMTileMissSetBitCount(uint64_t bits)
+{
+	unsigned count = 0;
+	for (; bits != 0; bits &= bits - 1)
+		count++;
+	return count;
+}
+
+size_t RMTileMissSetCount(RMTileMissSet *set, time_t now)
+{
+	size_t count = 0, i;
+
+	RMTileMissSetAdvance(set, now);
+
+	for (i = 0; i <= set->mask; i++)
+	{
+		if (set->blocks[i].key != kRMTileMissSetEmpty)
+			count += RMTileMissSetBitCount(set->blocks[i].bits[0] | set->blocks[i].bits[1]);
+	}
+	return count;
+}
+
+int RMTileMissSetSave(RMTileMissSet *set, const char *path, time_t now)
+{
+	RMTileMissSetFileHeader header;
+	size_t i, length = strlen(path);
+	char *temporary = malloc(length + 5);
+	FILE *file;
+	int ok;
+
+	if (temporary == NULL)
+		return 0;
+	memcpy(temporary, path, length);
+	memcpy(temporary + length, ".tmp", 5);
+
+	file = fopen(temporary, "wb");
+	if (file == NULL)
+	{
+		free(temporary);
+		return 0;
+	}
+
+	RMTileMissSetAdvance(set, now);
+
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, kRMTileMissSetMagic, sizeof header.magic);
+	header.version = kRMTileMissSetVersion;
+	header.timeToLive = set->timeToLive;
+	header.current = set->current;
+	header.generationStart = set->generationStart;
+	header.count = RMTileMissSetLive(set);
+
+	ok = fwrite(&header, sizeof header, 1, file) == 1;
+	for (i = 0; ok && i <= set->mask; i++)
+	{
+		RMTileMissSetBlock *block = &set->blocks[i];
+		if (block->key != kRMTileMissSetEmpty && (block->bits[0] | block->bits[1]) != 0)
+			ok = fwrite(block, sizeof *block, 1, file) == 1;
+	}
+
+	if (fclose(file) != 0)
+		ok = 0;
+	if (ok)
+		ok = rename(temporary, path) == 0;
+	if (!ok)
+		remove(temporary);
+
+	free(temporary);
+	return ok;
+}
+
+int RMTileMissSetLoad(RMTileMissSet *set, const char *path, time_t now)
+{
+	RMTileMissSetFileHeader header;
+	RMTileMissSetBlock block;
+	uint64_t i;
+	FILE *file;
+	int ok;
+
+	RMTileMissSetRemoveAll(set);
+
+	file = fopen(path, "rb");
+	if (file == NULL)
+		return 0;
+
+	ok = fread(&header, sizeof header, 1, file) == 1
+		&& memcmp(header.magic, kRMTileMissSetMagic, sizeof header.magic) == 0
+		&& header.version == kRMTileMissSetVersion
+		&& header.timeToLive == set->timeToLive
+		&& header.current <= 1
+		&& header.count <= SIZE_MAX / (2 * sizeof(RMTileMissSetBlock))
+		&& RMTileMissSetRehash(set, RMTileMissSetSlotsFor((size_t)header.count));
+
+	for (i = 0; ok && i < header.count; i++)
+	{
+		RMTileMissSetBlock *slot;
+
+		ok = fread(&block, sizeof block, 1, file) == 1 && block.key != kRMTileMissSetEmpty;
+		if (!ok)
+			break;
+
+		slot = RMTileMissSetProbe(set, block.key);
+		if (slot->key == kRMTileMissSetEmpty)
+			set->used++;
+		*slot = block;
+	}
+	fclose(file);
+
+	if (!ok)
+	{
+		RMTileMissSetRemoveAll(set);
+		return 0;
+	}
+
+	set->current = header.current;
+	set->generationStart = (time_t)header.generationStart;
+	RMTileMissSetAdvance(set, now);
+	return 1;
+}
@@ -0,0 +1,79 @@
+//
+//  RMTileMissSet.h
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+#ifndef _RMTILEMISSSET_H_
+#define _RMTILEMISSSET_H_
+
+#include <stddef.h>
+#include <time.h>
+#include "RMTile.h"
+
+/*! \file RMTileMissSet.h
+ */
+/*! \struct RMTileMissSet
+ \brief The tiles a tile source is known not to have, each remembered for a limited time.
+
+ Tiles are grouped per zoom level into blocks of 8x8, and each block keeps one bit per tile in
+ a hash table, so a sparse source costs a few bytes per missing tile and one probe per lookup.
+
+ Misses do not carry their own time stamps. Instead the set keeps two generations of bits, the
+ current one and the one before it, each spanning half the time to live; when a generation is
+ over the older one is dropped as a whole. A miss is therefore remembered for at least half the
+ time to live and at most the full time to live after it was recorded.
+
+ The set can be saved to a file and read back, for instance next to the database cache. The file
+ is in the byte order of the machine that wrote it and is only meant to be read back there.
+
+ Plain C without any framework dependency besides RMTile; not thread safe.
+ */
+typedef struct RMTileMissSet RMTileMissSet;
+
+/// Creates an empty set whose misses live for timeToLive seconds (at least 2).
+/// Returns NULL if out of memory.
+RMTileMissSet *RMTileMissSetCreate(unsigned timeToLive, time_t now);
+/// Frees the set.
+void RMTileMissSetFree(RMTileMissSet *set);
+
+/// Records that the source has no such tile. Returns 0 if out of memory.
+int RMTileMissSetAdd(RMTileMissSet *set, RMTile tile, time_t now);
+/// Returns 1 if the tile is a miss that has not expired yet.
+int RMTileMissSetContains(RMTileMissSet *set, RMTile tile, time_t now);
+/// Forgets a miss, for a tile that turned up after all.
+void RMTileMissSetRemove(RMTileMissSet *set, RMTile tile);
+/// Forgets all misses.
+void RMTileMissSetRemoveAll(RMTileMissSet *set);
+
+/// Number of misses that have not expired yet.
+size_t RMTileMissSetCount(RMTileMissSet *set, time_t now);
+
+/// Writes the set to a file, replacing it atomically. Returns 0 on failure.
+int RMTileMissSetSave(RMTileMissSet *set, const char *path, time_t now);
+/// Replaces the contents of the set with the misses saved in a file that have not expired yet.
+/// A file written with a different time to live is ignored. Returns 0 if the file was missing
+/// or could not be read, in which case the set is left empty.
+int RMTileMissSetLoad(RMTileMissSet *set, const char *path, time_t now);
+
+#endif
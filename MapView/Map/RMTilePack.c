@@ -0,0 +1,292 @@
+//
+//  RMTilePack.c
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// pwrite() and ftruncate() are POSIX, not C99
+#define _XOPEN_SOURCE 600
+
+#include "RMTilePack.h"
+#include "RMTileLRU.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct RMTilePackSegment {
+	pthread_mutex_t lock;
+	unsigned refs;		// one for the map cache of the pack, one per pin
+	void *base;
+	size_t size;
+};
+
+struct RMTilePack {
+	char *prefix;
+	size_t segmentSize;
+
+	pthread_mutex_t lock;		// maps and active
+	RMTileLRU *maps;		// segment number -> RMTilePackSegment
+	uint32_t active;
+	uint64_t activeSize;
+	int fd;		// of the active segment, -1 until the first append
+	int dirty;		// appended since the last sync
+};
+
+static char *RMTilePackPath(const RMTilePack *pack, uint32_t segment)
+{
+	char *path = malloc(strlen(pack->prefix) + 32);
+	if (path != NULL)
+		sprintf(path, "%s-%u.seg", pack->prefix, (unsigned)segment);
+	return path;
+}
+
+static void RMTilePackRelease(void *context, uint64_t key, void *value)
+{
+	RMTilePackUnpin(value);
+}
+
+RMTilePack *RMTilePackOpen(const char *prefix, uint32_t active, uint64_t activeSize, size_t segmentSize, unsigned mappedSegments)
+{
+	RMTilePack *pack = calloc(1, sizeof(RMTilePack));
+
+	if (pack == NULL)
+		return NULL;
+	pack->prefix = malloc(strlen(prefix) + 1);
+	pack->maps = RMTileLRUCreate(0, mappedSegments > 0 ? mappedSegments : 1, RMTilePackRelease, NULL);
+	if (pack->prefix == NULL || pack->maps == NULL) {
+		free(pack->prefix);
+		RMTileLRUFree(pack->maps);
+		free(pack);
+		return NULL;
+	}
+	strcpy(pack->prefix, prefix);
+	pthread_mutex_init(&pack->lock, NULL);
+	pack->segmentSize = segmentSize;
+	pack->active = active;
+	pack->activeSize = activeSize;
+	pack->fd = -1;
+
+	return pack;
+}
+
+void RMTilePackClose(RMTilePack *pack)
+{
+	if (pack == NULL)
+		return;
+
+	RMTileLRUFree(pack->maps);
+	if (pack->fd >= 0)
+		close(pack->fd);
+	pthread_mutex_destroy(&pack->lock);
+	free(pack->prefix);
+	free(pack);
+}
+
+// Opens the file of the active segment. With truncate, bytes past activeSize are dropped:
+// a crash can leave data there that was never committed to the index.
+static int RMTilePackOpenActive(RMTilePack *pack, int truncate)
+{
+	char *path = RMTilePackPath(pack, pack->active);
+
+	if (path == NULL)
+		return 0;
+	pack->fd = open(path, O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+	free(path);
+	if (pack->fd < 0)
+		return 0;
+	if (!truncate && ftruncate(pack->fd, (off_t)pack->activeSize) != 0) {
+		close(pack->fd);
+		pack->fd = -1;
+		return 0;
+	}
+	return 1;
+}
+
+int RMTilePackSync(RMTilePack *pack)
+{
+	if (pack->fd < 0 || !pack->dirty)
+		return 1;
+	pack->dirty = 0;
+	return fsync(pack->fd) == 0;
+}
+
+uint32_t RMTilePackRoll(RMTilePack *pack)
+{
+	uint32_t active;
+
+	RMTilePackSync(pack);
+	pthread_mutex_lock(&pack->lock);
+	if (pack->fd >= 0)
+		close(pack->fd);
+	pack->fd = -1;
+	pack->active++;
+	pack->activeSize = 0;
+	active = pack->active;
+	pthread_mutex_unlock(&pack->lock);
+
+	RMTilePackOpenActive(pack, 1);
+	return active;
+}
+
+uint32_t RMTilePackActive(RMTilePack *pack)
+{
+	uint32_t active;
+
+	pthread_mutex_lock(&pack->lock);
+	active = pack->active;
+	pthread_mutex_unlock(&pack->lock);
+	return active;
+}
+
+int RMTilePackAppend(RMTilePack *pack, const void *data, size_t length, uint32_t *segment, uint64_t *offset, uint64_t *segmentSize)
+{
+	const char *bytes = data;
+	size_t written = 0;
+
+	// a tile larger than a segment gets a segment of its own
+	if (pack->activeSize > 0 && pack->activeSize + length > pack->segmentSize)
+		RMTilePackRoll(pack);
+	if (pack->fd < 0 && !RMTilePackOpenActive(pack, 0))
+		return 0;
+
+	while (written < length) {
+		ssize_t result = pwrite(pack->fd, bytes + written, length - written, (off_t)(pack->activeSize + written));
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result <= 0)
+			return 0;
+		written += (size_t)result;
+	}
+
+	// A map of the segment made before is only segmentSize long, too short for the tile; the
+	// next pin maps the whole file.
+	if (length > pack->segmentSize) {
+		pthread_mutex_lock(&pack->lock);
+		RMTileLRURemove(pack->maps, pack->active);
+		pthread_mutex_unlock(&pack->lock);
+	}
+
+	*segment = pack->active;
+	*offset = pack->activeSize;
+	pack->activeSize += length;
+	*segmentSize = pack->activeSize;
+	pack->dirty = 1;
+	return 1;
+}
+
+void RMTilePackRetire(RMTilePack *pack, uint32_t segment)
+{
+	char *path = RMTilePackPath(pack, segment);
+
+	pthread_mutex_lock(&pack->lock);
+	RMTileLRURemove(pack->maps, segment);
+	pthread_mutex_unlock(&pack->lock);
+
+	// maps of the file stay valid after it is gone
+	if (path != NULL)
+		unlink(path);
+	free(path);
+}
+
+// Maps a segment with one reference, for the map cache. Called with the pack lock held.
+static RMTilePackSegment *RMTilePackMap(RMTilePack *pack, uint32_t number)
+{
+	RMTilePackSegment *segment;
+	char *path = RMTilePackPath(pack, number);
+	struct stat status;
+	int fd;
+
+	if (path == NULL)
+		return NULL;
+	fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &status) != 0 || (segment = calloc(1, sizeof(RMTilePackSegment))) == NULL) {
+		close(fd);
+		return NULL;
+	}
+
+	// The active segment grows after it is mapped, so map all it can grow to. Only bytes that
+	// were written before they were looked up are ever read.
+	segment->size = (size_t)status.st_size > pack->segmentSize ? (size_t)status.st_size : pack->segmentSize;
+	segment->base = segment->size > 0 ? mmap(NULL, segment->size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (segment->base == MAP_FAILED) {
+		free(segment);
+		return NULL;
+	}
+	pthread_mutex_init(&segment->lock, NULL);
+	segment->refs = 1;
+	return segment;
+}
+
+RMTilePackSegment *RMTilePackPin(RMTilePack *pack, uint32_t number)
+{
+	RMTilePackSegment *segment;
+
+	pthread_mutex_lock(&pack->lock);
+	segment = RMTileLRUGet(pack->maps, number);
+	if (segment == NULL && (segment = RMTilePackMap(pack, number)) != NULL) {
+		segment->refs++;
+		// a failed put drops the reference of the cache, not the pin
+		RMTileLRUPut(pack->maps, number, segment, 0);
+	} else if (segment != NULL) {
+		pthread_mutex_lock(&segment->lock);
+		segment->refs++;
+		pthread_mutex_unlock(&segment->lock);
+	}
+	pthread_mutex_unlock(&pack->lock);
+
+	return segment;
+}
+
+const void *RMTilePackBytes(const RMTilePackSegment *segment, uint64_t offset, size_t length)
+{
+	if (offset > segment->size || length > segment->size - offset)
+		return NULL;
+	return (const char *)segment->base + offset;
+}
+
+void RMTilePackUnpin(RMTilePackSegment *segment)
+{
+	unsigned refs;
+
+	pthread_mutex_lock(&segment->lock);
+	refs = --segment->refs;
+	pthread_mutex_unlock(&segment->lock);
+
+	if (refs == 0) {
+		munmap(segment->base, segment->size);
+		pthread_mutex_destroy(&segment->lock);
+		free(segment);
+	}
+}
@@ -0,0 +1,80 @@
+//
+//  RMTilePack.h
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _RMTILEPACK_H_
+#define _RMTILEPACK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*! \file RMTilePack.h
+ */
+/*! \struct RMTilePack
+ \brief Append-only segment files holding tile data, read through memory maps.
+
+ Segment n of a pack lives in "<prefix>-<n>.seg". Data is only ever appended, to the active
+ segment, which is replaced by a new one once the next append would take it past
+ segmentSize. Which bytes are still in use is up to the caller (RMTileStore keeps that in
+ SQLite); segments nothing uses any more are retired, which deletes their file.
+
+ Segments are read through read-only shared maps, kept for the most recently used
+ mappedSegments segments. A pinned segment stays mapped, even after it has been retired or
+ the pack closed, until it is unpinned, so its bytes can be handed out without copying.
+
+ Appending, syncing, rolling and retiring must not run on two threads at once; pinning may
+ run on any number of threads alongside them.
+ */
+typedef struct RMTilePack RMTilePack;
+/// A mapped segment.
+typedef struct RMTilePackSegment RMTilePackSegment;
+
+/// Opens a pack whose active segment is segment active, of which activeSize bytes are in use.
+/// The file is only created, or cut back to activeSize, by the first append.
+RMTilePack *RMTilePackOpen(const char *prefix, uint32_t active, uint64_t activeSize, size_t segmentSize, unsigned mappedSegments);
+/// Closes the pack. Pinned segments stay mapped until unpinned.
+void RMTilePackClose(RMTilePack *pack);
+
+/// Appends data to the active segment, or to a new one if it would grow past segmentSize.
+/// Returns 0 on error, otherwise where the data went and the new size of that segment.
+int RMTilePackAppend(RMTilePack *pack, const void *data, size_t length, uint32_t *segment, uint64_t *offset, uint64_t *segmentSize);
+/// Makes appended data durable. Returns 0 on error.
+int RMTilePackSync(RMTilePack *pack);
+/// Starts a new, empty active segment. Returns its number.
+uint32_t RMTilePackRoll(RMTilePack *pack);
+/// The segment appends go to.
+uint32_t RMTilePackActive(RMTilePack *pack);
+/// Deletes a segment that is no longer used; it stays mapped while pinned.
+void RMTilePackRetire(RMTilePack *pack, uint32_t segment);
+
+/// Maps a segment, if not mapped yet, and pins it. Returns NULL if it cannot be mapped.
+RMTilePackSegment *RMTilePackPin(RMTilePack *pack, uint32_t segment);
+/// The bytes at offset in a pinned segment, or NULL if they are past its end.
+const void *RMTilePackBytes(const RMTilePackSegment *segment, uint64_t offset, size_t length);
+/// Releases a pin; may be called on any thread, and after the pack has been closed.
+void RMTilePackUnpin(RMTilePackSegment *segment);
+
+#endif
@@ -0,0 +1,133 @@
+//
+//  RMTilePrefetch.c
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "RMTilePrefetch.h"
+#include <math.h>
+#include <stdlib.h>
+
+/// Moments between minSeconds and maxSeconds at which the screen is predicted.
+#define kRMTilePrefetchSamples 4
+
+typedef struct {
+	RMTile tile;
+	double distance;
+} RMTilePrefetchCandidate;
+
+static int RMTilePrefetchCompare(const void *a, const void *b)
+{
+	double da = ((const RMTilePrefetchCandidate *)a)->distance;
+	double db = ((const RMTilePrefetchCandidate *)b)->distance;
+	return (da > db) - (da < db);
+}
+
+static int RMTilePrefetchContains(const RMTile *tiles, size_t count, RMTile tile)
+{
+	for (size_t i = 0; i < count; i++)
+		if (RMTilesEqual(tiles[i], tile))
+			return 1;
+	return 0;
+}
+
+void RMTileMotionPredict(RMTileMotion motion, double seconds, double *dx, double *dy, double *dzoom)
+{
+	// the distance covered by a speed dying down as exp(-decay t)
+	double travel = motion.decay > 0 ? (1.0 - exp(-motion.decay * seconds)) / motion.decay : seconds;
+
+	*dx = motion.vx * travel;
+	*dy = motion.vy * travel;
+	*dzoom = motion.zoomRate * seconds;
+}
+
+size_t RMTilePrefetchPredict(RMTileRect rect, RMTileMotion motion, double minSeconds, double maxSeconds,
+							 short minZoom, short maxZoom, RMTile *tiles, size_t capacity)
+{
+	short zoom = rect.origin.tile.zoom;
+	double centreX = rect.origin.tile.x + rect.origin.offset.x + rect.size.width / 2;
+	double centreY = rect.origin.tile.y + rect.origin.offset.y + rect.size.height / 2;
+	RMTilePrefetchCandidate *candidates = NULL;
+	size_t candidateCapacity = 0, count = 0;
+
+	for (int sample = 0; sample < kRMTilePrefetchSamples && count < capacity; sample++) {
+		double seconds = minSeconds + (maxSeconds - minSeconds) * sample / (kRMTilePrefetchSamples - 1);
+		double dx, dy, dzoom, scale, x, y, halfWidth, halfHeight, side;
+		long minX, maxX, minY, maxY;
+		short level;
+		size_t found = 0;
+
+		RMTileMotionPredict(motion, seconds, &dx, &dy, &dzoom);
+		level = (short)floor(zoom + dzoom + 0.5);
+		if (level < minZoom)
+			level = minZoom;
+		if (level > maxZoom)
+			level = maxZoom;
+		if (level < 0 || level > 30)
+			continue;
+
+		// the screen at the predicted zoom, in tiles of the level it shows
+		scale = ldexp(1.0, level - zoom);
+		x = (centreX + dx) * scale;
+		y = (centreY + dy) * scale;
+		halfWidth = rect.size.width * scale * exp2(-dzoom) / 2;
+		halfHeight = rect.size.height * scale * exp2(-dzoom) / 2;
+		side = ldexp(1.0, level);
+		minX = (long)floor(fmax(x - halfWidth, 0));
+		maxX = (long)ceil(fmin(x + halfWidth, side)) - 1;
+		minY = (long)floor(fmax(y - halfHeight, 0));
+		maxY = (long)ceil(fmin(y + halfHeight, side)) - 1;
+		if (minX > maxX || minY > maxY)
+			continue;
+
+		if ((size_t)((maxX - minX + 1) * (maxY - minY + 1)) > candidateCapacity) {
+			size_t needed = (size_t)((maxX - minX + 1) * (maxY - minY + 1));
+			RMTilePrefetchCandidate *grown = realloc(candidates, needed * sizeof(RMTilePrefetchCandidate));
+			if (grown == NULL)
+				break;
+			candidates = grown;
+			candidateCapacity = needed;
+		}
+
+		for (long tx = minX; tx <= maxX; tx++) {
+			for (long ty = minY; ty <= maxY; ty++) {
+				RMTilePrefetchCandidate *candidate = &candidates[found];
+
+				candidate->tile.x = (uint32_t)tx;
+				candidate->tile.y = (uint32_t)ty;
+				candidate->tile.zoom = level;
+				candidate->distance = (tx + 0.5 - x) * (tx + 0.5 - x) + (ty + 0.5 - y) * (ty + 0.5 - y);
+				found++;
+			}
+		}
+
+		qsort(candidates, found, sizeof(RMTilePrefetchCandidate), RMTilePrefetchCompare);
+		for (size_t i = 0; i < found && count < capacity; i++)
+			if (!RMTilePrefetchContains(tiles, count, candidates[i].tile))
+				tiles[count++] = candidates[i].tile;
+	}
+
+	free(candidates);
+	return count;
+}
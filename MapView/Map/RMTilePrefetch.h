@@ -0,0 +1,77 @@
+//
+//  RMTilePrefetch.h
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _RMTILEPREFETCH_H_
+#define _RMTILEPREFETCH_H_
+
+#include <stddef.h>
+#include "RMTile.h"
+
+/*! \file RMTilePrefetch.h
+ \brief Predicts which tiles the screen is heading for, so they can be asked for ahead of time.
+
+ The screen moves on with its current speed, which dies down exponentially while it decelerates
+ after a flick, and zooms on with its current pinch rate. The tiles it will show later are
+ those of the zoom level it will be nearest to by then.
+
+ Plain C, without any framework dependency besides RMTile.
+ */
+
+/// How the screen moves, in tiles of the zoom level of its tile rect.
+typedef struct {
+	/// speed of the centre of the screen, in tiles per second
+	double vx, vy;
+	/// rate at which the speed dies down, per second; 0 keeps it up
+	double decay;
+	/// zoom levels per second, positive when zooming in
+	double zoomRate;
+} RMTileMotion;
+
+/// Counters of the prefetched tiles, kept by whoever asks for them.
+typedef struct {
+	/// tiles asked for ahead of time, and those of them that came on screen
+	unsigned long prefetched, hits;
+	/// hits that had loaded by the time they came on screen
+	unsigned long ready;
+	/// prefetched tiles let go of without coming on screen
+	unsigned long wasted;
+} RMTilePrefetchStatistics;
+
+/// How far the centre of the screen has moved after the given seconds, in tiles of the zoom level
+/// of the screen, and how many zoom levels it has zoomed by.
+void RMTileMotionPredict(RMTileMotion motion, double seconds, double *dx, double *dy, double *dzoom);
+
+/// Fills tiles with up to capacity tiles that are predicted to come on screen between minSeconds
+/// and maxSeconds from now, soonest first and the ones nearest to the centre of the screen first
+/// after that, and returns how many. rect is the screen now. Tiles outside of the world, which has
+/// 2^zoom tiles a side, are left out, and the zoom level is kept within minZoom to maxZoom. The
+/// tiles on screen now are among them if the screen is still over them, so that a screen that has
+/// come to rest keeps what was predicted for it; the caller leaves out the tiles it has.
+size_t RMTilePrefetchPredict(RMTileRect rect, RMTileMotion motion, double minSeconds, double maxSeconds,
+							 short minZoom, short maxZoom, RMTile *tiles, size_t capacity);
+
+#endif
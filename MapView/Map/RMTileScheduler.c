@@ -0,0 +1,517 @@
+//
+//  RMTileScheduler.c
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "RMTileScheduler.h"
+#include "RMTileIndex.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define kRMTileSchedulerRunning SIZE_MAX	// heap position of a running request
+#define kRMTileSchedulerFocuses 16		// owners whose focus is kept while they have no requests
+
+// The focus of one owner.
+typedef struct RMTileSchedulerFocus {
+	const void *owner;
+	short zoom;
+	double x, y;
+	size_t entries;
+	struct RMTileSchedulerFocus *next;
+} RMTileSchedulerFocus;
+
+typedef struct RMTileSchedulerEntry {
+	RMTile tile;
+	void *request;
+	RMTileSchedulerFocus *focus;	// of the owner of the request
+	struct RMTileSchedulerEntry *next;	// of another owner, for the same tile
+	RMTileRequestKind kind;
+	int zoomRank;			// distance from the focus zoom level, coarser levels first
+	double distance;		// squared, in tiles of the focus zoom level
+	unsigned long sequence;
+	size_t position;		// in the heap, or kRMTileSchedulerRunning
+	double queued;
+} RMTileSchedulerEntry;
+
+struct RMTileScheduler {
+	pthread_mutex_t lock;
+	pthread_cond_t work, idle;
+	pthread_t *threads;
+	unsigned threadCount;
+	int stopping;
+
+	RMTileSchedulerWork perform;
+	RMTileSchedulerDrop drop;
+	void *context;
+
+	RMTileIndex *entries;		// queued and running, by tile, then chained by owner
+	RMTileSchedulerEntry **heap;	// queued, most urgent first
+	size_t queued, capacity, running;
+	unsigned long sequence;
+
+	RMTileSchedulerFocus *focuses;
+
+	RMTileSchedulerStatistics statistics;
+};
+
+static double RMTileSchedulerNow(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec + now.tv_usec * 1e-6;
+}
+
+static void RMTileSchedulerRank(RMTileSchedulerEntry *entry)
+{
+	const RMTileSchedulerFocus *focus = entry->focus;
+	int dz = focus->zoom - entry->tile.zoom;
+	// the centre of the tile in tiles of the focus zoom level
+	double scale = ldexp(1.0, dz);
+	double dx = (entry->tile.x + 0.5) * scale - focus->x;
+	double dy = (entry->tile.y + 0.5) * scale - focus->y;
+
+	entry->zoomRank = dz >= 0 ? 2 * dz : -2 * dz + 1;
+	entry->distance = dx * dx + dy * dy;
+}
+
+static int RMTileSchedulerBefore(const RMTileSchedulerEntry *a, const RMTileSchedulerEntry *b)
+{
+	if (a->kind != b->kind)
+		return a->kind < b->kind;
+	if (a->zoomRank != b->zoomRank)
+		return a->zoomRank < b->zoomRank;
+	if (a->distance != b->distance)
+		return a->distance < b->distance;
+	return a->sequence < b->sequence;
+}
+
+static void RMTileSchedulerPlace(RMTileScheduler *scheduler, size_t position, RMTileSchedulerEntry *entry)
+{
+	scheduler->heap[position] = entry;
+	entry->position = position;
+}
+
+static void RMTileSchedulerSiftUp(RMTileScheduler *scheduler, size_t position)
+{
+	RMTileSchedulerEntry *entry = scheduler->heap[position];
+
+	while (position > 0) {
+		size_t parent = (position - 1) / 2;
+		if (!RMTileSchedulerBefore(entry, scheduler->heap[parent]))
+			break;
+		RMTileSchedulerPlace(scheduler, position, scheduler->heap[parent]);
+		position = parent;
+	}
+	RMTileSchedulerPlace(scheduler, position, entry);
+}
+
+static void RMTileSchedulerSiftDown(RMTileScheduler *scheduler, size_t position)
+{
+	RMTileSchedulerEntry *entry = scheduler->heap[position];
+
+	for (;;) {
+		size_t child = 2 * position + 1;
+		if (child >= scheduler->queued)
+			break;
+		if (child + 1 < scheduler->queued && RMTileSchedulerBefore(scheduler->heap[child + 1], scheduler->heap[child]))
+			child++;
+		if (!RMTileSchedulerBefore(scheduler->heap[child], entry))
+			break;
+		RMTileSchedulerPlace(scheduler, position, scheduler->heap[child]);
+		position = child;
+	}
+	RMTileSchedulerPlace(scheduler, position, entry);
+}
+
+// Takes a queued entry out of the heap. Called with the lock held.
+static void RMTileSchedulerUnqueue(RMTileScheduler *scheduler, RMTileSchedulerEntry *entry)
+{
+	size_t position = entry->position;
+	RMTileSchedulerEntry *last = scheduler->heap[--scheduler->queued];
+
+	entry->position = kRMTileSchedulerRunning;
+	if (last == entry)
+		return;
+	RMTileSchedulerPlace(scheduler, position, last);
+	if (position > 0 && RMTileSchedulerBefore(last, scheduler->heap[(position - 1) / 2]))
+		RMTileSchedulerSiftUp(scheduler, position);
+	else
+		RMTileSchedulerSiftDown(scheduler, position);
+}
+
+// Returns the focus of the owner, creating it if needed, and moves it to the front of the list.
+// The focuses of owners without requests are dropped once more recent owners fill the list.
+// Called with the lock held.
+static RMTileSchedulerFocus *RMTileSchedulerFocusOf(RMTileScheduler *scheduler, const void *owner)
+{
+	RMTileSchedulerFocus *focus, **link;
+	size_t position = 1;
+
+	for (link = &scheduler->focuses; *link != NULL; link = &(*link)->next) {
+		if ((*link)->owner == owner)
+			break;
+	}
+	if ((focus = *link) != NULL) {
+		*link = focus->next;
+	} else {
+		if ((focus = calloc(1, sizeof(RMTileSchedulerFocus))) == NULL)
+			return NULL;
+		focus->owner = owner;
+	}
+	focus->next = scheduler->focuses;
+	scheduler->focuses = focus;
+
+	for (link = &focus->next; *link != NULL; ) {
+		RMTileSchedulerFocus *other = *link;
+		if (position >= kRMTileSchedulerFocuses && other->entries == 0) {
+			*link = other->next;
+			free(other);
+		} else {
+			link = &other->next;
+			position++;
+		}
+	}
+	return focus;
+}
+
+// Returns the entry of the owner for the tile, or NULL. Called with the lock held.
+static RMTileSchedulerEntry *RMTileSchedulerFind(RMTileScheduler *scheduler, const void *owner, RMTile tile)
+{
+	RMTileSchedulerEntry *entry;
+
+	for (entry = RMTileIndexGet(scheduler->entries, tile); entry != NULL; entry = entry->next) {
+		if (entry->focus->owner == owner)
+			return entry;
+	}
+	return NULL;
+}
+
+// Takes an entry that is no longer queued out of the index. Called with the lock held.
+static void RMTileSchedulerForget(RMTileScheduler *scheduler, RMTileSchedulerEntry *entry)
+{
+	RMTileSchedulerEntry *head = RMTileIndexGet(scheduler->entries, entry->tile);
+
+	if (head == entry) {
+		// replacing the value of a tile in the index never fails
+		if (entry->next != NULL)
+			RMTileIndexInsert(scheduler->entries, entry->tile, entry->next);
+		else
+			RMTileIndexRemove(scheduler->entries, entry->tile);
+	} else {
+		while (head->next != entry)
+			head = head->next;
+		head->next = entry->next;
+	}
+	entry->focus->entries--;
+}
+
+static void *RMTileSchedulerWorker(void *argument)
+{
+	RMTileScheduler *scheduler = argument;
+
+	pthread_mutex_lock(&scheduler->lock);
+	for (;;) {
+		while (!scheduler->stopping && scheduler->queued == 0)
+			pthread_cond_wait(&scheduler->work, &scheduler->lock);
+		if (scheduler->stopping)
+			break;
+
+		RMTileSchedulerEntry *entry = scheduler->heap[0];
+		double started = RMTileSchedulerNow();
+		RMTileSchedulerUnqueue(scheduler, entry);
+		scheduler->running++;
+		scheduler->statistics.started++;
+		scheduler->statistics.waitSeconds += started - entry->queued;
+		pthread_mutex_unlock(&scheduler->lock);
+
+		scheduler->perform(scheduler->context, entry->tile, entry->request);
+
+		pthread_mutex_lock(&scheduler->lock);
+		scheduler->statistics.workSeconds += RMTileSchedulerNow() - started;
+		RMTileSchedulerForget(scheduler, entry);
+		free(entry);
+		scheduler->running--;
+		if (scheduler->queued == 0 && scheduler->running == 0)
+			pthread_cond_broadcast(&scheduler->idle);
+	}
+	pthread_mutex_unlock(&scheduler->lock);
+	return NULL;
+}
+
+RMTileScheduler *RMTileSchedulerCreate(unsigned workers, RMTileSchedulerWork work, RMTileSchedulerDrop drop, void *context)
+{
+	RMTileScheduler *scheduler = calloc(1, sizeof(RMTileScheduler));
+
+	if (scheduler == NULL)
+		return NULL;
+	if (workers == 0)
+		workers = 1;
+	scheduler->perform = work;
+	scheduler->drop = drop;
+	scheduler->context = context;
+	scheduler->entries = RMTileIndexCreate();
+	scheduler->threads = calloc(workers, sizeof(pthread_t));
+	if (scheduler->entries == NULL || scheduler->threads == NULL) {
+		RMTileIndexFree(scheduler->entries);
+		free(scheduler->threads);
+		free(scheduler);
+		return NULL;
+	}
+	pthread_mutex_init(&scheduler->lock, NULL);
+	pthread_cond_init(&scheduler->work, NULL);
+	pthread_cond_init(&scheduler->idle, NULL);
+
+	for (; scheduler->threadCount < workers; scheduler->threadCount++) {
+		if (pthread_create(&scheduler->threads[scheduler->threadCount], NULL, RMTileSchedulerWorker, scheduler) != 0) {
+			RMTileSchedulerFree(scheduler);
+			return NULL;
+		}
+	}
+	return scheduler;
+}
+
+void RMTileSchedulerFree(RMTileScheduler *scheduler)
+{
+	RMTileSchedulerEntry **queued;
+	size_t count;
+
+	if (scheduler == NULL)
+		return;
+
+	pthread_mutex_lock(&scheduler->lock);
+	scheduler->stopping = 1;
+	queued = scheduler->heap;
+	count = scheduler->queued;
+	scheduler->heap = NULL;
+	scheduler->queued = scheduler->capacity = 0;
+	pthread_cond_broadcast(&scheduler->work);
+	pthread_mutex_unlock(&scheduler->lock);
+
+	for (size_t i = 0; i < count; i++) {
+		if (scheduler->drop != NULL)
+			scheduler->drop(scheduler->context, queued[i]->tile, queued[i]->request);
+		free(queued[i]);
+	}
+	free(queued);
+
+	for (unsigned i = 0; i < scheduler->threadCount; i++)
+		pthread_join(scheduler->threads[i], NULL);
+
+	pthread_cond_destroy(&scheduler->idle);
+	pthread_cond_destroy(&scheduler->work);
+	pthread_mutex_destroy(&scheduler->lock);
+	while (scheduler->focuses != NULL) {
+		RMTileSchedulerFocus *focus = scheduler->focuses;
+		scheduler->focuses = focus->next;
+		free(focus);
+	}
+	RMTileIndexFree(scheduler->entries);
+	free(scheduler->threads);
+	free(scheduler);
+}
+
+int RMTileSchedulerSubmit(RMTileScheduler *scheduler, const void *owner, RMTile tile, RMTileRequestKind kind, void *request)
+{
+	RMTileSchedulerEntry *entry;
+	RMTileSchedulerFocus *focus;
+	int accepted = 0;
+
+	pthread_mutex_lock(&scheduler->lock);
+	entry = RMTileSchedulerFind(scheduler, owner, tile);
+	if (entry != NULL) {
+		// promote the same request, and let it be otherwise
+		if (entry->request == request && entry->position != kRMTileSchedulerRunning && kind < entry->kind) {
+			entry->kind = kind;
+			RMTileSchedulerSiftUp(scheduler, entry->position);
+			scheduler->statistics.visible += kind == RMTileRequestVisible;
+		}
+		accepted = entry->request == request;
+		goto done;
+	}
+
+	if (scheduler->queued == scheduler->capacity) {
+		size_t capacity = scheduler->capacity ? scheduler->capacity * 2 : 64;
+		RMTileSchedulerEntry **heap = realloc(scheduler->heap, capacity * sizeof(RMTileSchedulerEntry *));
+		if (heap == NULL)
+			goto done;
+		scheduler->heap = heap;
+		scheduler->capacity = capacity;
+	}
+	focus = RMTileSchedulerFocusOf(scheduler, owner);
+	if (focus == NULL)
+		goto done;
+	entry = malloc(sizeof(RMTileSchedulerEntry));
+	if (entry == NULL)
+		goto done;
+	entry->next = RMTileIndexGet(scheduler->entries, tile);
+	if (!RMTileIndexInsert(scheduler->entries, tile, entry)) {
+		free(entry);
+		goto done;
+	}
+
+	entry->tile = tile;
+	entry->request = request;
+	entry->focus = focus;
+	focus->entries++;
+	entry->kind = kind;
+	entry->sequence = scheduler->sequence++;
+	entry->queued = RMTileSchedulerNow();
+	RMTileSchedulerRank(entry);
+	scheduler->heap[scheduler->queued] = entry;
+	entry->position = scheduler->queued++;
+	RMTileSchedulerSiftUp(scheduler, entry->position);
+
+	scheduler->statistics.submitted++;
+	scheduler->statistics.visible += kind == RMTileRequestVisible;
+	pthread_cond_signal(&scheduler->work);
+	accepted = 1;
+
+done:
+	pthread_mutex_unlock(&scheduler->lock);
+	return accepted;
+}
+
+int RMTileSchedulerCancel(RMTileScheduler *scheduler, const void *owner, RMTile tile, void *request)
+{
+	RMTileSchedulerEntry *entry;
+	int cancelled = 0;
+
+	pthread_mutex_lock(&scheduler->lock);
+	entry = RMTileSchedulerFind(scheduler, owner, tile);
+	if (entry != NULL && entry->request == request && entry->position != kRMTileSchedulerRunning) {
+		RMTileSchedulerUnqueue(scheduler, entry);
+		RMTileSchedulerForget(scheduler, entry);
+		free(entry);
+		cancelled = 1;
+		scheduler->statistics.cancelled++;
+		if (scheduler->queued == 0 && scheduler->running == 0)
+			pthread_cond_broadcast(&scheduler->idle);
+	}
+	pthread_mutex_unlock(&scheduler->lock);
+	return cancelled;
+}
+
+typedef struct {
+	const void *owner;
+	RMTileSchedulerEntry **entries;
+	size_t count;
+} RMTileSchedulerCancelled;
+
+static void RMTileSchedulerCollect(void *context, RMTile tile, void *value)
+{
+	RMTileSchedulerCancelled *cancelled = context;
+	RMTileSchedulerEntry *entry;
+
+	for (entry = value; entry != NULL; entry = entry->next) {
+		if (entry->focus->owner == cancelled->owner && entry->position != kRMTileSchedulerRunning)
+			cancelled->entries[cancelled->count++] = entry;
+	}
+}
+
+void RMTileSchedulerCancelOutside(RMTileScheduler *scheduler, const void *owner, short zoom, uint32_t minX, uint32_t maxX, uint32_t minY, uint32_t maxY)
+{
+	RMTileSchedulerCancelled cancelled = { owner, NULL, 0 };
+
+	pthread_mutex_lock(&scheduler->lock);
+	if (scheduler->queued > 0)
+		cancelled.entries = malloc(scheduler->queued * sizeof(RMTileSchedulerEntry *));
+	if (cancelled.entries != NULL) {
+		RMTileIndexForEachOutside(scheduler->entries, zoom, minX, maxX, minY, maxY, RMTileSchedulerCollect, &cancelled);
+		for (size_t i = 0; i < cancelled.count; i++) {
+			RMTileSchedulerUnqueue(scheduler, cancelled.entries[i]);
+			RMTileSchedulerForget(scheduler, cancelled.entries[i]);
+		}
+		scheduler->statistics.cancelled += cancelled.count;
+		if (scheduler->queued == 0 && scheduler->running == 0)
+			pthread_cond_broadcast(&scheduler->idle);
+	}
+	pthread_mutex_unlock(&scheduler->lock);
+
+	for (size_t i = 0; i < cancelled.count; i++) {
+		if (scheduler->drop != NULL)
+			scheduler->drop(scheduler->context, cancelled.entries[i]->tile, cancelled.entries[i]->request);
+		free(cancelled.entries[i]);
+	}
+	free(cancelled.entries);
+}
+
+void RMTileSchedulerSetFocus(RMTileScheduler *scheduler, const void *owner, short zoom, double x, double y)
+{
+	RMTileSchedulerFocus *focus;
+
+	pthread_mutex_lock(&scheduler->lock);
+	focus = RMTileSchedulerFocusOf(scheduler, owner);
+	if (focus != NULL && (zoom != focus->zoom || x != focus->x || y != focus->y)) {
+		focus->zoom = zoom;
+		focus->x = x;
+		focus->y = y;
+		for (size_t i = 0; i < scheduler->queued; i++) {
+			if (scheduler->heap[i]->focus == focus)
+				RMTileSchedulerRank(scheduler->heap[i]);
+		}
+		for (size_t i = scheduler->queued / 2; i-- > 0; )
+			RMTileSchedulerSiftDown(scheduler, i);
+	}
+	pthread_mutex_unlock(&scheduler->lock);
+}
+
+size_t RMTileSchedulerQueued(RMTileScheduler *scheduler)
+{
+	size_t queued;
+
+	pthread_mutex_lock(&scheduler->lock);
+	queued = scheduler->queued;
+	pthread_mutex_unlock(&scheduler->lock);
+	return queued;
+}
+
+void RMTileSchedulerWait(RMTileScheduler *scheduler)
+{
+	pthread_mutex_lock(&scheduler->lock);
+	while (scheduler->queued > 0 || scheduler->running > 0)
+		pthread_cond_wait(&scheduler->idle, &scheduler->lock);
+	pthread_mutex_unlock(&scheduler->lock);
+}
+
+RMTileSchedulerStatistics RMTileSchedulerGetStatistics(RMTileScheduler *scheduler)
+{
+	RMTileSchedulerStatistics statistics;
+
+	pthread_mutex_lock(&scheduler->lock);
+	statistics = scheduler->statistics;
+	pthread_mutex_unlock(&scheduler->lock);
+	return statistics;
+}
+
+void RMTileSchedulerResetStatistics(RMTileScheduler *scheduler)
+{
+	pthread_mutex_lock(&scheduler->lock);
+	memset(&scheduler->statistics, 0, sizeof(scheduler->statistics));
+	pthread_mutex_unlock(&scheduler->lock);
+}
@@ -0,0 +1,114 @@
+//
+//  RMTileScheduler.h
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _RMTILESCHEDULER_H_
+#define _RMTILESCHEDULER_H_
+
+#include <stddef.h>
+#include "RMTile.h"
+
+/*! \file RMTileScheduler.h
+ */
+/*! \struct RMTileScheduler
+ \brief Runs tile requests on a bounded pool of worker threads, most urgent first.
+
+ Requests are queued for an owner, like a tile source, with a kind, and are taken off the queue
+ in order of
+ - kind: visible tiles before prefetched ones,
+ - zoom level: tiles of the focus zoom level of their owner first, then the fallback levels
+   nearest to it, coarser before finer,
+ - distance: tiles whose centre is nearest to the focus point of their owner first,
+ and in the order they were submitted otherwise. Every owner has its own focus, so two map views
+ showing different places each get their tiles in their own order; setting a new focus reorders
+ the queue.
+
+ A tile has at most one request of each owner queued or running at a time. Queued requests can
+ be cancelled one by one or all those of an owner outside of the screen at once; a request that
+ is running finishes.
+
+ The caller owns the requests, which are opaque to the scheduler: each one is handed back
+ exactly once: to the work function on a worker thread, to the drop function when it is
+ cancelled in bulk or the scheduler is freed, or to the caller of RMTileSchedulerCancel().
+
+ Plain C on top of pthreads, without any framework dependency besides RMTile. All functions are
+ thread safe, except that the scheduler must not be freed while other calls are running.
+ */
+typedef struct RMTileScheduler RMTileScheduler;
+
+/// How urgent a request is, most urgent first.
+typedef enum {
+	/// a tile on the screen
+	RMTileRequestVisible,
+	/// a tile that may be needed soon
+	RMTileRequestPrefetch,
+} RMTileRequestKind;
+
+/// Carries out a request, on a worker thread.
+typedef void (*RMTileSchedulerWork)(void *context, RMTile tile, void *request);
+/// Releases a request that will not be carried out. Called without the scheduler locked.
+typedef void (*RMTileSchedulerDrop)(void *context, RMTile tile, void *request);
+
+/// Counters since the scheduler was created or the statistics were last reset.
+typedef struct {
+	/// requests accepted, and those of them that were visible tiles
+	unsigned long submitted, visible;
+	/// requests taken off the queue by a worker, and cancelled while queued
+	unsigned long started, cancelled;
+	/// seconds the started requests were queued, and ran
+	double waitSeconds, workSeconds;
+} RMTileSchedulerStatistics;
+
+/// Creates a scheduler with the given number of workers, at least 1. Returns NULL if the workers
+/// cannot be started or out of memory.
+RMTileScheduler *RMTileSchedulerCreate(unsigned workers, RMTileSchedulerWork work, RMTileSchedulerDrop drop, void *context);
+/// Drops the queued requests, waits for the running ones and stops the workers.
+void RMTileSchedulerFree(RMTileScheduler *scheduler);
+
+/// Queues a request of the owner. If the same request is queued already, it is made as urgent as
+/// the given kind. Returns 0, and keeps nothing, if another request of the owner for the tile is
+/// queued or running, or out of memory.
+int RMTileSchedulerSubmit(RMTileScheduler *scheduler, const void *owner, RMTile tile, RMTileRequestKind kind, void *request);
+/// Takes the request off the queue, and returns 1 if it was queued for the owner and the tile; the
+/// caller has it back. A request that is running is not stopped.
+int RMTileSchedulerCancel(RMTileScheduler *scheduler, const void *owner, RMTile tile, void *request);
+/// Drops the queued requests of the owner for tiles outside of the tiles minX to maxX and minY to
+/// maxY at the given zoom level, the way RMTileIndexForEachOutside() tells them apart.
+void RMTileSchedulerCancelOutside(RMTileScheduler *scheduler, const void *owner, short zoom, uint32_t minX, uint32_t maxX, uint32_t minY, uint32_t maxY);
+
+/// Sets the zoom level and the point, in tiles of that level, that the requests of the owner are
+/// ordered by.
+void RMTileSchedulerSetFocus(RMTileScheduler *scheduler, const void *owner, short zoom, double x, double y);
+
+/// Number of queued requests, not counting the running ones.
+size_t RMTileSchedulerQueued(RMTileScheduler *scheduler);
+/// Waits until no request is queued or running.
+void RMTileSchedulerWait(RMTileScheduler *scheduler);
+
+RMTileSchedulerStatistics RMTileSchedulerGetStatistics(RMTileScheduler *scheduler);
+void RMTileSchedulerResetStatistics(RMTileScheduler *scheduler);
+
+#endif
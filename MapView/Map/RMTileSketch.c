@@ -0,0 +1,181 @@
+//
+//  RMTileSketch.c
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "RMTileSketch.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct RMTileSketch {
+	uint64_t *counters;		// kRMTileSketchRows rows of width 4-bit counters, 16 to a word
+	uint64_t *doorkeeper;		// one bit each, 8 * width of them
+	size_t width;			// counters per row, a power of two
+	size_t sampleSize;
+	size_t samples;			// requests since the counters were last halved
+};
+
+#define kRMTileSketchRows 4
+#define kRMTileSketchDoorkeeperProbes 2
+#define kRMTileSketchMinWidth 16
+
+// RMTileKey() puts the zoom in the top bits, so mix everything before taking bits off the bottom.
+static uint64_t RMTileSketchHash(uint64_t key)
+{
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	key ^= key >> 31;
+	return key;
+}
+
+// Double hashing: probe i of a key is h1 + i * h2.
+static size_t RMTileSketchProbe(uint64_t hash, unsigned i, size_t mask)
+{
+	uint32_t h1 = (uint32_t)hash, h2 = (uint32_t)(hash >> 32) | 1;
+	return (size_t)(h1 + i * h2) & mask;
+}
+
+static unsigned RMTileSketchCounter(const RMTileSketch *sketch, unsigned row, size_t column)
+{
+	size_t index = row * sketch->width + column;
+	return (unsigned)(sketch->counters[index >> 4] >> ((index & 15) * 4)) & 15;
+}
+
+static int RMTileSketchInDoorkeeper(const RMTileSketch *sketch, uint64_t hash)
+{
+	size_t mask = sketch->width * 8 - 1;
+	for (unsigned i = 0; i < kRMTileSketchDoorkeeperProbes; i++) {
+		size_t bit = RMTileSketchProbe(hash, kRMTileSketchRows + i, mask);
+		if (!(sketch->doorkeeper[bit >> 6] & (1ULL << (bit & 63))))
+			return 0;
+	}
+	return 1;
+}
+
+RMTileSketch *RMTileSketchCreate(size_t sampleSize)
+{
+	RMTileSketch *sketch = calloc(1, sizeof(RMTileSketch));
+	if (sketch == NULL)
+		return NULL;
+
+	if (sampleSize < kRMTileSketchMinWidth)
+		sampleSize = kRMTileSketchMinWidth;
+	sketch->sampleSize = sampleSize;
+
+	// a counter per row for every two requests of the sample; fewer collide too often to
+	// tell a tile seen twice from one seen once
+	sketch->width = kRMTileSketchMinWidth;
+	while (sketch->width < sampleSize / 2)
+		sketch->width *= 2;
+
+	sketch->counters = calloc(kRMTileSketchRows * sketch->width / 16, sizeof(uint64_t));
+	sketch->doorkeeper = calloc(sketch->width * 8 / 64, sizeof(uint64_t));
+	if (sketch->counters == NULL || sketch->doorkeeper == NULL) {
+		RMTileSketchFree(sketch);
+		return NULL;
+	}
+	return sketch;
+}
+
+void RMTileSketchFree(RMTileSketch *sketch)
+{
+	if (sketch == NULL)
+		return;
+	free(sketch->counters);
+	free(sketch->doorkeeper);
+	free(sketch);
+}
+
+// Halves every counter and clears the doorkeeper, so that old requests count for less.
+static void RMTileSketchAge(RMTileSketch *sketch)
+{
+	size_t words = kRMTileSketchRows * sketch->width / 16;
+	for (size_t i = 0; i < words; i++)
+		sketch->counters[i] = (sketch->counters[i] >> 1) & 0x7777777777777777ULL;
+	memset(sketch->doorkeeper, 0, sketch->width * 8 / 8);
+	sketch->samples /= 2;
+}
+
+void RMTileSketchIncrement(RMTileSketch *sketch, uint64_t key)
+{
+	uint64_t hash = RMTileSketchHash(key);
+	size_t mask = sketch->width - 1;
+
+	if (!RMTileSketchInDoorkeeper(sketch, hash)) {
+		size_t doorkeeperMask = sketch->width * 8 - 1;
+		for (unsigned i = 0; i < kRMTileSketchDoorkeeperProbes; i++) {
+			size_t bit = RMTileSketchProbe(hash, kRMTileSketchRows + i, doorkeeperMask);
+			sketch->doorkeeper[bit >> 6] |= 1ULL << (bit & 63);
+		}
+	} else {
+		// conservative update: only the smallest counters grow, which keeps collisions down
+		unsigned minimum = 15;
+		for (unsigned row = 0; row < kRMTileSketchRows; row++) {
+			unsigned count = RMTileSketchCounter(sketch, row, RMTileSketchProbe(hash, row, mask));
+			if (count < minimum)
+				minimum = count;
+		}
+		if (minimum < 15) {
+			for (unsigned row = 0; row < kRMTileSketchRows; row++) {
+				size_t column = RMTileSketchProbe(hash, row, mask);
+				if (RMTileSketchCounter(sketch, row, column) == minimum) {
+					size_t index = row * sketch->width + column;
+					sketch->counters[index >> 4] += 1ULL << ((index & 15) * 4);
+				}
+			}
+		}
+	}
+
+	if (++sketch->samples >= sketch->sampleSize)
+		RMTileSketchAge(sketch);
+}
+
+unsigned RMTileSketchEstimate(const RMTileSketch *sketch, uint64_t key)
+{
+	uint64_t hash = RMTileSketchHash(key);
+	size_t mask = sketch->width - 1;
+	unsigned minimum = 15;
+
+	for (unsigned row = 0; row < kRMTileSketchRows; row++) {
+		unsigned count = RMTileSketchCounter(sketch, row, RMTileSketchProbe(hash, row, mask));
+		if (count < minimum)
+			minimum = count;
+	}
+	return minimum + (unsigned)RMTileSketchInDoorkeeper(sketch, hash);
+}
+
+int RMTileSketchAdmit(const RMTileSketch *sketch, uint64_t candidate, uint64_t victim)
+{
+	return RMTileSketchEstimate(sketch, candidate) > RMTileSketchEstimate(sketch, victim);
+}
+
+void RMTileSketchClear(RMTileSketch *sketch)
+{
+	memset(sketch->counters, 0, kRMTileSketchRows * sketch->width / 16 * sizeof(uint64_t));
+	memset(sketch->doorkeeper, 0, sketch->width * 8 / 8);
+	sketch->samples = 0;
+}
@@ -0,0 +1,71 @@
+//
+//  RMTileSketch.h
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _RMTILESKETCH_H_
+#define _RMTILESKETCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*! \file RMTileSketch.h
+ */
+/*! \struct RMTileSketch
+ \brief An estimate of how often each tile has been asked for lately, for TinyLFU cache admission.
+
+ A count-min sketch of four rows of 4-bit counters, fronted by a one-bit "doorkeeper" filter: the
+ first request for a tile only sets its doorkeeper bits, so tiles that are asked for once never
+ reach the counters. Estimates can be too high when keys collide, never too low.
+
+ After a sample of as many requests as the sketch was created for, all counters are halved and
+ the doorkeeper is cleared, so that what was popular a while ago fades out.
+
+ A cache admits a new tile over its eviction victim only if the tile is asked for more often,
+ which keeps the one-off tiles of a pan across the map from pushing out the tiles around home.
+ Admission alone shuts out tiles that are new but about to be asked for again, so it goes with a
+ small LRU window in front of the cache that every new tile gets into first (W-TinyLFU).
+
+ Plain C without any framework dependency; not thread safe.
+ */
+typedef struct RMTileSketch RMTileSketch;
+
+/// Creates a sketch that ages after sampleSize requests, which should span the time it takes to
+/// come back to a tile worth keeping. Takes two to three bytes per request of the sample.
+/// Returns NULL if out of memory.
+RMTileSketch *RMTileSketchCreate(size_t sampleSize);
+/// Frees the sketch.
+void RMTileSketchFree(RMTileSketch *sketch);
+
+/// Records a request for the key.
+void RMTileSketchIncrement(RMTileSketch *sketch, uint64_t key);
+/// Estimated number of recent requests for the key, at most 16.
+unsigned RMTileSketchEstimate(const RMTileSketch *sketch, uint64_t key);
+/// Returns 1 if the candidate is asked for more often than the victim it would evict.
+int RMTileSketchAdmit(const RMTileSketch *sketch, uint64_t candidate, uint64_t victim);
+/// Forgets all requests.
+void RMTileSketchClear(RMTileSketch *sketch);
+
+#endif
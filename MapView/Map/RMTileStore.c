@@ -0,0 +1,1332 @@
+//
+//  RMTileStore.c
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "RMTileStore.h"
+#include "RMTileLRU.h"
+#include "RMTilePack.h"
+#include <sqlite3.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+enum {
+	kRMTileStoreTouched = 1,		// lastUsed is to be written
+	kRMTileStoreReferenced = 2	// the reference bit is to be set
+};
+
+/// A queued put, or touch and reference. The data of a put follows the structure.
+typedef struct {
+	void *data;		// NULL unless a put
+	size_t length;
+	double lastUsed, inserted;
+	int flags;
+} RMTileStoreWrite;
+
+typedef struct RMTileStoreReader {
+	sqlite3 *db;
+	sqlite3_stmt *select;
+	struct RMTileStoreReader *next;		// all readers of the shard
+	struct RMTileStoreReader *nextIdle;
+} RMTileStoreReader;
+
+typedef struct {
+	sqlite3 *db;		// the write connection
+	sqlite3_stmt *insert, *update, *touch, *remove;
+	sqlite3_stmt *reference, *oldestBucket, *referenced, *move, *unreference, *evict;
+	sqlite3_stmt *findBlob, *addBlob, *retainBlob, *growSegment;
+	RMTilePack *pack;
+	int inTransaction;
+	size_t count;		// rows, under the store lock
+	long delta;		// rows added by the write in progress
+
+	RMTileStoreReader *readers;	// read connections, linked through next
+	RMTileStoreReader *idle;		// read connections not in use
+	pthread_mutex_t readLock;
+	pthread_cond_t readerIdle;
+} RMTileStoreShard;
+
+struct RMTileStore {
+	RMTileStoreShard *shards;
+	unsigned shardCount;
+
+	pthread_mutex_t lock;		// everything below
+	pthread_cond_t queued;		// wakes the writer
+	pthread_cond_t written;		// the writer finished a batch
+	RMTileLRU *pending;		// key -> RMTileStoreWrite, waiting to be written
+	RMTileLRU *writing;		// key -> RMTileStoreWrite, being written
+	size_t pendingPuts, writingPuts;
+	double firstPending;
+	size_t writeBatchSize;
+	double writeDelay;
+	double bucketWidth;		// fixed at open
+	size_t segmentSize;		// fixed at open
+	int flushRequested, stopping, writerStarted;
+	pthread_t writer;
+
+	pthread_mutex_t writeLock;	// the write connections of all shards
+};
+
+#define kRMTileStoreBusyTimeout 5000
+
+RMTileStoreOptions RMTileStoreDefaultOptions(void)
+{
+	RMTileStoreOptions options;
+	options.shardBits = 0;
+	options.readers = 4;
+	options.writeBatchSize = 64;
+	options.writeDelay = 0.5;
+	options.bucketWidth = 3600;
+	options.segmentSize = 0;
+	options.mappedSegments = 16;
+	return options;
+}
+
+static double RMTileStoreNow(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec + now.tv_usec * 1e-6;
+}
+
+static sqlite3_int64 RMTileStoreBucket(const RMTileStore *store, double time)
+{
+	return (sqlite3_int64)(time / store->bucketWidth);
+}
+
+// 64-bit FNV-1a; blobs with equal hashes are compared before they are shared
+static uint64_t RMTileStoreHash(const void *data, size_t length)
+{
+	const unsigned char *bytes = data;
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < length; i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	return hash;
+}
+
+static void RMTileStoreFreeWrite(void *context, uint64_t key, void *value)
+{
+	free(value);
+}
+
+// RMTileKey() keeps x in bits 28-55 and y in bits 0-27; their low bits make a checkerboard,
+// so the tiles of a screen are spread evenly over the shards.
+static RMTileStoreShard *RMTileStoreShardFor(const RMTileStore *store, uint64_t key)
+{
+	uint32_t x = (uint32_t)(key >> 28) & 0xFFFFFFF;
+	uint32_t y = (uint32_t)key & 0xFFFFFFF;
+	return &store->shards[(x ^ (y * 3)) & (store->shardCount - 1)];
+}
+
+
+static int RMTileStoreOpenShard(RMTileStore *store, RMTileStoreShard *shard, const char *path, const RMTileStoreOptions *options)
+{
+	sqlite3_stmt *count, *migrate, *active;
+	uint32_t activeSegment = 1;
+	uint64_t activeSize = 0;
+
+	if (sqlite3_open(path, &shard->db) != SQLITE_OK)
+		return 0;
+	sqlite3_busy_timeout(shard->db, kRMTileStoreBusyTimeout);
+
+	// page_size only takes on a new database. With WAL a crash can only lose the last
+	// batches, so NORMAL synchronous is enough. SQLite before 3.7 ignores journal_mode = WAL,
+	// and its readers then wait for the writer through the busy timeout.
+	sqlite3_exec(shard->db, "PRAGMA page_size = 4096", NULL, NULL, NULL);
+	sqlite3_exec(shard->db, "PRAGMA journal_mode = WAL", NULL, NULL, NULL);
+	sqlite3_exec(shard->db, "PRAGMA synchronous = NORMAL", NULL, NULL, NULL);
+
+	if (sqlite3_exec(shard->db, "CREATE TABLE IF NOT EXISTS ZCACHE (ztileHash INTEGER PRIMARY KEY, zlastUsed DOUBLE, zdata BLOB)", NULL, NULL, NULL) != SQLITE_OK
+		|| sqlite3_exec(shard->db, "CREATE INDEX IF NOT EXISTS zlastUsedIndex ON ZCACHE(zLastUsed)", NULL, NULL, NULL) != SQLITE_OK)
+		return 0;
+	// fail once the columns are there, as they do in databases from older versions
+	sqlite3_exec(shard->db, "ALTER TABLE ZCACHE ADD COLUMN zInserted DOUBLE", NULL, NULL, NULL);
+	sqlite3_exec(shard->db, "ALTER TABLE ZCACHE ADD COLUMN zBucket INTEGER", NULL, NULL, NULL);
+	sqlite3_exec(shard->db, "ALTER TABLE ZCACHE ADD COLUMN zblob INTEGER", NULL, NULL, NULL);
+	if (sqlite3_exec(shard->db, "CREATE INDEX IF NOT EXISTS zInsertedIndex ON ZCACHE(zInserted)", NULL, NULL, NULL) != SQLITE_OK
+		|| sqlite3_exec(shard->db, "CREATE INDEX IF NOT EXISTS zBucketIndex ON ZCACHE(zBucket)", NULL, NULL, NULL) != SQLITE_OK)
+		return 0;
+
+	// The reference bits live in a table of their own: setting one then writes a few bytes
+	// to a small table rather than rewriting the row of the tile and its data.
+	if (sqlite3_exec(shard->db, "CREATE TABLE IF NOT EXISTS ZREFERENCED (ztileHash INTEGER PRIMARY KEY)", NULL, NULL, NULL) != SQLITE_OK
+		|| sqlite3_exec(shard->db, "CREATE TRIGGER IF NOT EXISTS zUnreferenceTrigger AFTER DELETE ON ZCACHE BEGIN DELETE FROM ZREFERENCED WHERE ztileHash = old.ztileHash; END", NULL, NULL, NULL) != SQLITE_OK)
+		return 0;
+
+	// Packed tiles point to a blob, which blobs of the same hash may share; the triggers drop
+	// blobs no tile points to any more.
+	if (sqlite3_exec(shard->db, "CREATE TABLE IF NOT EXISTS ZBLOB (zblob INTEGER PRIMARY KEY, zhash INTEGER, zsegment INTEGER, zoffset INTEGER, zlength INTEGER, zrefs INTEGER)", NULL, NULL, NULL) != SQLITE_OK
+		|| sqlite3_exec(shard->db, "CREATE INDEX IF NOT EXISTS zHashIndex ON ZBLOB(zhash)", NULL, NULL, NULL) != SQLITE_OK
+		|| sqlite3_exec(shard->db, "CREATE INDEX IF NOT EXISTS zSegmentIndex ON ZBLOB(zsegment)", NULL, NULL, NULL) != SQLITE_OK
+		|| sqlite3_exec(shard->db, "CREATE TABLE IF NOT EXISTS ZSEGMENT (zsegment INTEGER PRIMARY KEY, zsize INTEGER)", NULL, NULL, NULL) != SQLITE_OK
+		|| sqlite3_exec(shard->db, "CREATE TRIGGER IF NOT EXISTS zReleaseBlobTrigger AFTER DELETE ON ZCACHE WHEN old.zblob IS NOT NULL BEGIN "
+						"UPDATE ZBLOB SET zrefs = zrefs - 1 WHERE zblob = old.zblob; DELETE FROM ZBLOB WHERE zblob = old.zblob AND zrefs <= 0; END", NULL, NULL, NULL) != SQLITE_OK
+		|| sqlite3_exec(shard->db, "CREATE TRIGGER IF NOT EXISTS zReplaceBlobTrigger AFTER UPDATE OF zblob ON ZCACHE WHEN old.zblob IS NOT NULL BEGIN "
+						"UPDATE ZBLOB SET zrefs = zrefs - 1 WHERE zblob = old.zblob; DELETE FROM ZBLOB WHERE zblob = old.zblob AND zrefs <= 0; END", NULL, NULL, NULL) != SQLITE_OK)
+		return 0;
+
+	// tiles from older versions go to the bucket of their last use
+	if (sqlite3_prepare_v2(shard->db, "UPDATE ZCACHE SET zBucket = CAST(zlastUsed / ? AS INTEGER) WHERE zBucket IS NULL", -1, &migrate, NULL) != SQLITE_OK)
+		return 0;
+	sqlite3_bind_double(migrate, 1, store->bucketWidth);
+	sqlite3_step(migrate);
+	sqlite3_finalize(migrate);
+
+	if (sqlite3_prepare_v2(shard->db, "INSERT OR IGNORE INTO ZCACHE (ztileHash, zlastUsed, zInserted, zBucket, zblob, zdata) VALUES (?, ?, ?, ?, ?, ?)", -1, &shard->insert, NULL) != SQLITE_OK
+		|| sqlite3_prepare_v2(shard->db, "UPDATE ZCACHE SET zlastUsed = ?, zInserted = ?, zBucket = ?, zblob = ?, zdata = ? WHERE ztileHash = ?", -1, &shard->update, NULL) != SQLITE_OK
+		|| sqlite3_prepare_v2(shard->db, "UPDATE ZCACHE SET zlastUsed = ? WHERE ztileHash = ?", -1, &shard->touch, NULL) != SQLITE_OK
+		|| sqlite3_prepare_v2(shard->db, "DELETE FROM ZCACHE WHERE ztileHash = ?", -1, &shard->remove, NULL) != SQLITE_OK
+		|| sqlite3_prepare_v2(shard->db, "INSERT OR IGNORE INTO ZREFERENCED (ztileHash) VALUES (?)", -1, &shard->reference, NULL) != SQLITE_OK
+		|| sqlite3_prepare_v2(shard->db, "SELECT MIN(zBucket) FROM ZCACHE", -1, &shard->oldestBucket, NULL) != SQLITE_OK
+		|| sqlite3_prepare_v2(shard->db, "SELECT ZCACHE.ztileHash FROM ZCACHE JOIN ZREFERENCED ON ZREFERENCED.ztileHash = ZCACHE.ztileHash WHERE zBucket = ?", -1, &shard->referenced, NULL) != SQLITE_OK
+		|| sqlite3_prepare_v2(shard->db, "UPDATE ZCACHE SET zBucket = ? WHERE ztileHash = ?", -1, &shard->move, NULL) != SQLITE_OK
+		|| sqlite3_prepare_v2(shard->db, "DELETE FROM ZREFERENCED WHERE ztileHash = ?", -1, &shard->unreference, NULL) != SQLITE_OK
+		|| sqlite3_prepare_v2(shard->db, "DELETE FROM ZCACHE WHERE ztileHash IN (SELECT ztileHash FROM ZCACHE WHERE zBucket = ? LIMIT ?)", -1, &shard->evict, NULL) != SQLITE_OK
+		|| sqlite3_prepare_v2(shard->db, "SELECT zblob, zsegment, zoffset, zlength FROM ZBLOB WHERE zhash = ?", -1, &shard->findBlob, NULL) != SQLITE_OK
+		|| sqlite3_prepare_v2(shard->db, "INSERT INTO ZBLOB (zhash, zsegment, zoffset, zlength, zrefs) VALUES (?, ?, ?, ?, 0)", -1, &shard->addBlob, NULL) != SQLITE_OK
+		|| sqlite3_prepare_v2(shard->db, "UPDATE ZBLOB SET zrefs = zrefs + 1 WHERE zblob = ?", -1, &shard->retainBlob, NULL) != SQLITE_OK
+		|| sqlite3_prepare_v2(shard->db, "INSERT OR REPLACE INTO ZSEGMENT (zsegment, zsize) VALUES (?, ?)", -1, &shard->growSegment, NULL) != SQLITE_OK)
+		return 0;
+
+	// The pack is opened even if new tiles go into their rows, to read the ones that do not.
+	// Appends continue the newest segment, after the last bytes the index knows of.
+	if (sqlite3_prepare_v2(shard->db, "SELECT zsegment, zsize FROM ZSEGMENT ORDER BY zsegment DESC LIMIT 1", -1, &active, NULL) != SQLITE_OK)
+		return 0;
+	if (sqlite3_step(active) == SQLITE_ROW) {
+		activeSegment = (uint32_t)sqlite3_column_int64(active, 0);
+		activeSize = (uint64_t)sqlite3_column_int64(active, 1);
+	}
+	sqlite3_finalize(active);
+	shard->pack = RMTilePackOpen(path, activeSegment, activeSize, options->segmentSize, options->mappedSegments);
+	if (shard->pack == NULL)
+		return 0;
+
+	// the only full count; from here on every change adjusts it
+	if (sqlite3_prepare_v2(shard->db, "SELECT COUNT(ztileHash) FROM ZCACHE", -1, &count, NULL) != SQLITE_OK)
+		return 0;
+	if (sqlite3_step(count) == SQLITE_ROW)
+		shard->count = (size_t)sqlite3_column_int64(count, 0);
+	sqlite3_finalize(count);
+
+	// the database exists now, so the read-only connections can open it
+	for (unsigned i = 0; i < (options->readers > 0 ? options->readers : 1); i++) {
+		RMTileStoreReader *reader = calloc(1, sizeof(RMTileStoreReader));
+		if (reader == NULL)
+			return 0;
+		reader->next = shard->readers;
+		shard->readers = reader;
+
+		if (sqlite3_open_v2(path, &reader->db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK
+			|| sqlite3_prepare_v2(reader->db, "SELECT zdata, zsegment, zoffset, zlength FROM ZCACHE LEFT JOIN ZBLOB ON ZBLOB.zblob = ZCACHE.zblob WHERE ztileHash = ?", -1, &reader->select, NULL) != SQLITE_OK)
+			return 0;
+		sqlite3_busy_timeout(reader->db, kRMTileStoreBusyTimeout);
+	}
+	for (RMTileStoreReader *reader = shard->readers; reader != NULL; reader = reader->next)
+		reader->nextIdle = reader->next;
+	shard->idle = shard->readers;
+
+	return 1;
+}
+
+static void RMTileStoreCloseShard(RMTileStoreShard *shard)
+{
+	while (shard->readers != NULL) {
+		RMTileStoreReader *reader = shard->readers;
+		shard->readers = reader->next;
+		sqlite3_finalize(reader->select);
+		sqlite3_close(reader->db);
+		free(reader);
+	}
+
+	sqlite3_finalize(shard->insert);
+	sqlite3_finalize(shard->update);
+	sqlite3_finalize(shard->touch);
+	sqlite3_finalize(shard->remove);
+	sqlite3_finalize(shard->reference);
+	sqlite3_finalize(shard->oldestBucket);
+	sqlite3_finalize(shard->referenced);
+	sqlite3_finalize(shard->move);
+	sqlite3_finalize(shard->unreference);
+	sqlite3_finalize(shard->evict);
+	sqlite3_finalize(shard->findBlob);
+	sqlite3_finalize(shard->addBlob);
+	sqlite3_finalize(shard->retainBlob);
+	sqlite3_finalize(shard->growSegment);
+	sqlite3_close(shard->db);
+	RMTilePackClose(shard->pack);
+
+	pthread_mutex_destroy(&shard->readLock);
+	pthread_cond_destroy(&shard->readerIdle);
+}
+
+static void RMTileStoreDestroy(RMTileStore *store)
+{
+	if (store->shards != NULL) {
+		for (unsigned i = 0; i < store->shardCount; i++)
+			RMTileStoreCloseShard(&store->shards[i]);
+		free(store->shards);
+	}
+	RMTileLRUFree(store->pending);
+	RMTileLRUFree(store->writing);
+
+	pthread_mutex_destroy(&store->lock);
+	pthread_mutex_destroy(&store->writeLock);
+	pthread_cond_destroy(&store->queued);
+	pthread_cond_destroy(&store->written);
+	free(store);
+}
+
+
+typedef struct {
+	RMTileStore *store;
+	int failed;
+} RMTileStoreBatch;
+
+// Finds a blob with the data of a put, or appends one to the pack, and takes a reference on
+// it. Called in a transaction on the write connection. Returns 0 on error.
+static int RMTileStorePack(RMTileStoreShard *shard, const RMTileStoreWrite *write, sqlite3_int64 *blob)
+{
+	uint64_t hash = RMTileStoreHash(write->data, write->length);
+	uint32_t segment;
+	uint64_t offset, size;
+	int found = 0;
+
+	sqlite3_bind_int64(shard->findBlob, 1, (sqlite3_int64)hash);
+	while (!found && sqlite3_step(shard->findBlob) == SQLITE_ROW) {
+		RMTilePackSegment *pinned;
+		const void *bytes;
+
+		if ((size_t)sqlite3_column_int64(shard->findBlob, 3) != write->length)
+			continue;
+		pinned = RMTilePackPin(shard->pack, (uint32_t)sqlite3_column_int64(shard->findBlob, 1));
+		if (pinned == NULL)
+			continue;
+		bytes = RMTilePackBytes(pinned, (uint64_t)sqlite3_column_int64(shard->findBlob, 2), write->length);
+		if (bytes != NULL && memcmp(bytes, write->data, write->length) == 0) {
+			*blob = sqlite3_column_int64(shard->findBlob, 0);
+			found = 1;
+		}
+		RMTilePackUnpin(pinned);
+	}
+	sqlite3_reset(shard->findBlob);
+
+	if (!found) {
+		if (!RMTilePackAppend(shard->pack, write->data, write->length, &segment, &offset, &size))
+			return 0;
+		sqlite3_bind_int64(shard->growSegment, 1, segment);
+		sqlite3_bind_int64(shard->growSegment, 2, (sqlite3_int64)size);
+		sqlite3_step(shard->growSegment);
+		sqlite3_reset(shard->growSegment);
+
+		sqlite3_bind_int64(shard->addBlob, 1, (sqlite3_int64)hash);
+		sqlite3_bind_int64(shard->addBlob, 2, segment);
+		sqlite3_bind_int64(shard->addBlob, 3, (sqlite3_int64)offset);
+		sqlite3_bind_int64(shard->addBlob, 4, (sqlite3_int64)write->length);
+		if (sqlite3_step(shard->addBlob) != SQLITE_DONE) {
+			sqlite3_reset(shard->addBlob);
+			return 0;
+		}
+		sqlite3_reset(shard->addBlob);
+		*blob = sqlite3_last_insert_rowid(shard->db);
+	}
+
+	// taken before the tile points to the blob, so replacing a tile by itself keeps it
+	sqlite3_bind_int64(shard->retainBlob, 1, *blob);
+	sqlite3_step(shard->retainBlob);
+	sqlite3_reset(shard->retainBlob);
+	return 1;
+}
+
+// Binds the blob and data columns of a put, at index and index + 1; one of them is NULL.
+static void RMTileStoreBindData(sqlite3_stmt *statement, int index, const RMTileStoreWrite *write, sqlite3_int64 blob)
+{
+	if (blob != 0) {
+		sqlite3_bind_int64(statement, index, blob);
+		sqlite3_bind_null(statement, index + 1);
+	} else {
+		sqlite3_bind_null(statement, index);
+		sqlite3_bind_blob(statement, index + 1, write->data, (int)write->length, SQLITE_STATIC);
+	}
+}
+
+static void RMTileStoreWriteOne(void *context, uint64_t key, void *value)
+{
+	RMTileStoreBatch *batch = context;
+	RMTileStoreWrite *write = value;
+	RMTileStoreShard *shard = RMTileStoreShardFor(batch->store, key);
+	sqlite3_stmt *statement;
+
+	if (!shard->inTransaction) {
+		if (sqlite3_exec(shard->db, "BEGIN IMMEDIATE", NULL, NULL, NULL) != SQLITE_OK) {
+			batch->failed = 1;
+			return;
+		}
+		shard->inTransaction = 1;
+	}
+
+	if (write->data == NULL) {
+		if (write->flags & kRMTileStoreTouched) {
+			statement = shard->touch;
+			sqlite3_bind_double(statement, 1, write->lastUsed);
+			sqlite3_bind_int64(statement, 2, (sqlite3_int64)key);
+			sqlite3_step(statement);
+			sqlite3_reset(statement);
+		}
+		if (write->flags & kRMTileStoreReferenced) {
+			statement = shard->reference;
+			sqlite3_bind_int64(statement, 1, (sqlite3_int64)key);
+			sqlite3_step(statement);
+			sqlite3_reset(statement);
+		}
+		return;
+	}
+
+	sqlite3_int64 blob = 0;
+	if (batch->store->segmentSize > 0 && !RMTileStorePack(shard, write, &blob)) {
+		batch->failed = 1;
+		return;
+	}
+
+	// Rows replaced by INSERT OR REPLACE do not show in sqlite3_changes(), so insert only
+	// new tiles and update existing ones; that tells the running count which one happened.
+	statement = shard->insert;
+	sqlite3_bind_int64(statement, 1, (sqlite3_int64)key);
+	sqlite3_bind_double(statement, 2, write->lastUsed);
+	sqlite3_bind_double(statement, 3, write->inserted);
+	sqlite3_bind_int64(statement, 4, RMTileStoreBucket(batch->store, write->lastUsed));
+	RMTileStoreBindData(statement, 5, write, blob);
+	int result = sqlite3_step(statement);
+	sqlite3_reset(statement);
+
+	if (result == SQLITE_DONE && sqlite3_changes(shard->db) > 0) {
+		shard->delta++;
+	} else {
+		statement = shard->update;
+		sqlite3_bind_double(statement, 1, write->lastUsed);
+		sqlite3_bind_double(statement, 2, write->inserted);
+		sqlite3_bind_int64(statement, 3, RMTileStoreBucket(batch->store, write->lastUsed));
+		RMTileStoreBindData(statement, 4, write, blob);
+		sqlite3_bind_int64(statement, 6, (sqlite3_int64)key);
+		sqlite3_step(statement);
+		sqlite3_reset(statement);
+	}
+
+	if (write->flags & kRMTileStoreReferenced) {
+		statement = shard->reference;
+		sqlite3_bind_int64(statement, 1, (sqlite3_int64)key);
+		sqlite3_step(statement);
+		sqlite3_reset(statement);
+	}
+}
+
+// Commits the transactions opened on the write connections, and zeroes the entries of removed,
+// if not NULL, for the shards whose transaction was rolled back. Called with the write lock held.
+static void RMTileStoreCommit(RMTileStore *store, size_t *removed)
+{
+	for (unsigned i = 0; i < store->shardCount; i++) {
+		RMTileStoreShard *shard = &store->shards[i];
+		if (!shard->inTransaction)
+			continue;
+		// the index must not point to data that could still be lost
+		if (!RMTilePackSync(shard->pack) || sqlite3_exec(shard->db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK) {
+			sqlite3_exec(shard->db, "ROLLBACK", NULL, NULL, NULL);
+			shard->delta = 0;
+			if (removed != NULL)
+				removed[i] = 0;
+		}
+		shard->inTransaction = 0;
+	}
+}
+
+// Adds the row changes of the last commit to the counts. Called with the write lock and the store
+// lock held, so that no other write changes the deltas in between.
+static void RMTileStoreApplyDeltas(RMTileStore *store)
+{
+	for (unsigned i = 0; i < store->shardCount; i++) {
+		RMTileStoreShard *shard = &store->shards[i];
+		if (shard->delta < 0 && (size_t)-shard->delta > shard->count)
+			shard->count = 0;
+		else
+			shard->count += shard->delta;
+		shard->delta = 0;
+	}
+}
+
+static void *RMTileStoreWriter(void *context)
+{
+	RMTileStore *store = context;
+
+	pthread_mutex_lock(&store->lock);
+	for (;;)
+	{
+		size_t queued = RMTileLRUCount(store->pending);
+
+		if (queued == 0) {
+			store->flushRequested = 0;
+			if (store->stopping)
+				break;
+			pthread_cond_wait(&store->queued, &store->lock);
+			continue;
+		}
+
+		if (queued < store->writeBatchSize && !store->flushRequested && !store->stopping) {
+			double due = store->firstPending + store->writeDelay;
+			if (RMTileStoreNow() < due) {
+				struct timespec until;
+				until.tv_sec = (time_t)due;
+				until.tv_nsec = (long)((due - until.tv_sec) * 1e9);
+				pthread_cond_timedwait(&store->queued, &store->lock, &until);
+				continue;
+			}
+		}
+
+		// Take the queue; lookups find its tiles in writing until they are committed.
+		RMTileLRU *batch = store->pending;
+		store->pending = store->writing;
+		store->writing = batch;
+		store->writingPuts = store->pendingPuts;
+		store->pendingPuts = 0;
+		pthread_mutex_unlock(&store->lock);
+
+		RMTileStoreBatch write = { store, 0 };
+		pthread_mutex_lock(&store->writeLock);
+		RMTileLRUForEach(batch, RMTileStoreWriteOne, &write);
+		RMTileStoreCommit(store, NULL);
+
+		pthread_mutex_lock(&store->lock);
+		RMTileStoreApplyDeltas(store);
+		pthread_mutex_unlock(&store->writeLock);
+		RMTileLRURemoveAll(store->writing);
+		store->writingPuts = 0;
+		pthread_cond_broadcast(&store->written);
+	}
+	pthread_mutex_unlock(&store->lock);
+
+	return NULL;
+}
+
+RMTileStore *RMTileStoreOpen(const char *path, const RMTileStoreOptions *options)
+{
+	RMTileStoreOptions defaults = RMTileStoreDefaultOptions();
+	RMTileStore *store;
+
+	if (options == NULL)
+		options = &defaults;
+	if (options->shardBits > 8)
+		return NULL;
+
+	store = calloc(1, sizeof(RMTileStore));
+	if (store == NULL)
+		return NULL;
+
+	pthread_mutex_init(&store->lock, NULL);
+	pthread_mutex_init(&store->writeLock, NULL);
+	pthread_cond_init(&store->queued, NULL);
+	pthread_cond_init(&store->written, NULL);
+	store->writeBatchSize = options->writeBatchSize > 0 ? options->writeBatchSize : 1;
+	store->writeDelay = options->writeDelay;
+	store->bucketWidth = options->bucketWidth > 0 ? options->bucketWidth : 3600;
+	store->segmentSize = options->segmentSize;
+
+	store->pending = RMTileLRUCreate(0, 0, RMTileStoreFreeWrite, NULL);
+	store->writing = RMTileLRUCreate(0, 0, RMTileStoreFreeWrite, NULL);
+	store->shardCount = 1u << options->shardBits;
+	store->shards = calloc(store->shardCount, sizeof(RMTileStoreShard));
+	if (store->pending == NULL || store->writing == NULL || store->shards == NULL) {
+		RMTileStoreDestroy(store);
+		return NULL;
+	}
+	for (unsigned i = 0; i < store->shardCount; i++) {
+		pthread_mutex_init(&store->shards[i].readLock, NULL);
+		pthread_cond_init(&store->shards[i].readerIdle, NULL);
+	}
+
+	for (unsigned i = 0; i < store->shardCount; i++) {
+		char *shardPath = malloc(strlen(path) + 32);
+		int opened;
+
+		if (shardPath == NULL) {
+			RMTileStoreDestroy(store);
+			return NULL;
+		}
+		if (store->shardCount == 1)
+			strcpy(shardPath, path);
+		else
+			sprintf(shardPath, "%s.%u-%u", path, i, store->shardCount);
+
+		opened = RMTileStoreOpenShard(store, &store->shards[i], shardPath, options);
+		free(shardPath);
+		if (!opened) {
+			RMTileStoreDestroy(store);
+			return NULL;
+		}
+	}
+
+	if (pthread_create(&store->writer, NULL, RMTileStoreWriter, store) != 0) {
+		RMTileStoreDestroy(store);
+		return NULL;
+	}
+
+	return store;
+}
+
+void RMTileStoreClose(RMTileStore *store)
+{
+	if (store == NULL)
+		return;
+
+	pthread_mutex_lock(&store->lock);
+	store->stopping = 1;
+	pthread_cond_signal(&store->queued);
+	pthread_mutex_unlock(&store->lock);
+	pthread_join(store->writer, NULL);
+
+	RMTileStoreDestroy(store);
+}
+
+void RMTileStoreSetWriteBatch(RMTileStore *store, size_t writeBatchSize, double writeDelay)
+{
+	pthread_mutex_lock(&store->lock);
+	store->writeBatchSize = writeBatchSize > 0 ? writeBatchSize : 1;
+	store->writeDelay = writeDelay;
+	pthread_cond_signal(&store->queued);
+	pthread_mutex_unlock(&store->lock);
+}
+
+// Queues a write, replacing any queued one for the same tile. Called with the store lock held.
+static int RMTileStoreQueue(RMTileStore *store, uint64_t key, RMTileStoreWrite *write)
+{
+	RMTileStoreWrite *queued = RMTileLRUPeek(store->pending, key);
+	size_t puts = store->pendingPuts - (queued != NULL && queued->data != NULL);
+
+	if (RMTileLRUCount(store->pending) == 0)
+		store->firstPending = RMTileStoreNow();
+
+	// a failed put has released the queued write as well as this one
+	if (!RMTileLRUPut(store->pending, key, write, 0)) {
+		store->pendingPuts = puts;
+		return 0;
+	}
+	store->pendingPuts = puts + (write->data != NULL);
+
+	size_t count = RMTileLRUCount(store->pending);
+	if (count == 1 || count >= store->writeBatchSize)
+		pthread_cond_signal(&store->queued);
+	return 1;
+}
+
+int RMTileStorePut(RMTileStore *store, uint64_t key, const void *data, size_t length, double lastUsed, double inserted)
+{
+	RMTileStoreWrite *write = malloc(sizeof(RMTileStoreWrite) + length);
+	int queued;
+
+	if (write == NULL)
+		return 0;
+	write->data = write + 1;
+	write->length = length;
+	write->lastUsed = lastUsed;
+	write->inserted = inserted;
+	write->flags = 0;
+	memcpy(write->data, data, length);
+
+	pthread_mutex_lock(&store->lock);
+	queued = RMTileStoreQueue(store, key, write);
+	pthread_mutex_unlock(&store->lock);
+
+	return queued;
+}
+
+void RMTileStoreTouch(RMTileStore *store, uint64_t key, double lastUsed)
+{
+	RMTileStoreWrite *write;
+
+	pthread_mutex_lock(&store->lock);
+
+	write = RMTileLRUPeek(store->pending, key);
+	if (write != NULL) {
+		write->lastUsed = lastUsed;
+		if (write->data == NULL)
+			write->flags |= kRMTileStoreTouched;
+	} else if ((write = malloc(sizeof(RMTileStoreWrite))) != NULL) {
+		write->data = NULL;
+		write->length = 0;
+		write->lastUsed = lastUsed;
+		write->inserted = 0;
+		write->flags = kRMTileStoreTouched;
+		RMTileStoreQueue(store, key, write);
+	}
+
+	pthread_mutex_unlock(&store->lock);
+}
+
+void RMTileStoreReference(RMTileStore *store, uint64_t key)
+{
+	RMTileStoreWrite *write;
+
+	pthread_mutex_lock(&store->lock);
+
+	write = RMTileLRUPeek(store->pending, key);
+	if (write != NULL) {
+		write->flags |= kRMTileStoreReferenced;
+	} else if ((write = malloc(sizeof(RMTileStoreWrite))) != NULL) {
+		write->data = NULL;
+		write->length = 0;
+		write->lastUsed = 0;
+		write->inserted = 0;
+		write->flags = kRMTileStoreReferenced;
+		RMTileStoreQueue(store, key, write);
+	}
+
+	pthread_mutex_unlock(&store->lock);
+}
+
+void RMTileStoreFlush(RMTileStore *store)
+{
+	pthread_mutex_lock(&store->lock);
+	while (RMTileLRUCount(store->pending) != 0 || RMTileLRUCount(store->writing) != 0) {
+		store->flushRequested = 1;
+		pthread_cond_signal(&store->queued);
+		pthread_cond_wait(&store->written, &store->lock);
+	}
+	pthread_mutex_unlock(&store->lock);
+}
+
+int RMTileStoreHasPendingWrites(RMTileStore *store)
+{
+	int pending;
+
+	pthread_mutex_lock(&store->lock);
+	pending = RMTileLRUCount(store->pending) != 0 || RMTileLRUCount(store->writing) != 0;
+	pthread_mutex_unlock(&store->lock);
+
+	return pending;
+}
+
+size_t RMTileStoreCount(RMTileStore *store)
+{
+	size_t count;
+
+	pthread_mutex_lock(&store->lock);
+	count = store->pendingPuts + store->writingPuts;
+	for (unsigned i = 0; i < store->shardCount; i++)
+		count += store->shards[i].count;
+	pthread_mutex_unlock(&store->lock);
+
+	return count;
+}
+
+
+// Copies the data of a queued put of the tile, if any. Called with the store lock held.
+static int RMTileStoreGetQueued(RMTileStore *store, uint64_t key, void **data, size_t *length)
+{
+	RMTileStoreWrite *write = RMTileLRUPeek(store->pending, key);
+
+	if (write == NULL || write->data == NULL)
+		write = RMTileLRUPeek(store->writing, key);
+	if (write == NULL || write->data == NULL)
+		return 0;
+
+	*data = malloc(write->length > 0 ? write->length : 1);
+	if (*data == NULL)
+		return -1;
+	memcpy(*data, write->data, write->length);
+	*length = write->length;
+	return 1;
+}
+
+int RMTileStoreGetData(RMTileStore *store, uint64_t key, RMTileStoreData *data)
+{
+	RMTileStoreShard *shard = RMTileStoreShardFor(store, key);
+	RMTileStoreReader *reader;
+	sqlite3_stmt *select;
+	void *copy;
+	size_t length;
+	int found;
+
+	data->bytes = NULL;
+	data->length = 0;
+	data->pin = NULL;
+
+	pthread_mutex_lock(&store->lock);
+	found = RMTileStoreGetQueued(store, key, &copy, &length);
+	pthread_mutex_unlock(&store->lock);
+	if (found == 1) {
+		data->bytes = copy;
+		data->length = length;
+	}
+	if (found != 0)
+		return found;
+
+	pthread_mutex_lock(&shard->readLock);
+	while (shard->idle == NULL)
+		pthread_cond_wait(&shard->readerIdle, &shard->readLock);
+	reader = shard->idle;
+	shard->idle = reader->nextIdle;
+	pthread_mutex_unlock(&shard->readLock);
+
+	select = reader->select;
+	sqlite3_bind_int64(select, 1, (sqlite3_int64)key);
+	switch (sqlite3_step(select)) {
+		case SQLITE_ROW:
+			if (sqlite3_column_type(select, 0) != SQLITE_NULL || sqlite3_column_type(select, 1) == SQLITE_NULL) {
+				// stored in the row
+				length = (size_t)sqlite3_column_bytes(select, 0);
+				copy = malloc(length > 0 ? length : 1);
+				if (copy != NULL) {
+					memcpy(copy, sqlite3_column_blob(select, 0), length);
+					data->bytes = copy;
+					data->length = length;
+					found = 1;
+				} else {
+					found = -1;
+				}
+			} else {
+				// Packed. If compaction has just moved the blob and deleted the segment, the
+				// tile is missed this once.
+				RMTilePackSegment *pinned = RMTilePackPin(shard->pack, (uint32_t)sqlite3_column_int64(select, 1));
+				length = (size_t)sqlite3_column_int64(select, 3);
+				data->bytes = pinned != NULL ? RMTilePackBytes(pinned, (uint64_t)sqlite3_column_int64(select, 2), length) : NULL;
+				if (data->bytes != NULL) {
+					data->length = length;
+					data->pin = pinned;
+					found = 1;
+				} else {
+					if (pinned != NULL)
+						RMTilePackUnpin(pinned);
+					found = 0;
+				}
+			}
+			break;
+		case SQLITE_DONE:
+			found = 0;
+			break;
+		default:
+			found = -1;
+			break;
+	}
+	sqlite3_reset(select);
+
+	pthread_mutex_lock(&shard->readLock);
+	reader->nextIdle = shard->idle;
+	shard->idle = reader;
+	pthread_cond_signal(&shard->readerIdle);
+	pthread_mutex_unlock(&shard->readLock);
+
+	return found;
+}
+
+void RMTileStoreReleaseData(RMTileStoreData *data)
+{
+	if (data->pin != NULL)
+		RMTilePackUnpin(data->pin);
+	else
+		free((void *)data->bytes);
+	data->bytes = NULL;
+	data->length = 0;
+	data->pin = NULL;
+}
+
+int RMTileStoreGet(RMTileStore *store, uint64_t key, void **data, size_t *length)
+{
+	RMTileStoreData tile;
+	int found = RMTileStoreGetData(store, key, &tile);
+
+	*data = NULL;
+	*length = 0;
+	if (found != 1)
+		return found;
+
+	if (tile.pin == NULL) {
+		*data = (void *)tile.bytes;
+		*length = tile.length;
+		return 1;
+	}
+
+	*data = malloc(tile.length > 0 ? tile.length : 1);
+	if (*data == NULL) {
+		RMTileStoreReleaseData(&tile);
+		return -1;
+	}
+	memcpy(*data, tile.bytes, tile.length);
+	*length = tile.length;
+	RMTileStoreReleaseData(&tile);
+	return 1;
+}
+
+typedef struct {
+	uint64_t key;
+	RMTileStoreShard *shard;
+} RMTileStoreVictim;
+
+size_t RMTileStorePurge(RMTileStore *store, size_t count)
+{
+	sqlite3_stmt **oldest;
+	RMTileStoreVictim *victims;
+	size_t *removed;
+	size_t found = 0, deleted = 0;
+
+	if (count == 0)
+		return 0;
+
+	RMTileStoreFlush(store);
+	pthread_mutex_lock(&store->writeLock);
+
+	oldest = calloc(store->shardCount, sizeof(sqlite3_stmt *));
+	victims = malloc(count * sizeof(RMTileStoreVictim));
+	removed = calloc(store->shardCount, sizeof(size_t));
+	if (oldest == NULL || victims == NULL || removed == NULL) {
+		pthread_mutex_unlock(&store->writeLock);
+		free(oldest);
+		free(victims);
+		free(removed);
+		return 0;
+	}
+
+	// Merge the shards in order of use, each walked through its zlastUsed index, until
+	// count tiles are found.
+	for (unsigned i = 0; i < store->shardCount; i++) {
+		if (sqlite3_prepare_v2(store->shards[i].db, "SELECT ztileHash, zlastUsed FROM ZCACHE ORDER BY zlastUsed", -1, &oldest[i], NULL) != SQLITE_OK
+			|| sqlite3_step(oldest[i]) != SQLITE_ROW) {
+			sqlite3_finalize(oldest[i]);
+			oldest[i] = NULL;
+		}
+	}
+	while (found < count) {
+		int next = -1;
+		for (unsigned i = 0; i < store->shardCount; i++) {
+			if (oldest[i] != NULL
+				&& (next < 0 || sqlite3_column_double(oldest[i], 1) < sqlite3_column_double(oldest[next], 1)))
+				next = (int)i;
+		}
+		if (next < 0)
+			break;
+
+		victims[found].key = (uint64_t)sqlite3_column_int64(oldest[next], 0);
+		victims[found].shard = &store->shards[next];
+		found++;
+
+		if (sqlite3_step(oldest[next]) != SQLITE_ROW) {
+			sqlite3_finalize(oldest[next]);
+			oldest[next] = NULL;
+		}
+	}
+	for (unsigned i = 0; i < store->shardCount; i++)
+		sqlite3_finalize(oldest[i]);
+
+	for (size_t i = 0; i < found; i++) {
+		RMTileStoreShard *shard = victims[i].shard;
+		if (!shard->inTransaction) {
+			if (sqlite3_exec(shard->db, "BEGIN IMMEDIATE", NULL, NULL, NULL) != SQLITE_OK)
+				continue;
+			shard->inTransaction = 1;
+		}
+		sqlite3_bind_int64(shard->remove, 1, (sqlite3_int64)victims[i].key);
+		if (sqlite3_step(shard->remove) == SQLITE_DONE) {
+			int changes = sqlite3_changes(shard->db);
+			shard->delta -= changes;
+			removed[shard - store->shards] += (size_t)changes;
+		}
+		sqlite3_reset(shard->remove);
+	}
+	RMTileStoreCommit(store, removed);
+	for (unsigned i = 0; i < store->shardCount; i++)
+		deleted += removed[i];
+
+	pthread_mutex_lock(&store->lock);
+	RMTileStoreApplyDeltas(store);
+	pthread_mutex_unlock(&store->lock);
+
+	pthread_mutex_unlock(&store->writeLock);
+	free(oldest);
+	free(victims);
+	free(removed);
+
+	return deleted;
+}
+
+// Moves the referenced tiles of a bucket to another one and clears their bits. Called in a
+// transaction on the write connection. Returns 0 if out of memory.
+static int RMTileStoreSpare(RMTileStoreShard *shard, sqlite3_int64 bucket, sqlite3_int64 to)
+{
+	uint64_t *keys = NULL;
+	size_t count = 0, capacity = 0;
+
+	// collected first, as moving them changes the index the query walks
+	sqlite3_bind_int64(shard->referenced, 1, bucket);
+	while (sqlite3_step(shard->referenced) == SQLITE_ROW) {
+		if (count == capacity) {
+			uint64_t *grown = realloc(keys, (capacity = capacity ? 2 * capacity : 64) * sizeof(uint64_t));
+			if (grown == NULL) {
+				sqlite3_reset(shard->referenced);
+				free(keys);
+				return 0;
+			}
+			keys = grown;
+		}
+		keys[count++] = (uint64_t)sqlite3_column_int64(shard->referenced, 0);
+	}
+	sqlite3_reset(shard->referenced);
+
+	for (size_t i = 0; i < count; i++) {
+		sqlite3_bind_int64(shard->move, 1, to);
+		sqlite3_bind_int64(shard->move, 2, (sqlite3_int64)keys[i]);
+		sqlite3_step(shard->move);
+		sqlite3_reset(shard->move);
+		sqlite3_bind_int64(shard->unreference, 1, (sqlite3_int64)keys[i]);
+		sqlite3_step(shard->unreference);
+		sqlite3_reset(shard->unreference);
+	}
+	free(keys);
+
+	return 1;
+}
+
+size_t RMTileStorePurgeClock(RMTileStore *store, size_t count)
+{
+	sqlite3_int64 current = RMTileStoreBucket(store, RMTileStoreNow());
+	char *exhausted;
+	size_t *removed;
+	size_t deleted = 0, found = 0;
+
+	if (count == 0)
+		return 0;
+
+	RMTileStoreFlush(store);
+	pthread_mutex_lock(&store->writeLock);
+
+	exhausted = calloc(store->shardCount, 1);
+	removed = calloc(store->shardCount, sizeof(size_t));
+	if (exhausted == NULL || removed == NULL) {
+		pthread_mutex_unlock(&store->writeLock);
+		free(exhausted);
+		free(removed);
+		return 0;
+	}
+
+	// The hand goes through the buckets oldest first, over all shards. A bucket costs an
+	// index lookup, one UPDATE for its referenced tiles and one range DELETE for the rest.
+	while (found < count) {
+		RMTileStoreShard *shard = NULL;
+		sqlite3_int64 bucket = 0;
+		int evicted = 0;
+
+		for (unsigned i = 0; i < store->shardCount; i++) {
+			sqlite3_stmt *oldest = store->shards[i].oldestBucket;
+			if (exhausted[i])
+				continue;
+			if (sqlite3_step(oldest) == SQLITE_ROW && sqlite3_column_type(oldest, 0) != SQLITE_NULL) {
+				if (shard == NULL || sqlite3_column_int64(oldest, 0) < bucket) {
+					shard = &store->shards[i];
+					bucket = sqlite3_column_int64(oldest, 0);
+				}
+			} else {
+				exhausted[i] = 1;
+			}
+			sqlite3_reset(oldest);
+		}
+		if (shard == NULL)
+			break;
+
+		if (!shard->inTransaction) {
+			if (sqlite3_exec(shard->db, "BEGIN IMMEDIATE", NULL, NULL, NULL) != SQLITE_OK) {
+				exhausted[shard - store->shards] = 1;
+				continue;
+			}
+			shard->inTransaction = 1;
+		}
+
+		// second chance: referenced tiles move to the current bucket, their bit cleared
+		if (bucket < current && !RMTileStoreSpare(shard, bucket, current)) {
+			exhausted[shard - store->shards] = 1;
+			continue;
+		}
+
+		sqlite3_bind_int64(shard->evict, 1, bucket);
+		sqlite3_bind_int64(shard->evict, 2, (sqlite3_int64)(count - found));
+		if (sqlite3_step(shard->evict) == SQLITE_DONE)
+			evicted = sqlite3_changes(shard->db);
+		sqlite3_reset(shard->evict);
+
+		shard->delta -= evicted;
+		removed[shard - store->shards] += (size_t)evicted;
+		found += (size_t)evicted;
+		// the current bucket has no second chances left to give
+		if (evicted == 0 && bucket >= current)
+			exhausted[shard - store->shards] = 1;
+	}
+	RMTileStoreCommit(store, removed);
+	for (unsigned i = 0; i < store->shardCount; i++)
+		deleted += removed[i];
+
+	pthread_mutex_lock(&store->lock);
+	RMTileStoreApplyDeltas(store);
+	pthread_mutex_unlock(&store->lock);
+
+	pthread_mutex_unlock(&store->writeLock);
+	free(exhausted);
+	free(removed);
+
+	return deleted;
+}
+
+// Runs a statement on every write connection and takes the deleted rows off the counts.
+static size_t RMTileStoreDelete(RMTileStore *store, const char *sql, const double *bound)
+{
+	size_t deleted = 0;
+
+	pthread_mutex_lock(&store->writeLock);
+	for (unsigned i = 0; i < store->shardCount; i++) {
+		RMTileStoreShard *shard = &store->shards[i];
+		sqlite3_stmt *statement;
+
+		if (sqlite3_prepare_v2(shard->db, sql, -1, &statement, NULL) != SQLITE_OK)
+			continue;
+		if (bound != NULL)
+			sqlite3_bind_double(statement, 1, *bound);
+		if (sqlite3_step(statement) == SQLITE_DONE) {
+			int changes = sqlite3_changes(shard->db);
+			shard->delta -= changes;
+			deleted += (size_t)changes;
+		}
+		sqlite3_finalize(statement);
+	}
+
+	pthread_mutex_lock(&store->lock);
+	RMTileStoreApplyDeltas(store);
+	pthread_mutex_unlock(&store->lock);
+	pthread_mutex_unlock(&store->writeLock);
+
+	return deleted;
+}
+
+size_t RMTileStorePurgeInsertedBefore(RMTileStore *store, double inserted)
+{
+	RMTileStoreFlush(store);
+	return RMTileStoreDelete(store, "DELETE FROM ZCACHE WHERE zInserted < ?", &inserted);
+}
+
+void RMTileStoreRemoveAll(RMTileStore *store)
+{
+	pthread_mutex_lock(&store->lock);
+	RMTileLRURemoveAll(store->pending);
+	store->pendingPuts = 0;
+	while (RMTileLRUCount(store->writing) != 0)
+		pthread_cond_wait(&store->written, &store->lock);
+	pthread_mutex_unlock(&store->lock);
+
+	RMTileStoreDelete(store, "DELETE FROM ZCACHE", NULL);
+
+	pthread_mutex_lock(&store->lock);
+	for (unsigned i = 0; i < store->shardCount; i++)
+		store->shards[i].count = 0;
+	pthread_mutex_unlock(&store->lock);
+
+	RMTileStoreCompact(store, 1);
+}
+
+
+typedef struct {
+	uint32_t number;
+	uint64_t size, live;
+} RMTileStoreSegment;
+
+typedef struct {
+	sqlite3_int64 blob;
+	uint64_t offset;
+	size_t length;
+} RMTileStoreBlob;
+
+// Copies the blobs of a segment to the active one. Called in a transaction on the write
+// connection. Returns 0 on error.
+static int RMTileStoreMoveBlobs(RMTileStoreShard *shard, uint32_t number)
+{
+	sqlite3_stmt *select, *update;
+	RMTileStoreBlob *blobs = NULL;
+	size_t count = 0, capacity = 0;
+	RMTilePackSegment *pinned;
+	int moved = 1;
+
+	if (sqlite3_prepare_v2(shard->db, "SELECT zblob, zoffset, zlength FROM ZBLOB WHERE zsegment = ?", -1, &select, NULL) != SQLITE_OK)
+		return 0;
+	sqlite3_bind_int64(select, 1, number);
+	while (moved && sqlite3_step(select) == SQLITE_ROW) {
+		if (count == capacity) {
+			RMTileStoreBlob *grown = realloc(blobs, (capacity = capacity ? 2 * capacity : 64) * sizeof(RMTileStoreBlob));
+			if (grown == NULL) {
+				moved = 0;
+				break;
+			}
+			blobs = grown;
+		}
+		blobs[count].blob = sqlite3_column_int64(select, 0);
+		blobs[count].offset = (uint64_t)sqlite3_column_int64(select, 1);
+		blobs[count].length = (size_t)sqlite3_column_int64(select, 2);
+		count++;
+	}
+	sqlite3_finalize(select);
+	if (!moved || count == 0) {
+		free(blobs);
+		return moved;
+	}
+
+	pinned = RMTilePackPin(shard->pack, number);
+	if (pinned == NULL || sqlite3_prepare_v2(shard->db, "UPDATE ZBLOB SET zsegment = ?, zoffset = ? WHERE zblob = ?", -1, &update, NULL) != SQLITE_OK) {
+		if (pinned != NULL)
+			RMTilePackUnpin(pinned);
+		free(blobs);
+		return 0;
+	}
+
+	for (size_t i = 0; moved && i < count; i++) {
+		const void *bytes = RMTilePackBytes(pinned, blobs[i].offset, blobs[i].length);
+		uint32_t segment;
+		uint64_t offset, size;
+
+		if (bytes == NULL || !RMTilePackAppend(shard->pack, bytes, blobs[i].length, &segment, &offset, &size)) {
+			moved = 0;
+			break;
+		}
+		sqlite3_bind_int64(shard->growSegment, 1, segment);
+		sqlite3_bind_int64(shard->growSegment, 2, (sqlite3_int64)size);
+		sqlite3_step(shard->growSegment);
+		sqlite3_reset(shard->growSegment);
+
+		sqlite3_bind_int64(update, 1, segment);
+		sqlite3_bind_int64(update, 2, (sqlite3_int64)offset);
+		sqlite3_bind_int64(update, 3, blobs[i].blob);
+		moved = sqlite3_step(update) == SQLITE_DONE;
+		sqlite3_reset(update);
+	}
+
+	sqlite3_finalize(update);
+	RMTilePackUnpin(pinned);
+	free(blobs);
+	return moved;
+}
+
+// Compacts the segments of one shard. Called with the write lock held.
+static uint64_t RMTileStoreCompactShard(RMTileStoreShard *shard, double minLive)
+{
+	RMTileStoreSegment *segments = NULL;
+	size_t count = 0, capacity = 0, retired = 0;
+	uint32_t active = RMTilePackActive(shard->pack);
+	uint64_t freed = 0;
+	sqlite3_stmt *select, *drop;
+	int ok = 1;
+
+	if (sqlite3_prepare_v2(shard->db, "SELECT zsegment, zsize, (SELECT COALESCE(SUM(zlength), 0) FROM ZBLOB WHERE ZBLOB.zsegment = ZSEGMENT.zsegment) FROM ZSEGMENT", -1, &select, NULL) != SQLITE_OK)
+		return 0;
+	while (sqlite3_step(select) == SQLITE_ROW) {
+		RMTileStoreSegment segment;
+		segment.number = (uint32_t)sqlite3_column_int64(select, 0);
+		segment.size = (uint64_t)sqlite3_column_int64(select, 1);
+		segment.live = (uint64_t)sqlite3_column_int64(select, 2);
+		// the active segment is still filling up, unless nothing in it is used
+		if (segment.size == 0 || segment.live >= minLive * segment.size || (segment.number == active && segment.live > 0))
+			continue;
+
+		if (count == capacity) {
+			RMTileStoreSegment *grown = realloc(segments, (capacity = capacity ? 2 * capacity : 16) * sizeof(RMTileStoreSegment));
+			if (grown == NULL)
+				break;
+			segments = grown;
+		}
+		segments[count++] = segment;
+	}
+	sqlite3_finalize(select);
+	if (count == 0 || sqlite3_prepare_v2(shard->db, "DELETE FROM ZSEGMENT WHERE zsegment = ?", -1, &drop, NULL) != SQLITE_OK) {
+		free(segments);
+		return 0;
+	}
+
+	if (sqlite3_exec(shard->db, "BEGIN IMMEDIATE", NULL, NULL, NULL) != SQLITE_OK) {
+		sqlite3_finalize(drop);
+		free(segments);
+		return 0;
+	}
+	// an unused active segment is replaced first, so no blob is moved into it
+	for (size_t i = 0; i < count; i++) {
+		if (segments[i].number == active)
+			RMTilePackRoll(shard->pack);
+	}
+	for (size_t i = 0; ok && i < count; i++) {
+		if (segments[i].number != active)
+			ok = RMTileStoreMoveBlobs(shard, segments[i].number);
+
+		sqlite3_bind_int64(drop, 1, segments[i].number);
+		ok = ok && sqlite3_step(drop) == SQLITE_DONE;
+		sqlite3_reset(drop);
+		retired = i + 1;
+	}
+	sqlite3_finalize(drop);
+
+	if (ok && RMTilePackSync(shard->pack) && sqlite3_exec(shard->db, "COMMIT", NULL, NULL, NULL) == SQLITE_OK) {
+		// readers holding the old bytes keep them mapped
+		for (size_t i = 0; i < retired; i++) {
+			RMTilePackRetire(shard->pack, segments[i].number);
+			freed += segments[i].size - segments[i].live;
+		}
+	} else {
+		sqlite3_exec(shard->db, "ROLLBACK", NULL, NULL, NULL);
+	}
+
+	free(segments);
+	return freed;
+}
+
+uint64_t RMTileStoreCompact(RMTileStore *store, double minLive)
+{
+	uint64_t freed = 0;
+
+	RMTileStoreFlush(store);
+	pthread_mutex_lock(&store->writeLock);
+	for (unsigned i = 0; i < store->shardCount; i++)
+		freed += RMTileStoreCompactShard(&store->shards[i], minLive);
+	pthread_mutex_unlock(&store->writeLock);
+
+	return freed;
+}
+
+uint64_t RMTileStorePackedBytes(RMTileStore *store)
+{
+	uint64_t bytes = 0;
+
+	pthread_mutex_lock(&store->writeLock);
+	for (unsigned i = 0; i < store->shardCount; i++) {
+		sqlite3_stmt *sum;
+		if (sqlite3_prepare_v2(store->shards[i].db, "SELECT COALESCE(SUM(zsize), 0) FROM ZSEGMENT", -1, &sum, NULL) != SQLITE_OK)
+			continue;
+		if (sqlite3_step(sum) == SQLITE_ROW)
+			bytes += (uint64_t)sqlite3_column_int64(sum, 0);
+		sqlite3_finalize(sum);
+	}
+	pthread_mutex_unlock(&store->writeLock);
+
+	return bytes;
+}
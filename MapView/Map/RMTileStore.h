@@ -0,0 +1,144 @@
+//
+//  RMTileStore.h
+//
+// Copyright (c) 2008-2011, Route-Me Contributors
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _RMTILESTORE_H_
+#define _RMTILESTORE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*! \file RMTileStore.h
+ */
+/*! \struct RMTileStore
+ \brief SQLite tile storage that many threads can read while one thread writes.
+
+ Tiles are kept in the ZCACHE table RMTileCacheDAO has always used, optionally spread over
+ several database files (shards) by the low bits of their x and y, so neighbouring tiles go
+ to different files.
+
+ Every shard has a pool of read-only connections, so lookups from different threads run at
+ the same time and are not held up by writes. Puts and LRU touches are queued and written by
+ a writer thread of the store, in one transaction per shard once the queue holds
+ writeBatchSize entries or its oldest entry is writeDelay seconds old. Lookups see queued
+ tiles. Purges run on the calling thread, on the write connections, after the queue has been
+ written.
+
+ Besides zlastUsed every tile has a coarse time bucket, bucketWidth seconds wide, and a
+ reference bit, for CLOCK purges: RMTileStoreReference() only sets the bit, once, and leaves
+ the tile rows alone, and RMTileStorePurgeClock() deletes from the oldest buckets, moving tiles
+ with the bit set to the current bucket instead (their second chance).
+
+ With a segmentSize, the data of new tiles goes to an RMTilePack of each shard rather than
+ into their rows, and ZCACHE only points into the ZBLOB table, which says where in the pack
+ the bytes are. Identical tiles, like all those of open sea, share one blob: they are found by
+ a hash of their data and then compared byte for byte. RMTileStoreGetData() hands out the
+ bytes of packed tiles straight from the mapped segment. Deleting tiles leaves dead bytes in
+ the segments until RMTileStoreCompact() copies the live blobs of mostly dead segments to
+ the active one and deletes the old files. Tiles stored in their rows stay readable.
+
+ Times are seconds since 1970, the way FMDatabase stores NSDates. All functions are thread
+ safe, except that RMTileStoreClose() must be the last call.
+ */
+typedef struct RMTileStore RMTileStore;
+
+typedef struct {
+	/// 2^shardBits database files. With 0 the path is used as is; otherwise shard i of n
+	/// lives in "<path>.<i>-<n>", so different layouts never share files.
+	unsigned shardBits;
+	/// read-only connections per shard, at least 1
+	unsigned readers;
+	/// queued writes after which the queue is written, at least 1
+	size_t writeBatchSize;
+	/// longest time a write stays queued, in seconds
+	double writeDelay;
+	/// width of the time buckets of RMTileStorePurgeClock(), in seconds
+	double bucketWidth;
+	/// size of the pack segments new tiles go to, in bytes; 0 stores tiles in their rows
+	size_t segmentSize;
+	/// pack segments kept mapped per shard
+	unsigned mappedSegments;
+} RMTileStoreOptions;
+
+/// Options for one file, 4 readers, batches of 64 writes or 0.5 s, buckets of an hour and
+/// tiles stored in their rows.
+RMTileStoreOptions RMTileStoreDefaultOptions(void);
+
+/// Opens or creates the store. Returns NULL if a database cannot be opened or set up.
+RMTileStore *RMTileStoreOpen(const char *path, const RMTileStoreOptions *options);
+/// Writes the queue, stops the writer and closes all connections.
+void RMTileStoreClose(RMTileStore *store);
+
+/// Changes the batching of writes.
+void RMTileStoreSetWriteBatch(RMTileStore *store, size_t writeBatchSize, double writeDelay);
+
+/// Looks up a tile. Returns 1 and a malloc()ed copy of its data if found, 0 if not, -1 on error.
+int RMTileStoreGet(RMTileStore *store, uint64_t key, void **data, size_t *length);
+
+/// The data of a tile, mapped from a pack segment or copied.
+typedef struct {
+	const void *bytes;
+	size_t length;
+	void *pin;		// the pinned segment, or NULL if bytes is a malloc()ed copy
+} RMTileStoreData;
+
+/// Looks up a tile without copying packed data. Returns 1 if found, 0 if not, -1 on error;
+/// if found, the data must be given back with RMTileStoreReleaseData().
+int RMTileStoreGetData(RMTileStore *store, uint64_t key, RMTileStoreData *data);
+/// Releases data from RMTileStoreGetData(). May be called on any thread, even after the store
+/// has been closed.
+void RMTileStoreReleaseData(RMTileStoreData *data);
+/// Queues a tile to be stored, copying its data. Returns 0 if out of memory.
+int RMTileStorePut(RMTileStore *store, uint64_t key, const void *data, size_t length, double lastUsed, double inserted);
+/// Queues a new last used time for a tile.
+void RMTileStoreTouch(RMTileStore *store, uint64_t key, double lastUsed);
+/// Queues setting the reference bit of a tile. Writes nothing if the bit is already set.
+void RMTileStoreReference(RMTileStore *store, uint64_t key);
+
+/// Number of stored tiles, counting queued tiles as new ones. Does not query the databases.
+size_t RMTileStoreCount(RMTileStore *store);
+/// Nonzero if writes are queued or being written.
+int RMTileStoreHasPendingWrites(RMTileStore *store);
+/// Waits until everything queued so far is written.
+void RMTileStoreFlush(RMTileStore *store);
+
+/// Deletes the count least recently used tiles over all shards. Returns how many were deleted.
+size_t RMTileStorePurge(RMTileStore *store, size_t count);
+/// Deletes count tiles from the oldest time buckets over all shards, moving referenced tiles to
+/// the current bucket rather than deleting them. Returns how many were deleted.
+size_t RMTileStorePurgeClock(RMTileStore *store, size_t count);
+/// Deletes the tiles inserted before the given time. Returns how many were deleted.
+size_t RMTileStorePurgeInsertedBefore(RMTileStore *store, double inserted);
+/// Deletes all tiles, queued ones included.
+void RMTileStoreRemoveAll(RMTileStore *store);
+
+/// Rewrites the pack segments of which less than minLive (0 to 1) is still in use, and deletes
+/// those wholly unused. Returns the number of bytes freed.
+uint64_t RMTileStoreCompact(RMTileStore *store, double minLive);
+/// Bytes in pack segments, in use or not.
+uint64_t RMTileStorePackedBytes(RMTileStore *store);
+
+#endif
@@ -27,8 +27,11 @@
 
 #import <Foundation/Foundation.h>
 #import "RMTileImage.h"
+#import "RMTileFetcher.h"
 
-static const NSUInteger kWebTileRetries = 30;
+/// Retries of a tile that failed to load, after a backoff starting at half a second and doubling
+/// each time, about half a minute in all.
+static const NSUInteger kWebTileRetries = 6;
 
 extern NSString *RMWebTileImageErrorDomain;
 
@@ -43,16 +46,24 @@ extern NSString *RMWebTileImageNotificationErrorKey;
 
 
 /// RMTileImage subclass: a tile image loaded from a URL.
+/// Images of http:// URLs are fetched by a fetcher they share, on a few kept-alive connections to
+/// each host, and images of the same URL share its request. Others load with an NSURLConnection,
+/// as do tiles the server redirects.
 @interface RMWebTileImage : RMTileImage {
     NSUInteger retries;
     NSError *lastError;
 
 	NSURL *url;
 	NSURLConnection *connection;
+	BOOL fetching;
+	BOOL cancelled;
 
 	NSMutableData *data;
 }
 
+/// The fetcher shared by all web images.
++ (RMTileFetcher*) fetcher;
+
 /*!
  */
 - (id) initWithTile: (RMTile)tile FromURL:(NSString*)url;
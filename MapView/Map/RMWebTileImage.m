@@ -35,9 +35,61 @@ NSString *RMWebTileImageErrorDomain = @"RMWebTileImageErrorDomain";
 NSString *RMWebTileImageHTTPResponseCodeKey = @"RMWebTileImageHTTPResponseCodeKey";
 NSString *RMWebTileImageNotificationErrorKey = @"RMWebTileImageNotificationErrorKey";
 
+/// The first backoff before retrying a tile, and the longest, in seconds.
+#define kWebTileBackoff 0.5
+#define kWebTileBackoffCap 30.0
+
+static NSString *kRMWebTileStatusKey = @"status";
+static NSString *kRMWebTileDataKey = @"data";
+
+static RMTileFetcher *sharedFetcher = NULL;
+
+@interface RMWebTileImage (Fetching)
+- (BOOL) startFetching;
+- (void) finishFetchingWithResponse: (NSDictionary*) response;
+@end
+
+static void RMWebTileImageFetched(void *context, int status, const void *body, size_t length)
+{
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	RMWebTileImage *image = (RMWebTileImage *)context;
+	NSDictionary *response = [NSDictionary dictionaryWithObjectsAndKeys:
+							  [NSNumber numberWithInt:status], kRMWebTileStatusKey,
+							  [NSData dataWithBytes:body length:length], kRMWebTileDataKey, nil];
+
+	// retains the image until it has finished on the main thread
+	[image performSelectorOnMainThread:@selector(finishFetchingWithResponse:) withObject:response waitUntilDone:NO];
+	[image release];
+	[pool release];
+}
 
 @implementation RMWebTileImage
 
++ (RMTileFetcher*) fetcher
+{
+	@synchronized ([RMWebTileImage class]) {
+		if (sharedFetcher == NULL)
+		{
+			NSDictionary *info = [[NSBundle mainBundle] infoDictionary];
+			NSString *application = [info objectForKey:@"CFBundleName"];
+			NSString *userAgent = @"route-me";
+			RMTileFetcherOptions options;
+
+			// tile servers ask to be told which application is asking
+			if (application != nil)
+				userAgent = [NSString stringWithFormat:@"%@/%@ route-me", application, [info objectForKey:@"CFBundleVersion"]];
+
+			RMTileFetcherDefaultOptions(&options);
+			options.maxRetries = kWebTileRetries;
+			options.backoffBase = kWebTileBackoff;
+			options.backoffCap = kWebTileBackoffCap;
+			options.userAgent = [userAgent UTF8String];
+			sharedFetcher = RMTileFetcherCreate(&options);
+		}
+	}
+	return sharedFetcher;
+}
+
 #pragma mark -
 #pragma mark Initialization and deallocation
 - (id) initWithTile: (RMTile)_tile FromURL:(NSString*)urlStr
@@ -48,6 +100,8 @@ NSString *RMWebTileImageNotificationErrorKey = @"RMWebTileImageNotificationError
 	url = [[NSURL alloc] initWithString:urlStr];
 
         connection = nil;
+	fetching = NO;
+	cancelled = NO;
 		
 	data =[[NSMutableData alloc] initWithCapacity:0];
 	
@@ -90,20 +144,96 @@ NSString *RMWebTileImageNotificationErrorKey = @"RMWebTileImageNotificationError
 			[[NSNotificationCenter defaultCenter] postNotificationName:RMTileRetrieved object:self];
 
 			[[NSNotificationCenter defaultCenter] postNotificationName:RMTileError object:self userInfo:[NSDictionary dictionaryWithObject:lastError forKey:RMWebTileImageNotificationErrorKey]];
+			[self failWithError:lastError];
             [lastError autorelease]; lastError = nil;
 
 			return;
 		}
 		retries--;		
 
-		[NSTimer scheduledTimerWithTimeInterval:1.0 target:self selector:@selector(startLoading:) userInfo:nil repeats:NO];		
+		NSTimeInterval backoff = RMTileFetcherBackoff(kWebTileRetries - retries - 1, kWebTileBackoff, kWebTileBackoffCap, arc4random() / 4294967296.0);
+		[NSTimer scheduledTimerWithTimeInterval:backoff target:self selector:@selector(startLoading:) userInfo:nil repeats:NO];		
 	}
-	else 
+	else if (![self startFetching])
 	{
 		[self startLoading:nil];
 	}
 }
 
+/// Asks the shared fetcher for http:// URLs, and returns NO for others.
+- (BOOL) startFetching
+{
+	RMTileFetcher *fetcher = [RMWebTileImage fetcher];
+	NSString *address = [url absoluteString];
+
+	if (fetcher == NULL || address == nil)
+		return NO;
+
+	// the fetcher may call back before it returns
+	[self retain];
+	if (!RMTileFetcherGet(fetcher, [address UTF8String], [RMTileImage isPrefetching] ? RMTileRequestPrefetch : RMTileRequestVisible, RMWebTileImageFetched, self))
+	{
+		[self release];
+		return NO;
+	}
+	fetching = YES;
+	return YES;
+}
+
+- (void) finishFetchingWithResponse: (NSDictionary*) response
+{
+	int status = [[response objectForKey:kRMWebTileStatusKey] intValue];
+	NSData *body = [response objectForKey:kRMWebTileDataKey];
+	NSError *error;
+
+	fetching = NO;
+	if (cancelled || status == kRMTileFetchCancelled)
+		return;
+
+	if (status >= 300 && status < 400)
+	{
+		// NSURLConnection follows redirects
+		[self startLoading:nil];
+		return;
+	}
+	if (status >= 200 && status < 300 && [body length] > 0)
+	{
+		[self updateImageUsingData:body];
+		[[NSNotificationCenter defaultCenter] postNotificationName:RMTileRetrieved object:self];
+		return;
+	}
+
+	// the fetcher has retried what was worth retrying
+	if (status == 404)
+		error = [NSError errorWithDomain:RMWebTileImageErrorDomain 
+									code:RMWebTileImageErrorNotFoundResponse
+								userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+										  NSLocalizedString(@"The requested tile was not found on the server", @""), NSLocalizedDescriptionKey, nil]];
+	else if (status >= 200 && status < 300)
+		error = [NSError errorWithDomain:RMWebTileImageErrorDomain 
+									code:RMWebTileImageErrorZeroLengthResponse
+								userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+										  NSLocalizedString(@"The server returned a zero-length response", @""), NSLocalizedDescriptionKey, nil]];
+	else if (status > 0)
+		error = [NSError errorWithDomain:RMWebTileImageErrorDomain 
+									code:RMWebTileImageErrorUnexpectedHTTPResponse 
+								userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+										  [NSNumber numberWithInt:status], RMWebTileImageHTTPResponseCodeKey,
+										  [NSString stringWithFormat:NSLocalizedString(@"The server returned error code %d", @""), status], NSLocalizedDescriptionKey, nil]];
+	else if (status == kRMTileFetchTimedOut)
+		error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorTimedOut userInfo:nil];
+	else if (status == kRMTileFetchBadResponse)
+		error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorBadServerResponse userInfo:nil];
+	else
+		error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCannotConnectToHost userInfo:nil];
+
+	[super displayProxy:status == 404 ? [RMTileProxy missingTile] : [RMTileProxy errorTile]];
+	[[NSNotificationCenter defaultCenter] postNotificationName:RMTileRetrieved object:self];
+
+	[[NSNotificationCenter defaultCenter] postNotificationName:RMTileError object:self userInfo:[NSDictionary dictionaryWithObject:error forKey:RMWebTileImageNotificationErrorKey]];
+	[self failWithError:error];
+}
+
 - (void) startLoading:(NSTimer *)timer
 {
 	NSURLRequest *request = [NSURLRequest requestWithURL:url cachePolicy:NSURLRequestReloadIgnoringCacheData timeoutInterval:30.0];
@@ -114,25 +244,46 @@ NSString *RMWebTileImageNotificationErrorKey = @"RMWebTileImageNotificationError
 	{
 		[super displayProxy:[RMTileProxy errorTile]];
 		[[NSNotificationCenter defaultCenter] postNotificationName:RMTileRetrieved object:self];
+		[self failWithError:nil];
 	}
 }
 
 - (void) cancelLoading
 {
-	if (!connection)
-		return;
-	
-	[[NSNotificationCenter defaultCenter] postNotificationName:RMTileRetrieved object:self];
-	[connection cancel];
-	
-	[connection release];
-	connection = nil;
-	
-    if ( lastError ) [lastError release]; lastError = nil;
+	if (fetching && !cancelled)
+	{
+		cancelled = YES;
+		[[NSNotificationCenter defaultCenter] postNotificationName:RMTileRetrieved object:self];
+
+		// a response on its way to the main thread is ignored
+		if (RMTileFetcherCancel(sharedFetcher, [[url absoluteString] UTF8String], self))
+		{
+			fetching = NO;
+			[self autorelease];
+		}
+	}
+
+	if (connection)
+	{
+		[[NSNotificationCenter defaultCenter] postNotificationName:RMTileRetrieved object:self];
+		[connection cancel];
+		
+		[connection release];
+		connection = nil;
+		
+		if ( lastError ) [lastError release]; lastError = nil;
+	}
     
+	// also between retries, when there is no connection
 	[super cancelLoading];
 }
 
+- (void) prioritize
+{
+	if (fetching && !cancelled)
+		RMTileFetcherPromote(sharedFetcher, [[url absoluteString] UTF8String], RMTileRequestVisible);
+}
+
 #pragma mark -
 #pragma mark URL loading functions
 // Delegate methods for loading the image
@@ -167,6 +318,7 @@ NSString *RMWebTileImageNotificationErrorKey = @"RMWebTileImageNotificationError
                                                    NSLocalizedString(@"The requested tile was not found on the server", @""), NSLocalizedDescriptionKey, nil]];
         
         [[NSNotificationCenter defaultCenter] postNotificationName:RMTileError object:self userInfo:[NSDictionary dictionaryWithObject:error forKey:RMWebTileImageNotificationErrorKey]];
+		[self failWithError:error];
 		[self cancelLoading];
 	}
 	else // Other Error
@@ -197,6 +349,7 @@ NSString *RMWebTileImageNotificationErrorKey = @"RMWebTileImageNotificationError
 		else 
 		{
 			[[NSNotificationCenter defaultCenter] postNotificationName:RMTileError object:self userInfo:[NSDictionary dictionaryWithObject:error forKey:RMWebTileImageNotificationErrorKey]];
+			[self failWithError:error];
 			[self cancelLoading];
 		}
 	}
@@ -238,6 +391,7 @@ NSString *RMWebTileImageNotificationErrorKey = @"RMWebTileImageNotificationError
 	else 
 	{
 		[[NSNotificationCenter defaultCenter] postNotificationName:RMTileError object:self userInfo:[NSDictionary dictionaryWithObject:error forKey:RMWebTileImageNotificationErrorKey]];
+		[self failWithError:error];
 		[self cancelLoading];
 	}
 }
@@ -27,6 +27,53 @@
 // POSSIBILITY OF SUCH DAMAGE.
 
 #import "RMFoundationTests.h"
+#import "RMTileLRU.h"
+#import "RMMemoryCache.h"
+#import "RMTileImage.h"
+#import "RMTileCacheDAO.h"
+#import "RMMissingTileCache.h"
+#import "RMDecodedTileCache.h"
+#import "RMTileImageSet.h"
+#import "RMTileIndex.h"
+#import "RMScheduledTileImage.h"
+#import "RMTilePrefetch.h"
+#import "RMTileFetcher.h"
+#import "RMTilePack.h"
+
+static void RMCountRelease(void *context, uint64_t key, void *value)
+{
+	(*(int *)context)++;
+}
+
+// Hands out the same data for every tile, as a tile source would from its database.
+@interface RMTestTileDataReader : NSObject<RMTileDataReader>
+{
+	NSData *data;
+}
+@end
+
+@implementation RMTestTileDataReader
+
+-(id) initWithData: (NSData*) _data
+{
+	if (![super init])
+		return nil;
+	data = [_data retain];
+	return self;
+}
+
+-(void) dealloc
+{
+	[data release];
+	[super dealloc];
+}
+
+-(NSData*) tileData: (RMTile) tile
+{
+	return data;
+}
+
+@end
 
 @implementation RMFoundationTests
 
@@ -44,4 +91,564 @@
 	STAssertTrue(RMProjectedRectInterectsProjectedRect(r0123, r0022), nil);
 }
 
+- (void)testTileLRUEvictsLeastRecentlyUsed {
+	int released = 0;
+	int a = 1, b = 2, c = 3, d = 4;
+	RMTileLRU *lru = RMTileLRUCreate(0, 3, RMCountRelease, &released);
+	
+	RMTileLRUPut(lru, 1, &a, 10);
+	RMTileLRUPut(lru, 2, &b, 10);
+	RMTileLRUPut(lru, 3, &c, 10);
+	STAssertEquals(RMTileLRUGet(lru, 1), (void *)&a, nil);
+	
+	RMTileLRUPut(lru, 4, &d, 10);
+	STAssertEquals(released, 1, nil);
+	STAssertTrue(RMTileLRUGet(lru, 2) == NULL, @"least recently used entry should be evicted");
+	STAssertEquals(RMTileLRUCount(lru), (size_t)3, nil);
+	STAssertEquals(RMTileLRUCost(lru), (size_t)30, nil);
+	
+	// replacing an entry releases the old value and keeps the count
+	RMTileLRUPut(lru, 3, &b, 15);
+	STAssertEquals(released, 2, nil);
+	STAssertEquals(RMTileLRUCount(lru), (size_t)3, nil);
+	STAssertEquals(RMTileLRUCost(lru), (size_t)35, nil);
+	
+	RMTileLRURemove(lru, 1);
+	STAssertEquals(released, 3, nil);
+	RMTileLRUFree(lru);
+	STAssertEquals(released, 5, nil);
+}
+
+- (void)testTileLRUByteBudget {
+	int released = 0;
+	RMTileLRU *lru = RMTileLRUCreate(100, 0, RMCountRelease, &released);
+	
+	for (uint64_t key = 0; key < 10; key++)
+		RMTileLRUPut(lru, key, NULL, 30);
+	STAssertEquals(RMTileLRUCount(lru), (size_t)3, nil);
+	STAssertEquals(RMTileLRUCost(lru), (size_t)90, nil);
+	
+	// an entry over the whole budget pushes out everything else
+	RMTileLRUPut(lru, 42, NULL, 500);
+	STAssertEquals(RMTileLRUCount(lru), (size_t)1, nil);
+	STAssertEquals(released, 10, nil);
+	
+	// an entry growing in place pushes out older entries, but never itself
+	RMTileLRUPut(lru, 1, NULL, 30);
+	RMTileLRUPut(lru, 2, NULL, 30);
+	RMTileLRUPut(lru, 3, NULL, 30);
+	STAssertEquals(RMTileLRUCount(lru), (size_t)3, nil);
+	STAssertEquals(RMTileLRUSetCost(lru, 1, 60), (size_t)1, nil);
+	STAssertEquals(RMTileLRUCost(lru), (size_t)90, nil);
+	STAssertEquals(RMTileLRUSetCost(lru, 1, 500), (size_t)1, nil);
+	STAssertEquals(RMTileLRUCount(lru), (size_t)1, nil);
+	STAssertEquals(RMTileLRUCost(lru), (size_t)500, nil);
+	STAssertEquals(RMTileLRUSetCost(lru, 7, 10), (size_t)0, @"a missing entry has no cost to change");
+	STAssertEquals(released, 13, nil);
+	RMTileLRUFree(lru);
+}
+
+- (void)testMemoryCacheByteBudget {
+	NSUInteger tileCost = [RMMemoryCache costOfImage:nil];
+	RMMemoryCache *cache = [[RMMemoryCache alloc] initWithCapacity:100 byteBudget:3 * tileCost];
+	RMTile tiles[4];
+	
+	for (int i = 0; i < 4; i++) {
+		tiles[i].x = i;
+		tiles[i].y = 7;
+		tiles[i].zoom = 3;
+		RMTileImage *image = [[RMTileImage alloc] initWithTile:tiles[i]];
+		[cache addTile:tiles[i] WithImage:image];
+		STAssertEquals([image retainCount], (NSUInteger)2, @"cache should retain its images");
+		[image release];
+		if (i == 2)
+			STAssertNotNil([cache cachedImage:tiles[0]], nil);
+	}
+	
+	STAssertEquals(cache.count, (NSUInteger)3, nil);
+	STAssertTrue(cache.cost <= 3 * tileCost, nil);
+	STAssertNil([cache cachedImage:tiles[1]], @"least recently used tile should be evicted");
+	STAssertNotNil([cache cachedImage:tiles[0]], nil);
+	
+	// an image added before it has loaded is charged again for its bitmap once it has
+	UIGraphicsBeginImageContext(CGSizeMake(512, 512));
+	UIImage *large = UIGraphicsGetImageFromCurrentImageContext();
+	UIGraphicsEndImageContext();
+	RMTileImage *image = [[RMTileImage alloc] initWithTile:tiles[1]];
+	[cache addTile:tiles[1] WithImage:image];
+	STAssertEquals(cache.count, (NSUInteger)3, nil);
+	[image updateImageUsingData:UIImagePNGRepresentation(large)];
+	STAssertEquals(cache.cost, [RMMemoryCache costOfImage:image], @"loaded image should be charged its bitmap");
+	STAssertTrue(cache.cost > 3 * tileCost, nil);
+	STAssertEquals(cache.count, (NSUInteger)1, @"the other tiles should be evicted for it");
+	STAssertEquals([cache cachedImage:tiles[1]], image, nil);
+	[image release];
+	
+	[cache didReceiveMemoryWarning];
+	STAssertEquals(cache.count, (NSUInteger)0, nil);
+	[cache release];
+}
+
+- (void)testTileCacheDAOCountsWithoutQuerying {
+	NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"RMTileCacheDAOTest.sqlite"];
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+	NSData *data = [@"tile" dataUsingEncoding:NSUTF8StringEncoding];
+	
+	RMTileCacheDAO *dao = [[RMTileCacheDAO alloc] initWithDatabase:path];
+	STAssertEquals([dao count], (NSUInteger)0, nil);
+	for (uint64_t key = 1; key <= 10; key++)
+		[dao addData:data LastUsed:[NSDate dateWithTimeIntervalSinceReferenceDate:key] ForTile:key];
+	[dao addData:data LastUsed:[NSDate date] ForTile:3];
+	STAssertEquals([dao count], (NSUInteger)10, @"replacing a tile should not change the count");
+	
+	STAssertEquals([dao purgeTiles:4], (NSUInteger)4, nil);
+	STAssertEquals([dao count], (NSUInteger)6, nil);
+	STAssertNotNil([dao dataForTile:3], @"recently used tile should survive the purge");
+	STAssertNil([dao dataForTile:2], nil);
+	[dao release];
+	
+	dao = [[RMTileCacheDAO alloc] initWithDatabase:path];
+	STAssertEquals([dao count], (NSUInteger)6, @"count should be seeded when opening");
+	[dao removeAllCachedImages];
+	STAssertEquals([dao count], (NSUInteger)0, nil);
+	[dao release];
+	
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testTileCacheDAOQueuesWrites {
+	NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"RMTileCacheDAOQueueTest.sqlite"];
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+	NSData *data = [@"tile" dataUsingEncoding:NSUTF8StringEncoding];
+	
+	RMTileCacheDAO *dao = [[RMTileCacheDAO alloc] initWithDatabase:path];
+	[dao setWriteBatchSize:7];
+	[dao setWriteDelay:3600];
+	for (uint64_t key = 1; key <= 5; key++)
+		[dao addData:data LastUsed:[NSDate date] ForTile:key];
+	STAssertTrue([dao hasPendingWrites], @"5 tiles should not fill a batch of 7");
+	STAssertEqualObjects([dao dataForTile:4], data, @"queued tiles should be readable");
+	[dao touchTile:4 withDate:[NSDate date]];
+	
+	for (uint64_t key = 6; key <= 7; key++)
+		[dao addData:data LastUsed:[NSDate date] ForTile:key];
+	// the writer thread takes it from here
+	for (int i = 0; i < 200 && [dao hasPendingWrites]; i++)
+		[NSThread sleepForTimeInterval:0.01];
+	STAssertFalse([dao hasPendingWrites], @"a full batch should be written");
+	
+	[dao addData:data LastUsed:[NSDate date] ForTile:8];
+	[dao release];
+	
+	dao = [[RMTileCacheDAO alloc] initWithDatabase:path];
+	STAssertEquals([dao count], (NSUInteger)8, @"the queue should be flushed on dealloc");
+	[dao release];
+	
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testShardedTileCacheDAOReadsWhileWriting {
+	NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"RMTileCacheDAOShardTest.sqlite"];
+	NSUInteger tiles = 2000;
+	
+	RMTileCacheDAO *dao = [[RMTileCacheDAO alloc] initWithDatabase:path shards:4 readers:2];
+	STAssertNotNil(dao, nil);
+	[dao removeAllCachedImages];
+	[dao setWriteBatchSize:32];
+	
+	for (uint64_t key = 0; key < tiles; key++) {
+		NSData *data = [NSData dataWithBytes:&key length:sizeof(key)];
+		[dao addData:data LastUsed:[NSDate dateWithTimeIntervalSince1970:key] ForTile:key];
+		
+		// read back an earlier tile, queued, being written or in its shard by now
+		uint64_t earlier = key / 2, found = ~0ULL;
+		[[dao dataForTile:earlier] getBytes:&found length:sizeof(found)];
+		STAssertEquals(found, earlier, nil);
+	}
+	STAssertEquals([dao count], tiles, nil);
+	
+	// the oldest tiles of all shards together go first
+	STAssertEquals([dao purgeTiles:100], (NSUInteger)100, nil);
+	STAssertNil([dao dataForTile:99], nil);
+	STAssertNotNil([dao dataForTile:100], nil);
+	[dao release];
+	
+	dao = [[RMTileCacheDAO alloc] initWithDatabase:path shards:4 readers:2];
+	STAssertEquals([dao count], tiles - 100, nil);
+	[dao removeAllCachedImages];
+	[dao release];
+	
+	// shard i of 4 lives in "<path>.<i>-4"
+	for (unsigned shard = 0; shard < 4; shard++) {
+		NSString *file = [path stringByAppendingFormat:@".%u-4", shard];
+		[[NSFileManager defaultManager] removeItemAtPath:file error:nil];
+		[[NSFileManager defaultManager] removeItemAtPath:[file stringByAppendingString:@"-wal"] error:nil];
+		[[NSFileManager defaultManager] removeItemAtPath:[file stringByAppendingString:@"-shm"] error:nil];
+	}
+}
+
+- (void)testTileCacheDAOClockPurgeSparesReferencedTiles {
+	NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"RMTileCacheDAOClockTest.sqlite"];
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+	NSData *data = [@"tile" dataUsingEncoding:NSUTF8StringEncoding];
+	
+	// one tile per hour-wide bucket, tile 1 the oldest
+	RMTileCacheDAO *dao = [[RMTileCacheDAO alloc] initWithDatabase:path];
+	for (uint64_t key = 1; key <= 10; key++)
+		[dao addData:data LastUsed:[NSDate dateWithTimeIntervalSinceNow:-7200.0 * (11 - key)] ForTile:key];
+	[dao referenceTile:1];
+	[dao referenceTile:1];
+	
+	STAssertEquals([dao purgeTilesByClock:3], (NSUInteger)3, nil);
+	STAssertNotNil([dao dataForTile:1], @"a referenced tile should get a second chance");
+	STAssertNil([dao dataForTile:2], nil);
+	STAssertNil([dao dataForTile:4], nil);
+	STAssertNotNil([dao dataForTile:5], nil);
+	
+	// the second chance cleared the bit, and moved the tile to the newest bucket
+	STAssertEquals([dao purgeTilesByClock:6], (NSUInteger)6, nil);
+	STAssertNotNil([dao dataForTile:1], nil);
+	STAssertEquals([dao purgeTilesByClock:6], (NSUInteger)1, nil);
+	STAssertEquals([dao count], (NSUInteger)0, nil);
+	[dao release];
+	
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testPackedTileCacheDAOStoresIdenticalTilesOnce {
+	NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"RMTileCacheDAOPackTest.sqlite"];
+	NSData *ocean = [NSMutableData dataWithLength:1000];
+	
+	RMTileStoreOptions options = [RMTileCacheDAO optionsWithShards:1 readers:2];
+	options.segmentSize = 16384;
+	RMTileCacheDAO *dao = [[RMTileCacheDAO alloc] initWithDatabase:path options:&options];
+	STAssertNotNil(dao, nil);
+	[dao removeAllCachedImages];
+	
+	for (uint64_t key = 0; key < 100; key++) {
+		NSMutableData *land = [NSMutableData dataWithLength:1000];
+		memset([land mutableBytes], (int)key + 1, [land length]);
+		[dao addData:(key % 2 ? ocean : land) LastUsed:[NSDate dateWithTimeIntervalSince1970:key] ForTile:key];
+	}
+	[dao flush];
+	STAssertEquals([dao packedBytes], (unsigned long long)51000, @"the 50 ocean tiles should share their data");
+	STAssertEqualObjects([dao dataForTile:7], ocean, nil);
+	NSData *early = [dao dataForTile:8];
+	STAssertEquals(((const unsigned char*)[early bytes])[0], (unsigned char)9, nil);
+	
+	// tiles outlive the compaction of the segment they were read from
+	STAssertEquals([dao purgeTiles:80], (NSUInteger)80, nil);
+	STAssertTrue([dao compactPackFiles] > 0, nil);
+	STAssertTrue([dao packedBytes] < 51000, nil);
+	STAssertEquals(((const unsigned char*)[early bytes])[999], (unsigned char)9, nil);
+	STAssertEqualObjects([dao dataForTile:81], ocean, nil);
+	STAssertEquals(((const unsigned char*)[[dao dataForTile:90] bytes])[0], (unsigned char)91, nil);
+	STAssertNil([dao dataForTile:8], nil);
+	
+	[dao removeAllCachedImages];
+	STAssertEquals([dao packedBytes], (unsigned long long)0, nil);
+	[dao release];
+}
+
+- (void)testTilePackReadsTilesLargerThanASegment {
+	NSString *prefix = [NSTemporaryDirectory() stringByAppendingPathComponent:@"RMTilePackTest"];
+	RMTilePack *pack = RMTilePackOpen([prefix fileSystemRepresentation], 0, 0, 4096, 4);
+	char large[10000];
+	uint32_t segment;
+	uint64_t offset, size;
+	
+	memset(large, 7, sizeof(large));
+	// a map of the empty segment is only a segment long
+	uint32_t empty = RMTilePackRoll(pack);
+	RMTilePackUnpin(RMTilePackPin(pack, empty));
+	STAssertTrue(RMTilePackAppend(pack, large, sizeof(large), &segment, &offset, &size), nil);
+	STAssertEquals(segment, empty, @"a large tile fills an empty segment");
+	
+	RMTilePackSegment *map = RMTilePackPin(pack, segment);
+	const char *bytes = RMTilePackBytes(map, offset, sizeof(large));
+	STAssertTrue(bytes != NULL && memcmp(bytes, large, sizeof(large)) == 0, nil);
+	RMTilePackUnpin(map);
+	
+	STAssertTrue(RMTilePackAppend(pack, large, 10, &segment, &offset, &size), nil);
+	STAssertFalse(segment == empty, @"nothing goes after it");
+	RMTilePackRetire(pack, empty);
+	RMTilePackRetire(pack, segment);
+	RMTilePackClose(pack);
+}
+
+- (void)testMissingTileCacheRemembersDummyTiles {
+	NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"RMMissingTileCacheTest.missing"];
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+	RMTile sea = {17, 42, 9}, land = {18, 42, 9};
+	
+	RMMissingTileCache *cache = [[RMMissingTileCache alloc] initWithTimeToLive:3600 path:path];
+	STAssertNil([cache cachedImage:sea], nil);
+	[cache addTile:sea WithImage:[RMTileImage dummyTile:sea]];
+	STAssertNotNil([cache cachedImage:sea], @"a dummy tile from the source is a miss");
+	STAssertNil([cache cachedImage:land], nil);
+	STAssertTrue([cache save], nil);
+	[cache release];
+	
+	cache = [[RMMissingTileCache alloc] initWithTimeToLive:3600 path:path];
+	STAssertEquals([cache count], (NSUInteger)1, @"misses should be read back from the file");
+	STAssertTrue([cache isMissingTile:sea], nil);
+	[cache removeAllCachedImages];
+	STAssertFalse([cache isMissingTile:sea], nil);
+	[cache release];
+	
+	// a file written with another time to live is ignored
+	cache = [[RMMissingTileCache alloc] initWithTimeToLive:3600 path:path];
+	[cache addMissingTile:land];
+	[cache release];
+	cache = [[RMMissingTileCache alloc] initWithTimeToLive:60 path:path];
+	STAssertEquals([cache count], (NSUInteger)0, nil);
+	[cache release];
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testDecodedTileCacheKeepsBitmapsOfPNGTiles {
+	UIGraphicsBeginImageContext(CGSizeMake(32, 32));
+	[[UIColor redColor] setFill];
+	UIRectFill(CGRectMake(0, 0, 32, 32));
+	UIImage *red = UIGraphicsGetImageFromCurrentImageContext();
+	UIGraphicsEndImageContext();
+	RMTile tile = {3, 5, 4}, other = {4, 5, 4};
+	
+	RMDecodedTileCache *cache = [[RMDecodedTileCache alloc] initWithByteBudget:1024 * 1024 pixelFormat:RMTilePixelFormatRGBA8888];
+	STAssertNil([cache cachedImage:tile], nil);
+	STAssertTrue([[cache imageForTile:tile withData:UIImagePNGRepresentation(red)] isLoaded], nil);
+	STAssertEquals([cache count], (NSUInteger)1, nil);
+	STAssertEquals([cache cost], (NSUInteger)(32 * 32 * 4), nil);
+	STAssertTrue([[cache cachedImage:tile] isLoaded], @"the bitmap should be reused without the data");
+	
+	// JPEG is left to UIImage and not cached
+	STAssertTrue([[cache imageForTile:other withData:UIImageJPEGRepresentation(red, 0.8)] isLoaded], nil);
+	STAssertNil([cache cachedImage:other], nil);
+	
+	[cache removeAllCachedImages];
+	STAssertNil([cache cachedImage:tile], nil);
+	[cache release];
+}
+
+- (void)testTileImageTellsObserversOnce {
+	UIGraphicsBeginImageContext(CGSizeMake(8, 8));
+	UIImage *blank = UIGraphicsGetImageFromCurrentImageContext();
+	UIGraphicsEndImageContext();
+	RMTile cancelled = {1, 1, 2}, loaded = {2, 1, 2};
+	RMMemoryCache *cache = [[RMMemoryCache alloc] initWithCapacity:4];
+	[RMTileImage resetDispatchStatistics];
+	
+	RMTileImage *image = [RMTileImage dummyTile:cancelled];
+	[cache addTile:cancelled WithImage:image];
+	[image cancelLoading];
+	STAssertNil([cache cachedImage:cancelled], @"an image that will not load should be dropped");
+	
+	image = [RMTileImage dummyTile:loaded];
+	[cache addTile:loaded WithImage:image];
+	[image updateImageUsingData:UIImagePNGRepresentation(blank)];
+	[image cancelLoading];
+	STAssertEquals([cache cachedImage:loaded], image, @"a loaded image has no observers left to tell");
+	
+	RMTileImageDispatchStatistics statistics = [RMTileImage dispatchStatistics];
+	STAssertEquals(statistics.dispatches, 2ULL, nil);
+	STAssertEquals(statistics.callbacks, 1ULL, @"the memory cache only cares about cancelling");
+	[cache release];
+}
+
+- (void)testMemoryCacheAdmissionKeepsHotTiles {
+	RMMemoryCache *cache = [[RMMemoryCache alloc] initWithCapacity:8 byteBudget:0 admissionSampleSize:160];
+	RMTile tile = {0, 0, 12};
+	
+	for (tile.x = 0; tile.x < 6; tile.x++)
+	{
+		for (int i = 0; i < 4; i++)
+			[cache cachedImage:tile];
+		[cache addTile:tile WithImage:[RMTileImage dummyTile:tile]];
+	}
+	
+	// a pan over tiles that are seen once
+	tile.y = 1;
+	for (tile.x = 0; tile.x < 20; tile.x++)
+	{
+		STAssertNil([cache cachedImage:tile], nil);
+		[cache addTile:tile WithImage:[RMTileImage dummyTile:tile]];
+	}
+	STAssertEquals([cache count], (NSUInteger)8, nil);
+	STAssertTrue([cache admissionRejections] > 0, nil);
+	
+	tile.y = 0;
+	for (tile.x = 0; tile.x < 6; tile.x++)
+		STAssertNotNil([cache cachedImage:tile], @"one-off tiles should not push out hot ones");
+	[cache release];
+}
+
+static void RMFoundationTestsCountTile(void *context, RMTile tile, void *value)
+{
+	(*(int *)context)++;
+}
+
+- (void)testTileImageSetIndexesTiles {
+	RMTileImageSet *set = [[RMTileImageSet alloc] initWithDelegate:nil];
+	RMTile tile = {0, 0, 14}, coarse = {0, 0, 12}, missing = {9, 9, 14};
+	
+	set.zoom = 14;
+	for (tile.x = 0; tile.x < 4; tile.x++)
+		for (tile.y = 0; tile.y < 4; tile.y++)
+			[set addTile:tile WithImage:[RMTileImage dummyTile:tile] At:CGRectZero];
+	[set addTile:coarse WithImage:[RMTileImage dummyTile:coarse] At:CGRectZero];
+	STAssertEquals([set count], (NSUInteger)17, nil);
+	tile.x = tile.y = 3;
+	STAssertTrue(RMTilesEqual([set imageWithTile:tile].tile, tile), nil);
+	STAssertNil([set imageWithTile:missing], nil);
+	[set removeTile:tile];
+	STAssertNil([set imageWithTile:tile], nil);
+	STAssertEquals([set count], (NSUInteger)16, nil);
+	[set release];
+	
+	RMTileIndex *index = RMTileIndexCreate();
+	int visited = 0;
+	for (tile.x = 0; tile.x < 16; tile.x++)
+		for (tile.y = 0; tile.y < 16; tile.y++)
+			RMTileIndexInsert(index, tile, index);
+	RMTileIndexInsert(index, coarse, index);
+	RMTileIndexForEachOverlapping(index, coarse, RMFoundationTestsCountTile, &visited);
+	STAssertEquals(visited, 17, @"the coarse tile and the 4x4 tiles under it");
+	visited = 0;
+	RMTileIndexForEachOutside(index, 14, 2, 13, 0, 15, RMFoundationTestsCountTile, &visited);
+	STAssertEquals(visited, 64, @"the two columns on either side, the coarse tile is inside");
+	visited = 0;
+	RMTileIndexForEachOutside(index, 14, 14, 1, 0, 15, RMFoundationTestsCountTile, &visited);
+	STAssertEquals(visited, 192, @"the rect wraps around");
+	RMTileIndexFree(index);
+}
+
+- (void)testTileImageSetDropsTilesCoveredByBetterOnes {
+	UIGraphicsBeginImageContext(CGSizeMake(8, 8));
+	NSData *png = UIImagePNGRepresentation(UIGraphicsGetImageFromCurrentImageContext());
+	UIGraphicsEndImageContext();
+	RMTileImageSet *set = [[RMTileImageSet alloc] initWithDelegate:nil];
+	RMTile coarse = {0, 0, 12}, fine = {1, 2, 14};
+	
+	set.zoom = 14;
+	RMTileImage *image = [RMTileImage dummyTile:coarse];
+	[image updateImageUsingData:png];
+	[set addTile:coarse WithImage:image At:CGRectZero];
+	[set addTile:fine WithImage:[RMTileImage dummyTile:fine] At:CGRectZero];
+	STAssertEquals([set count], (NSUInteger)2, @"the fine tile has not loaded yet");
+	
+	[[set imageWithTile:fine] updateImageUsingData:png];
+	STAssertNil([set imageWithTile:coarse], @"the loaded fine tile is better");
+	STAssertTrue([set isTileCoveredByBetterTile:coarse countingItself:NO], nil);
+	[set addTile:coarse WithImage:[RMTileImage dummyTile:coarse] At:CGRectZero];
+	STAssertNil([set imageWithTile:coarse], nil);
+	
+	set.zoom = 12;
+	STAssertNotNil([set imageWithTile:fine], @"no loaded tile is better at zoom 12 yet");
+	image = [RMTileImage dummyTile:coarse];
+	[image updateImageUsingData:png];
+	[set addTile:coarse WithImage:image At:CGRectZero];
+	STAssertNil([set imageWithTile:fine], nil);
+	STAssertEquals([set count], (NSUInteger)1, nil);
+	[set release];
+}
+
+- (void)testScheduledTileImageLoadsInTheBackground {
+	UIGraphicsBeginImageContext(CGSizeMake(8, 8));
+	NSData *png = UIImagePNGRepresentation(UIGraphicsGetImageFromCurrentImageContext());
+	UIGraphicsEndImageContext();
+	RMTestTileDataReader *reader = [[RMTestTileDataReader alloc] initWithData:png];
+	RMTile tile = {3, 5, 4}, other = {4, 5, 4};
+	
+	RMScheduledTileImage *image = [[RMScheduledTileImage alloc] initWithTile:tile reader:reader];
+	RMScheduledTileImage *cancelled = [[RMScheduledTileImage alloc] initWithTile:other reader:reader];
+	[cancelled cancelLoading];
+	STAssertFalse([image isLoaded], @"reads on a worker and updates on the main thread");
+	
+	RMTileSchedulerWait([RMScheduledTileImage scheduler]);
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+	STAssertTrue([image isLoaded], nil);
+	STAssertFalse([cancelled isLoaded], @"cancelled while queued or ignored once read");
+	[image release];
+	[cancelled release];
+	[reader release];
+}
+
+- (void)testScheduledTileImagesOfTwoReadersShareATile {
+	UIGraphicsBeginImageContext(CGSizeMake(8, 8));
+	NSData *png = UIImagePNGRepresentation(UIGraphicsGetImageFromCurrentImageContext());
+	UIGraphicsEndImageContext();
+	RMTestTileDataReader *base = [[RMTestTileDataReader alloc] initWithData:png];
+	RMTestTileDataReader *overlay = [[RMTestTileDataReader alloc] initWithData:png];
+	RMTile tile = {6, 2, 4};
+	RMTileRect rect = {{{6, 2, 4}, {0, 0}}, {1, 1}};
+	
+	[RMScheduledTileImage focusOnTileRect:rect forReader:base];
+	RMScheduledTileImage *first = [[RMScheduledTileImage alloc] initWithTile:tile reader:base];
+	RMScheduledTileImage *second = [[RMScheduledTileImage alloc] initWithTile:tile reader:overlay];
+	STAssertFalse([second isLoaded], @"another reader's tile is read in the background too");
+	
+	RMTileSchedulerWait([RMScheduledTileImage scheduler]);
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+	STAssertTrue([first isLoaded], nil);
+	STAssertTrue([second isLoaded], nil);
+	[first release];
+	[second release];
+	[overlay release];
+	[base release];
+}
+
+- (void)testMissingTileCacheRemembersTilesAReaderDoesNotHave {
+	RMTestTileDataReader *reader = [[RMTestTileDataReader alloc] initWithData:nil];
+	RMMissingTileCache *cache = [[RMMissingTileCache alloc] initWithTimeToLive:3600 path:nil];
+	RMTile tile = {7, 9, 5};
+	
+	RMScheduledTileImage *image = [[RMScheduledTileImage alloc] initWithTile:tile reader:reader];
+	[cache addTile:tile WithImage:image];
+	RMTileSchedulerWait([RMScheduledTileImage scheduler]);
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+	STAssertTrue([image isMissing], nil);
+	STAssertNotNil([cache cachedImage:tile], @"a tile the database does not have is a miss");
+	[image release];
+	[cache release];
+	[reader release];
+}
+
+- (void)testTilePrefetchFollowsMotion {
+	RMTileRect screen = {{{100, 200, 10}, {0.5, 0.5}}, {4, 6}};
+	RMTileMotion motion = {10.0, 0.0, 0.0, 0.0};
+	RMTile tiles[64];
+	size_t i, count;
+	
+	count = RMTilePrefetchPredict(screen, motion, 0.3, 1.0, 0, 18, tiles, 64);
+	STAssertEquals(count, (size_t)64, @"the budget caps the tiles");
+	STAssertEquals(tiles[0].x, (uint32_t)105, @"3 tiles on after 0.3 s, nearest the centre first");
+	STAssertEquals(tiles[0].y, (uint32_t)203, nil);
+	
+	// a flick at 10 tiles a second dying down by 12.8 a second comes to rest within a tile
+	motion.decay = 12.8;
+	count = RMTilePrefetchPredict(screen, motion, 0.3, 1.0, 0, 18, tiles, 64);
+	for (i = 0; i < count; i++)
+		STAssertTrue(tiles[i].x <= 105, nil);
+	
+	motion.vx = 0.0;
+	motion.decay = 0.0;
+	motion.zoomRate = 2.0;
+	count = RMTilePrefetchPredict(screen, motion, 0.3, 1.0, 0, 11, tiles, 64);
+	for (i = 0; i < count; i++)
+		STAssertEquals(tiles[i].zoom, (short)11, @"zooming in, up to the source's maximum");
+}
+
+- (void)testTileFetcherBacksOffWithJitter {
+	STAssertTrue(fabs(RMTileFetcherBackoff(0, 0.5, 30.0, 0.0) - 0.25) < 1e-9, @"half the backoff at least");
+	STAssertTrue(fabs(RMTileFetcherBackoff(0, 0.5, 30.0, 1.0) - 0.5) < 1e-9, @"and all of it at most");
+	STAssertTrue(fabs(RMTileFetcherBackoff(3, 0.5, 30.0, 1.0) - 4.0) < 1e-9, @"doubling with every attempt");
+	STAssertTrue(fabs(RMTileFetcherBackoff(20, 0.5, 30.0, 0.5) - 22.5) < 1e-9, @"up to the cap");
+	
+	RMTileFetcher *fetcher = RMTileFetcherCreate(NULL);
+	STAssertTrue(fetcher != NULL, nil);
+	STAssertFalse(RMTileFetcherGet(fetcher, "https://tile.example.com/1/0/0.png", RMTileRequestVisible, NULL, NULL), @"https loads with NSURLConnection");
+	STAssertFalse(RMTileFetcherCancel(fetcher, "http://tile.example.com/1/0/0.png", NULL), nil);
+	RMTileFetcherFree(fetcher);
+}
+
 @end
@@ -7,6 +7,206 @@
 //
 
 #import "RMProjectionTests.h"
+#import "proj_api.h"
+#import "geodesic.h"
+#import <pthread.h>
+
+// private to Proj4, see pj_gridmap.c
+int pj_gridinfo_write_native(const char *gridname, const char *filename);
+
+#define kStressPointCount 5000
+#define kStressThreadCount 8
+#define kStressRounds 10
+
+typedef struct {
+    projPJ source, destination;
+    const double *expectedX, *expectedY;
+    int failures;
+} RMProjectionStressJob;
+
+static void RMFillStressPoints(double *x, double *y)
+{
+    // a grid of points over Great Britain, in radians
+    for (int i = 0; i < kStressPointCount; i++) {
+        x[i] = (-8.0 + (i % 100) * 0.1) * DEG_TO_RAD;
+        y[i] = (50.0 + (i / 100) * 0.1) * DEG_TO_RAD;
+    }
+}
+
+static void *RMProjectionStressWorker(void *arg)
+{
+    RMProjectionStressJob *job = (RMProjectionStressJob *)arg;
+    projCtx ctx = pj_ctx_alloc();
+    double *x = malloc(sizeof(double) * kStressPointCount);
+    double *y = malloc(sizeof(double) * kStressPointCount);
+
+    for (int round = 0; round < kStressRounds; round++) {
+        RMFillStressPoints(x, y);
+        if (pj_transform_ctx(ctx, job->source, job->destination, kStressPointCount, 1, x, y, NULL) != 0
+            || memcmp(x, job->expectedX, sizeof(double) * kStressPointCount) != 0
+            || memcmp(y, job->expectedY, sizeof(double) * kStressPointCount) != 0)
+            job->failures++;
+        // so that any grids are loaded again while the other threads use theirs
+        pj_ctx_deallocate_grids(ctx);
+    }
+
+    free(x);
+    free(y);
+    pj_ctx_free(ctx);
+    return NULL;
+}
+
+
+// a grid of an NTv2 file, in degrees north and west, with the same latitude
+// shift in seconds all over
+typedef struct {
+    const char *name, *parent;
+    double south, north, east, west, shift;
+} RMTestGrid;
+
+static void RMAppendGridRecord(NSMutableData *data, const char *label, const void *value, size_t length)
+{
+    char record[16];
+    memset(record, ' ', 8);
+    memset(record + 8, 0, 8);
+    memcpy(record, label, strlen(label));
+    memcpy(record + 8, value, length);
+    [data appendBytes:record length:16];
+}
+
+static void RMAppendGridString(NSMutableData *data, const char *label, const char *value)
+{
+    char padded[8];
+    memset(padded, ' ', 8);
+    memcpy(padded, value, strlen(value));
+    RMAppendGridRecord(data, label, padded, 8);
+}
+
+static void RMAppendGridDouble(NSMutableData *data, const char *label, double value)
+{
+    RMAppendGridRecord(data, label, &value, sizeof(value));
+}
+
+static void RMAppendGridInt(NSMutableData *data, const char *label, int value)
+{
+    RMAppendGridRecord(data, label, &value, sizeof(value));
+}
+
+static NSString *RMWriteTestGrids(NSString *name, const RMTestGrid *grids, int count)
+{
+    NSMutableData *data = [NSMutableData data];
+    RMAppendGridInt(data, "NUM_OREC", 11);
+    RMAppendGridInt(data, "NUM_SREC", 11);
+    RMAppendGridInt(data, "NUM_FILE", count);
+    RMAppendGridString(data, "GS_TYPE", "SECONDS");
+    RMAppendGridString(data, "VERSION", "1");
+    RMAppendGridString(data, "SYSTEM_F", "A");
+    RMAppendGridString(data, "SYSTEM_T", "B");
+    RMAppendGridDouble(data, "MAJOR_F", 6378137.0);
+    RMAppendGridDouble(data, "MINOR_F", 6356752.3);
+    RMAppendGridDouble(data, "MAJOR_T", 6378137.0);
+    RMAppendGridDouble(data, "MINOR_T", 6356752.3);
+
+    for (int k = 0; k < count; k++) {
+        // nodes every half degree
+        int rows = (int)((grids[k].north - grids[k].south) * 2 + 1.5);
+        int columns = (int)((grids[k].west - grids[k].east) * 2 + 1.5);
+        float node[4] = {grids[k].shift, 0, 0, 0};
+
+        RMAppendGridString(data, "SUB_NAME", grids[k].name);
+        RMAppendGridString(data, "PARENT", grids[k].parent);
+        RMAppendGridString(data, "CREATED", "");
+        RMAppendGridString(data, "UPDATED", "");
+        RMAppendGridDouble(data, "S_LAT", grids[k].south * 3600);
+        RMAppendGridDouble(data, "N_LAT", grids[k].north * 3600);
+        RMAppendGridDouble(data, "E_LONG", grids[k].east * 3600);
+        RMAppendGridDouble(data, "W_LONG", grids[k].west * 3600);
+        RMAppendGridDouble(data, "LAT_INC", 1800);
+        RMAppendGridDouble(data, "LONG_INC", 1800);
+        RMAppendGridInt(data, "GS_COUNT", rows * columns);
+        for (int i = 0; i < rows * columns; i++)
+            [data appendBytes:node length:sizeof(node)];
+    }
+    RMAppendGridString(data, "END", "");
+
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:name];
+    [data writeToFile:path atomically:YES];
+    return path;
+}
+
+// a ctable grid over 40 to 50 degrees north and 0 to 10 degrees west, with
+// the same latitude shift in seconds all over; the header is laid out as
+// struct CTABLE of projects.h
+static NSString *RMWriteTestCtable(NSString *name, float shift)
+{
+    struct {
+        char id[80];
+        double lowerLeft[2], cellSize[2];
+        int limits[2];
+        void *unused;
+    } header;
+    float node[2] = {0, shift / 3600.0 * DEG_TO_RAD};
+    NSMutableData *data = [NSMutableData data];
+
+    memset(&header, 0, sizeof(header));
+    strcpy(header.id, "RMTestCtable");
+    header.lowerLeft[0] = -10 * DEG_TO_RAD;
+    header.lowerLeft[1] = 40 * DEG_TO_RAD;
+    header.cellSize[0] = header.cellSize[1] = 0.5 * DEG_TO_RAD;
+    header.limits[0] = header.limits[1] = 21;
+    [data appendBytes:&header length:sizeof(header)];
+    for (int i = 0; i < 21 * 21; i++)
+        [data appendBytes:node length:sizeof(node)];
+
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:name];
+    [data writeToFile:path atomically:YES];
+    return path;
+}
+
+static void RMSetModificationTime(NSString *path, NSTimeInterval seconds)
+{
+    NSDictionary *attributes = [NSDictionary dictionaryWithObject:[NSDate dateWithTimeIntervalSince1970:seconds]
+                                                           forKey:NSFileModificationDate];
+    [[NSFileManager defaultManager] setAttributes:attributes ofItemAtPath:path error:NULL];
+}
+
+// the latitude shift in seconds at 45.13 north, 5.13 west, with the grid
+// loaded afresh, or -1 if the shift fails
+static double RMGridShift(NSString *path)
+{
+    NSString *definition = [NSString stringWithFormat:@"+proj=latlong +ellps=WGS84 +nadgrids=%@", path];
+    projPJ source = pj_init_plus([definition UTF8String]);
+    projPJ wgs84 = pj_init_plus("+proj=latlong +datum=WGS84");
+    double x = -5.13 * DEG_TO_RAD, y = 45.13 * DEG_TO_RAD;
+    int error;
+
+    pj_deallocate_grids();
+    error = pj_transform(source, wgs84, 1, 1, &x, &y, NULL);
+    pj_free(source);
+    pj_free(wgs84);
+    return error != 0 ? -1 : (y * RAD_TO_DEG - 45.13) * 3600;
+}
+
+static BOOL RMTestGridHolds(const RMTestGrid *grid, double latitude, double west)
+{
+    return latitude >= grid->south && latitude <= grid->north && west >= grid->east && west <= grid->west;
+}
+
+// the shift of the first top level grid holding the point, or of its first
+// child holding it, 0 if none does
+static double RMExpectedGridShift(const RMTestGrid *grids, int count, double latitude, double west)
+{
+    for (int k = 0; k < count; k++) {
+        if (strcmp(grids[k].parent, "NONE") != 0 || !RMTestGridHolds(&grids[k], latitude, west))
+            continue;
+        for (int child = 0; child < count; child++) {
+            if (strcmp(grids[child].parent, grids[k].name) == 0 && RMTestGridHolds(&grids[child], latitude, west))
+                return grids[child].shift;
+        }
+        return grids[k].shift;
+    }
+    return 0;
+}
 
 
 @implementation RMProjectionTests
@@ -55,4 +255,445 @@
                                .1, @"Setting projected region should be exact.");
 }
 
+-(void) testTransformContextsAreThreadSafe
+{
+    // The shared projections are used concurrently, each thread reporting
+    // through its own context and loading its own grids. Results must match
+    // a single threaded run bit for bit.
+    RMTestGrid grid[] = {{"G", "NONE", 49, 61, -3, 9, 1}};
+    NSString *path = RMWriteTestGrids(@"RMStressGrid.gsb", grid, 1);
+    NSString *gridded = [NSString stringWithFormat:@"+proj=latlong +ellps=WGS84 +nadgrids=%@", path];
+    projPJ wgs84 = pj_init_plus("+proj=latlong +datum=WGS84");
+    projPJ sources[] = {wgs84, pj_init_plus([gridded UTF8String])};
+    projPJ destinations[] = {[[RMProjection OSGB] internalProjection], wgs84};
+    double *expectedX = malloc(sizeof(double) * kStressPointCount);
+    double *expectedY = malloc(sizeof(double) * kStressPointCount);
+
+    for (int pair = 0; pair < 2; pair++) {
+        RMFillStressPoints(expectedX, expectedY);
+        STAssertEquals(pj_transform(sources[pair], destinations[pair], kStressPointCount, 1,
+                                    expectedX, expectedY, NULL), 0,
+                       @"single threaded transform %d failed", pair);
+        pj_deallocate_grids();
+
+        RMProjectionStressJob jobs[kStressThreadCount];
+        pthread_t threads[kStressThreadCount];
+
+        for (int i = 0; i < kStressThreadCount; i++) {
+            jobs[i].source = sources[pair];
+            jobs[i].destination = destinations[pair];
+            jobs[i].expectedX = expectedX;
+            jobs[i].expectedY = expectedY;
+            jobs[i].failures = 0;
+            pthread_create(&threads[i], NULL, RMProjectionStressWorker, &jobs[i]);
+        }
+
+        for (int i = 0; i < kStressThreadCount; i++) {
+            pthread_join(threads[i], NULL);
+            STAssertEquals(jobs[i].failures, 0, @"thread %d produced different results for transform %d", i, pair);
+        }
+    }
+    STAssertEqualsWithAccuracy(expectedY[0] * RAD_TO_DEG - 50.0, 1.0 / 3600, 1e-9, @"grid shift not applied");
+
+    // errors stay in the context they were raised in
+    projCtx ctx = pj_ctx_alloc();
+    STAssertNULL(pj_init_plus_ctx(ctx, "+proj=merc +lat_ts=95"), @"invalid definition accepted");
+    STAssertTrue(pj_ctx_get_errno(ctx) != 0, @"error not reported in the context");
+    STAssertEquals(pj_ctx_get_errno(pj_get_default_ctx()), 0, @"error leaked into the default context");
+    pj_ctx_free(ctx);
+
+    pj_free(sources[1]);
+    pj_free(wgs84);
+    free(expectedX);
+    free(expectedY);
+}
+
+-(void) testArrayProjectionMatchesScalar
+{
+    // pj_fwd_array()/pj_inv_array() must give the same bits as pj_fwd()/pj_inv()
+    NSArray *projections = [NSArray arrayWithObjects:[RMProjection googleProjection], [RMProjection OSGB], nil];
+    double lam[kStressPointCount], phi[kStressPointCount];
+    double x[kStressPointCount], y[kStressPointCount];
+
+    RMFillStressPoints(lam, phi);
+    lam[7] = HUGE_VAL; // already failed points are passed over
+    phi[11] = 2.0;     // an over range latitude fails just that point
+
+    for (RMProjection *projection in projections) {
+        projPJ pj = [projection internalProjection];
+
+        memcpy(x, lam, sizeof(x));
+        memcpy(y, phi, sizeof(y));
+        pj_fwd_array(pj, kStressPointCount, x, y);
+
+        for (int i = 0; i < kStressPointCount; i++) {
+            projUV expected = {HUGE_VAL, HUGE_VAL};
+            if (lam[i] != HUGE_VAL) {
+                projUV uv = {lam[i], phi[i]};
+                expected = pj_fwd(uv, pj);
+            }
+            STAssertTrue(memcmp(&expected.u, &x[i], sizeof(double)) == 0
+                         && memcmp(&expected.v, &y[i], sizeof(double)) == 0,
+                         @"forward point %d differs", i);
+        }
+        STAssertEquals(x[11], (double)HUGE_VAL, @"over range point not failed");
+
+        double forwardX[kStressPointCount], forwardY[kStressPointCount];
+        memcpy(forwardX, x, sizeof(x));
+        memcpy(forwardY, y, sizeof(y));
+        pj_inv_array(pj, kStressPointCount, x, y);
+
+        for (int i = 0; i < kStressPointCount; i++) {
+            if (forwardX[i] == HUGE_VAL) {
+                STAssertEquals(x[i], (double)HUGE_VAL, @"failed point %d was projected", i);
+                continue;
+            }
+            projUV uv = {forwardX[i], forwardY[i]};
+            projUV expected = pj_inv(uv, pj);
+            STAssertTrue(memcmp(&expected.u, &x[i], sizeof(double)) == 0
+                         && memcmp(&expected.v, &y[i], sizeof(double)) == 0,
+                         @"inverse point %d differs", i);
+        }
+    }
+}
+
+-(void) testParallelTransformMatchesSerial
+{
+    // large enough to be split into chunks across the pool
+    const long count = 8 * kStressPointCount;
+    projPJ latLong = [[RMProjection EPSGLatLong] internalProjection];
+    projPJ osgb = [[RMProjection OSGB] internalProjection];
+    double *expectedX = malloc(sizeof(double) * count), *expectedY = malloc(sizeof(double) * count);
+    double *x = malloc(sizeof(double) * count), *y = malloc(sizeof(double) * count);
+
+    for (long i = 0; i < count; i += kStressPointCount)
+        RMFillStressPoints(expectedX + i, expectedY + i);
+    expectedY[3 * kStressPointCount + 11] = 2.0; // an over range latitude fails just that point
+
+    memcpy(x, expectedX, sizeof(double) * count);
+    memcpy(y, expectedY, sizeof(double) * count);
+    STAssertEquals(pj_transform(latLong, osgb, count, 1, expectedX, expectedY, NULL), 0,
+                   @"serial transform failed");
+
+    int threadCounts[] = {1, 2, 8, 0};
+    for (int t = 0; t < 4; t++) {
+        double *px = malloc(sizeof(double) * count), *py = malloc(sizeof(double) * count);
+        memcpy(px, x, sizeof(double) * count);
+        memcpy(py, y, sizeof(double) * count);
+
+        pj_set_thread_count(threadCounts[t]);
+        STAssertEquals(pj_transform_parallel(latLong, osgb, count, 1, px, py, NULL), 0,
+                       @"parallel transform failed with %d threads", threadCounts[t]);
+        STAssertTrue(memcmp(px, expectedX, sizeof(double) * count) == 0
+                     && memcmp(py, expectedY, sizeof(double) * count) == 0,
+                     @"parallel transform differs with %d threads", threadCounts[t]);
+        free(px);
+        free(py);
+    }
+    STAssertEquals(expectedX[3 * kStressPointCount + 11], (double)HUGE_VAL, @"over range point not failed");
+
+    free(expectedX);
+    free(expectedY);
+    free(x);
+    free(y);
+}
+
+-(void) testParallelTransformUsesContextSearchPath
+{
+    // a grid only found through the search path of the context
+    static const RMTestGrid grid[] = {{"G", "NONE", 49, 61, -3, 9, 1}};
+    NSString *path = RMWriteTestGrids(@"RMContextGrid.gsb", grid, 1);
+    const char *searchPath[] = {[NSTemporaryDirectory() fileSystemRepresentation]};
+    projCtx ctx = pj_ctx_alloc();
+    pj_ctx_set_searchpath(ctx, 1, searchPath);
+    projPJ source = pj_init_plus_ctx(ctx, "+proj=latlong +ellps=WGS84 +nadgrids=RMContextGrid.gsb");
+    projPJ wgs84 = pj_init_plus_ctx(ctx, "+proj=latlong +datum=WGS84");
+
+    // large enough to be split into chunks across the pool
+    const long count = 2 * kStressPointCount;
+    double *expectedX = malloc(sizeof(double) * count), *expectedY = malloc(sizeof(double) * count);
+    double *x = malloc(sizeof(double) * count), *y = malloc(sizeof(double) * count);
+
+    for (long i = 0; i < count; i += kStressPointCount)
+        RMFillStressPoints(expectedX + i, expectedY + i);
+    STAssertEquals(pj_transform_ctx(ctx, source, wgs84, count, 1, expectedX, expectedY, NULL), 0,
+                   @"serial grid shift failed");
+    STAssertEqualsWithAccuracy((expectedY[0] - 50.0 * DEG_TO_RAD) * RAD_TO_DEG * 3600, 1.0, 1e-6,
+                               @"grid not applied");
+
+    // again once the workers have dropped their grids
+    pj_set_thread_count(4);
+    for (int round = 0; round < 2; round++) {
+        for (long i = 0; i < count; i += kStressPointCount)
+            RMFillStressPoints(x + i, y + i);
+        STAssertEquals(pj_transform_parallel(source, wgs84, count, 1, x, y, NULL), 0,
+                       @"parallel grid shift failed");
+        STAssertTrue(memcmp(x, expectedX, sizeof(double) * count) == 0
+                     && memcmp(y, expectedY, sizeof(double) * count) == 0,
+                     @"parallel grid shift differs in round %d", round);
+        pj_deallocate_thread_grids();
+    }
+    pj_set_thread_count(0);
+
+    free(expectedX);
+    free(expectedY);
+    free(x);
+    free(y);
+    pj_free(source);
+    pj_free(wgs84);
+    pj_ctx_free(ctx);
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+}
+
+-(void) testPlanMatchesTransform
+{
+    projPJ latLong = [[RMProjection EPSGLatLong] internalProjection];
+    NSArray *projections = [NSArray arrayWithObjects:[RMProjection googleProjection], [RMProjection OSGB], nil];
+    double expectedX[kStressPointCount], expectedY[kStressPointCount];
+    double x[kStressPointCount], y[kStressPointCount];
+
+    for (RMProjection *projection in projections) {
+        projPJ pj = [projection internalProjection];
+        projPlan plan = pj_plan_create(latLong, pj);
+        STAssertTrue(plan != NULL, @"no plan for %@", projection);
+
+        RMFillStressPoints(expectedX, expectedY);
+        expectedY[11] = 2.0; // an over range latitude fails just that point
+        memcpy(x, expectedX, sizeof(x));
+        memcpy(y, expectedY, sizeof(y));
+
+        STAssertEquals(pj_transform(latLong, pj, kStressPointCount, 1, expectedX, expectedY, NULL), 0,
+                       @"transform failed");
+        STAssertEquals(pj_plan_execute(plan, kStressPointCount, 1, x, y, NULL), 0, @"plan failed");
+        STAssertTrue(memcmp(x, expectedX, sizeof(x)) == 0 && memcmp(y, expectedY, sizeof(y)) == 0,
+                     @"plan results differ for %@", projection);
+        pj_plan_free(plan);
+    }
+}
+
+-(void) testDatumShiftMatchesStepwise
+{
+    // WGS84 to OSGB36, as the OSGB projection does it, against the same
+    // shift done one stage at a time through the public geocentric calls
+    const double wgs84A = 6378137.0, wgs84Es = 0.0066943799901413165;
+    const double airyA = 6377563.396, airyB = 6356256.910;
+    const double secToRad = 4.84813681109535993589914102357e-6;
+    const double dx = 446.448, dy = -125.157, dz = 542.060;
+    const double rx = 0.1502 * secToRad, ry = 0.2470 * secToRad, rz = 0.8421 * secToRad;
+    const double m = -20.4894 / 1000000.0 + 1;
+
+    // EPSGLatLong has no datum, so would not be shifted at all
+    projPJ latLong = pj_init_plus("+proj=latlong +datum=WGS84");
+    projPJ osgb = [[RMProjection OSGB] internalProjection];
+    double x[kStressPointCount], y[kStressPointCount], z[kStressPointCount];
+    double sx[kStressPointCount], sy[kStressPointCount], sz[kStressPointCount];
+
+    RMFillStressPoints(sx, sy);
+    memset(sz, 0, sizeof(sz));
+    pj_geodetic_to_geocentric(wgs84A, wgs84Es, kStressPointCount, 1, sx, sy, sz);
+    for (int i = 0; i < kStressPointCount; i++) {
+        double tx = (sx[i] - dx) / m, ty = (sy[i] - dy) / m, tz = (sz[i] - dz) / m;
+        sx[i] =     tx + rz*ty - ry*tz;
+        sy[i] = -rz*tx +    ty + rx*tz;
+        sz[i] =  ry*tx - rx*ty +    tz;
+    }
+    pj_geocentric_to_geodetic(airyA, 1 - (airyB * airyB) / (airyA * airyA),
+                              kStressPointCount, 1, sx, sy, sz);
+
+    RMFillStressPoints(x, y);
+    memset(z, 0, sizeof(z));
+    STAssertEquals(pj_datum_transform(latLong, osgb, kStressPointCount, 1, x, y, z), 0,
+                   @"datum shift failed");
+
+    for (int i = 0; i < kStressPointCount; i++) {
+        STAssertEqualsWithAccuracy(x[i], sx[i], 1e-12, @"longitude %d differs", i);
+        STAssertEqualsWithAccuracy(y[i], sy[i], 1e-12, @"latitude %d differs", i);
+        STAssertEqualsWithAccuracy(z[i], sz[i], 1e-6, @"height %d differs", i);
+    }
+
+    pj_free(latLong);
+}
+
+-(void) testGridShiftUsesFirstGridHoldingPoint
+{
+    // two overlapping top level grids, the first with two overlapping
+    // children, and a grid of another file overlapping both
+    static const RMTestGrid overlapping[] = {
+        {"P1", "NONE", 40, 50, 0, 10, 1},
+        {"P2", "NONE", 45, 55, 5, 15, 2},
+        {"C1", "P1", 44, 46, 4, 6, 3},
+        {"C2", "P1", 45, 47, 3, 5, 4},
+        {"C3", "P2", 48, 52, 8, 12, 5},
+    };
+    static const RMTestGrid other[] = {
+        {"Q", "NONE", 42, 48, 2, 8, 6},
+    };
+    NSString *overlappingPath = RMWriteTestGrids(@"RMOverlappingGrids.gsb", overlapping, 5);
+    NSString *otherPath = RMWriteTestGrids(@"RMOtherGrids.gsb", other, 1);
+    NSString *definitions[2] = {
+        [NSString stringWithFormat:@"+proj=latlong +ellps=WGS84 +nadgrids=%@", overlappingPath],
+        [NSString stringWithFormat:@"+proj=latlong +ellps=WGS84 +nadgrids=%@,%@", otherPath, overlappingPath],
+    };
+    projPJ sources[2] = {pj_init_plus([definitions[0] UTF8String]), pj_init_plus([definitions[1] UTF8String])};
+    projPJ wgs84 = pj_init_plus("+proj=latlong +datum=WGS84");
+    double x[2000], y[2000], latitude[2000], west[2000];
+
+    STAssertTrue(sources[0] != NULL && sources[1] != NULL, @"cannot set up the grid shifts");
+
+    // alternate between the two nadgrids strings, in batches of points
+    // along rows, off the grid nodes and edges
+    for (int round = 0; round < 4; round++) {
+        int which = round % 2, count = 0;
+
+        for (int i = 0; i < 2000; i++) {
+            latitude[count] = 39.07 + (i / 40) * 0.337;
+            west[count] = 0.13 + (i % 40) * 0.37;
+            if (RMExpectedGridShift(overlapping, 5, latitude[count], west[count]) == 0)
+                continue;
+            x[count] = -west[count] * DEG_TO_RAD;
+            y[count] = latitude[count] * DEG_TO_RAD;
+            count++;
+        }
+
+        STAssertEquals(pj_transform(sources[which], wgs84, count, 1, x, y, NULL), 0, @"grid shift failed");
+        for (int i = 0; i < count; i++) {
+            double expected = 0;
+            if (which == 1)
+                expected = RMExpectedGridShift(other, 1, latitude[i], west[i]);
+            if (expected == 0)
+                expected = RMExpectedGridShift(overlapping, 5, latitude[i], west[i]);
+            STAssertEqualsWithAccuracy(fabs(y[i] * RAD_TO_DEG - latitude[i]) * 3600, expected, 1e-6,
+                                       @"point %d of round %d shifted by the wrong grid", i, round);
+        }
+    }
+
+    pj_free(wgs84);
+    pj_free(sources[0]);
+    pj_free(sources[1]);
+    [[NSFileManager defaultManager] removeItemAtPath:overlappingPath error:NULL];
+    [[NSFileManager defaultManager] removeItemAtPath:otherPath error:NULL];
+}
+
+-(void) testMappedCtableGridShifts
+{
+    // ctable grids are mapped straight from the file
+    NSString *path = RMWriteTestCtable(@"RMTestGrid.ct", 3);
+    STAssertEqualsWithAccuracy(RMGridShift(path), 3.0, 1e-6, @"mapped ctable grid shifts wrongly");
+
+    // and there is no sidecar for them
+    NSString *native = [path stringByAppendingString:@".native"];
+    STAssertFalse(pj_gridinfo_write_native([path UTF8String], [native UTF8String]), @"sidecar written for ctable");
+    STAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:native], @"sidecar left behind");
+
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+}
+
+-(void) testNativeSidecarIsUsedOnlyWhileUpToDate
+{
+    static const RMTestGrid grid[] = {{"G", "NONE", 40, 50, 0, 10, 1}};
+    static const RMTestGrid regridded[] = {{"G", "NONE", 40, 50, 0, 10, 7}};
+    static const RMTestGrid smaller[] = {{"G", "NONE", 40, 48, 0, 10, 1}};
+    const NSTimeInterval written = 1300000000;
+    NSFileManager *files = [NSFileManager defaultManager];
+    NSString *path = RMWriteTestGrids(@"RMSidecarGrid.gsb", grid, 1);
+    NSString *otherPath = RMWriteTestGrids(@"RMSidecarOtherGrid.gsb", smaller, 1);
+    NSString *native = [path stringByAppendingString:@".native"];
+
+    STAssertEqualsWithAccuracy(RMGridShift(path), 1.0, 1e-6, @"grid without sidecar shifts wrongly");
+
+    RMSetModificationTime(path, written);
+    STAssertTrue(pj_gridinfo_write_native([path UTF8String], [native UTF8String]), @"cannot write sidecar");
+
+    // a grid file of the same size and time as the one the sidecar was made
+    // from is taken to be that file, so the shift comes from the sidecar
+    RMWriteTestGrids(@"RMSidecarGrid.gsb", regridded, 1);
+    RMSetModificationTime(path, written);
+    STAssertEqualsWithAccuracy(RMGridShift(path), 1.0, 1e-6, @"sidecar not used");
+
+    // once the time differs, the grid file is read
+    RMSetModificationTime(path, written + 60);
+    STAssertEqualsWithAccuracy(RMGridShift(path), 7.0, 1e-6, @"stale sidecar used");
+
+    // as it is with the sidecar of another grid file
+    RMSetModificationTime(otherPath, written);
+    STAssertTrue(pj_gridinfo_write_native([otherPath UTF8String], [native UTF8String]), @"cannot write sidecar");
+    RMSetModificationTime(path, written);
+    STAssertEqualsWithAccuracy(RMGridShift(path), 7.0, 1e-6, @"sidecar of another grid used");
+
+    // or with an up to date sidecar cut short
+    STAssertTrue(pj_gridinfo_write_native([path UTF8String], [native UTF8String]), @"cannot write sidecar");
+    STAssertEqualsWithAccuracy(RMGridShift(path), 7.0, 1e-6, @"sidecar shifts wrongly");
+    RMWriteTestGrids(@"RMSidecarGrid.gsb", grid, 1);
+    RMSetModificationTime(path, written);
+    NSFileHandle *handle = [NSFileHandle fileHandleForWritingAtPath:native];
+    [handle truncateFileAtOffset:200];
+    [handle closeFile];
+    STAssertEqualsWithAccuracy(RMGridShift(path), 1.0, 1e-6, @"truncated sidecar used");
+
+    [files removeItemAtPath:path error:NULL];
+    [files removeItemAtPath:otherPath error:NULL];
+    [files removeItemAtPath:native error:NULL];
+}
+
+-(void) testGeodesicSolverRoundTrips
+{
+    struct geod_geodesic wgs84;
+    geod_init(&wgs84, 6378137.0, 1 / 298.257223563);
+
+    // London to Paris
+    double s, az12, az21;
+    geod_inverse(&wgs84, 51.5 * DEG_TO_RAD, -0.1 * DEG_TO_RAD, 48.85 * DEG_TO_RAD, 2.35 * DEG_TO_RAD,
+                 &s, &az12, &az21);
+    STAssertEqualsWithAccuracy(s, 342000.0, 1000.0, @"unexpected distance");
+
+    double phi, lam, back;
+    geod_direct(&wgs84, 51.5 * DEG_TO_RAD, -0.1 * DEG_TO_RAD, az12, s, &phi, &lam, &back);
+    STAssertEqualsWithAccuracy(phi, 48.85 * DEG_TO_RAD, 1e-7, @"direct latitude differs");
+    STAssertEqualsWithAccuracy(lam, 2.35 * DEG_TO_RAD, 1e-7, @"direct longitude differs");
+    STAssertEqualsWithAccuracy(back, az21, 1e-7, @"back azimuth differs");
+
+    // the array form gives the same bits as one call per point
+    double phi1[kStressPointCount], lam1[kStressPointCount], phi2[kStressPointCount], lam2[kStressPointCount];
+    double distances[kStressPointCount], azimuths[kStressPointCount];
+    RMFillStressPoints(lam1, phi1);
+    RMFillStressPoints(lam2, phi2);
+    for (int i = 0; i < kStressPointCount; i++)
+        lam2[i] = -lam2[i];
+
+    geod_inverse_array(&wgs84, kStressPointCount, phi1, lam1, phi2, lam2, distances, azimuths, NULL);
+    for (int i = 0; i < kStressPointCount; i++) {
+        geod_inverse(&wgs84, phi1[i], lam1[i], phi2[i], lam2[i], &s, &az12, NULL);
+        STAssertTrue(s == distances[i] && az12 == azimuths[i], @"array inverse %d differs", i);
+    }
+}
+
+-(void) testProjectionCacheSharesDefinitions
+{
+    projCacheStats before, after;
+    pj_cache_get_stats(&before);
+
+    // the same parameters in another order, repeated, and spaced differently
+    RMProjection *a = [[RMProjection alloc] initWithString:@"+proj=merc +lat_ts=10 +ellps=WGS84"];
+    RMProjection *b = [[RMProjection alloc] initWithString:@" +ellps=WGS84  +proj=merc +lat_ts=10 +lat_ts=20"];
+    RMProjection *c = [[RMProjection alloc] initWithString:@"+proj=merc +lat_ts=20 +ellps=WGS84"];
+
+    STAssertTrue([a internalProjection] == [b internalProjection], @"equivalent definitions not shared");
+    STAssertTrue([a internalProjection] != [c internalProjection], @"different definitions shared");
+
+    pj_cache_get_stats(&after);
+    STAssertEquals(after.lookups - before.lookups, 3L, @"lookups not counted");
+    STAssertTrue(after.hits - before.hits >= 1, @"hit not counted");
+
+    [a release];
+    [b release];
+    [c release];
+
+    // still usable after other holders let go
+    RMProjection *d = [[RMProjection alloc] initWithString:@"+proj=merc +lat_ts=10 +ellps=WGS84"];
+    RMLatLong latLong = {51.5, -0.1};
+    RMProjectedPoint point = [d latLongToPoint:latLong];
+    STAssertTrue(point.easting != HUGE_VAL && point.northing != HUGE_VAL, @"cached projection unusable");
+    [d release];
+}
+
 @end
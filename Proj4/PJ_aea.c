@@ -43,7 +43,6 @@
 	double	dd; \
 	double	n2; \
 	double	rho0; \
-	double	rho; \
 	double	phi1; \
 	double	phi2; \
 	double	*en; \
@@ -87,21 +86,25 @@ phi1_(double qs, double Te, double Tone_es) {
 	return( i ? Phi : HUGE_VAL );
 }
 FORWARD(e_forward); /* ellipsoid & spheroid */
-	if ((P->rho = P->c - (P->ellips ? P->n * pj_qsfn(sin(lp.phi),
+	double rho;
+
+	if ((rho = P->c - (P->ellips ? P->n * pj_qsfn(sin(lp.phi),
 		P->e, P->one_es) : P->n2 * sin(lp.phi))) < 0.) F_ERROR
-	P->rho = P->dd * sqrt(P->rho);
-	xy.x = P->rho * sin( lp.lam *= P->n );
-	xy.y = P->rho0 - P->rho * cos(lp.lam);
+	rho = P->dd * sqrt(rho);
+	xy.x = rho * sin( lp.lam *= P->n );
+	xy.y = P->rho0 - rho * cos(lp.lam);
 	return (xy);
 }
 INVERSE(e_inverse) /* ellipsoid & spheroid */;
-	if( (P->rho = hypot(xy.x, xy.y = P->rho0 - xy.y)) != 0.0 ) {
+	double rho;
+
+	if( (rho = hypot(xy.x, xy.y = P->rho0 - xy.y)) != 0.0 ) {
 		if (P->n < 0.) {
-			P->rho = -P->rho;
+			rho = -rho;
 			xy.x = -xy.x;
 			xy.y = -xy.y;
 		}
-		lp.phi =  P->rho / P->dd;
+		lp.phi =  rho / P->dd;
 		if (P->ellips) {
 			lp.phi = (P->c - lp.phi * lp.phi) / P->n;
 			if (fabs(P->ec - fabs(lp.phi)) > TOL7) {
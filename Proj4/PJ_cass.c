@@ -3,15 +3,6 @@ static const char SCCSID[]="@(#)PJ_cass.c	4.1	94/02/15	GIE	REL";
 #endif
 #define PROJ_PARMS__ \
 	double m0; \
-	double n; \
-	double t; \
-	double a1; \
-	double c; \
-	double r; \
-	double dd; \
-	double d2; \
-	double a2; \
-	double tn; \
 	double *en;
 #define PJ_LIB__
 # include	"projects.h"
@@ -23,16 +14,18 @@ PROJ_HEAD(cass, "Cassini") "\n\tCyl, Sph&Ell";
 # define C4	.33333333333333333333
 # define C5	.06666666666666666666
 FORWARD(e_forward); /* ellipsoid */
-	xy.y = pj_mlfn(lp.phi, P->n = sin(lp.phi), P->c = cos(lp.phi), P->en);
-	P->n = 1./sqrt(1. - P->es * P->n * P->n);
-	P->tn = tan(lp.phi); P->t = P->tn * P->tn;
-	P->a1 = lp.lam * P->c;
-	P->c *= P->es * P->c / (1 - P->es);
-	P->a2 = P->a1 * P->a1;
-	xy.x = P->n * P->a1 * (1. - P->a2 * P->t *
-		(C1 - (8. - P->t + 8. * P->c) * P->a2 * C2));
-	xy.y -= P->m0 - P->n * P->tn * P->a2 *
-		(.5 + (5. - P->t + 6. * P->c) * P->a2 * C3);
+	double n, t, a1, c, a2, tn;
+
+	xy.y = pj_mlfn(lp.phi, n = sin(lp.phi), c = cos(lp.phi), P->en);
+	n = 1./sqrt(1. - P->es * n * n);
+	tn = tan(lp.phi); t = tn * tn;
+	a1 = lp.lam * c;
+	c *= P->es * c / (1 - P->es);
+	a2 = a1 * a1;
+	xy.x = n * a1 * (1. - a2 * t *
+		(C1 - (8. - t + 8. * c) * a2 * C2));
+	xy.y -= P->m0 - n * tn * a2 *
+		(.5 + (5. - t + 6. * c) * a2 * C3);
 	return (xy);
 }
 FORWARD(s_forward); /* spheroid */
@@ -41,25 +34,27 @@ FORWARD(s_forward); /* spheroid */
 	return (xy);
 }
 INVERSE(e_inverse); /* ellipsoid */
-	double ph1;
+	double n, t, r, dd, d2, tn, ph1;
 
 	ph1 = pj_inv_mlfn(P->m0 + xy.y, P->es, P->en);
-	P->tn = tan(ph1); P->t = P->tn * P->tn;
-	P->n = sin(ph1);
-	P->r = 1. / (1. - P->es * P->n * P->n);
-	P->n = sqrt(P->r);
-	P->r *= (1. - P->es) * P->n;
-	P->dd = xy.x / P->n;
-	P->d2 = P->dd * P->dd;
-	lp.phi = ph1 - (P->n * P->tn / P->r) * P->d2 *
-		(.5 - (1. + 3. * P->t) * P->d2 * C3);
-	lp.lam = P->dd * (1. + P->t * P->d2 *
-		(-C4 + (1. + 3. * P->t) * P->d2 * C5)) / cos(ph1);
+	tn = tan(ph1); t = tn * tn;
+	n = sin(ph1);
+	r = 1. / (1. - P->es * n * n);
+	n = sqrt(r);
+	r *= (1. - P->es) * n;
+	dd = xy.x / n;
+	d2 = dd * dd;
+	lp.phi = ph1 - (n * tn / r) * d2 *
+		(.5 - (1. + 3. * t) * d2 * C3);
+	lp.lam = dd * (1. + t * d2 *
+		(-C4 + (1. + 3. * t) * d2 * C5)) / cos(ph1);
 	return (lp);
 }
 INVERSE(s_inverse); /* spheroid */
-	lp.phi = asin(sin(P->dd = xy.y + P->phi0) * cos(xy.x));
-	lp.lam = atan2(tan(xy.x), cos(P->dd));
+	double dd;
+
+	lp.phi = asin(sin(dd = xy.y + P->phi0) * cos(xy.x));
+	lp.lam = atan2(tan(xy.x), cos(dd));
 	return (lp);
 }
 FREEUP;
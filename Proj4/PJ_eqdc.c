@@ -5,7 +5,6 @@ static const char SCCSID[]="@(#)PJ_eqdc.c	4.2	94/03/16	GIE	REL";
 	double phi1; \
 	double phi2; \
 	double n; \
-	double rho; \
 	double rho0; \
 	double c; \
 	double *en; \
@@ -16,20 +15,24 @@ PROJ_HEAD(eqdc, "Equidistant Conic")
 	"\n\tConic, Sph&Ell\n\tlat_1= lat_2=";
 # define EPS10	1.e-10
 FORWARD(e_forward); /* sphere & ellipsoid */
-	P->rho = P->c - (P->ellips ? pj_mlfn(lp.phi, sin(lp.phi),
+	double rho;
+
+	rho = P->c - (P->ellips ? pj_mlfn(lp.phi, sin(lp.phi),
 		cos(lp.phi), P->en) : lp.phi);
-	xy.x = P->rho * sin( lp.lam *= P->n );
-	xy.y = P->rho0 - P->rho * cos(lp.lam);
+	xy.x = rho * sin( lp.lam *= P->n );
+	xy.y = P->rho0 - rho * cos(lp.lam);
 	return (xy);
 }
 INVERSE(e_inverse); /* sphere & ellipsoid */
-	if ((P->rho = hypot(xy.x, xy.y = P->rho0 - xy.y)) != 0.0 ) {
+	double rho;
+
+	if ((rho = hypot(xy.x, xy.y = P->rho0 - xy.y)) != 0.0 ) {
 		if (P->n < 0.) {
-			P->rho = -P->rho;
+			rho = -rho;
 			xy.x = -xy.x;
 			xy.y = -xy.y;
 		}
-		lp.phi = P->c - P->rho;
+		lp.phi = P->c - rho;
 		if (P->ellips)
 			lp.phi = pj_inv_mlfn(lp.phi, P->es, P->en);
 		lp.lam = atan2(xy.x, xy.y) / P->n;
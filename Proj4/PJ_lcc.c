@@ -5,7 +5,6 @@ static const char SCCSID[]="@(#)PJ_lcc.c	4.2	94/03/18	GIE	REL";
 	double	phi1; \
 	double	phi2; \
 	double	n; \
-	double	rho; \
 	double	rho0; \
 	double	c; \
 	int		ellips;
@@ -15,32 +14,36 @@ PROJ_HEAD(lcc, "Lambert Conformal Conic")
 	"\n\tConic, Sph&Ell\n\tlat_1= and lat_2= or lat_0";
 # define EPS10	1.e-10	
 FORWARD(e_forward); /* ellipsoid & spheroid */
+	double rho;
+
 	if (fabs(fabs(lp.phi) - HALFPI) < EPS10) {
 		if ((lp.phi * P->n) <= 0.) F_ERROR;
-		P->rho = 0.;
+		rho = 0.;
 		}
 	else
-		P->rho = P->c * (P->ellips ? pow(pj_tsfn(lp.phi, sin(lp.phi),
+		rho = P->c * (P->ellips ? pow(pj_tsfn(lp.phi, sin(lp.phi),
 			P->e), P->n) : pow(tan(FORTPI + .5 * lp.phi), -P->n));
-	xy.x = P->k0 * (P->rho * sin( lp.lam *= P->n ) );
-	xy.y = P->k0 * (P->rho0 - P->rho * cos(lp.lam) );
+	xy.x = P->k0 * (rho * sin( lp.lam *= P->n ) );
+	xy.y = P->k0 * (P->rho0 - rho * cos(lp.lam) );
 	return (xy);
 }
 INVERSE(e_inverse); /* ellipsoid & spheroid */
+	double rho;
+
 	xy.x /= P->k0;
 	xy.y /= P->k0;
-	if( (P->rho = hypot(xy.x, xy.y = P->rho0 - xy.y)) != 0.0) {
+	if( (rho = hypot(xy.x, xy.y = P->rho0 - xy.y)) != 0.0) {
 		if (P->n < 0.) {
-			P->rho = -P->rho;
+			rho = -rho;
 			xy.x = -xy.x;
 			xy.y = -xy.y;
 		}
 		if (P->ellips) {
-			if ((lp.phi = pj_phi2(pow(P->rho / P->c, 1./P->n), P->e))
+			if ((lp.phi = pj_phi2(pow(rho / P->c, 1./P->n), P->e))
 				== HUGE_VAL)
 				I_ERROR;
 		} else
-			lp.phi = 2. * atan(pow(P->c / P->rho, 1./P->n)) - HALFPI;
+			lp.phi = 2. * atan(pow(P->c / rho, 1./P->n)) - HALFPI;
 		lp.lam = atan2(xy.x, xy.y) / P->n;
 	} else {
 		lp.lam = 0.;
@@ -48,15 +51,67 @@ INVERSE(e_inverse); /* ellipsoid & spheroid */
 	}
 	return (lp);
 }
+FORWARD_N(e_forward_n) { /* ellipsoid & spheroid */
+	double rho, l;
+	long i;
+
+	for (i = 0; i < count; ++i) {
+		if (lam[i] == HUGE_VAL) continue;
+		if (fabs(fabs(phi[i]) - HALFPI) < EPS10) {
+			if ((phi[i] * P->n) <= 0.) N_ERROR(i, lam, phi);
+			rho = 0.;
+			}
+		else
+			rho = P->c * (P->ellips ? pow(pj_tsfn(phi[i], sin(phi[i]),
+				P->e), P->n) : pow(tan(FORTPI + .5 * phi[i]), -P->n));
+		lam[i] = P->k0 * (rho * sin( l = lam[i] * P->n ) );
+		phi[i] = P->k0 * (P->rho0 - rho * cos(l) );
+	}
+}
+INVERSE_N(e_inverse_n) { /* ellipsoid & spheroid */
+	double rho, xx, yy;
+	int *err = &pj_errno, last = 0;
+	long i;
+
+	for (i = 0; i < count; ++i) {
+		if (x[i] == HUGE_VAL) continue;
+		xx = x[i] / P->k0;
+		yy = y[i] / P->k0;
+		if( (rho = hypot(xx, yy = P->rho0 - yy)) != 0.0) {
+			if (P->n < 0.) {
+				rho = -rho;
+				xx = -xx;
+				yy = -yy;
+			}
+			if (P->ellips) {
+				*err = 0;
+				y[i] = pj_phi2(pow(rho / P->c, 1./P->n), P->e);
+				if (*err) {
+					x[i] = y[i] = HUGE_VAL;
+					last = *err;
+					continue;
+				}
+			} else
+				y[i] = 2. * atan(pow(P->c / rho, 1./P->n)) - HALFPI;
+			x[i] = atan2(xx, yy) / P->n;
+		} else {
+			x[i] = 0.;
+			y[i] = P->n > 0. ? HALFPI : - HALFPI;
+		}
+	}
+	*err = last;
+}
 SPECIAL(fac) {
+	double rho;
+
 	if (fabs(fabs(lp.phi) - HALFPI) < EPS10) {
 		if ((lp.phi * P->n) <= 0.) return;
-		P->rho = 0.;
+		rho = 0.;
 	} else
-		P->rho = P->c * (P->ellips ? pow(pj_tsfn(lp.phi, sin(lp.phi),
+		rho = P->c * (P->ellips ? pow(pj_tsfn(lp.phi, sin(lp.phi),
 			P->e), P->n) : pow(tan(FORTPI + .5 * lp.phi), -P->n));
 	fac->code |= IS_ANAL_HK + IS_ANAL_CONV;
-	fac->k = fac->h = P->k0 * P->n * P->rho /
+	fac->k = fac->h = P->k0 * P->n * rho /
 		pj_msfn(sin(lp.phi), cos(lp.phi), P->es);
 	fac->conv = - P->n * lp.lam;
 }
@@ -102,5 +157,7 @@ ENTRY0(lcc)
 	}
 	P->inv = e_inverse;
 	P->fwd = e_forward;
+	P->inv_n = e_inverse_n;
+	P->fwd_n = e_forward_n;
 	P->spc = fac;
 ENDENTRY(P)
@@ -27,6 +27,52 @@ INVERSE(s_inverse); /* spheroid */
 	lp.lam = xy.x / P->k0;
 	return (lp);
 }
+FORWARD_N(e_forward_n) { /* ellipsoid */
+	long i;
+
+	for (i = 0; i < count; ++i) {
+		if (lam[i] == HUGE_VAL) continue;
+		if (fabs(fabs(phi[i]) - HALFPI) <= EPS10) N_ERROR(i, lam, phi);
+		lam[i] = P->k0 * lam[i];
+		phi[i] = - P->k0 * log(pj_tsfn(phi[i], sin(phi[i]), P->e));
+	}
+}
+FORWARD_N(s_forward_n) { /* spheroid */
+	long i;
+
+	for (i = 0; i < count; ++i) {
+		if (lam[i] == HUGE_VAL) continue;
+		if (fabs(fabs(phi[i]) - HALFPI) <= EPS10) N_ERROR(i, lam, phi);
+		lam[i] = P->k0 * lam[i];
+		phi[i] = P->k0 * log(tan(FORTPI + .5 * phi[i]));
+	}
+}
+INVERSE_N(e_inverse_n) { /* ellipsoid */
+	int *err = &pj_errno, last = 0;
+	long i;
+
+	for (i = 0; i < count; ++i) {
+		if (x[i] == HUGE_VAL) continue;
+		*err = 0;
+		y[i] = pj_phi2(exp(- y[i] / P->k0), P->e);
+		if (*err) {
+			x[i] = y[i] = HUGE_VAL;
+			last = *err;
+			continue;
+		}
+		x[i] = x[i] / P->k0;
+	}
+	*err = last;
+}
+INVERSE_N(s_inverse_n) { /* spheroid */
+	long i;
+
+	for (i = 0; i < count; ++i) {
+		if (x[i] == HUGE_VAL) continue;
+		y[i] = HALFPI - 2. * atan(exp(-y[i] / P->k0));
+		x[i] = x[i] / P->k0;
+	}
+}
 FREEUP; if (P) pj_dalloc(P); }
 ENTRY0(merc)
 	double phits=0.0;
@@ -41,10 +87,14 @@ ENTRY0(merc)
 			P->k0 = pj_msfn(sin(phits), cos(phits), P->es);
 		P->inv = e_inverse;
 		P->fwd = e_forward;
+		P->inv_n = e_inverse_n;
+		P->fwd_n = e_forward_n;
 	} else { /* sphere */
 		if (is_phits)
 			P->k0 = cos(phits);
 		P->inv = s_inverse;
 		P->fwd = s_forward;
+		P->inv_n = s_inverse_n;
+		P->fwd_n = s_forward_n;
 	}
 ENDENTRY(P)
@@ -100,6 +100,107 @@ INVERSE(s_inverse); /* sphere */
 	lp.lam = (g || h) ? atan2(g, h) : 0.;
 	return (lp);
 }
+FORWARD_N(e_forward_n) { /* ellipse */
+	double al, als, n, cosphi, sinphi, t;
+	long i;
+
+	for (i = 0; i < count; ++i) {
+		if (lam[i] == HUGE_VAL) continue;
+		sinphi = sin(phi[i]); cosphi = cos(phi[i]);
+		t = fabs(cosphi) > 1e-10 ? sinphi/cosphi : 0.;
+		t *= t;
+		al = cosphi * lam[i];
+		als = al * al;
+		al /= sqrt(1. - P->es * sinphi * sinphi);
+		n = P->esp * cosphi * cosphi;
+		phi[i] = P->k0 * (pj_mlfn(phi[i], sinphi, cosphi, P->en) - P->ml0 +
+			sinphi * al * lam[i] * FC2 * ( 1. +
+			FC4 * als * (5. - t + n * (9. + 4. * n) +
+			FC6 * als * (61. + t * (t - 58.) + n * (270. - 330 * t)
+			+ FC8 * als * (1385. + t * ( t * (543. - t) - 3111.) )
+			))));
+		lam[i] = P->k0 * al * (FC1 +
+			FC3 * als * (1. - t + n +
+			FC5 * als * (5. + t * (t - 18.) + n * (14. - 58. * t)
+			+ FC7 * als * (61. + t * ( t * (179. - t) - 479. ) )
+			)));
+	}
+}
+FORWARD_N(s_forward_n) { /* sphere */
+	double b, cosphi, xx, yy;
+	long i;
+
+	for (i = 0; i < count; ++i) {
+		if (lam[i] == HUGE_VAL) continue;
+		b = (cosphi = cos(phi[i])) * sin(lam[i]);
+		if (fabs(fabs(b) - 1.) <= EPS10) N_ERROR(i, lam, phi);
+		xx = aks5 * log((1. + b) / (1. - b));
+		if ((b = fabs( yy = cosphi * cos(lam[i]) / sqrt(1. - b * b) )) >= 1.) {
+			if ((b - 1.) > EPS10) N_ERROR(i, lam, phi)
+			else yy = 0.;
+		} else
+			yy = acos(yy);
+		if (phi[i] < 0.) yy = -yy;
+		lam[i] = xx;
+		phi[i] = aks0 * (yy - P->phi0);
+	}
+}
+INVERSE_N(e_inverse_n) { /* ellipsoid */
+	double n, con, cosphi, d, ds, sinphi, t, phi;
+	int *err = &pj_errno, last = 0;
+	long i;
+
+	for (i = 0; i < count; ++i) {
+		if (x[i] == HUGE_VAL) continue;
+		*err = 0;
+		phi = pj_inv_mlfn(P->ml0 + y[i] / P->k0, P->es, P->en);
+		if (*err) {
+			x[i] = y[i] = HUGE_VAL;
+			last = *err;
+			continue;
+		}
+		if (fabs(phi) >= HALFPI) {
+			y[i] = y[i] < 0. ? -HALFPI : HALFPI;
+			x[i] = 0.;
+			continue;
+		}
+		sinphi = sin(phi);
+		cosphi = cos(phi);
+		t = fabs(cosphi) > 1e-10 ? sinphi/cosphi : 0.;
+		n = P->esp * cosphi * cosphi;
+		d = x[i] * sqrt(con = 1. - P->es * sinphi * sinphi) / P->k0;
+		con *= t;
+		t *= t;
+		ds = d * d;
+		y[i] = phi - (con * ds / (1.-P->es)) * FC2 * (1. -
+			ds * FC4 * (5. + t * (3. - 9. *  n) + n * (1. - 4 * n) -
+			ds * FC6 * (61. + t * (90. - 252. * n +
+				45. * t) + 46. * n
+		   - ds * FC8 * (1385. + t * (3633. + t * (4095. + 1574. * t)) )
+			)));
+		x[i] = d*(FC1 -
+			ds*FC3*( 1. + 2.*t + n -
+			ds*FC5*(5. + t*(28. + 24.*t + 8.*n) + 6.*n
+		   - ds * FC7 * (61. + t * (662. + t * (1320. + 720. * t)) )
+		))) / cosphi;
+	}
+	*err = last;
+}
+INVERSE_N(s_inverse_n) { /* sphere */
+	double h, g, phi;
+	long i;
+
+	for (i = 0; i < count; ++i) {
+		if (x[i] == HUGE_VAL) continue;
+		h = exp(x[i] / aks0);
+		g = .5 * (h - 1. / h);
+		h = cos(P->phi0 + y[i] / aks0);
+		phi = asin(sqrt((1. - h * h) / (1. + g * g)));
+		if (y[i] < 0.) phi = -phi;
+		x[i] = (g || h) ? atan2(g, h) : 0.;
+		y[i] = phi;
+	}
+}
 FREEUP;
 	if (P) {
 		if (P->en)
@@ -116,11 +217,15 @@ setup(PJ *P) { /* general initialization */
 		P->esp = P->es / (1. - P->es);
 		P->inv = e_inverse;
 		P->fwd = e_forward;
+		P->inv_n = e_inverse_n;
+		P->fwd_n = e_forward_n;
 	} else {
 		aks0 = P->k0;
 		aks5 = .5 * aks0;
 		P->inv = s_inverse;
 		P->fwd = s_forward;
+		P->inv_n = s_inverse_n;
+		P->fwd_n = s_forward_n;
 	}
 	return P;
 }
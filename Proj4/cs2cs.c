@@ -66,8 +66,27 @@
 #include <ctype.h>
 #include <string.h>
 #include <math.h>
+#include <sys/stat.h>
 #include "emess.h"
 
+#ifndef S_ISREG
+#  define S_ISREG(m) (((m) & S_IFMT) == S_IFREG)
+#endif
+
+#if defined(MSDOS) || defined(OS2) || defined(WIN32) || defined(__WIN32__)
+#  include <fcntl.h>
+#  include <io.h>
+#  define SET_BINARY_MODE(file) setmode(fileno(file), O_BINARY)
+#else
+#  define SET_BINARY_MODE(file)
+#endif
+
+#if !defined(_WIN32) || defined(__CYGWIN__)
+#  include <sys/mman.h>
+#  include <unistd.h>
+#  define HAVE_INPUT_MAP
+#endif
+
 #define MAX_LINE 1000
 #define MAX_PARGS 100
 
@@ -76,13 +95,15 @@ static projPJ   fromProj, toProj;
 static int
 reversein = 0,	/* != 0 reverse input arguments */
 reverseout = 0,	/* != 0 reverse output arguments */
+bin_in = 0,	/* != 0 then binary input */
+bin_out = 0,	/* != 0 then binary output */
 echoin = 0,	/* echo input data to output line */
 tag = '#';	/* beginning of line tag character */
 	static char
 *oform = (char *)0,	/* output format for x-y or decimal degrees */
 *oterr = "*\t*",	/* output line for unprojectable input */
 *usage =
-"%s\nusage: %s [ -eEfIlrstvwW [args] ] [ +opts[=arg] ]\n"
+"%s\nusage: %s [ -beEfiIlorstvwW [args] ] [ +opts[=arg] ]\n"
 "                   [+to [+opts[=arg] [ files ]\n";
 
 static struct FACTORS facs;
@@ -90,65 +111,167 @@ static double (*informat)(const char *,
                           char **); /* input data deformatter function */
 
 
+/*
+** Points are read in batches and handed to pj_transform_parallel() in one
+** go, so large files keep all processors busy.  Only regular files are
+** batched; input from a terminal or a pipe is still answered line by line.
+*/
+#define MAX_BATCH 16384
+
+typedef struct {
+    projUV data;
+    double z;
+    long   text;    /* tag line or echoed input in batch_text, or -1 */
+    int    is_tag;
+} BATCH_POINT;
+
+/*
+** Binary mode (-b, or -i and -o for input or output alone) reads and
+** writes packed triplets of little endian doubles, x y z, with angles in
+** radians: the values pj_transform() itself takes and returns.  Binary
+** input is transformed in blocks of BIN_BATCH points as it lies in the
+** file, mapped into memory where that is possible, and each block goes
+** out in a single write.  Points that fail are written as HUGE_VAL.
+*/
+#define BIN_BATCH 65536
+
+static BATCH_POINT batch[MAX_BATCH];
+static double batch_x[MAX_BATCH], batch_y[MAX_BATCH], batch_z[MAX_BATCH];
+static int batch_count = 0;
+static char *batch_text = NULL;
+static long batch_text_used = 0, batch_text_max = 0;
+
 /************************************************************************/
-/*                              process()                               */
+/*                             batch_save()                             */
 /*                                                                      */
-/*      File processing function.                                       */
+/*      Keep the first len characters of a line for output.             */
 /************************************************************************/
-static void process(FILE *fid) 
+static long batch_save(const char *text, size_t len)
 
 {
-    char line[MAX_LINE+3], *s, pline[40];
-    projUV data;
+    long offset = batch_text_used;
 
-    for (;;) {
-        double z;
+    if (batch_text_used + (long) len + 1 > batch_text_max) {
+        batch_text_max = 2 * batch_text_max + (long) len + MAX_LINE;
+        batch_text = (char *) realloc(batch_text, batch_text_max);
+        if (!batch_text)
+            emess(2, "out of memory for input lines");
+    }
+    memcpy(batch_text + offset, text, len);
+    batch_text[offset + len] = '\0';
+    batch_text_used += (long) len + 1;
 
-        ++emess_dat.File_line;
-        if (!(s = fgets(line, MAX_LINE, fid)))
-            break;
-        if (!strchr(s, '\n')) { /* overlong line */
-            int c;
-            (void)strcat(s, "\n");
-				/* gobble up to newline */
-            while ((c = fgetc(fid)) != EOF && c != '\n') ;
+    return offset;
+}
+
+/************************************************************************/
+/*                              bin_swap()                              */
+/*                                                                      */
+/*      Convert doubles between little endian and the machine byte      */
+/*      order.                                                          */
+/************************************************************************/
+static void bin_swap(double *values, long count)
+
+{
+    static const int byte_order_test = 1;
+    unsigned char *data = (unsigned char *) values, t;
+    long i;
+    int j;
+
+    if (((const unsigned char *) &byte_order_test)[0] == 1)
+        return;
+
+    for (i = 0; i < count; i++, data += sizeof(double)) {
+        for (j = 0; j < (int) sizeof(double) / 2; j++) {
+            t = data[j];
+            data[j] = data[sizeof(double) - 1 - j];
+            data[sizeof(double) - 1 - j] = t;
         }
-        if (*s == tag) {
-            fputs(line, stdout);
+    }
+}
+
+/************************************************************************/
+/*                             bin_write()                              */
+/*                                                                      */
+/*      Write out count points.  The buffer is left in file byte        */
+/*      order.                                                          */
+/************************************************************************/
+static void bin_write(double *xyz, long count)
+
+{
+    bin_swap(xyz, 3 * count);
+    if (fwrite(xyz, 3 * sizeof(double), count, stdout) != (size_t) count)
+        emess(2, "binary output");
+}
+
+/************************************************************************/
+/*                            batch_flush()                             */
+/*                                                                      */
+/*      Transform the pending points and write out the batch.  If       */
+/*      the batch as a whole fails, the points are redone one at a      */
+/*      time so a bad point only fails its own line, as it always did.  */
+/************************************************************************/
+static void batch_flush(void)
+
+{
+    char pline[40];
+    long count = 0, i, j;
+
+    for (i = 0; i < batch_count; i++) {
+        if (batch[i].is_tag || batch[i].data.u == HUGE_VAL)
             continue;
-        }
+        batch_x[count] = batch[i].data.u;
+        batch_y[count] = batch[i].data.v;
+        batch_z[count] = batch[i].z;
+        count++;
+    }
 
-        if (reversein) {
-            data.v = (*informat)(s, &s);
-            data.u = (*informat)(s, &s);
-        } else {
-            data.u = (*informat)(s, &s);
-            data.v = (*informat)(s, &s);
+    if (count > 0 && pj_transform_parallel( fromProj, toProj, count, 1,
+                                            batch_x, batch_y, batch_z ) != 0)
+    {
+        for (i = 0, j = 0; i < batch_count; i++) {
+            if (batch[i].is_tag || batch[i].data.u == HUGE_VAL)
+                continue;
+            batch_x[j] = batch[i].data.u;
+            batch_y[j] = batch[i].data.v;
+            batch_z[j] = batch[i].z;
+            if( pj_transform( fromProj, toProj, 1, 0,
+                              batch_x + j, batch_y + j, batch_z + j ) != 0 )
+                batch_x[j] = batch_y[j] = HUGE_VAL;
+            j++;
         }
+    }
 
-        z = strtod( s, &s );
+    for (i = 0, j = 0; i < batch_count; i++) {
+        projUV data = batch[i].data;
+        double z = batch[i].z;
 
-        if (data.v == HUGE_VAL)
-            data.u = HUGE_VAL;
+        if (batch[i].is_tag) {
+            if (!bin_out)
+                fputs(batch_text + batch[i].text, stdout);
+            continue;
+        }
 
-        if (!*s && (s > line)) --s; /* assumed we gobbled \n */
+        if (data.u != HUGE_VAL) {
+            data.u = batch_x[j];
+            data.v = batch_y[j];
+            z = batch_z[j];
+            j++;
+        }
 
-        if ( echoin) {
-            int t;
-            t = *s;
-            *s = '\0';
-            (void)fputs(line, stdout);
-            *s = t;
-            putchar('\t');
+        if (bin_out) {
+            double xyz[3];
+
+            xyz[0] = data.u;
+            xyz[1] = data.u == HUGE_VAL ? HUGE_VAL : data.v;
+            xyz[2] = z;
+            bin_write(xyz, 1);
+            continue;
         }
 
-        if (data.u != HUGE_VAL) {
-            if( pj_transform( fromProj, toProj, 1, 0, 
-                              &(data.u), &(data.v), &z ) != 0 )
-            {
-                data.u = HUGE_VAL;
-                data.v = HUGE_VAL;
-            }
+        if (batch[i].text >= 0) {
+            (void)fputs(batch_text + batch[i].text, stdout);
+            putchar('\t');
         }
 
         if (data.u == HUGE_VAL) /* error output */
@@ -186,6 +309,193 @@ static void process(FILE *fid)
             printf( "%.3f", z );
         fputs("\n", stdout );
     }
+
+    batch_count = 0;
+    batch_text_used = 0;
+}
+
+/************************************************************************/
+/*                              process()                               */
+/*                                                                      */
+/*      File processing function.                                       */
+/************************************************************************/
+static void process(FILE *fid) 
+
+{
+    char line[MAX_LINE+3], *s;
+    struct stat st;
+    int batch_max = 1;
+
+    if (fstat(fileno(fid), &st) == 0 && S_ISREG(st.st_mode))
+        batch_max = MAX_BATCH;
+
+    for (;;) {
+        BATCH_POINT *point;
+
+        ++emess_dat.File_line;
+        if (!(s = fgets(line, MAX_LINE, fid)))
+            break;
+        if (!strchr(s, '\n')) { /* overlong line */
+            int c;
+            (void)strcat(s, "\n");
+				/* gobble up to newline */
+            while ((c = fgetc(fid)) != EOF && c != '\n') ;
+        }
+
+        point = batch + batch_count++;
+        point->is_tag = (*s == tag);
+        point->text = -1;
+
+        if (point->is_tag) {
+            point->text = batch_save(line, strlen(line));
+        } else {
+            if (reversein) {
+                point->data.v = (*informat)(s, &s);
+                point->data.u = (*informat)(s, &s);
+            } else {
+                point->data.u = (*informat)(s, &s);
+                point->data.v = (*informat)(s, &s);
+            }
+
+            point->z = strtod( s, &s );
+
+            if (point->data.v == HUGE_VAL)
+                point->data.u = HUGE_VAL;
+
+            if (!*s && (s > line)) --s; /* assumed we gobbled \n */
+
+            if ( echoin && !bin_out )
+                point->text = batch_save(line, s - line);
+        }
+
+        if (batch_count == batch_max)
+            batch_flush();
+    }
+
+    batch_flush();
+}
+
+/************************************************************************/
+/*                           bin_transform()                            */
+/*                                                                      */
+/*      Transform count points from the input block into out, in        */
+/*      machine byte order.  As in batch_flush(), a block that fails    */
+/*      as a whole is redone one point at a time.                       */
+/************************************************************************/
+static void bin_transform(const double *in, double *out, long count)
+
+{
+    long i;
+
+    memcpy(out, in, 3 * sizeof(double) * count);
+    bin_swap(out, 3 * count);
+
+    if (pj_transform_parallel( fromProj, toProj, count, 3,
+                               out, out + 1, out + 2 ) == 0)
+        return;
+
+    memcpy(out, in, 3 * sizeof(double) * count);
+    bin_swap(out, 3 * count);
+
+    for (i = 0; i < count; i++) {
+        double *xyz = out + 3 * i;
+
+        if (xyz[0] != HUGE_VAL
+            && pj_transform( fromProj, toProj, 1, 0,
+                             xyz, xyz + 1, xyz + 2 ) != 0)
+            xyz[0] = xyz[1] = HUGE_VAL;
+    }
+}
+
+/************************************************************************/
+/*                          process_binary()                            */
+/*                                                                      */
+/*      Binary input processing function.                               */
+/************************************************************************/
+static void process_binary(FILE *fid)
+
+{
+    static double block[3 * BIN_BATCH], out[3 * BIN_BATCH];
+    const char *map = NULL;
+    size_t map_size = 0, map_used = 0, trailing = 0;
+    long count, i;
+
+#ifdef HAVE_INPUT_MAP
+    {
+        struct stat st;
+
+        if (fstat(fileno(fid), &st) == 0 && S_ISREG(st.st_mode)
+            && st.st_size > 0 && lseek(fileno(fid), 0, SEEK_CUR) == 0) {
+            map = (const char *) mmap(NULL, (size_t) st.st_size, PROT_READ,
+                                      MAP_PRIVATE, fileno(fid), 0);
+            if (map == (const char *) MAP_FAILED)
+                map = NULL;
+            else {
+                map_size = (size_t) st.st_size;
+                trailing = map_size % (3 * sizeof(double));
+#ifdef MADV_SEQUENTIAL
+                madvise((void *) map, map_size, MADV_SEQUENTIAL);
+#endif
+            }
+        }
+    }
+#endif
+
+    for (;;) {
+        const double *in;
+
+        if (map != NULL) {
+            count = (long) ((map_size - map_used) / (3 * sizeof(double)));
+            if (count > BIN_BATCH)
+                count = BIN_BATCH;
+            in = (const double *) (map + map_used);
+            map_used += count * 3 * sizeof(double);
+        } else {
+            size_t got = fread(block, 1, sizeof(block), fid);
+
+            count = (long) (got / (3 * sizeof(double)));
+            trailing = got % (3 * sizeof(double));
+            in = block;
+        }
+
+        if (count == 0)
+            break;
+
+        emess_dat.File_line += count;
+
+        if (bin_out) {
+            bin_transform(in, out, count);
+            bin_write(out, count);
+            continue;
+        }
+
+        /* text output goes through the usual batches */
+        memcpy(out, in, 3 * sizeof(double) * count);
+        bin_swap(out, 3 * count);
+        for (i = 0; i < count; i++) {
+            BATCH_POINT *point = batch + batch_count++;
+
+            point->data.u = out[3 * i];
+            point->data.v = out[3 * i + 1];
+            point->z = out[3 * i + 2];
+            point->text = -1;
+            point->is_tag = 0;
+
+            if (batch_count == MAX_BATCH)
+                batch_flush();
+        }
+    }
+
+    batch_flush();
+
+#ifdef HAVE_INPUT_MAP
+    if (map != NULL)
+        munmap((void *) map, map_size);
+#endif
+
+    if (trailing != 0)
+        emess(-1, "%d bytes left over at the end of binary input",
+              (int) trailing);
 }
 
 /************************************************************************/
@@ -215,9 +525,18 @@ int main(int argc, char **argv)
               case '\0': /* position of "stdin" */
                 if (arg[-1] == '-') eargv[eargc++] = "-";
                 break;
+              case 'b': /* binary I/O */
+                bin_in = bin_out = 1;
+                continue;
               case 'v': /* monitor dump of initialization */
                 mon = 1;
                 continue;
+              case 'i': /* input binary */
+                bin_in = 1;
+                continue;
+              case 'o': /* output binary */
+                bin_out = 1;
+                continue;
               case 'I': /* alt. method to spec inverse */
                 inverse = 1;
                 continue;
@@ -416,21 +735,34 @@ int main(int argc, char **argv)
     if( !toProj->is_latlong && !oform )
         oform = "%.2f";
 
+    if (bin_out)
+    {
+        SET_BINARY_MODE(stdout);
+    }
+
     /* process input file list */
     for ( ; eargc-- ; ++eargv) {
         if (**eargv == '-') {
             fid = stdin;
             emess_dat.File_name = "<stdin>";
 
+            if (bin_in)
+            {
+                SET_BINARY_MODE(stdin);
+            }
+
         } else {
-            if ((fid = fopen(*eargv, "rt")) == NULL) {
+            if ((fid = fopen(*eargv, bin_in ? "rb" : "rt")) == NULL) {
                 emess(-2, *eargv, "input file");
                 continue;
             }
             emess_dat.File_name = *eargv;
         }
         emess_dat.File_line = 0;
-        process(fid);
+        if (bin_in)
+            process_binary(fid);
+        else
+            process(fid);
         fclose(fid);
         emess_dat.File_name = 0;
     }
@@ -441,6 +773,7 @@ int main(int argc, char **argv)
         pj_free( toProj );
 
     pj_deallocate_grids();
+    free( batch_text );
 
     exit(0); /* normal completion */
 }
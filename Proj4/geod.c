@@ -17,6 +17,15 @@ fullout = 0,	/* output full set of geodesic values */
 tag = '#',	/* beginning of line tag character */
 pos_azi = 0,	/* output azimuths as positive values */
 inverse = 0;	/* != 0 then inverse geodesic */
+	static struct geod_geodesic
+geod;		/* the ellipsoid */
+	static struct geod_line
+line;		/* geodesic of arc/geodesic mode */
+	static double
+phi1, lam1, phi2, lam2, al12, al21, geod_S,
+to_meter, fr_meter, del_alpha;
+	static int
+n_alpha, n_S;
 	static char
 *oform = (char *)0,	/* output format for decimal degrees */
 *osform = "%.3f",	/* output format for S */
@@ -40,8 +49,8 @@ do_arc(void) {
 	printLL(phi2, lam2); putchar('\n');
 	for (az = al12; n_alpha--; ) {
 		al12 = az = adjlon(az + del_alpha);
-		geod_pre();
-		geod_for();
+		geod_lineinit(&line, &geod, phi1, lam1, al12);
+		geod_position(&line, geod_S, &phi2, &lam2, &al21);
 		printLL(phi2, lam2); putchar('\n');
 	}
 }
@@ -53,7 +62,7 @@ do_geod(void) {
 	laml = lam2;
 	printLL(phi1, lam1); putchar('\n');
 	for ( geod_S = del_S = geod_S / n_S; --n_S; geod_S += del_S) {
-		geod_for();
+		geod_position(&line, geod_S, &phi2, &lam2, &al21);
 		printLL(phi2, lam2); putchar('\n');
 	}
 	printLL(phil, laml); putchar('\n');
@@ -81,12 +90,13 @@ process(FILE *fid) {
 		if (inverse) {
 			phi2 = dmstor(s, &s);
 			lam2 = dmstor(s, &s);
-			geod_inv();
+			geod_inverse(&geod, phi1, lam1, phi2, lam2,
+				&geod_S, &al12, &al21);
 		} else {
-			al12 = dmstor(s, &s);
+			al12 = adjlon(dmstor(s, &s));
 			geod_S = strtod(s, &s) * to_meter;
-			geod_pre();
-			geod_for();
+			geod_direct(&geod, phi1, lam1, al12, geod_S,
+				&phi2, &lam2, &al21);
 		}
 		if (!*s && (s > line)) --s; /* assumed we gobbled \n */
 		if (pos_azi) {
@@ -126,6 +136,67 @@ process(FILE *fid) {
 	}
 }
 
+	static void	/* set up the ellipsoid, units and any arc/geodesic */
+geod_set(int argc, char **argv) {
+	paralist *start = 0, *curr = 0;
+	double a, es;
+	char *name;
+	int i;
+
+    /* put arguments into internal linked list */
+	if (argc <= 0)
+		emess(1, "no arguments in initialization list");
+	for (i = 0; i < argc; ++i)
+		if (i)
+			curr = curr->next = pj_mkparam(argv[i]);
+		else
+			start = curr = pj_mkparam(argv[i]);
+	/* set elliptical parameters */
+	if (pj_ell_set(start, &a, &es)) emess(1,"ellipse setup failure");
+	geod_init(&geod, a, es != 0. ? 1. - sqrt(1. - es) : 0.);
+	/* set units */
+	name = pj_param(start, "sunits").s;
+	if (name) {
+		char *s;
+                struct PJ_UNITS *unit_list = pj_get_units_ref();
+		for (i = 0; (s = unit_list[i].id) && strcmp(name, s) ; ++i) ;
+		if (!s)
+			emess(1,"%s unknown unit conversion id", name);
+		fr_meter = 1. / (to_meter = atof(unit_list[i].to_meter));
+	} else
+		to_meter = fr_meter = 1.;
+	/* check if line or arc mode */
+	if (pj_param(start, "tlat_1").i) {
+		double del_S;
+		phi1 = pj_param(start, "rlat_1").f;
+		lam1 = pj_param(start, "rlon_1").f;
+		if (pj_param(start, "tlat_2").i) {
+			phi2 = pj_param(start, "rlat_2").f;
+			lam2 = pj_param(start, "rlon_2").f;
+			geod_inverse(&geod, phi1, lam1, phi2, lam2,
+				&geod_S, &al12, &al21);
+			geod_lineinit(&line, &geod, phi1, lam1, al12);
+		} else if ((geod_S = pj_param(start, "dS").f)) {
+			al12 = pj_param(start, "rA").f;
+			geod_lineinit(&line, &geod, phi1, lam1, al12);
+			al12 = line.al12;
+			geod_position(&line, geod_S, &phi2, &lam2, &al21);
+		} else emess(1,"incomplete geodesic/arc info");
+		if ((n_alpha = pj_param(start, "in_A").i) > 0) {
+			if (!(del_alpha = pj_param(start, "rdel_A").f))
+				emess(1,"del azimuth == 0");
+		} else if ((del_S = fabs(pj_param(start, "ddel_S").f))) {
+			n_S = geod_S / del_S + .5;
+		} else if ((n_S = pj_param(start, "in_S").i) <= 0)
+			emess(1,"no interval divisor selected");
+	}
+	/* free up linked list */
+	for ( ; start; start = curr) {
+		curr = start->next;
+		pj_dalloc(start);
+	}
+}
+
 static char *pargv[MAX_PARGS];
 static int   pargc = 0;
 
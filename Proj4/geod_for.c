@@ -4,98 +4,103 @@ static const char SCCSID[]="@(#)geod_for.c	4.6	95/09/23	GIE	REL";
 # include "projects.h"
 # include "geodesic.h"
 # define MERI_TOL 1e-9
-	static double
-th1,costh1,sinth1,sina12,cosa12,M,N,c1,c2,D,P,s1;
-	static int
-merid, signS;
-	void
-geod_pre(void) {
-	al12 = adjlon(al12); /* reduce to  +- 0-PI */
-	signS = fabs(al12) > HALFPI ? 1 : 0;
-	th1 = ellipse ? atan(onef * tan(phi1)) : phi1;
-	costh1 = cos(th1);
-	sinth1 = sin(th1);
-	if ((merid = fabs(sina12 = sin(al12)) < MERI_TOL)) {
-		sina12 = 0.;
-		cosa12 = fabs(al12) < HALFPI ? 1. : -1.;
-		M = 0.;
+	void	/* geodesic from (phi1, lam1) at azimuth al12 */
+geod_lineinit(struct geod_line *l, const struct geod_geodesic *g,
+	double phi1, double lam1, double al12) {
+	l->g = *g;
+	l->phi1 = phi1;
+	l->lam1 = lam1;
+	l->al12 = al12 = adjlon(al12); /* reduce to  +- 0-PI */
+	l->signS = fabs(al12) > HALFPI ? 1 : 0;
+	l->th1 = g->ellipse ? atan(g->onef * tan(phi1)) : phi1;
+	l->costh1 = cos(l->th1);
+	l->sinth1 = sin(l->th1);
+	if ((l->merid = fabs(l->sina12 = sin(al12)) < MERI_TOL)) {
+		l->sina12 = 0.;
+		l->cosa12 = fabs(al12) < HALFPI ? 1. : -1.;
+		l->M = 0.;
 	} else {
-		cosa12 = cos(al12);
-		M = costh1 * sina12;
+		l->cosa12 = cos(al12);
+		l->M = l->costh1 * l->sina12;
 	}
-	N = costh1 * cosa12;
-	if (ellipse) {
-		if (merid) {
-			c1 = 0.;
-			c2 = f4;
-			D = 1. - c2;
-			D *= D;
-			P = c2 / D;
+	l->N = l->costh1 * l->cosa12;
+	if (g->ellipse) {
+		if (l->merid) {
+			l->c1 = 0.;
+			l->c2 = g->f4;
+			l->D = 1. - l->c2;
+			l->D *= l->D;
+			l->P = l->c2 / l->D;
 		} else {
-			c1 = geod_f * M;
-			c2 = f4 * (1. - M * M);
-			D = (1. - c2)*(1. - c2 - c1 * M);
-			P = (1. + .5 * c1 * M) * c2 / D;
+			l->c1 = g->f * l->M;
+			l->c2 = g->f4 * (1. - l->M * l->M);
+			l->D = (1. - l->c2)*(1. - l->c2 - l->c1 * l->M);
+			l->P = (1. + .5 * l->c1 * l->M) * l->c2 / l->D;
 		}
-	}
-	if (merid) s1 = HALFPI - th1;
+	} else
+		l->c1 = l->c2 = l->D = l->P = 0.;
+	if (l->merid) l->s1 = HALFPI - l->th1;
 	else {
-		s1 = (fabs(M) >= 1.) ? 0. : acos(M);
-		s1 =  sinth1 / sin(s1);
-		s1 = (fabs(s1) >= 1.) ? 0. : acos(s1);
+		l->s1 = (fabs(l->M) >= 1.) ? 0. : acos(l->M);
+		l->s1 =  l->sinth1 / sin(l->s1);
+		l->s1 = (fabs(l->s1) >= 1.) ? 0. : acos(l->s1);
 	}
 }
-	void
-geod_for(void) {
-	double d,sind,u,V,X,ds,cosds,sinds,ss,de;
+	void	/* point at distance S along a geodesic */
+geod_position(const struct geod_line *l, double S,
+	double *phi2, double *lam2, double *al21) {
+	double d,sind,u,V,X,ds,cosds,sinds,ss,de,al,phi;
+	const double onef = l->g.onef, M = l->M, N = l->N, s1 = l->s1,
+		sinth1 = l->sinth1, c1 = l->c1, c2 = l->c2;
+	const int signS = l->signS;
+
 	ss = 0.;
-	
-	if (ellipse) {
-		d = geod_S / (D * geod_a);
+	if (l->g.ellipse) {
+		d = S / (l->D * l->g.a);
 		if (signS) d = -d;
 		u = 2. * (s1 - d);
 		V = cos(u + d);
 		X = c2 * c2 * (sind = sin(d)) * cos(d) * (2. * V * V - 1.);
-		ds = d + X - 2. * P * V * (1. - 2. * P * cos(u)) * sind;
+		ds = d + X - 2. * l->P * V * (1. - 2. * l->P * cos(u)) * sind;
 		ss = s1 + s1 - ds;
 	} else {
-		ds = geod_S / geod_a;
+		ds = S / l->g.a;
 		if (signS) ds = - ds;
 	}
 	cosds = cos(ds);
 	sinds = sin(ds);
 	if (signS) sinds = - sinds;
-	al21 = N * cosds - sinth1 * sinds;
-	if (merid) {
-		phi2 = atan( tan(HALFPI + s1 - ds) / onef);
-		if (al21 > 0.) {
-			al21 = PI;
+	al = N * cosds - sinth1 * sinds;
+	if (l->merid) {
+		phi = atan( tan(HALFPI + s1 - ds) / onef);
+		if (al > 0.) {
+			al = PI;
 			if (signS)
 				de = PI;
 			else {
-				phi2 = - phi2;
+				phi = - phi;
 				de = 0.;
 			}
 		} else {
-			al21 = 0.;
+			al = 0.;
 			if (signS) {
-				phi2 = - phi2;
+				phi = - phi;
 				de = 0;
 			} else
 				de = PI;
 		}
 	} else {
-		al21 = atan(M / al21);
-		if (al21 > 0)
-			al21 += PI;
-		if (al12 < 0.)
-			al21 -= PI;
-		al21 = adjlon(al21);
-		phi2 = atan(-(sinth1 * cosds + N * sinds) * sin(al21) /
-			(ellipse ? onef * M : M));
-		de = atan2(sinds * sina12 ,
-			(costh1 * cosds - sinth1 * sinds * cosa12));
-		if (ellipse)
+		al = atan(M / al);
+		if (al > 0)
+			al += PI;
+		if (l->al12 < 0.)
+			al -= PI;
+		al = adjlon(al);
+		phi = atan(-(sinth1 * cosds + N * sinds) * sin(al) /
+			(l->g.ellipse ? onef * M : M));
+		de = atan2(sinds * l->sina12 ,
+			(l->costh1 * cosds - sinth1 * sinds * l->cosa12));
+		if (l->g.ellipse)
 			if (signS)
 				de += c1 * ((1. - c2) * ds +
 					c2 * sinds * cos(ss));
@@ -103,5 +108,28 @@ geod_for(void) {
 				de -= c1 * ((1. - c2) * ds -
 					c2 * sinds * cos(ss));
 	}
-	lam2 = adjlon( lam1 + de );
+	*phi2 = phi;
+	*lam2 = adjlon( l->lam1 + de );
+	if (al21)
+		*al21 = al;
+}
+	void	/* direct problem: end point and back azimuth */
+geod_direct(const struct geod_geodesic *g,
+	double phi1, double lam1, double al12, double S,
+	double *phi2, double *lam2, double *al21) {
+	struct geod_line l;
+
+	geod_lineinit(&l, g, phi1, lam1, al12);
+	geod_position(&l, S, phi2, lam2, al21);
+}
+	void	/* direct problem over arrays; al21 may be NULL */
+geod_direct_array(const struct geod_geodesic *g, long count,
+	const double *phi1, const double *lam1,
+	const double *al12, const double *S,
+	double *phi2, double *lam2, double *al21) {
+	long i;
+
+	for (i = 0; i < count; ++i)
+		geod_direct(g, phi1[i], lam1[i], al12[i], S[i],
+			phi2 + i, lam2 + i, al21 ? al21 + i : 0);
 }
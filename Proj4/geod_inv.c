@@ -4,14 +4,17 @@ static const char SCCSID[]="@(#)geod_inv.c	4.5	95/09/23	GIE	REL";
 # include "projects.h"
 # include "geodesic.h"
 # define DTOL	1e-12
-	void
-geod_inv(void) {
+	void	/* inverse problem: distance and azimuths between two points */
+geod_inverse(const struct geod_geodesic *g,
+	double phi1, double lam1, double phi2, double lam2,
+	double *S, double *al12, double *al21) {
 	double	th1,th2,thm,dthm,dlamm,dlam,sindlamm,costhm,sinthm,cosdthm,
 		sindthm,L,E,cosd,d,X,Y,T,sind,tandlammp,u,v,D,A,B;
+	const double f2 = g->f2, f4 = g->f4, f64 = g->f64;
 
-	if (ellipse) {
-		th1 = atan(onef * tan(phi1));
-		th2 = atan(onef * tan(phi2));
+	if (g->ellipse) {
+		th1 = atan(g->onef * tan(phi1));
+		th2 = atan(g->onef * tan(phi2));
 	} else {
 		th1 = phi1;
 		th2 = phi2;
@@ -20,7 +23,9 @@ geod_inv(void) {
 	dthm = .5 * (th2 - th1);
 	dlamm = .5 * ( dlam = adjlon(lam2 - lam1) );
 	if (fabs(dlam) < DTOL && fabs(dthm) < DTOL) {
-		al12 =  al21 = geod_S = 0.;
+		*S = 0.;
+		if (al12) *al12 = 0.;
+		if (al21) *al21 = 0.;
 		return;
 	}
 	sindlamm = sin(dlamm);
@@ -29,7 +34,7 @@ geod_inv(void) {
 	L = sindthm * sindthm + (cosdthm * cosdthm - sinthm * sinthm)
 		* sindlamm * sindlamm;
 	d = acos(cosd = 1 - L - L);
-	if (ellipse) {
+	if (g->ellipse) {
 		E = cosd + cosd;
 		sind = sin( d );
 		Y = sinthm * cosdthm;
@@ -42,18 +47,29 @@ geod_inv(void) {
 		D = 4. * T * T;
 		A = D * E;
 		B = D + D;
-		geod_S = geod_a * sind * (T - f4 * (T * X - Y) +
+		*S = g->a * sind * (T - f4 * (T * X - Y) +
 			f64 * (X * (A + (T - .5 * (A - E)) * X) -
 			Y * (B + E * Y) + D * X * Y));
 		tandlammp = tan(.5 * (dlam - .25 * (Y + Y - E * (4. - X)) *
 			(f2 * T + f64 * (32. * T - (20. * T - A)
 			* X - (B + 4.) * Y)) * tan(dlam)));
 	} else {
-		geod_S = geod_a * d;
+		*S = g->a * d;
 		tandlammp = tan(dlamm);
 	}
 	u = atan2(sindthm , (tandlammp * costhm));
 	v = atan2(cosdthm , (tandlammp * sinthm));
-	al12 = adjlon(TWOPI + v - u);
-	al21 = adjlon(TWOPI - v - u);
+	if (al12) *al12 = adjlon(TWOPI + v - u);
+	if (al21) *al21 = adjlon(TWOPI - v - u);
+}
+	void	/* inverse problem over arrays; al12 and al21 may be NULL */
+geod_inverse_array(const struct geod_geodesic *g, long count,
+	const double *phi1, const double *lam1,
+	const double *phi2, const double *lam2,
+	double *S, double *al12, double *al21) {
+	long i;
+
+	for (i = 0; i < count; ++i)
+		geod_inverse(g, phi1[i], lam1[i], phi2[i], lam2[i], S + i,
+			al12 ? al12 + i : 0, al21 ? al21 + i : 0);
 }
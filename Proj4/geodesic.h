@@ -2,50 +2,58 @@
 static char GEODESIC_H_ID[] = "@(#)geodesic.h	4.3	95/08/19	GIE	REL";
 #endif
 
+#ifndef GEODESIC_H
+#define GEODESIC_H
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-#ifndef _IN_GEOD_SET
-#  define GEOD_EXTERN extern
-#else
-#  define GEOD_EXTERN
-#endif
+/*
+** Geodesics on an ellipsoid of revolution.  All state lives in the
+** structures below, so any number of threads may solve geodesics at
+** once, on the same ellipsoid or on different ones.  Angles are in
+** radians, distances in the units of the semimajor axis.
+*/
+
+struct geod_geodesic {		/* an ellipsoid, set up by geod_init() */
+	double	a;		/* semimajor axis */
+	double	onef, f, f2, f4, f64;	/* 1 - f, f, f/2, f/4, f*f/64 */
+	int	ellipse;	/* != 0 unless a sphere */
+};
+
+struct geod_line {		/* a geodesic from a point, by geod_lineinit() */
+	struct geod_geodesic g;
+	double	phi1, lam1, al12;	/* start and (reduced) azimuth */
+	double	th1, costh1, sinth1, sina12, cosa12, M, N, c1, c2, D, P, s1;
+	int	merid, signS;
+};
 
-GEOD_EXTERN struct geodesic {
-	double	A;
-	double	LAM1, PHI1, ALPHA12;
-	double	LAM2, PHI2, ALPHA21;
-	double	DIST;
-	double	ONEF, FLAT, FLAT2, FLAT4, FLAT64;
-	int	ELLIPSE;
-} GEODESIC;
-
-# define geod_a	GEODESIC.A
-# define lam1	GEODESIC.LAM1
-# define phi1	GEODESIC.PHI1
-# define al12	GEODESIC.ALPHA12
-# define lam2	GEODESIC.LAM2
-# define phi2	GEODESIC.PHI2
-# define al21	GEODESIC.ALPHA21
-# define geod_S	GEODESIC.DIST
-# define geod_f	GEODESIC.FLAT
-# define onef	GEODESIC.ONEF
-# define f2	GEODESIC.FLAT2
-# define f4	GEODESIC.FLAT4
-# define ff2	GEODESIC.FLAT4
-# define f64	GEODESIC.FLAT64
-# define ellipse GEODESIC.ELLIPSE
-
-    
-GEOD_EXTERN int n_alpha, n_S;
-GEOD_EXTERN double to_meter, fr_meter, del_alpha;
-	
-void geod_set(int, char **);
-void geod_for(void);
-void geod_pre(void);
-void geod_inv(void);
+void geod_init(struct geod_geodesic *, double a, double f);
+
+void geod_inverse(const struct geod_geodesic *,
+	double phi1, double lam1, double phi2, double lam2,
+	double *S, double *al12, double *al21);
+void geod_direct(const struct geod_geodesic *,
+	double phi1, double lam1, double al12, double S,
+	double *phi2, double *lam2, double *al21);
+
+void geod_lineinit(struct geod_line *, const struct geod_geodesic *,
+	double phi1, double lam1, double al12);
+void geod_position(const struct geod_line *, double S,
+	double *phi2, double *lam2, double *al21);
+
+void geod_inverse_array(const struct geod_geodesic *, long count,
+	const double *phi1, const double *lam1,
+	const double *phi2, const double *lam2,
+	double *S, double *al12, double *al21);
+void geod_direct_array(const struct geod_geodesic *, long count,
+	const double *phi1, const double *lam1,
+	const double *al12, const double *S,
+	double *phi2, double *lam2, double *al21);
 
 #ifdef __cplusplus
 }
 #endif
+
+#endif /* GEODESIC_H */
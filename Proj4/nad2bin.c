@@ -4,11 +4,12 @@ static const char SCCSID[]="@(#)nad2bin.c	4.2 93/08/25 GIE REL";
 #endif
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #define PJ_LIB__
 #include "projects.h"
 #define U_SEC_TO_RAD 4.848136811095359935899141023e-12
 	static char
-*usage = "<ASCII_dist_table local_bin_table";
+*usage = "<ASCII_dist_table local_bin_table\n\tor: -n NTv1_or_NTv2_grid_file";
 	void
 main(int argc, char **argv) {
 	struct CTABLE ct;
@@ -18,6 +19,21 @@ main(int argc, char **argv) {
 	long lam, laml, phi, phil;
 	FILE *bin;
 
+	if (argc == 3 && !strcmp(argv[1], "-n")) {
+		/* write the native sidecar, see pj_gridmap.c */
+		char *native;
+
+		if (!(native = malloc(strlen(argv[2]) + strlen(PJ_NATIVE_SUFFIX) + 1))) {
+			perror("mem. alloc");
+			exit(1);
+		}
+		sprintf(native, "%s%s", argv[2], PJ_NATIVE_SUFFIX);
+		if (!pj_gridinfo_write_native(argv[2], native)) {
+			fprintf(stderr, "%s: %s\n", native, pj_strerrno(pj_errno));
+			exit(2);
+		}
+		exit(0);
+	}
 	if (argc != 2) {
 		fprintf(stderr,"usage: %s %s\n", argv[0], usage);
 		exit(1);
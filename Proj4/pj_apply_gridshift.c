@@ -62,9 +62,63 @@
 #include "projects.h"
 #include <string.h>
 #include <math.h>
+#include <errno.h>
+
+#define GRID_CONTAINS(ct, lp) \
+    ((ct)->ll.phi <= (lp).phi && (ct)->ll.lam <= (lp).lam \
+     && (ct)->ll.phi + ((ct)->lim.phi-1) * (ct)->del.phi >= (lp).phi \
+     && (ct)->ll.lam + ((ct)->lim.lam-1) * (ct)->del.lam >= (lp).lam)
+
+/************************************************************************/
+/*                         pj_gridshift_child()                         */
+/*                                                                      */
+/*      Find the first child of a grid holding a location.  *first      */
+/*      is set if it is the first child listed in its index bucket,     */
+/*      or when no child is found, if the bucket is empty.              */
+/************************************************************************/
+
+static PJ_GRIDINFO *pj_gridshift_child( PJ_GRIDINFO *gi, LP input,
+                                        int *bucket, int *first )
+
+{
+    PJ_GRIDINDEX *index = gi->child_index;
+    int j;
+
+    *bucket = pj_gridindex_bucket( index, input );
+    *first = 1;
+    if( *bucket < 0 )
+        return NULL;
+
+    for( j = index->first[*bucket]; j < index->first[*bucket+1]; j++ )
+    {
+        if( GRID_CONTAINS( index->items[j]->ct, input ) )
+            return index->items[j];
+
+        *first = 0;
+    }
+
+    return NULL;
+}
 
 /************************************************************************/
 /*                         pj_apply_gridshift()                         */
+/*                                                                      */
+/*      Each point is shifted with the first grid of the list that      */
+/*      holds it, or rather with the first child of that grid holding   */
+/*      it, moving on to the next grid if the shift fails.  Children    */
+/*      of children are not looked at, just as before the grids were    */
+/*      indexed (the NTv2 reader does not build them anyway).  The      */
+/*      grids holding a point are found through the bucket indexes      */
+/*      built by pj_gridlist_get(), which keep the order of the list.   */
+/*                                                                      */
+/*      The grid used for a point is remembered in the grid list along  */
+/*      with the index buckets of the point, when these alone decide    */
+/*      that grid: the first grid of the bucket holds the point and     */
+/*      either has no children, or its first child in the point's       */
+/*      child bucket holds the point, or that child bucket is empty.    */
+/*      The next point falling in the same buckets and the same grids   */
+/*      then goes straight to that grid, which is the common case for   */
+/*      points along a track.                                           */
 /************************************************************************/
 
 int pj_apply_gridshift( const char *nadgrids, int inverse, 
@@ -72,57 +126,74 @@ int pj_apply_gridshift( const char *nadgrids, int inverse,
                         double *x, double *y, double *z )
 
 {
-    int grid_count = 0;
-    PJ_GRIDINFO   **tables;
+    PJ_GRIDLIST   *list;
+    PJ_GRIDINDEX  *index;
     int  i;
     int debug_flag = getenv( "PROJ_DEBUG" ) != NULL;
     static int debug_count = 0;
 
     pj_errno = 0;
 
-    tables = pj_gridlist_from_nadgrids( nadgrids, &grid_count);
-    if( tables == NULL || grid_count == 0 )
+    list = pj_gridlist_get( nadgrids );
+    if( list == NULL )
         return pj_errno;
 
+    index = list->index;
+
     for( i = 0; i < point_count; i++ )
     {
         long io = i * point_offset;
         LP   input, output;
-        int  itable;
+        int  bucket, k;
 
         input.phi = y[io];
         input.lam = x[io];
         output.phi = HUGE_VAL;
         output.lam = HUGE_VAL;
 
+        if( input.lam == HUGE_VAL )
+            continue;
+
+        bucket = pj_gridindex_bucket( index, input );
+
+        /* try the grid used for the last point */
+        if( list->last_hit != NULL
+            && bucket == list->last_hit_bucket
+            && GRID_CONTAINS( list->last_hit_top->ct, input )
+            && GRID_CONTAINS( list->last_hit->ct, input ) )
+        {
+            PJ_GRIDINFO *top = list->last_hit_top;
+            int child_bucket = -1, first;
+
+            if( top->child_index != NULL )
+                pj_gridshift_child( top, input, &child_bucket, &first );
+
+            if( child_bucket == list->last_hit_child_bucket )
+                output = nad_cvt( input, inverse, list->last_hit->ct );
+        }
+
         /* keep trying till we find a table that works */
-        for( itable = 0; itable < grid_count; itable++ )
+        for( k = bucket < 0 ? 0 : index->first[bucket];
+             output.lam == HUGE_VAL && bucket >= 0 && k < index->first[bucket+1];
+             k++ )
         {
-            PJ_GRIDINFO *gi = tables[itable];
+            PJ_GRIDINFO *top = index->items[k], *gi = top;
             struct CTABLE *ct = gi->ct;
+            int child_bucket = -1, decided = k == index->first[bucket];
 
             /* skip tables that don't match our point at all.  */
-            if( ct->ll.phi > input.phi || ct->ll.lam > input.lam
-                || ct->ll.phi + (ct->lim.phi-1) * ct->del.phi < input.phi
-                || ct->ll.lam + (ct->lim.lam-1) * ct->del.lam < input.lam )
+            if( !GRID_CONTAINS( ct, input ) )
                 continue;
 
             /* If we have child nodes, check to see if any of them apply. */
-            if( gi->child != NULL )
+            if( gi->child_index != NULL )
             {
                 PJ_GRIDINFO *child;
+                int first;
 
-                for( child = gi->child; child != NULL; child = child->next )
-                {
-                    struct CTABLE *ct1 = child->ct;
-
-                    if( ct1->ll.phi > input.phi || ct1->ll.lam > input.lam
-                      || ct1->ll.phi+(ct1->lim.phi-1)*ct1->del.phi < input.phi
-                      || ct1->ll.lam+(ct1->lim.lam-1)*ct1->del.lam < input.lam)
-                        continue;
-
-                    break;
-                }
+                child = pj_gridshift_child( gi, input, &child_bucket, &first );
+                if( !first )
+                    decided = 0;
 
                 /* we found a more refined child node to use */
                 if( child != NULL )
@@ -146,7 +217,11 @@ int pj_apply_gridshift( const char *nadgrids, int inverse,
                     fprintf( stderr,
                              "pj_apply_gridshift(): used %s\n",
                              ct->id );
-                break;
+
+                list->last_hit = decided ? gi : NULL;
+                list->last_hit_top = top;
+                list->last_hit_bucket = bucket;
+                list->last_hit_child_bucket = child_bucket;
             }
         }
 
@@ -162,9 +237,10 @@ int pj_apply_gridshift( const char *nadgrids, int inverse,
                 fprintf( stderr, 
                          "   tried: %s\n", nadgrids );
             }
-        
+
+            /* The point is left as it is, and the rest of the points
+               still shifted, just as when it is transformed on its own. */
             pj_errno = -38;
-            return pj_errno;
         }
         else
         {
@@ -173,6 +249,5 @@ int pj_apply_gridshift( const char *nadgrids, int inverse,
         }
     }
 
-    return 0;
+    return pj_errno;
 }
-
@@ -0,0 +1,301 @@
+/******************************************************************************
+ * Project:  PROJ.4
+ * Purpose:  Forward and inverse projection of whole arrays of points.
+ * Author:   Route-Me Contributors
+ *
+ ******************************************************************************
+ * Copyright (c) 2011, Route-Me Contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+#define PJ_LIB__
+#include "projects.h"
+#include <errno.h>
+
+#define EPS 1.0e-12
+
+/*
+** The array entry points work in place on separate x and y (lam and phi)
+** arrays rather than on XY/LP pairs.  The context is entered once for the
+** whole array, and the per point preamble and the scaling to metres are
+** done as separate passes over each array.
+**
+** Projections may provide a batch kernel (P->fwd_n / P->inv_n): a loop
+** over the points computing the same expressions as their scalar fwd/inv
+** functions, so results are identical to calling pj_fwd()/pj_inv() one
+** point at a time, without a call through P->fwd or P->inv for each.
+** Projections without a kernel fall back to calling P->fwd or P->inv for
+** each point.
+**
+** Points that fail are set to HUGE_VAL in both arrays and the rest of the
+** array is still processed, as with pj_transform().  Points that are
+** already HUGE_VAL on input are passed over.  The return value is zero,
+** the first error that pj_transform() would fail the whole array for, or
+** failing that the error of the last point that failed.
+*/
+
+/************************************************************************/
+/*                           pj_array_error()                           */
+/*                                                                      */
+/*      The error to report once another point of the array has        */
+/*      failed with point_err: a fatal error already seen is kept.      */
+/************************************************************************/
+
+static int pj_array_error( int err, int point_err, long count )
+
+{
+    return pj_transform_fatal( err, count ) ? err : point_err;
+}
+
+/************************************************************************/
+/*                           pj_array_check()                           */
+/*                                                                      */
+/*      Fail points for which the kernel produced something that is     */
+/*      not a finite number.  The scalar code picks these up through    */
+/*      errno, which the kernels do not look at.                        */
+/************************************************************************/
+
+static int pj_array_check( long count, double *u, double *v, int err )
+
+{
+    long i;
+
+    for( i = 0; i < count; i++ )
+    {
+        if( u[i] == HUGE_VAL )
+            v[i] = HUGE_VAL;
+        else if( !(fabs(u[i]) < HUGE_VAL && fabs(v[i]) < HUGE_VAL) )
+        {
+            u[i] = v[i] = HUGE_VAL;
+            err = pj_array_error( err, EDOM, count );
+        }
+    }
+
+    return err;
+}
+
+/************************************************************************/
+/*                          pj_fwd_array_ctx()                          */
+/************************************************************************/
+
+int pj_fwd_array_ctx( projCtx ctx, PJ *P, long count, double *lam, double *phi )
+
+{
+    projCtx_t *prev;
+    double t, a, x0, y0, fr_meter;
+    int err = 0;
+    long i;
+
+    if( ctx == NULL )
+        ctx = pj_get_default_ctx();
+    prev = pj_ctx_enter( ctx );
+
+/* -------------------------------------------------------------------- */
+/*      Check for over range input and reduce to the central            */
+/*      meridian.                                                       */
+/* -------------------------------------------------------------------- */
+    for( i = 0; i < count; i++ )
+    {
+        if( lam[i] == HUGE_VAL )
+        {
+            phi[i] = HUGE_VAL;
+            continue;
+        }
+
+        if( (t = fabs(phi[i]) - HALFPI) > EPS || fabs(lam[i]) > 10. )
+        {
+            lam[i] = phi[i] = HUGE_VAL;
+            err = pj_array_error( err, -14, count );
+            continue;
+        }
+
+        if( fabs(t) <= EPS )
+            phi[i] = phi[i] < 0. ? -HALFPI : HALFPI;
+        else if( P->geoc )
+            phi[i] = atan(P->rone_es * tan(phi[i]));
+        lam[i] -= P->lam0;
+        if( !P->over )
+            lam[i] = adjlon(lam[i]);
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Project.                                                        */
+/* -------------------------------------------------------------------- */
+    if( P->fwd_n != NULL )
+    {
+        ctx->last_errno = 0;
+        (*P->fwd_n)( count, lam, phi, P );
+        if( ctx->last_errno )
+            err = pj_array_error( err, ctx->last_errno, count );
+        err = pj_array_check( count, lam, phi, err );
+    }
+    else
+    {
+        for( i = 0; i < count; i++ )
+        {
+            LP lp;
+            XY xy;
+
+            if( lam[i] == HUGE_VAL )
+                continue;
+
+            lp.lam = lam[i];
+            lp.phi = phi[i];
+            errno = ctx->last_errno = 0;
+            xy = (*P->fwd)(lp, P);
+            if( ctx->last_errno || (ctx->last_errno = errno) )
+            {
+                lam[i] = phi[i] = HUGE_VAL;
+                err = pj_array_error( err, ctx->last_errno, count );
+            }
+            else
+            {
+                lam[i] = xy.x;
+                phi[i] = xy.y;
+            }
+        }
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Adjust for major axis and easting/northings.                    */
+/* -------------------------------------------------------------------- */
+    a = P->a;
+    x0 = P->x0;
+    y0 = P->y0;
+    fr_meter = P->fr_meter;
+
+    for( i = 0; i < count; i++ )
+        lam[i] = lam[i] == HUGE_VAL ? HUGE_VAL : fr_meter * (a * lam[i] + x0);
+    for( i = 0; i < count; i++ )
+        phi[i] = phi[i] == HUGE_VAL ? HUGE_VAL : fr_meter * (a * phi[i] + y0);
+
+    ctx->last_errno = err;
+    pj_ctx_leave( prev, ctx );
+
+    return err;
+}
+
+/************************************************************************/
+/*                            pj_fwd_array()                            */
+/************************************************************************/
+
+int pj_fwd_array( PJ *P, long count, double *lam, double *phi )
+
+{
+    return pj_fwd_array_ctx( P->ctx, P, count, lam, phi );
+}
+
+/************************************************************************/
+/*                          pj_inv_array_ctx()                          */
+/************************************************************************/
+
+int pj_inv_array_ctx( projCtx ctx, PJ *P, long count, double *x, double *y )
+
+{
+    projCtx_t *prev;
+    double ra, x0, y0, to_meter;
+    int err = 0;
+    long i;
+
+    if( ctx == NULL )
+        ctx = pj_get_default_ctx();
+    prev = pj_ctx_enter( ctx );
+
+/* -------------------------------------------------------------------- */
+/*      Descale and de-offset.                                          */
+/* -------------------------------------------------------------------- */
+    ra = P->ra;
+    x0 = P->x0;
+    y0 = P->y0;
+    to_meter = P->to_meter;
+
+    for( i = 0; i < count; i++ )
+        x[i] = x[i] == HUGE_VAL || y[i] == HUGE_VAL
+            ? HUGE_VAL : (x[i] * to_meter - x0) * ra;
+    for( i = 0; i < count; i++ )
+        y[i] = x[i] == HUGE_VAL ? HUGE_VAL : (y[i] * to_meter - y0) * ra;
+
+/* -------------------------------------------------------------------- */
+/*      Inverse project.                                                */
+/* -------------------------------------------------------------------- */
+    if( P->inv_n != NULL )
+    {
+        ctx->last_errno = 0;
+        (*P->inv_n)( count, x, y, P );
+        err = pj_array_check( count, x, y, ctx->last_errno );
+    }
+    else
+    {
+        for( i = 0; i < count; i++ )
+        {
+            XY xy;
+            LP lp;
+
+            if( x[i] == HUGE_VAL )
+                continue;
+
+            xy.x = x[i];
+            xy.y = y[i];
+            errno = ctx->last_errno = 0;
+            lp = (*P->inv)(xy, P);
+            if( ctx->last_errno || (ctx->last_errno = errno) )
+            {
+                x[i] = y[i] = HUGE_VAL;
+                err = pj_array_error( err, ctx->last_errno, count );
+            }
+            else
+            {
+                x[i] = lp.lam;
+                y[i] = lp.phi;
+            }
+        }
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Reduce from del lam, adjust longitude to the central meridian   */
+/*      and convert geocentric latitudes.                               */
+/* -------------------------------------------------------------------- */
+    for( i = 0; i < count; i++ )
+    {
+        if( x[i] == HUGE_VAL )
+            continue;
+
+        x[i] += P->lam0;
+        if( !P->over )
+            x[i] = adjlon(x[i]);
+        if( P->geoc && fabs(fabs(y[i])-HALFPI) > EPS )
+            y[i] = atan(P->one_es * tan(y[i]));
+    }
+
+    ctx->last_errno = err;
+    pj_ctx_leave( prev, ctx );
+
+    return err;
+}
+
+/************************************************************************/
+/*                            pj_inv_array()                            */
+/************************************************************************/
+
+int pj_inv_array( PJ *P, long count, double *x, double *y )
+
+{
+    return pj_inv_array_ctx( P->ctx, P, count, x, y );
+}
@@ -0,0 +1,417 @@
+/******************************************************************************
+ * Project:  PROJ.4
+ * Purpose:  Shared cache of initialized projection definitions.
+ * Author:   Route-Me Contributors
+ *
+ ******************************************************************************
+ * Copyright (c) 2011, Route-Me Contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+#if defined(_WIN32) && !defined(__CYGWIN__)
+#  include <windows.h>
+#  define CACHE_LOCK_WIN32
+#else
+#  include <pthread.h>
+#endif
+
+#include "projects.h"
+#include <string.h>
+#include <time.h>
+
+/*
+** pj_init_plus_cached() returns a shared projection for a +proj string,
+** initializing it only the first time the definition is seen.  The
+** definition is first put in a canonical form (each +key=value once, in
+** key order, single spaced), so strings that only differ in the order
+** or repetition of their parameters share one projection.  Repeated keys
+** keep their first value, which is the one pj_param() would have found.
+**
+** Cached projections are shared between all their users, and between
+** threads, so they must be treated as read only: use the _ctx() entry
+** points rather than pj_set_ctx() to report into another context.  Each
+** pj_init_plus_cached() is balanced by a pj_free_cached().  Projections
+** nobody holds any more stay cached for reuse, up to CACHE_MAX_IDLE of
+** them, the least recently used going first.
+*/
+
+#define CACHE_BUCKETS   64
+#define CACHE_MAX_IDLE  32
+
+typedef struct PJ_CACHE_ENTRY {
+    char            *key;           /* canonical definition */
+    unsigned long   hash;
+    PJ              *P;
+    int             refcount;
+    unsigned long   last_used;
+    struct PJ_CACHE_ENTRY *next;
+} PJ_CACHE_ENTRY;
+
+static PJ_CACHE_ENTRY *cache_bucket[CACHE_BUCKETS];
+static int cache_idle = 0;              /* entries with no references */
+static unsigned long cache_clock = 0;
+static projCacheStats cache_stats;
+
+#ifdef CACHE_LOCK_WIN32
+static CRITICAL_SECTION cache_lock;
+static volatile LONG lock_state = 0;
+
+static void pj_cache_lock( void )
+
+{
+    if( InterlockedCompareExchange( &lock_state, 1, 0 ) == 0 )
+    {
+        InitializeCriticalSection( &cache_lock );
+        lock_state = 2;
+    }
+    else
+    {
+        while( lock_state != 2 )
+            Sleep( 0 );
+    }
+    EnterCriticalSection( &cache_lock );
+}
+
+#define CACHE_LOCK()    pj_cache_lock()
+#define CACHE_UNLOCK()  LeaveCriticalSection( &cache_lock )
+#else
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define CACHE_LOCK()    pthread_mutex_lock( &cache_lock )
+#define CACHE_UNLOCK()  pthread_mutex_unlock( &cache_lock )
+#endif
+
+/************************************************************************/
+/*                          pj_cache_compare()                          */
+/*                                                                      */
+/*      Order parameters by key, the part before any '='.               */
+/************************************************************************/
+
+static int pj_cache_compare( const char *a, const char *b )
+
+{
+    int ca, cb;
+
+    for( ; ; a++, b++ )
+    {
+        ca = *a == '=' ? '\0' : (unsigned char) *a;
+        cb = *b == '=' ? '\0' : (unsigned char) *b;
+
+        if( ca != cb )
+            return ca < cb ? -1 : 1;
+        if( ca == '\0' )
+            return 0;
+    }
+}
+
+/************************************************************************/
+/*                         pj_cache_canonical()                         */
+/*                                                                      */
+/*      Canonical form of a +proj definition, split the same way        */
+/*      pj_init_plus() splits it.  Returns NULL if there are too many   */
+/*      parameters.                                                     */
+/************************************************************************/
+
+static char *pj_cache_canonical( const char *definition )
+
+{
+#define MAX_ARG 200
+    char    *argv[MAX_ARG];
+    char    *copy, *key, *out;
+    int     argc = 0, i, j;
+
+    copy = (char *) pj_malloc( strlen(definition) + 1 );
+    if( copy == NULL )
+        return NULL;
+    strcpy( copy, definition );
+
+    for( i = 0; copy[i] != '\0'; i++ )
+    {
+        if( copy[i] == '+' && (i == 0 || copy[i-1] == '\0') )
+        {
+            if( argc+1 == MAX_ARG )
+            {
+                pj_dalloc( copy );
+                return NULL;
+            }
+            argv[argc++] = copy + i + 1;
+        }
+        else if( copy[i] == ' ' || copy[i] == '\t' || copy[i] == '\n' )
+            copy[i] = '\0';
+    }
+
+    /* stable insertion sort, so the first of a repeated key stays first */
+    for( i = 1; i < argc; i++ )
+    {
+        char *arg = argv[i];
+
+        for( j = i; j > 0 && pj_cache_compare( argv[j-1], arg ) > 0; j-- )
+            argv[j] = argv[j-1];
+        argv[j] = arg;
+    }
+
+    key = (char *) pj_malloc( strlen(definition) + argc + 1 );
+    if( key == NULL )
+    {
+        pj_dalloc( copy );
+        return NULL;
+    }
+
+    out = key;
+    for( i = 0; i < argc; i++ )
+    {
+        if( argv[i][0] == '\0'
+            || (i > 0 && pj_cache_compare( argv[i-1], argv[i] ) == 0) )
+            continue;
+
+        if( out != key )
+            *(out++) = ' ';
+        *(out++) = '+';
+        strcpy( out, argv[i] );
+        out += strlen( argv[i] );
+    }
+    *out = '\0';
+
+    pj_dalloc( copy );
+
+    return key;
+}
+
+/************************************************************************/
+/*                           pj_cache_hash()                            */
+/************************************************************************/
+
+static unsigned long pj_cache_hash( const char *key )
+
+{
+    unsigned long hash = 2166136261UL;
+
+    for( ; *key != '\0'; key++ )
+        hash = ((hash ^ (unsigned char) *key) * 16777619UL) & 0xffffffffUL;
+
+    return hash;
+}
+
+/************************************************************************/
+/*                           pj_cache_find()                            */
+/*                                                                      */
+/*      Look up a definition, taking a reference on it if found.        */
+/*      Called with the lock held.                                      */
+/************************************************************************/
+
+static PJ *pj_cache_find( const char *key, unsigned long hash )
+
+{
+    PJ_CACHE_ENTRY *entry;
+
+    for( entry = cache_bucket[hash % CACHE_BUCKETS];
+         entry != NULL; entry = entry->next )
+    {
+        if( entry->hash == hash && strcmp( entry->key, key ) == 0 )
+        {
+            if( entry->refcount++ == 0 )
+                cache_idle--;
+            entry->last_used = ++cache_clock;
+            return entry->P;
+        }
+    }
+
+    return NULL;
+}
+
+/************************************************************************/
+/*                           pj_cache_trim()                            */
+/*                                                                      */
+/*      Free the least recently used idle entries beyond                */
+/*      max_idle.  Called with the lock held.                           */
+/************************************************************************/
+
+static void pj_cache_trim( int max_idle )
+
+{
+    while( cache_idle > max_idle )
+    {
+        PJ_CACHE_ENTRY **link, **oldest = NULL, *entry;
+        int i;
+
+        for( i = 0; i < CACHE_BUCKETS; i++ )
+        {
+            for( link = cache_bucket + i; *link != NULL;
+                 link = &(*link)->next )
+            {
+                if( (*link)->refcount == 0
+                    && (oldest == NULL
+                        || (*link)->last_used < (*oldest)->last_used) )
+                    oldest = link;
+            }
+        }
+
+        entry = *oldest;
+        *oldest = entry->next;
+        cache_idle--;
+        cache_stats.entries--;
+
+        pj_free( entry->P );
+        pj_dalloc( entry->key );
+        pj_dalloc( entry );
+    }
+}
+
+/************************************************************************/
+/*                        pj_init_plus_cached()                         */
+/************************************************************************/
+
+PJ *pj_init_plus_cached( const char *definition )
+
+{
+    PJ_CACHE_ENTRY *entry;
+    PJ      *P, *shared = NULL;
+    char    *key;
+    unsigned long hash;
+    clock_t start;
+
+    key = pj_cache_canonical( definition );
+    if( key == NULL )
+        return pj_init_plus( definition );
+
+    hash = pj_cache_hash( key );
+
+    CACHE_LOCK();
+    cache_stats.lookups++;
+    P = pj_cache_find( key, hash );
+    if( P != NULL )
+        cache_stats.hits++;
+    CACHE_UNLOCK();
+
+    if( P != NULL )
+    {
+        pj_dalloc( key );
+        return P;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Initialize outside the lock, so one slow definition does not    */
+/*      hold up everybody else.                                         */
+/* -------------------------------------------------------------------- */
+    start = clock();
+    P = pj_init_plus_ctx( pj_get_default_ctx(), key );
+    entry = (PJ_CACHE_ENTRY *) pj_malloc( sizeof(PJ_CACHE_ENTRY) );
+
+    CACHE_LOCK();
+    cache_stats.init_seconds += (double) (clock() - start) / CLOCKS_PER_SEC;
+
+    /* another thread may have added the same definition meanwhile */
+    if( P != NULL )
+        shared = pj_cache_find( key, hash );
+
+    if( P != NULL && shared == NULL && entry != NULL )
+    {
+        entry->key = key;
+        entry->hash = hash;
+        entry->P = P;
+        entry->refcount = 1;
+        entry->last_used = ++cache_clock;
+        entry->next = cache_bucket[hash % CACHE_BUCKETS];
+        cache_bucket[hash % CACHE_BUCKETS] = entry;
+        cache_stats.entries++;
+
+        entry = NULL;
+        key = NULL;
+    }
+
+    CACHE_UNLOCK();
+
+    if( shared != NULL )
+    {
+        pj_free( P );
+        P = shared;
+    }
+    if( entry != NULL )
+        pj_dalloc( entry );
+    if( key != NULL )
+        pj_dalloc( key );
+
+    return P;
+}
+
+/************************************************************************/
+/*                           pj_free_cached()                           */
+/*                                                                      */
+/*      Drop a reference taken by pj_init_plus_cached().                */
+/************************************************************************/
+
+void pj_free_cached( PJ *P )
+
+{
+    PJ_CACHE_ENTRY *entry = NULL;
+    int i;
+
+    if( P == NULL )
+        return;
+
+    CACHE_LOCK();
+
+    for( i = 0; i < CACHE_BUCKETS && entry == NULL; i++ )
+    {
+        for( entry = cache_bucket[i]; entry != NULL; entry = entry->next )
+        {
+            if( entry->P == P )
+                break;
+        }
+    }
+
+    if( entry != NULL && --entry->refcount == 0 )
+    {
+        cache_idle++;
+        pj_cache_trim( CACHE_MAX_IDLE );
+    }
+
+    CACHE_UNLOCK();
+
+    /* not cached, because there was no memory for the entry */
+    if( entry == NULL )
+        pj_free( P );
+}
+
+/************************************************************************/
+/*                         pj_cache_get_stats()                         */
+/************************************************************************/
+
+void pj_cache_get_stats( projCacheStats *stats )
+
+{
+    CACHE_LOCK();
+    *stats = cache_stats;
+    CACHE_UNLOCK();
+}
+
+/************************************************************************/
+/*                           pj_cache_purge()                           */
+/*                                                                      */
+/*      Free all cached projections that are not in use.                */
+/************************************************************************/
+
+void pj_cache_purge()
+
+{
+    CACHE_LOCK();
+    pj_cache_trim( 0 );
+    CACHE_UNLOCK();
+}
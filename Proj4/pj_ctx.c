@@ -0,0 +1,278 @@
+/******************************************************************************
+ * Project:  PROJ.4
+ * Purpose:  Implementation of the projCtx thread context object.
+ * Author:   Route-Me Contributors
+ *
+ ******************************************************************************
+ * Copyright (c) 2011, Route-Me Contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+#if defined(_WIN32) && !defined(__CYGWIN__)
+#  include <windows.h>
+#  define CTX_TLS_WIN32
+#else
+#  include <pthread.h>
+#endif
+
+#include "projects.h"
+#include <string.h>
+
+/*
+** The context a thread is currently working on behalf of is kept in
+** thread local storage.  This lets the low level helpers (pj_phi2(),
+** nad_init(), the FORWARD/INVERSE error macros ...) keep using pj_errno
+** while still reporting into the context of the calling thread.  Threads
+** that never enter a context use the process wide default context, which
+** gives the same behaviour as the old global pj_errno.
+*/
+
+static projCtx_t default_context;
+
+#ifdef CTX_TLS_WIN32
+static DWORD current_key = TLS_OUT_OF_INDEXES;
+static volatile LONG key_state = 0;
+
+static void pj_ctx_key_init( void )
+
+{
+    if( InterlockedCompareExchange( &key_state, 1, 0 ) == 0 )
+    {
+        current_key = TlsAlloc();
+        key_state = 2;
+    }
+    else
+    {
+        while( key_state != 2 )
+            Sleep( 0 );
+    }
+}
+
+#define CTX_KEY_INIT()  if( key_state != 2 ) pj_ctx_key_init()
+#define CTX_GET()       ((projCtx_t *) TlsGetValue( current_key ))
+#define CTX_SET(ctx)    TlsSetValue( current_key, (ctx) )
+#else
+static pthread_key_t  current_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+
+static void pj_ctx_key_init( void )
+
+{
+    pthread_key_create( &current_key, NULL );
+}
+
+#define CTX_KEY_INIT()  pthread_once( &key_once, pj_ctx_key_init )
+#define CTX_GET()       ((projCtx_t *) pthread_getspecific( current_key ))
+#define CTX_SET(ctx)    pthread_setspecific( current_key, (ctx) )
+#endif
+
+/************************************************************************/
+/*                         pj_get_default_ctx()                         */
+/************************************************************************/
+
+projCtx pj_get_default_ctx()
+
+{
+    return &default_context;
+}
+
+/************************************************************************/
+/*                           pj_ctx_current()                           */
+/*                                                                      */
+/*      Return the context the calling thread is working in.            */
+/************************************************************************/
+
+projCtx_t *pj_ctx_current()
+
+{
+    projCtx_t *ctx;
+
+    CTX_KEY_INIT();
+    ctx = CTX_GET();
+
+    return ctx != NULL ? ctx : &default_context;
+}
+
+/************************************************************************/
+/*                            pj_ctx_enter()                            */
+/*                                                                      */
+/*      Make ctx the current context of the calling thread and          */
+/*      return the previous one, to be handed back to pj_ctx_leave().   */
+/************************************************************************/
+
+projCtx_t *pj_ctx_enter( projCtx_t *ctx )
+
+{
+    projCtx_t *prev;
+
+    if( ctx == NULL )
+        ctx = &default_context;
+
+    CTX_KEY_INIT();
+    prev = CTX_GET();
+    if( prev != ctx )
+        CTX_SET( ctx );
+
+    return prev;
+}
+
+/************************************************************************/
+/*                            pj_ctx_leave()                            */
+/************************************************************************/
+
+void pj_ctx_leave( projCtx_t *prev, projCtx_t *ctx )
+
+{
+    if( ctx == NULL )
+        ctx = &default_context;
+
+    if( prev != ctx )
+        CTX_SET( prev );
+}
+
+/************************************************************************/
+/*                            pj_ctx_alloc()                            */
+/*                                                                      */
+/*      Create a new context.  The file finder and search path of the   */
+/*      default context are inherited, so applications that set these  */
+/*      up once at startup do not need to repeat it for every thread.   */
+/************************************************************************/
+
+projCtx pj_ctx_alloc()
+
+{
+    projCtx_t *ctx = (projCtx_t *) pj_malloc( sizeof(projCtx_t) );
+
+    if( ctx == NULL )
+        return NULL;
+
+    memset( ctx, 0, sizeof(projCtx_t) );
+    ctx->finder = default_context.finder;
+    pj_ctx_set_searchpath( ctx, default_context.path_count,
+                           (const char **) default_context.search_path );
+
+    return ctx;
+}
+
+/************************************************************************/
+/*                            pj_ctx_free()                             */
+/*                                                                      */
+/*      Release a context along with the grids loaded through it.       */
+/*      Projections still attached to the context must not be used     */
+/*      afterwards.                                                     */
+/************************************************************************/
+
+void pj_ctx_free( projCtx ctx )
+
+{
+    if( ctx == NULL || ctx == &default_context )
+        return;
+
+    pj_ctx_deallocate_grids( ctx );
+    pj_ctx_set_searchpath( ctx, 0, NULL );
+    pj_dalloc( ctx );
+}
+
+/************************************************************************/
+/*                          pj_ctx_get_errno()                          */
+/************************************************************************/
+
+int pj_ctx_get_errno( projCtx ctx )
+
+{
+    return ctx->last_errno;
+}
+
+/************************************************************************/
+/*                          pj_ctx_set_errno()                          */
+/************************************************************************/
+
+void pj_ctx_set_errno( projCtx ctx, int new_errno )
+
+{
+    ctx->last_errno = new_errno;
+}
+
+/************************************************************************/
+/*                          pj_ctx_set_finder()                         */
+/************************************************************************/
+
+void pj_ctx_set_finder( projCtx ctx, const char *(*new_finder)(const char *) )
+
+{
+    ctx->finder = new_finder;
+}
+
+/************************************************************************/
+/*                        pj_ctx_set_searchpath()                       */
+/*                                                                      */
+/*      Call with (ctx,0,NULL) to clear the search path.                */
+/************************************************************************/
+
+void pj_ctx_set_searchpath( projCtx ctx, int count, const char **path )
+
+{
+    int i;
+
+    if( ctx->path_count > 0 && ctx->search_path != NULL )
+    {
+        for( i = 0; i < ctx->path_count; i++ )
+            pj_dalloc( ctx->search_path[i] );
+        pj_dalloc( ctx->search_path );
+    }
+    ctx->path_count = 0;
+    ctx->search_path = NULL;
+
+    if( count > 0 )
+    {
+        ctx->search_path = (char **) pj_malloc( sizeof(char *) * count );
+        for( i = 0; i < count; i++ )
+        {
+            ctx->search_path[i] = (char *) pj_malloc( strlen(path[i]) + 1 );
+            strcpy( ctx->search_path[i], path[i] );
+        }
+        ctx->path_count = count;
+    }
+}
+
+/************************************************************************/
+/*                             pj_get_ctx()                             */
+/************************************************************************/
+
+projCtx pj_get_ctx( PJ *pj )
+
+{
+    return pj->ctx;
+}
+
+/************************************************************************/
+/*                             pj_set_ctx()                             */
+/*                                                                      */
+/*      Move a projection to another context.  A projection may be      */
+/*      shared between threads when each thread passes its own          */
+/*      context to the _ctx() entry points, so this is only needed to   */
+/*      change the context used by the plain pj_fwd()/pj_inv() calls.   */
+/************************************************************************/
+
+void pj_set_ctx( PJ *pj, projCtx ctx )
+
+{
+    pj->ctx = ctx != NULL ? ctx : &default_context;
+}
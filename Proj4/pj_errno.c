@@ -5,16 +5,17 @@ static const char SCCSID[]="@(#)pj_errno.c	4.3	95/06/03	GIE	REL";
 
 #include "projects.h"
 
-int pj_errno = 0;
-
 /************************************************************************/
 /*                          pj_get_errno_ref()                          */
+/*                                                                      */
+/*      pj_errno is a macro for this, so the error code lives in the    */
+/*      context the calling thread is currently working in.             */
 /************************************************************************/
 
 int *pj_get_errno_ref()
 
 {
-    return &pj_errno;
+    return &(pj_ctx_current()->last_errno);
 }
 
 /* end */
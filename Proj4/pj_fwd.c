@@ -7,16 +7,20 @@ static const char SCCSID[]="@(#)pj_fwd.c	4.4	93/06/12	GIE	REL";
 #include <errno.h>
 # define EPS 1.0e-12
 	XY /* forward projection entry */
-pj_fwd(LP lp, PJ *P) {
+pj_fwd_ctx(projCtx ctx, LP lp, PJ *P) {
 	XY xy;
 	double t;
+	projCtx_t *prev;
 
+	if (!ctx)
+		ctx = pj_get_default_ctx();
+	prev = pj_ctx_enter(ctx);
 	/* check for forward and latitude or longitude overange */
 	if ((t = fabs(lp.phi)-HALFPI) > EPS || fabs(lp.lam) > 10.) {
 		xy.x = xy.y = HUGE_VAL;
-		pj_errno = -14;
+		ctx->last_errno = -14;
 	} else { /* proceed with projection */
-		errno = pj_errno = 0;
+		errno = ctx->last_errno = 0;
 		if (fabs(t) <= EPS)
 			lp.phi = lp.phi < 0. ? -HALFPI : HALFPI;
 		else if (P->geoc)
@@ -25,7 +29,7 @@ pj_fwd(LP lp, PJ *P) {
 		if (!P->over)
 			lp.lam = adjlon(lp.lam); /* adjust del longitude */
 		xy = (*P->fwd)(lp, P); /* project */
-		if (pj_errno || (pj_errno = errno))
+		if (ctx->last_errno || (ctx->last_errno = errno))
 			xy.x = xy.y = HUGE_VAL;
 		/* adjust for major axis and easting/northings */
 		else {
@@ -33,5 +37,10 @@ pj_fwd(LP lp, PJ *P) {
 			xy.y = P->fr_meter * (P->a * xy.y + P->y0);
 		}
 	}
+	pj_ctx_leave(prev, ctx);
 	return xy;
+}
+	XY
+pj_fwd(LP lp, PJ *P) {
+	return pj_fwd_ctx(P->ctx, lp, P);
 }
@@ -125,6 +125,11 @@ void pj_gridinfo_free( PJ_GRIDINFO *gi )
         }
     }
 
+    if( gi->map_base != NULL )
+        pj_gridmap_release( gi );
+
+    pj_gridindex_free( gi->child_index );
+
     if( gi->ct != NULL )
         nad_free( gi->ct );
     
@@ -141,10 +146,37 @@ void pj_gridinfo_free( PJ_GRIDINFO *gi )
 /*      This function is intended to implement delayed loading of       */
 /*      the data contents of a grid file.  The header and related       */
 /*      stuff are loaded by pj_gridinfo_init().                         */
+/*                                                                      */
+/*      ctable grids, and NTv1/NTv2 grids with an up to date native     */
+/*      sidecar, are memory mapped rather than read (see                */
+/*      pj_gridmap.c).                                                  */
 /************************************************************************/
 
 int pj_gridinfo_load( PJ_GRIDINFO *gi )
 
+{
+    if( gi == NULL || gi->ct == NULL )
+        return 0;
+
+    if( strcmp(gi->format,"ctable") == 0 && pj_gridmap_ctable( gi ) )
+        return 1;
+
+    if( (strcmp(gi->format,"ntv1") == 0 || strcmp(gi->format,"ntv2") == 0)
+        && pj_gridmap_native( gi ) )
+        return 1;
+
+    return pj_gridinfo_read( gi );
+}
+
+/************************************************************************/
+/*                          pj_gridinfo_read()                          */
+/*                                                                      */
+/*      Read the data contents of a grid file into memory, converting   */
+/*      them as needed.                                                 */
+/************************************************************************/
+
+int pj_gridinfo_read( PJ_GRIDINFO *gi )
+
 {
     if( gi == NULL || gi->ct == NULL )
         return 0;
@@ -51,6 +51,7 @@
 #include "projects.h"
 #include <string.h>
 #include <math.h>
+#include <errno.h>
 
 #ifdef _WIN32_WCE
 /* assert.h includes all Windows API headers and causes 'LP' name clash.
@@ -62,54 +63,269 @@
 # include <assert.h>
 #endif /* _WIN32_WCE */
 
-static PJ_GRIDINFO *grid_list = NULL;
+/*
+** The list of loaded grids, and the grid lists built for the last few
+** nadgrids strings, are kept in the context (see projCtx_t) so that
+** threads working in different contexts never share lazily loaded
+** grid state.  A list is kept for each string, so a transformation
+** between two grid shifted datums, which alternates between two strings,
+** builds each list and its index once.
+*/
 
-/* used only by pj_load_nadgrids() and pj_deallocate_grids() */
+#define PJ_GRIDLIST_CACHE 8     /* grid lists kept per context */
 
-static int           last_nadgrids_max = 0;
-static int           last_nadgrids_count = 0;
-static PJ_GRIDINFO **last_nadgrids_list = NULL;
-static char         *last_nadgrids = NULL;
+/************************************************************************/
+/*                          pj_gridlist_free()                          */
+/************************************************************************/
+
+static void pj_gridlist_free( PJ_GRIDLIST *list )
+
+{
+    pj_dalloc( list->nadgrids );
+    pj_dalloc( list->grids );
+    pj_gridindex_free( list->index );
+    pj_dalloc( list );
+}
 
 /************************************************************************/
 /*                        pj_deallocate_grids()                         */
 /*                                                                      */
-/*      Deallocate all loaded grids.                                    */
+/*      Deallocate all grids loaded in the current context.             */
 /************************************************************************/
 
 void pj_deallocate_grids()
 
 {
-    while( grid_list != NULL )
+    pj_ctx_deallocate_grids( pj_ctx_current() );
+}
+
+/************************************************************************/
+/*                      pj_ctx_deallocate_grids()                       */
+/************************************************************************/
+
+void pj_ctx_deallocate_grids( projCtx ctx )
+
+{
+    while( ctx->grid_list != NULL )
     {
-        PJ_GRIDINFO *item = grid_list;
-        grid_list = grid_list->next;
+        PJ_GRIDINFO *item = ctx->grid_list;
+        ctx->grid_list = ctx->grid_list->next;
         item->next = NULL;
 
         pj_gridinfo_free( item );
     }
 
-    if( last_nadgrids != NULL )
+    while( ctx->nadgrids_lists != NULL )
+    {
+        PJ_GRIDLIST *list = ctx->nadgrids_lists;
+        ctx->nadgrids_lists = list->next;
+
+        pj_gridlist_free( list );
+    }
+}
+
+/************************************************************************/
+/*                         pj_gridindex_bucket()                        */
+/*                                                                      */
+/*      Return the bucket of the index holding a location, or -1 if     */
+/*      the location is outside all the indexed grids.                  */
+/************************************************************************/
+
+int pj_gridindex_bucket( const PJ_GRIDINDEX *index, LP input )
+
+{
+    int ix, iy;
+
+    /* written so as to also reject NaN */
+    if( !(input.lam >= index->ll.lam && input.lam <= index->ur.lam
+          && input.phi >= index->ll.phi && input.phi <= index->ur.phi) )
+        return -1;
+
+    ix = (int) floor( (input.lam - index->ll.lam) / index->del.lam );
+    iy = (int) floor( (input.phi - index->ll.phi) / index->del.phi );
+
+    /* the upper edges belong to the last buckets */
+    ix = MAX( 0, MIN( ix, index->lim.lam - 1 ) );
+    iy = MAX( 0, MIN( iy, index->lim.phi - 1 ) );
+
+    return iy * index->lim.lam + ix;
+}
+
+/************************************************************************/
+/*                         pj_gridindex_build()                         */
+/*                                                                      */
+/*      Build a uniform bucket index over the extents of a list of      */
+/*      grids, so the grids that may hold a location can be found       */
+/*      without testing them all.  Each bucket lists the grids          */
+/*      overlapping it in the order of the list, so the first grid      */
+/*      of a bucket holding a location is also the first of the         */
+/*      whole list holding it.                                          */
+/************************************************************************/
+
+PJ_GRIDINDEX *pj_gridindex_build( PJ_GRIDINFO **grids, int count )
+
+{
+    PJ_GRIDINDEX *index;
+    LP ur;
+    int i, b, n, buckets, *fill;
+
+    if( count < 1 )
+        return NULL;
+
+    index = (PJ_GRIDINDEX *) pj_malloc( sizeof(PJ_GRIDINDEX) );
+    if( index == NULL )
+        return NULL;
+
+/* -------------------------------------------------------------------- */
+/*      Size the index on the extent of all the grids, with a few       */
+/*      buckets per grid.                                               */
+/* -------------------------------------------------------------------- */
+    index->ll = grids[0]->ct->ll;
+    ur = index->ll;
+    for( i = 0; i < count; i++ )
+    {
+        struct CTABLE *ct = grids[i]->ct;
+
+        index->ll.lam = MIN( index->ll.lam, ct->ll.lam );
+        index->ll.phi = MIN( index->ll.phi, ct->ll.phi );
+        ur.lam = MAX( ur.lam, ct->ll.lam + (ct->lim.lam-1) * ct->del.lam );
+        ur.phi = MAX( ur.phi, ct->ll.phi + (ct->lim.phi-1) * ct->del.phi );
+    }
+
+    index->ur = ur;
+
+    n = (int) ceil( sqrt( 4.0 * count ) );
+    if( n > 64 )
+        n = 64;
+    index->lim.lam = index->lim.phi = n;
+    index->del.lam = (ur.lam - index->ll.lam) / n;
+    index->del.phi = (ur.phi - index->ll.phi) / n;
+    if( index->del.lam <= 0.0 )
+        index->del.lam = 1.0;
+    if( index->del.phi <= 0.0 )
+        index->del.phi = 1.0;
+
+    buckets = n * n;
+    index->first = (int *) pj_malloc( sizeof(int) * (buckets + 1) );
+    fill = (int *) pj_malloc( sizeof(int) * buckets );
+    if( index->first == NULL || fill == NULL )
     {
-        pj_dalloc( last_nadgrids );
-        last_nadgrids = NULL;
+        pj_dalloc( fill );
+        index->items = NULL;
+        pj_gridindex_free( index );
+        return NULL;
+    }
+    memset( fill, 0, sizeof(int) * buckets );
 
-        pj_dalloc( last_nadgrids_list );
-        last_nadgrids_list = NULL;
+/* -------------------------------------------------------------------- */
+/*      Count the grids overlapping each bucket, then place them.       */
+/* -------------------------------------------------------------------- */
+    for( b = 0; b < 2; b++ )
+    {
+        for( i = 0; i < count; i++ )
+        {
+            struct CTABLE *ct = grids[i]->ct;
+            LP corner;
+            int lo, hi, ix, iy;
 
-        last_nadgrids_count = 0;
-        last_nadgrids_max = 0;
+            lo = pj_gridindex_bucket( index, ct->ll );
+            corner.lam = ct->ll.lam + (ct->lim.lam-1) * ct->del.lam;
+            corner.phi = ct->ll.phi + (ct->lim.phi-1) * ct->del.phi;
+            hi = pj_gridindex_bucket( index, corner );
+
+            for( iy = lo / n; iy <= hi / n; iy++ )
+                for( ix = lo % n; ix <= hi % n; ix++ )
+                {
+                    if( b == 0 )
+                        fill[iy * n + ix]++;
+                    else
+                        index->items[fill[iy * n + ix]++] = grids[i];
+                }
+        }
+
+        if( b == 0 )
+        {
+            index->first[0] = 0;
+            for( i = 0; i < buckets; i++ )
+            {
+                index->first[i+1] = index->first[i] + fill[i];
+                fill[i] = index->first[i];
+            }
+
+            index->items = (PJ_GRIDINFO **)
+                pj_malloc( sizeof(PJ_GRIDINFO *) * (index->first[buckets] + 1) );
+            if( index->items == NULL )
+            {
+                pj_dalloc( fill );
+                pj_gridindex_free( index );
+                return NULL;
+            }
+        }
     }
+
+    pj_dalloc( fill );
+
+    return index;
+}
+
+/************************************************************************/
+/*                          pj_gridindex_free()                         */
+/************************************************************************/
+
+void pj_gridindex_free( PJ_GRIDINDEX *index )
+
+{
+    if( index == NULL )
+        return;
+
+    pj_dalloc( index->first );
+    pj_dalloc( index->items );
+    pj_dalloc( index );
+}
+
+/************************************************************************/
+/*                      pj_gridindex_build_child()                      */
+/*                                                                      */
+/*      Index the children of a grid, if not done yet.  Returns zero    */
+/*      if out of memory.  pj_apply_gridshift() only looks at the       */
+/*      children of the grids of a list, not at their children, as      */
+/*      the NTv2 reader only attaches subgrids to top level grids.      */
+/************************************************************************/
+
+static int pj_gridindex_build_child( PJ_GRIDINFO *gi )
+
+{
+    PJ_GRIDINFO *child, **children;
+    int count = 0;
+
+    if( gi->child == NULL || gi->child_index != NULL )
+        return 1;
+
+    for( child = gi->child; child != NULL; child = child->next )
+        count++;
+
+    children = (PJ_GRIDINFO **) pj_malloc( sizeof(PJ_GRIDINFO *) * count );
+    if( children == NULL )
+        return 0;
+
+    count = 0;
+    for( child = gi->child; child != NULL; child = child->next )
+        children[count++] = child;
+
+    gi->child_index = pj_gridindex_build( children, count );
+    pj_dalloc( children );
+
+    return gi->child_index != NULL;
 }
 
 /************************************************************************/
 /*                       pj_gridlist_merge_grid()                       */
 /*                                                                      */
-/*      Find/load the named gridfile and merge it into the              */
-/*      last_nadgrids_list.                                             */
+/*      Find/load the named gridfile and merge it into the grid list.  */
 /************************************************************************/
 
-static int pj_gridlist_merge_gridfile( const char *gridname )
+static int pj_gridlist_merge_gridfile( projCtx_t *ctx, PJ_GRIDLIST *list,
+                                       const char *gridname )
 
 {
     int i, got_match=0;
@@ -120,7 +336,7 @@ static int pj_gridlist_merge_gridfile( const char *gridname )
 /*      matching grids as with NTv2 we can get many grids from one      */
 /*      file (one shared gridname).                                     */
 /* -------------------------------------------------------------------- */
-    for( this_grid = grid_list; this_grid != NULL; this_grid = this_grid->next)
+    for( this_grid = ctx->grid_list; this_grid != NULL; this_grid = this_grid->next)
     {
         if( strcmp(this_grid->gridname,gridname) == 0 )
         {
@@ -131,26 +347,26 @@ static int pj_gridlist_merge_gridfile( const char *gridname )
                 return 0;
 
             /* do we need to grow the list? */
-            if( last_nadgrids_count >= last_nadgrids_max - 2 )
+            if( list->count >= list->max - 2 )
             {
                 PJ_GRIDINFO **new_list;
-                int new_max = last_nadgrids_max + 20;
+                int new_max = list->max + 20;
 
                 new_list = (PJ_GRIDINFO **) pj_malloc(sizeof(void*) * new_max);
-                if( last_nadgrids_list != NULL )
+                if( list->grids != NULL )
                 {
-                    memcpy( new_list, last_nadgrids_list, 
-                            sizeof(void*) * last_nadgrids_max );
-                    pj_dalloc( last_nadgrids_list );
+                    memcpy( new_list, list->grids, 
+                            sizeof(void*) * list->max );
+                    pj_dalloc( list->grids );
                 }
 
-                last_nadgrids_list = new_list;
-                last_nadgrids_max = new_max;
+                list->grids = new_list;
+                list->max = new_max;
             }
 
             /* add to the list */
-            last_nadgrids_list[last_nadgrids_count++] = this_grid;
-            last_nadgrids_list[last_nadgrids_count] = NULL;
+            list->grids[list->count++] = this_grid;
+            list->grids[list->count] = NULL;
         }
 
         tail = this_grid;
@@ -174,54 +390,98 @@ static int pj_gridlist_merge_gridfile( const char *gridname )
     if( tail != NULL )
         tail->next = this_grid;
     else
-        grid_list = this_grid;
+        ctx->grid_list = this_grid;
 
 /* -------------------------------------------------------------------- */
 /*      Recurse to add the grid now that it is loaded.                  */
 /* -------------------------------------------------------------------- */
-    return pj_gridlist_merge_gridfile( gridname );
+    return pj_gridlist_merge_gridfile( ctx, list, gridname );
 }
 
 /************************************************************************/
-/*                     pj_gridlist_from_nadgrids()                      */
+/*                          pj_gridlist_get()                           */
 /*                                                                      */
 /*      This functions loads the list of grids corresponding to a       */
-/*      particular nadgrids string into a list, and returns it.  The    */
-/*      list is kept around till a request is made with a different     */
-/*      string in order to cut down on the string parsing cost, and     */
-/*      the cost of building the list of tables each time.              */
+/*      particular nadgrids string, indexed for pj_apply_gridshift(),   */
+/*      and returns it.  The lists of the last few strings are kept     */
+/*      around in order to cut down on the string parsing cost, and     */
+/*      the cost of building the list of tables and its index each      */
+/*      time.  Returns NULL, with pj_errno set, if a required grid      */
+/*      cannot be found, or if no grid was found (with pj_errno zero    */
+/*      the first time, and -38 once the string is known).              */
 /************************************************************************/
 
-PJ_GRIDINFO **pj_gridlist_from_nadgrids( const char *nadgrids, int *grid_count)
+PJ_GRIDLIST *pj_gridlist_get( const char *nadgrids )
 
 {
     const char *s;
+    projCtx_t *ctx = pj_ctx_current();
+    PJ_GRIDLIST *list, **link;
+    int i;
 
     pj_errno = 0;
-    *grid_count = 0;
 
-    if( last_nadgrids != NULL 
-        && strcmp(nadgrids,last_nadgrids) == 0 )
+/* -------------------------------------------------------------------- */
+/*      Look for the list among those already built, and move it to     */
+/*      the front.                                                      */
+/* -------------------------------------------------------------------- */
+    for( link = &ctx->nadgrids_lists; *link != NULL; link = &(*link)->next )
     {
-        *grid_count = last_nadgrids_count;
-        if( *grid_count == 0 )
-            pj_errno = -38;
+        list = *link;
 
-        return last_nadgrids_list;
+        if( strcmp(nadgrids,list->nadgrids) == 0 )
+        {
+            *link = list->next;
+            list->next = ctx->nadgrids_lists;
+            ctx->nadgrids_lists = list;
+
+            if( list->count == 0 )
+            {
+                pj_errno = -38;
+                return NULL;
+            }
+
+            return list;
+        }
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Drop the least recently used lists if the cache is full.        */
+/* -------------------------------------------------------------------- */
+    for( link = &ctx->nadgrids_lists, i = 0; *link != NULL;
+         link = &(*link)->next, i++ )
+    {
+        if( i == PJ_GRIDLIST_CACHE - 1 )
+        {
+            while( *link != NULL )
+            {
+                list = *link;
+                *link = list->next;
+                pj_gridlist_free( list );
+            }
+            break;
+        }
     }
 
 /* -------------------------------------------------------------------- */
-/*      Free old one, if any, and make space for new list.              */
+/*      Make space for the new list.                                    */
 /* -------------------------------------------------------------------- */
-    if( last_nadgrids != NULL )
+    list = (PJ_GRIDLIST *) pj_malloc( sizeof(PJ_GRIDLIST) );
+    if( list == NULL )
     {
-        pj_dalloc(last_nadgrids);
+        pj_errno = ENOMEM;
+        return NULL;
     }
-    
-    last_nadgrids = (char *) pj_malloc(strlen(nadgrids)+1);
-    strcpy( last_nadgrids, nadgrids );
+    memset( list, 0, sizeof(PJ_GRIDLIST) );
 
-    last_nadgrids_count = 0;
+    list->nadgrids = (char *) pj_malloc(strlen(nadgrids)+1);
+    if( list->nadgrids == NULL )
+    {
+        pj_gridlist_free( list );
+        pj_errno = ENOMEM;
+        return NULL;
+    }
+    strcpy( list->nadgrids, nadgrids );
 
 /* -------------------------------------------------------------------- */
 /*      Loop processing names out of nadgrids one at a time.            */
@@ -244,6 +504,7 @@ PJ_GRIDINFO **pj_gridlist_from_nadgrids( const char *nadgrids, int *grid_count)
 
         if( end_char > sizeof(name) )
         {
+            pj_gridlist_free( list );
             pj_errno = -38;
             return NULL;
         }
@@ -255,8 +516,9 @@ PJ_GRIDINFO **pj_gridlist_from_nadgrids( const char *nadgrids, int *grid_count)
         if( *s == ',' )
             s++;
 
-        if( !pj_gridlist_merge_gridfile( name ) && required )
+        if( !pj_gridlist_merge_gridfile( ctx, list, name ) && required )
         {
+            pj_gridlist_free( list );
             pj_errno = -38;
             return NULL;
         }
@@ -264,11 +526,46 @@ PJ_GRIDINFO **pj_gridlist_from_nadgrids( const char *nadgrids, int *grid_count)
             pj_errno = 0;
     }
 
-    if( last_nadgrids_count > 0 )
+/* -------------------------------------------------------------------- */
+/*      Index the list, and the children of each grid, for              */
+/*      pj_apply_gridshift().                                           */
+/* -------------------------------------------------------------------- */
+    if( list->count > 0 )
     {
-        *grid_count = last_nadgrids_count;
-        return last_nadgrids_list;
+        for( i = 0; i < list->count; i++ )
+        {
+            if( !pj_gridindex_build_child( list->grids[i] ) )
+                break;
+        }
+
+        if( i < list->count
+            || (list->index = pj_gridindex_build( list->grids,
+                                                  list->count )) == NULL )
+        {
+            pj_gridlist_free( list );
+            pj_errno = ENOMEM;
+            return NULL;
+        }
     }
-    else
-        return NULL;
+
+    list->next = ctx->nadgrids_lists;
+    ctx->nadgrids_lists = list;
+
+    return list->count > 0 ? list : NULL;
+}
+
+/************************************************************************/
+/*                     pj_gridlist_from_nadgrids()                      */
+/*                                                                      */
+/*      The grids of pj_gridlist_get(), NULL terminated.                */
+/************************************************************************/
+
+PJ_GRIDINFO **pj_gridlist_from_nadgrids( const char *nadgrids, int *grid_count)
+
+{
+    PJ_GRIDLIST *list = pj_gridlist_get( nadgrids );
+
+    *grid_count = list != NULL ? list->count : 0;
+
+    return list != NULL ? list->grids : NULL;
 }
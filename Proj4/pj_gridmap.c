@@ -0,0 +1,414 @@
+/******************************************************************************
+ * Project:  PROJ.4
+ * Purpose:  Memory mapped grid shift tables, and the "native" sidecar
+ *           format holding NTv1/NTv2 grids preconverted for mapping.
+ * Author:   Route-Me Contributors
+ *
+ ******************************************************************************
+ * Copyright (c) 2011, Route-Me Contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+#define PJ_LIB__
+
+#include "projects.h"
+#include <string.h>
+#include <errno.h>
+
+#if !defined(_WIN32) || defined(__CYGWIN__)
+#  include <sys/types.h>
+#  include <sys/stat.h>
+#  include <sys/mman.h>
+#  include <unistd.h>
+#  define HAVE_GRIDMAP
+#endif
+
+/*
+** A ctable file is the CTABLE header followed by the FLP array in the
+** byte order of the machine that wrote it, so the array can be mapped
+** straight from the file.  NTv1 and NTv2 grids need converting (byte
+** order, seconds to radians, and rows stored east to west) before use,
+** so for those a "native" sidecar file, named after the grid file with
+** PJ_NATIVE_SUFFIX appended, may hold the converted arrays:
+**
+**      PJ_NATIVE_HEADER
+**      PJ_NATIVE_GRID[grid_count]
+**      FLP arrays, each starting on a NATIVE_ALIGN boundary
+**
+** all in native byte order.  The sidecar records the size and
+** modification time of the grid file it was made from and is ignored
+** once those no longer match.  Use "nad2bin -n gridfile" to write one.
+**
+** Mapped grids are paged in by the system as cells are touched, and the
+** pages are shared with every other process mapping the same file.  Where
+** mapping is not available, or fails, grids are read into memory as
+** before.
+*/
+
+#define NATIVE_MAGIC      "PJNATIVE"
+#define NATIVE_BYTE_ORDER 0x01020304
+#define NATIVE_VERSION    1
+#define NATIVE_ALIGN      16384
+
+typedef struct {
+    char    magic[8];
+    int     byte_order;     /* NATIVE_BYTE_ORDER as written */
+    int     version;
+    int     grid_count;
+    int     flp_size;       /* sizeof(FLP) */
+    double  source_size;    /* size and mtime of the source grid file */
+    double  source_mtime;
+} PJ_NATIVE_HEADER;
+
+typedef struct {
+    double  grid_offset;    /* PJ_GRIDINFO grid_offset in the source file */
+    double  data_offset;    /* offset of the FLP array in the sidecar */
+    int     lim_lam, lim_phi;
+} PJ_NATIVE_GRID;
+
+#ifdef HAVE_GRIDMAP
+
+/************************************************************************/
+/*                         pj_gridmap_source()                          */
+/*                                                                      */
+/*      Fetch the size and modification time of a grid file.            */
+/************************************************************************/
+
+static int pj_gridmap_source( const char *filename,
+                              double *size, double *mtime )
+
+{
+    struct stat sbuf;
+    FILE *fid;
+    int ok;
+
+    if( (fid = pj_open_lib( (char *) filename, "rb" )) == NULL )
+        return 0;
+
+    ok = fstat( fileno(fid), &sbuf ) == 0;
+    fclose( fid );
+
+    if( ok )
+    {
+        *size = (double) sbuf.st_size;
+        *mtime = (double) sbuf.st_mtime;
+    }
+
+    return ok;
+}
+
+/************************************************************************/
+/*                          pj_gridmap_range()                          */
+/*                                                                      */
+/*      Map size bytes at offset of an open file, and point the         */
+/*      grid's conversion matrix at them.                               */
+/************************************************************************/
+
+static int pj_gridmap_range( PJ_GRIDINFO *gi, FILE *fid,
+                             long offset, size_t size )
+
+{
+    struct stat sbuf;
+    long page = sysconf( _SC_PAGESIZE );
+    long start = offset - offset % page;
+    void *base;
+
+    /* touching pages past the end of the file would fault */
+    if( fstat( fileno(fid), &sbuf ) != 0
+        || (double) offset + size > (double) sbuf.st_size )
+        return 0;
+
+    base = mmap( NULL, size + (offset - start), PROT_READ, MAP_SHARED,
+                 fileno(fid), start );
+    if( base == MAP_FAILED )
+        return 0;
+
+    gi->map_base = base;
+    gi->map_size = size + (offset - start);
+    gi->ct->cvs = (FLP *) ((char *) base + (offset - start));
+
+    if( getenv("PROJ_DEBUG") != NULL )
+        fprintf( stderr, "pj_gridmap: mapped %ld bytes for grid %s of %s\n",
+                 (long) size, gi->ct->id, gi->filename );
+
+    return 1;
+}
+
+/************************************************************************/
+/*                         pj_gridmap_release()                         */
+/************************************************************************/
+
+void pj_gridmap_release( PJ_GRIDINFO *gi )
+
+{
+    if( gi->map_base == NULL )
+        return;
+
+    munmap( gi->map_base, gi->map_size );
+    gi->map_base = NULL;
+    gi->map_size = 0;
+    if( gi->ct != NULL )
+        gi->ct->cvs = NULL;
+}
+
+/************************************************************************/
+/*                          pj_gridmap_ctable()                         */
+/*                                                                      */
+/*      Map the conversion matrix of a ctable grid.                     */
+/************************************************************************/
+
+int pj_gridmap_ctable( PJ_GRIDINFO *gi )
+
+{
+    FILE *fid;
+    int result;
+
+    if( (fid = pj_open_lib( gi->filename, "rb" )) == NULL )
+        return 0;
+
+    result = pj_gridmap_range( gi, fid, (long) sizeof(struct CTABLE),
+                               sizeof(FLP) * gi->ct->lim.lam * gi->ct->lim.phi );
+    fclose( fid );
+
+    return result;
+}
+
+/************************************************************************/
+/*                          pj_gridmap_native()                         */
+/*                                                                      */
+/*      Map the conversion matrix of a NTv1/NTv2 grid from its          */
+/*      native sidecar, if there is an up to date one.                  */
+/************************************************************************/
+
+int pj_gridmap_native( PJ_GRIDINFO *gi )
+
+{
+    char name[MAX_PATH_FILENAME+1];
+    PJ_NATIVE_HEADER header;
+    PJ_NATIVE_GRID grid;
+    double size, mtime;
+    FILE *fid;
+    int i, result = 0;
+
+    if( strlen(gi->filename) + strlen(PJ_NATIVE_SUFFIX) > MAX_PATH_FILENAME )
+        return 0;
+
+    sprintf( name, "%s%s", gi->filename, PJ_NATIVE_SUFFIX );
+    if( (fid = pj_open_lib( name, "rb" )) == NULL )
+        return 0;
+
+    if( fread( &header, sizeof(header), 1, fid ) != 1
+        || memcmp( header.magic, NATIVE_MAGIC, 8 ) != 0
+        || header.byte_order != NATIVE_BYTE_ORDER
+        || header.version != NATIVE_VERSION
+        || header.flp_size != sizeof(FLP)
+        || !pj_gridmap_source( gi->filename, &size, &mtime )
+        || header.source_size != size || header.source_mtime != mtime )
+    {
+        if( getenv("PROJ_DEBUG") != NULL )
+            fprintf( stderr, "pj_gridmap: ignoring stale or foreign %s\n",
+                     name );
+        fclose( fid );
+        return 0;
+    }
+
+    for( i = 0; i < header.grid_count; i++ )
+    {
+        if( fread( &grid, sizeof(grid), 1, fid ) != 1 )
+            break;
+
+        if( grid.grid_offset == gi->grid_offset
+            && grid.lim_lam == gi->ct->lim.lam
+            && grid.lim_phi == gi->ct->lim.phi )
+        {
+            result = pj_gridmap_range( gi, fid, (long) grid.data_offset,
+                                       sizeof(FLP) * grid.lim_lam * grid.lim_phi );
+            break;
+        }
+    }
+
+    fclose( fid );
+
+    return result;
+}
+
+#else /* ndef HAVE_GRIDMAP */
+
+void pj_gridmap_release( PJ_GRIDINFO *gi ) {}
+int pj_gridmap_ctable( PJ_GRIDINFO *gi ) { return 0; }
+int pj_gridmap_native( PJ_GRIDINFO *gi ) { return 0; }
+
+static int pj_gridmap_source( const char *filename,
+                              double *size, double *mtime )
+{
+    return 0;
+}
+
+#endif /* def HAVE_GRIDMAP */
+
+/************************************************************************/
+/*                          pj_gridmap_collect()                        */
+/*                                                                      */
+/*      Flatten a grid list, with the children of each grid, into an    */
+/*      array.  Returns the number of grids, only counting them when    */
+/*      list is NULL.                                                   */
+/************************************************************************/
+
+static int pj_gridmap_collect( PJ_GRIDINFO *gi, PJ_GRIDINFO **list, int n )
+
+{
+    for( ; gi != NULL; gi = gi->next )
+    {
+        if( gi->ct == NULL )
+            continue;
+
+        if( list != NULL )
+            list[n] = gi;
+        n = pj_gridmap_collect( gi->child, list, n + 1 );
+    }
+
+    return n;
+}
+
+/************************************************************************/
+/*                      pj_gridinfo_write_native()                      */
+/*                                                                      */
+/*      Write the native sidecar for the named NTv1/NTv2 grid file      */
+/*      to filename.  The sidecar is only picked up when it is found    */
+/*      next to the grid file, under the grid file name with            */
+/*      PJ_NATIVE_SUFFIX appended.                                      */
+/************************************************************************/
+
+int pj_gridinfo_write_native( const char *gridname, const char *filename )
+
+{
+    PJ_GRIDINFO *gilist, **grids = NULL;
+    PJ_NATIVE_HEADER header;
+    PJ_NATIVE_GRID *table = NULL;
+    FILE *fp = NULL;
+    double offset;
+    int i, count, result = 0;
+
+    gilist = pj_gridinfo_init( gridname );
+    if( gilist == NULL || gilist->ct == NULL
+        || (strcmp(gilist->format,"ntv1") != 0
+            && strcmp(gilist->format,"ntv2") != 0) )
+    {
+        /* ctable grids are mapped straight from the grid file */
+        pj_errno = -38;
+        goto done;
+    }
+
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, NATIVE_MAGIC, 8 );
+    header.byte_order = NATIVE_BYTE_ORDER;
+    header.version = NATIVE_VERSION;
+    header.flp_size = sizeof(FLP);
+    if( !pj_gridmap_source( gilist->filename,
+                            &header.source_size, &header.source_mtime ) )
+    {
+        pj_errno = -38;
+        goto done;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Lay out the grids.                                              */
+/* -------------------------------------------------------------------- */
+    count = pj_gridmap_collect( gilist, NULL, 0 );
+    grids = (PJ_GRIDINFO **) pj_malloc( sizeof(PJ_GRIDINFO *) * count );
+    table = (PJ_NATIVE_GRID *) pj_malloc( sizeof(PJ_NATIVE_GRID) * count );
+    if( grids == NULL || table == NULL )
+    {
+        pj_errno = ENOMEM;
+        goto done;
+    }
+    pj_gridmap_collect( gilist, grids, 0 );
+    header.grid_count = count;
+
+    offset = sizeof(header) + sizeof(PJ_NATIVE_GRID) * count;
+    for( i = 0; i < count; i++ )
+    {
+        offset = ceil( offset / NATIVE_ALIGN ) * NATIVE_ALIGN;
+        table[i].grid_offset = grids[i]->grid_offset;
+        table[i].data_offset = offset;
+        table[i].lim_lam = grids[i]->ct->lim.lam;
+        table[i].lim_phi = grids[i]->ct->lim.phi;
+        offset += sizeof(FLP) * table[i].lim_lam * table[i].lim_phi;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Write the header and the converted grids, one at a time so      */
+/*      only one is in memory at once.                                  */
+/* -------------------------------------------------------------------- */
+    if( (fp = fopen( filename, "wb" )) == NULL )
+    {
+        pj_errno = errno;
+        goto done;
+    }
+
+    if( fwrite( &header, sizeof(header), 1, fp ) != 1
+        || fwrite( table, sizeof(PJ_NATIVE_GRID), count, fp ) != count )
+    {
+        pj_errno = -38;
+        goto done;
+    }
+
+    for( i = 0; i < count; i++ )
+    {
+        size_t size = sizeof(FLP) * table[i].lim_lam * table[i].lim_phi;
+        int ok;
+
+        if( fseek( fp, (long) table[i].data_offset, SEEK_SET ) != 0
+            || !pj_gridinfo_read( grids[i] ) )
+        {
+            pj_errno = -38;
+            goto done;
+        }
+
+        ok = fwrite( grids[i]->ct->cvs, size, 1, fp ) == 1;
+        pj_dalloc( grids[i]->ct->cvs );
+        grids[i]->ct->cvs = NULL;
+        if( !ok )
+        {
+            pj_errno = -38;
+            goto done;
+        }
+    }
+
+    result = 1;
+
+  done:
+    if( fp != NULL && fclose( fp ) != 0 )
+        result = 0;
+    if( fp != NULL && !result )
+        remove( filename );
+    pj_dalloc( grids );
+    pj_dalloc( table );
+    while( gilist != NULL )
+    {
+        PJ_GRIDINFO *next = gilist->next;
+
+        gilist->next = NULL;
+        pj_gridinfo_free( gilist );
+        gilist = next;
+    }
+
+    return result;
+}
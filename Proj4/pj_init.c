@@ -86,6 +86,8 @@ PJ_CVSID("$Id: pj_init.c,v 1.19 2007/11/26 00:21:59 fwarmerdam Exp $");
 
 extern FILE *pj_open_lib(char *, char *);
 
+static PJ *init_in_ctx(projCtx, int, char **);
+
 /************************************************************************/
 /*                              get_opt()                               */
 /************************************************************************/
@@ -182,6 +184,17 @@ get_init(paralist **start, paralist *next, char *name) {
 PJ *
 pj_init_plus( const char *definition )
 
+{
+    return pj_init_plus_ctx( pj_ctx_current(), definition );
+}
+
+/************************************************************************/
+/*                          pj_init_plus_ctx()                          */
+/************************************************************************/
+
+PJ *
+pj_init_plus_ctx( projCtx ctx, const char *definition )
+
 {
 #define MAX_ARG 200
     char	*argv[MAX_ARG];
@@ -204,7 +217,8 @@ pj_init_plus( const char *definition )
             {
                 if( argc+1 == MAX_ARG )
                 {
-                    pj_errno = -44;
+                    pj_ctx_set_errno( ctx, -44 );
+                    pj_dalloc( defn_copy );
                     return NULL;
                 }
                 
@@ -224,7 +238,7 @@ pj_init_plus( const char *definition )
     }
 
     /* perform actual initialization */
-    result = pj_init( argc, argv );
+    result = pj_init_ctx( ctx, argc, argv );
 
     pj_dalloc( defn_copy );
 
@@ -242,6 +256,35 @@ pj_init_plus( const char *definition )
 
 PJ *
 pj_init(int argc, char **argv) {
+	return pj_init_ctx(pj_ctx_current(), argc, argv);
+}
+
+/************************************************************************/
+/*                            pj_init_ctx()                             */
+/*                                                                      */
+/*      Initialize a projection attached to the given context.  All     */
+/*      errors and the +init file lookups go through that context.      */
+/************************************************************************/
+
+PJ *
+pj_init_ctx(projCtx ctx, int argc, char **argv) {
+	projCtx_t *prev;
+	PJ *PIN;
+
+	if (!ctx)
+		ctx = pj_get_default_ctx();
+	prev = pj_ctx_enter(ctx);
+	PIN = init_in_ctx(ctx, argc, argv);
+	pj_ctx_leave(prev, ctx);
+	return PIN;
+}
+
+/************************************************************************/
+/*                            init_in_ctx()                             */
+/************************************************************************/
+
+static PJ *
+init_in_ctx(projCtx ctx, int argc, char **argv) {
 	char *s, *name;
         paralist *start = NULL;
 	PJ *(*proj)(PJ *);
@@ -284,6 +327,7 @@ pj_init(int argc, char **argv) {
 	/* allocate projection structure */
 	if (!(PIN = (*proj)(0))) goto bum_call;
 	PIN->params = start;
+        PIN->ctx = ctx;
         PIN->is_latlong = 0;
         PIN->is_geocent = 0;
         PIN->long_wrap_center = 0.0;
@@ -7,19 +7,23 @@ static const char SCCSID[]="@(#)pj_inv.c	4.5	93/06/12	GIE	REL";
 #include <errno.h>
 # define EPS 1.0e-12
 	LP /* inverse projection entry */
-pj_inv(XY xy, PJ *P) {
+pj_inv_ctx(projCtx ctx, XY xy, PJ *P) {
 	LP lp;
+	projCtx_t *prev;
 
+	if (!ctx)
+		ctx = pj_get_default_ctx();
+	prev = pj_ctx_enter(ctx);
 	/* can't do as much preliminary checking as with forward */
 	if (xy.x == HUGE_VAL || xy.y == HUGE_VAL) {
 		lp.lam = lp.phi = HUGE_VAL;
-		pj_errno = -15;
+		ctx->last_errno = -15;
 	}
-	errno = pj_errno = 0;
+	errno = ctx->last_errno = 0;
 	xy.x = (xy.x * P->to_meter - P->x0) * P->ra; /* descale and de-offset */
 	xy.y = (xy.y * P->to_meter - P->y0) * P->ra;
 	lp = (*P->inv)(xy, P); /* inverse project */
-	if (pj_errno || (pj_errno = errno))
+	if (ctx->last_errno || (ctx->last_errno = errno))
 		lp.lam = lp.phi = HUGE_VAL;
 	else {
 		lp.lam += P->lam0; /* reduce from del lp.lam */
@@ -28,5 +32,10 @@ pj_inv(XY xy, PJ *P) {
 		if (P->geoc && fabs(fabs(lp.phi)-HALFPI) > EPS)
 			lp.phi = atan(P->one_es * tan(lp.phi));
 	}
+	pj_ctx_leave(prev, ctx);
 	return lp;
+}
+	LP
+pj_inv(XY xy, PJ *P) {
+	return pj_inv_ctx(P->ctx, xy, P);
 }
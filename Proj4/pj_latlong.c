@@ -61,6 +61,24 @@ INVERSE(inverse);
         lp.lam = xy.x * P->a;
         return lp;
 }
+FORWARD_N(forward_n) {
+        double a = P->a;
+        long i;
+
+        for (i = 0; i < count; ++i)
+                lam[i] = lam[i] == HUGE_VAL ? HUGE_VAL : lam[i] / a;
+        for (i = 0; i < count; ++i)
+                phi[i] = phi[i] == HUGE_VAL ? HUGE_VAL : phi[i] / a;
+}
+INVERSE_N(inverse_n) {
+        double a = P->a;
+        long i;
+
+        for (i = 0; i < count; ++i)
+                y[i] = y[i] == HUGE_VAL ? HUGE_VAL : y[i] * a;
+        for (i = 0; i < count; ++i)
+                x[i] = x[i] == HUGE_VAL ? HUGE_VAL : x[i] * a;
+}
 FREEUP; if (P) pj_dalloc(P); }
 
 ENTRY0(latlong)
@@ -68,6 +86,7 @@ ENTRY0(latlong)
         P->x0 = 0.0;
         P->y0 = 0.0;
 	P->inv = inverse; P->fwd = forward;
+	P->inv_n = inverse_n; P->fwd_n = forward_n;
 ENDENTRY(P)
 
 ENTRY0(longlat)
@@ -75,6 +94,7 @@ ENTRY0(longlat)
         P->x0 = 0.0;
         P->y0 = 0.0;
 	P->inv = inverse; P->fwd = forward;
+	P->inv_n = inverse_n; P->fwd_n = forward_n;
 ENDENTRY(P)
 
 ENTRY0(latlon)
@@ -82,6 +102,7 @@ ENTRY0(latlon)
         P->x0 = 0.0;
         P->y0 = 0.0;
 	P->inv = inverse; P->fwd = forward;
+	P->inv_n = inverse_n; P->fwd_n = forward_n;
 ENDENTRY(P)
 
 ENTRY0(lonlat)
@@ -89,4 +110,5 @@ ENTRY0(lonlat)
         P->x0 = 0.0;
         P->y0 = 0.0;
 	P->inv = inverse; P->fwd = forward;
+	P->inv_n = inverse_n; P->fwd_n = forward_n;
 ENDENTRY(P)
@@ -56,9 +56,6 @@
 
 PJ_CVSID("$Id: pj_open_lib.c,v 1.9 2007/07/06 14:58:03 fwarmerdam Exp $");
 
-static const char *(*pj_finder)(const char *) = NULL;
-static int path_count = 0;
-static char **search_path = NULL;
 static char * proj_lib_name =
 #ifdef PROJ_LIB
 PROJ_LIB;
@@ -68,12 +65,15 @@ PROJ_LIB;
 
 /************************************************************************/
 /*                           pj_set_finder()                            */
+/*                                                                      */
+/*      Sets the finder of the default context.  Contexts created       */
+/*      afterwards with pj_ctx_alloc() inherit it.                      */
 /************************************************************************/
 
 void pj_set_finder( const char *(*new_finder)(const char *) )
 
 {
-    pj_finder = new_finder;
+    pj_ctx_set_finder( pj_get_default_ctx(), new_finder );
 }
 
 /************************************************************************/
@@ -81,35 +81,13 @@ void pj_set_finder( const char *(*new_finder)(const char *) )
 /*                                                                      */
 /*      Path control for callers that can't practically provide         */
 /*      pj_set_finder() style callbacks.  Call with (0,NULL) as args    */
-/*      to clear the searchpath set.                                    */
+/*      to clear the searchpath set.  Like pj_set_finder() this         */
+/*      applies to the default context.                                 */
 /************************************************************************/
 
 void pj_set_searchpath ( int count, const char **path )
 {
-    int i;
-
-    if (path_count > 0 && search_path != NULL)
-    {
-        for (i = 0; i < path_count; i++)
-        {
-            pj_dalloc(search_path[i]);
-        }
-        pj_dalloc(search_path);
-        path_count = 0;
-        search_path = NULL;
-    }
-
-    if( count > 0 )
-    {
-        search_path = pj_malloc(sizeof *search_path * count);
-        for (i = 0; i < count; i++)
-        {
-            search_path[i] = pj_malloc(strlen(path[i]) + 1);
-            strcpy(search_path[i], path[i]);
-        }
-    }
-        
-    path_count = count;
+    pj_ctx_set_searchpath( pj_get_default_ctx(), count, path );
 }
 
 /************************************************************************/
@@ -123,6 +101,7 @@ pj_open_lib(char *name, char *mode) {
     FILE *fid;
     int n = 0;
     int i;
+    projCtx_t *ctx = pj_ctx_current();
 #ifdef WIN32
     static const char dir_chars[] = "/\\";
 #else
@@ -153,8 +132,8 @@ pj_open_lib(char *name, char *mode) {
         sysname = name;
 
     /* or try to use application provided file finder */
-    } else if( pj_finder != NULL && pj_finder( name ) != NULL ) {
-        sysname = pj_finder( name );
+    } else if( ctx->finder != NULL && ctx->finder( name ) != NULL ) {
+        sysname = ctx->finder( name );
 
     /* or is environment PROJ_LIB defined */
     } else if ((sysname = getenv("PROJ_LIB")) || (sysname = proj_lib_name)) {
@@ -171,11 +150,11 @@ pj_open_lib(char *name, char *mode) {
         errno = 0;
 
     /* If none of those work and we have a search path, try it */
-    if (!fid && path_count > 0)
+    if (!fid && ctx->path_count > 0)
     {
-        for (i = 0; fid == NULL && i < path_count; i++)
+        for (i = 0; fid == NULL && i < ctx->path_count; i++)
         {
-            sprintf(fname, "%s%c%s", search_path[i], DIR_CHAR, name);
+            sprintf(fname, "%s%c%s", ctx->search_path[i], DIR_CHAR, name);
             sysname = fname;
             fid = fopen (sysname, mode);
         }
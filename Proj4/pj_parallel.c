@@ -0,0 +1,400 @@
+/******************************************************************************
+ * Project:  PROJ.4
+ * Purpose:  Transform large point arrays on a pool of worker threads.
+ * Author:   Route-Me Contributors
+ *
+ ******************************************************************************
+ * Copyright (c) 2011, Route-Me Contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+#if defined(_WIN32) && !defined(__CYGWIN__)
+#  define PJ_NO_THREADS
+#else
+#  include <pthread.h>
+#  include <unistd.h>
+#endif
+
+#include "projects.h"
+#include <string.h>
+
+/*
+** pj_transform_parallel() splits the point arrays into contiguous chunks
+** and runs pj_transform_ctx() on each chunk, handing the chunks out to a
+** pool of worker threads while the calling thread works through them
+** too.  Every worker owns a context of its own, so errors raised on one
+** chunk never show up in another, and the projections themselves are
+** only read.
+**
+** Before each chunk a worker takes on the file finder and search path of
+** the context of the source definition, so grids are found just as they
+** are on the calling thread, dropping the grids it loaded through another
+** finder or path.
+**
+** The pool is started on first use and its threads live for the rest of
+** the process, keeping the grids their contexts have loaded.
+** pj_deallocate_grids() only releases the grids of the calling thread's
+** context; pj_deallocate_thread_grids() has the workers release theirs.
+** Workers beyond the count set with pj_set_thread_count() leave as soon
+** as they are idle.
+**
+** Chunks are never smaller than MIN_CHUNK points, so a chunk never holds
+** a single point and the per point (transient) errors of pj_transform()
+** keep their meaning: such points come back as HUGE_VAL and the rest of
+** the array is still transformed.  A fatal error stops the remaining
+** chunks from being handed out, and the error of the first failing chunk
+** is returned, as pj_transform() would for the first failing point.
+*/
+
+#define MIN_CHUNK         1024
+#define CHUNKS_PER_THREAD 4
+
+#ifndef PJ_NO_THREADS
+
+typedef struct PJ_TRANSFORM_JOB
+{
+    PJ      *srcdefn, *dstdefn;
+    long    point_count;
+    int     point_offset;
+    double  *x, *y, *z;
+
+    int     chunk_count;
+    int     next_chunk;     /* next chunk to hand out */
+    int     chunks_done;    /* chunks finished or abandoned */
+    int     failed_chunk;   /* first chunk that failed, or chunk_count */
+    int     error;          /* error of failed_chunk */
+    int     queued;         /* still on the job queue */
+
+    struct PJ_TRANSFORM_JOB *next;
+} PJ_TRANSFORM_JOB;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  pool_done = PTHREAD_COND_INITIALIZER;
+
+static PJ_TRANSFORM_JOB *pool_jobs = NULL;  /* jobs with chunks left */
+static int pool_thread_count = 0;           /* 0: one per online CPU */
+static int pool_live = 0;                   /* worker threads running */
+static int pool_grid_generation = 0;        /* bumped to release grids */
+
+/************************************************************************/
+/*                          pj_pool_workers()                           */
+/*                                                                      */
+/*      Number of worker threads wanted.  The calling thread of         */
+/*      pj_transform_parallel() counts as one of the threads.           */
+/************************************************************************/
+
+static int pj_pool_workers( void )
+
+{
+    int threads = pool_thread_count;
+
+    if( threads <= 0 )
+    {
+#ifdef _SC_NPROCESSORS_ONLN
+        threads = (int) sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+        if( threads <= 0 )
+            threads = 1;
+    }
+
+    return threads - 1;
+}
+
+/************************************************************************/
+/*                          pj_pool_dequeue()                           */
+/************************************************************************/
+
+static void pj_pool_dequeue( PJ_TRANSFORM_JOB *job )
+
+{
+    PJ_TRANSFORM_JOB **link;
+
+    if( !job->queued )
+        return;
+
+    for( link = &pool_jobs; *link != job; link = &(*link)->next ) {}
+    *link = job->next;
+    job->queued = 0;
+}
+
+/************************************************************************/
+/*                           pj_pool_adopt()                            */
+/*                                                                      */
+/*      Give a worker context the file finder and search path of       */
+/*      another context, releasing its grids if these change.           */
+/************************************************************************/
+
+static void pj_pool_adopt( projCtx ctx, projCtx from )
+
+{
+    int i, same;
+
+    same = ctx->finder == from->finder && ctx->path_count == from->path_count;
+    for( i = 0; same && i < ctx->path_count; i++ )
+        same = strcmp( ctx->search_path[i], from->search_path[i] ) == 0;
+
+    if( same )
+        return;
+
+    /* the same grid names may stand for other files now */
+    pj_ctx_deallocate_grids( ctx );
+    ctx->finder = from->finder;
+    pj_ctx_set_searchpath( ctx, from->path_count,
+                           (const char **) from->search_path );
+}
+
+/************************************************************************/
+/*                         pj_pool_run_chunk()                          */
+/*                                                                      */
+/*      Take the next chunk of a job and transform it in the given      */
+/*      context.  Called, and returns, with pool_lock held.             */
+/************************************************************************/
+
+static void pj_pool_run_chunk( PJ_TRANSFORM_JOB *job, projCtx ctx )
+
+{
+    int   chunk, err;
+    long  start, count, base, extra;
+    long  offset = job->point_offset;
+
+    chunk = job->next_chunk++;
+    if( job->next_chunk == job->chunk_count )
+        pj_pool_dequeue( job );
+
+    pthread_mutex_unlock( &pool_lock );
+
+/* -------------------------------------------------------------------- */
+/*      Chunks differ in size by at most one point.                     */
+/* -------------------------------------------------------------------- */
+    base = job->point_count / job->chunk_count;
+    extra = job->point_count % job->chunk_count;
+    start = base * chunk + (chunk < extra ? chunk : extra);
+    count = base + (chunk < extra ? 1 : 0);
+
+    if( ctx != job->srcdefn->ctx )
+        pj_pool_adopt( ctx, job->srcdefn->ctx );
+
+    err = pj_transform_ctx( ctx, job->srcdefn, job->dstdefn,
+                            count, job->point_offset,
+                            job->x + start * offset,
+                            job->y + start * offset,
+                            job->z != NULL ? job->z + start * offset : NULL );
+
+    pthread_mutex_lock( &pool_lock );
+
+/* -------------------------------------------------------------------- */
+/*      On a fatal error abandon the chunks not yet handed out.         */
+/* -------------------------------------------------------------------- */
+    if( err != 0 )
+    {
+        if( chunk < job->failed_chunk )
+        {
+            job->failed_chunk = chunk;
+            job->error = err;
+        }
+        job->chunks_done += job->chunk_count - job->next_chunk;
+        job->next_chunk = job->chunk_count;
+        pj_pool_dequeue( job );
+    }
+
+    if( ++job->chunks_done == job->chunk_count )
+        pthread_cond_broadcast( &pool_done );
+}
+
+/************************************************************************/
+/*                           pj_pool_worker()                           */
+/************************************************************************/
+
+static void *pj_pool_worker( void *unused )
+
+{
+    projCtx ctx = pj_ctx_alloc();
+    int generation;
+
+    pthread_mutex_lock( &pool_lock );
+    generation = pool_grid_generation;
+
+    while( ctx != NULL && pool_live <= pj_pool_workers() )
+    {
+        if( generation != pool_grid_generation )
+        {
+            generation = pool_grid_generation;
+            pthread_mutex_unlock( &pool_lock );
+            pj_ctx_deallocate_grids( ctx );
+            pthread_mutex_lock( &pool_lock );
+        }
+        else if( pool_jobs != NULL )
+            pj_pool_run_chunk( pool_jobs, ctx );
+        else
+            pthread_cond_wait( &pool_work, &pool_lock );
+    }
+
+    pool_live--;
+    pthread_mutex_unlock( &pool_lock );
+
+    pj_ctx_free( ctx );
+
+    return NULL;
+}
+
+/************************************************************************/
+/*                           pj_pool_start()                            */
+/*                                                                      */
+/*      Bring the pool up to the wanted number of workers.  Called      */
+/*      with pool_lock held.                                            */
+/************************************************************************/
+
+static void pj_pool_start( int workers )
+
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    if( pool_live >= workers )
+        return;
+
+    pthread_attr_init( &attr );
+    pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+
+    while( pool_live < workers )
+    {
+        if( pthread_create( &thread, &attr, pj_pool_worker, NULL ) != 0 )
+            break;
+        pool_live++;
+    }
+
+    pthread_attr_destroy( &attr );
+}
+
+#endif /* ndef PJ_NO_THREADS */
+
+/************************************************************************/
+/*                        pj_set_thread_count()                         */
+/*                                                                      */
+/*      Set the number of threads pj_transform_parallel() uses,         */
+/*      including the calling thread.  Zero (the default) uses one      */
+/*      thread per online CPU, one runs everything on the caller.       */
+/************************************************************************/
+
+void pj_set_thread_count( int count )
+
+{
+#ifndef PJ_NO_THREADS
+    pthread_mutex_lock( &pool_lock );
+    pool_thread_count = count < 0 ? 0 : count;
+    pthread_cond_broadcast( &pool_work );
+    pthread_mutex_unlock( &pool_lock );
+#endif
+}
+
+/************************************************************************/
+/*                     pj_deallocate_thread_grids()                     */
+/*                                                                      */
+/*      Have the threads of pj_transform_parallel() release the grids   */
+/*      they have loaded: idle threads at once, busy ones once done     */
+/*      with their current chunk.                                       */
+/************************************************************************/
+
+void pj_deallocate_thread_grids( void )
+
+{
+#ifndef PJ_NO_THREADS
+    pthread_mutex_lock( &pool_lock );
+    pool_grid_generation++;
+    pthread_cond_broadcast( &pool_work );
+    pthread_mutex_unlock( &pool_lock );
+#endif
+}
+
+/************************************************************************/
+/*                       pj_transform_parallel()                        */
+/*                                                                      */
+/*      Same as pj_transform(), but large arrays are transformed on     */
+/*      the thread pool.  Errors are reported in the context of the     */
+/*      source definition.                                              */
+/************************************************************************/
+
+int pj_transform_parallel( PJ *srcdefn, PJ *dstdefn,
+                           long point_count, int point_offset,
+                           double *x, double *y, double *z )
+
+{
+#ifndef PJ_NO_THREADS
+    PJ_TRANSFORM_JOB job, **tail;
+    int workers;
+
+    pthread_mutex_lock( &pool_lock );
+    workers = pj_pool_workers();
+    pthread_mutex_unlock( &pool_lock );
+
+    if( workers < 1 || point_count < 2 * MIN_CHUNK )
+        return pj_transform( srcdefn, dstdefn, point_count, point_offset,
+                             x, y, z );
+
+    if( point_offset == 0 )
+        point_offset = 1;
+
+    job.srcdefn = srcdefn;
+    job.dstdefn = dstdefn;
+    job.point_count = point_count;
+    job.point_offset = point_offset;
+    job.x = x;
+    job.y = y;
+    job.z = z;
+
+    job.chunk_count = (workers + 1) * CHUNKS_PER_THREAD;
+    if( job.chunk_count > point_count / MIN_CHUNK )
+        job.chunk_count = (int) (point_count / MIN_CHUNK);
+    job.next_chunk = 0;
+    job.chunks_done = 0;
+    job.failed_chunk = job.chunk_count;
+    job.error = 0;
+    job.queued = 1;
+    job.next = NULL;
+
+/* -------------------------------------------------------------------- */
+/*      Queue the job, and work on it alongside the pool until all      */
+/*      chunks are finished.                                            */
+/* -------------------------------------------------------------------- */
+    pthread_mutex_lock( &pool_lock );
+
+    for( tail = &pool_jobs; *tail != NULL; tail = &(*tail)->next ) {}
+    *tail = &job;
+
+    pj_pool_start( workers );
+    pthread_cond_broadcast( &pool_work );
+
+    while( job.next_chunk < job.chunk_count )
+        pj_pool_run_chunk( &job, srcdefn->ctx );
+
+    while( job.chunks_done < job.chunk_count )
+        pthread_cond_wait( &pool_done, &pool_lock );
+
+    pthread_mutex_unlock( &pool_lock );
+
+    pj_ctx_set_errno( srcdefn->ctx, job.error );
+
+    return job.error;
+#else
+    return pj_transform( srcdefn, dstdefn, point_count, point_offset,
+                         x, y, z );
+#endif
+}
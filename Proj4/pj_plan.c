@@ -0,0 +1,633 @@
+/******************************************************************************
+ * Project:  PROJ.4
+ * Purpose:  Transformation plans: pj_transform() resolved once per pair.
+ * Author:   Route-Me Contributors
+ *
+ ******************************************************************************
+ * Copyright (c) 2011, Route-Me Contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+#include "projects.h"
+#include <errno.h>
+#include <string.h>
+#include "geocent.h"
+
+/*
+** pj_transform() works out on every call which of its stages apply to a
+** pair of coordinate systems: geocentric or projected input, prime
+** meridians, and the datum shift path of pj_datum_transform().  A plan
+** makes those decisions once, in pj_plan_create(), and keeps the result
+** as a flat list of steps that pj_plan_execute() runs over each batch.
+**
+** While the list is built, steps that do nothing are left out (unit
+** scalings, zero meridian offsets, zero towgs84 shifts), adjacent
+** scalings and meridian offsets are merged, and a geocentric to geodetic
+** conversion followed straight away by the conversion back on the same
+** ellipsoid is dropped.  pj_plan_fuse() then replaces each run of a
+** geodetic to geocentric conversion, towgs84 shifts and the conversion
+** back by one step calling pj_geodetic_datum_shift(), the function
+** pj_datum_transform() calls for the same run.
+**
+** Each step calls the functions the matching stage of pj_transform()
+** calls, with the same error handling, except that an ellipsoid the
+** geocentric conversions cannot be set up for fails pj_plan_create().
+** Results therefore equal those of pj_transform() except where steps
+** were merged or dropped: a merged scaling or offset may round
+** differently in the last bit, and geocentric points whose round trip
+** through geodetic coordinates was dropped keep their input values.
+*/
+
+#define SRS_WGS84_SEMIMAJOR 6378137.0
+#define SRS_WGS84_ESQUARED  0.0066943799901413165
+
+#define PJ_PLAN_MAX_STEPS 16
+
+enum {
+    PJ_STEP_SCALE,              /* x, y *= value */
+    PJ_STEP_LAM_OFFSET,         /* x += value */
+    PJ_STEP_INVERSE,            /* inverse projection by P */
+    PJ_STEP_FORWARD,            /* forward projection by P */
+    PJ_STEP_TO_GEODETIC,        /* geocentric to geodetic on (a, es) */
+    PJ_STEP_TO_GEOCENTRIC,      /* geodetic to geocentric on (a, es) */
+    PJ_STEP_TO_WGS84,           /* towgs84 shift of P */
+    PJ_STEP_FROM_WGS84,         /* reverse towgs84 shift of P */
+    PJ_STEP_GRIDSHIFT,          /* nadgrids of P, forward or inverse */
+    PJ_STEP_LONG_WRAP,          /* rewrap longitudes around value */
+    PJ_STEP_DATUM_SHIFT         /* geodetic on (a, es) to geodetic on
+                                   (dst_a, dst_es), through the towgs84
+                                   shifts of P and from */
+};
+
+typedef struct {
+    int             op;
+    double          value;
+    PJ              *P;
+    const char      *nadgrids;
+    int             inverse;
+    double          a, es;
+    GeocentricInfo  gi;
+    PJ              *from;
+    double          dst_a, dst_es;
+} PJ_PLAN_STEP;
+
+struct PJ_PLAN {
+    PJ              *srcdefn, *dstdefn;
+    int             needs_z;    /* geocentric input or output */
+    int             uses_z;     /* some step reads or writes z */
+    int             step_count;
+    PJ_PLAN_STEP    step[PJ_PLAN_MAX_STEPS];
+};
+
+/************************************************************************/
+/*                          pj_plan_is_noop()                           */
+/************************************************************************/
+
+static int pj_plan_is_noop( PJ_PLAN_STEP *step )
+
+{
+    double *p;
+
+    switch( step->op )
+    {
+      case PJ_STEP_SCALE:
+        return step->value == 1.0;
+
+      case PJ_STEP_LAM_OFFSET:
+        return step->value == 0.0;
+
+      case PJ_STEP_TO_WGS84:
+      case PJ_STEP_FROM_WGS84:
+        p = step->P->datum_params;
+        if( p[0] != 0.0 || p[1] != 0.0 || p[2] != 0.0 )
+            return 0;
+        return step->P->datum_type == PJD_3PARAM
+            || (p[3] == 0.0 && p[4] == 0.0 && p[5] == 0.0 && p[6] == 1.0);
+
+      default:
+        return 0;
+    }
+}
+
+/************************************************************************/
+/*                            pj_plan_add()                             */
+/*                                                                      */
+/*      Append a step, merging it with the last one where possible.     */
+/************************************************************************/
+
+static void pj_plan_add( struct PJ_PLAN *plan, PJ_PLAN_STEP *step )
+
+{
+    PJ_PLAN_STEP *last;
+
+    if( pj_plan_is_noop( step ) )
+        return;
+
+    last = plan->step_count > 0 ? plan->step + plan->step_count - 1 : NULL;
+
+    if( last != NULL && last->op == step->op
+        && (step->op == PJ_STEP_SCALE || step->op == PJ_STEP_LAM_OFFSET) )
+    {
+        if( step->op == PJ_STEP_SCALE )
+            last->value *= step->value;
+        else
+            last->value += step->value;
+
+        if( pj_plan_is_noop( last ) )
+            plan->step_count--;
+        return;
+    }
+
+    /* geocentric -> geodetic -> geocentric on the same ellipsoid */
+    if( last != NULL && last->op == PJ_STEP_TO_GEODETIC
+        && step->op == PJ_STEP_TO_GEOCENTRIC
+        && last->a == step->a && last->es == step->es )
+    {
+        plan->step_count--;
+        return;
+    }
+
+    if( step->op == PJ_STEP_TO_GEODETIC || step->op == PJ_STEP_TO_GEOCENTRIC
+        || step->op == PJ_STEP_TO_WGS84 || step->op == PJ_STEP_FROM_WGS84 )
+        plan->uses_z = 1;
+
+    plan->step[plan->step_count++] = *step;
+}
+
+/************************************************************************/
+/*                         pj_plan_add_simple()                         */
+/************************************************************************/
+
+static void pj_plan_add_simple( struct PJ_PLAN *plan, int op,
+                                double value, PJ *P )
+
+{
+    PJ_PLAN_STEP step;
+
+    memset( &step, 0, sizeof(step) );
+    step.op = op;
+    step.value = value;
+    step.P = P;
+
+    pj_plan_add( plan, &step );
+}
+
+/************************************************************************/
+/*                       pj_plan_add_geocentric()                       */
+/************************************************************************/
+
+static int pj_plan_add_geocentric( struct PJ_PLAN *plan, int op,
+                                   double a, double es )
+
+{
+    PJ_PLAN_STEP step;
+
+    memset( &step, 0, sizeof(step) );
+    step.op = op;
+    step.a = a;
+    step.es = es;
+
+    if( pj_Set_Geocentric_Parameters( &step.gi, a,
+                                      es == 0.0 ? a : a * sqrt(1-es) ) != 0 )
+        return PJD_ERR_GEOCENTRIC;
+
+    pj_plan_add( plan, &step );
+
+    return 0;
+}
+
+/************************************************************************/
+/*                       pj_plan_add_gridshift()                        */
+/************************************************************************/
+
+static void pj_plan_add_gridshift( struct PJ_PLAN *plan, PJ *P, int inverse )
+
+{
+    PJ_PLAN_STEP step;
+
+    memset( &step, 0, sizeof(step) );
+    step.op = PJ_STEP_GRIDSHIFT;
+    step.P = P;
+    step.nadgrids = pj_param( P->params, "snadgrids" ).s;
+    step.inverse = inverse;
+
+    pj_plan_add( plan, &step );
+}
+
+/************************************************************************/
+/*                         pj_plan_add_datum()                          */
+/*                                                                      */
+/*      The steps pj_datum_transform() would take.                      */
+/************************************************************************/
+
+static int pj_plan_add_datum( struct PJ_PLAN *plan, PJ *srcdefn, PJ *dstdefn )
+
+{
+    double      src_a, src_es, dst_a, dst_es;
+    int         err;
+
+    if( srcdefn->datum_type == PJD_UNKNOWN
+        || dstdefn->datum_type == PJD_UNKNOWN
+        || pj_compare_datums( srcdefn, dstdefn ) )
+        return 0;
+
+    src_a = srcdefn->a_orig;
+    src_es = srcdefn->es_orig;
+
+    dst_a = dstdefn->a_orig;
+    dst_es = dstdefn->es_orig;
+
+    if( srcdefn->datum_type == PJD_GRIDSHIFT )
+    {
+        pj_plan_add_gridshift( plan, srcdefn, 0 );
+
+        src_a = SRS_WGS84_SEMIMAJOR;
+        src_es = SRS_WGS84_ESQUARED;
+    }
+
+    if( dstdefn->datum_type == PJD_GRIDSHIFT )
+    {
+        dst_a = SRS_WGS84_SEMIMAJOR;
+        dst_es = SRS_WGS84_ESQUARED;
+    }
+
+    if( src_es != dst_es || src_a != dst_a
+        || srcdefn->datum_type == PJD_3PARAM
+        || srcdefn->datum_type == PJD_7PARAM
+        || dstdefn->datum_type == PJD_3PARAM
+        || dstdefn->datum_type == PJD_7PARAM)
+    {
+        if( (err = pj_plan_add_geocentric( plan, PJ_STEP_TO_GEOCENTRIC,
+                                           src_a, src_es )) != 0 )
+            return err;
+
+        if( srcdefn->datum_type == PJD_3PARAM
+            || srcdefn->datum_type == PJD_7PARAM )
+            pj_plan_add_simple( plan, PJ_STEP_TO_WGS84, 0.0, srcdefn );
+
+        if( dstdefn->datum_type == PJD_3PARAM
+            || dstdefn->datum_type == PJD_7PARAM )
+            pj_plan_add_simple( plan, PJ_STEP_FROM_WGS84, 0.0, dstdefn );
+
+        if( (err = pj_plan_add_geocentric( plan, PJ_STEP_TO_GEODETIC,
+                                           dst_a, dst_es )) != 0 )
+            return err;
+    }
+
+    if( dstdefn->datum_type == PJD_GRIDSHIFT )
+        pj_plan_add_gridshift( plan, dstdefn, 1 );
+
+    return 0;
+}
+
+/************************************************************************/
+/*                           pj_plan_fuse()                             */
+/*                                                                      */
+/*      Replace each run of to geocentric, towgs84 shifts and back to   */
+/*      geodetic by a single datum shift step.                          */
+/************************************************************************/
+
+static void pj_plan_fuse( struct PJ_PLAN *plan )
+
+{
+    PJ_PLAN_STEP *step, *end;
+    int i, j, out = 0;
+
+    for( i = 0; i < plan->step_count; i++ )
+    {
+        step = plan->step + i;
+        plan->step[out] = *step;
+
+        if( step->op != PJ_STEP_TO_GEOCENTRIC )
+        {
+            out++;
+            continue;
+        }
+
+        j = i + 1;
+        if( j < plan->step_count && plan->step[j].op == PJ_STEP_TO_WGS84 )
+            j++;
+        if( j < plan->step_count && plan->step[j].op == PJ_STEP_FROM_WGS84 )
+            j++;
+        if( j == plan->step_count || plan->step[j].op != PJ_STEP_TO_GEODETIC )
+        {
+            out++;
+            continue;
+        }
+
+        end = plan->step + j;
+        plan->step[out].op = PJ_STEP_DATUM_SHIFT;
+        plan->step[out].P = NULL;
+        plan->step[out].from = NULL;
+        plan->step[out].dst_a = end->a;
+        plan->step[out].dst_es = end->es;
+        for( ; step < end; step++ )
+        {
+            if( step->op == PJ_STEP_TO_WGS84 )
+                plan->step[out].P = step->P;
+            else if( step->op == PJ_STEP_FROM_WGS84 )
+                plan->step[out].from = step->P;
+        }
+        out++;
+        i = j;
+    }
+
+    plan->step_count = out;
+}
+
+/************************************************************************/
+/*                           pj_plan_create()                           */
+/*                                                                      */
+/*      Returns NULL, with the error in the context of the source       */
+/*      definition, if points could never be transformed between the    */
+/*      two.                                                            */
+/************************************************************************/
+
+struct PJ_PLAN *pj_plan_create( PJ *srcdefn, PJ *dstdefn )
+
+{
+    struct PJ_PLAN *plan;
+    int err = 0;
+
+    if( !srcdefn->is_geocent && !srcdefn->is_latlong && srcdefn->inv == NULL )
+    {
+        pj_ctx_set_errno( srcdefn->ctx, -17 );
+        return NULL;
+    }
+
+    plan = (struct PJ_PLAN *) pj_malloc( sizeof(struct PJ_PLAN) );
+    if( plan == NULL )
+    {
+        pj_ctx_set_errno( srcdefn->ctx, ENOMEM );
+        return NULL;
+    }
+
+    memset( plan, 0, sizeof(struct PJ_PLAN) );
+    plan->srcdefn = srcdefn;
+    plan->dstdefn = dstdefn;
+    plan->needs_z = srcdefn->is_geocent || dstdefn->is_geocent;
+
+/* -------------------------------------------------------------------- */
+/*      To lat/long on the source datum.                                */
+/* -------------------------------------------------------------------- */
+    if( srcdefn->is_geocent )
+    {
+        pj_plan_add_simple( plan, PJ_STEP_SCALE, srcdefn->to_meter, NULL );
+        err = pj_plan_add_geocentric( plan, PJ_STEP_TO_GEODETIC,
+                                      srcdefn->a_orig, srcdefn->es_orig );
+    }
+    else if( !srcdefn->is_latlong )
+        pj_plan_add_simple( plan, PJ_STEP_INVERSE, 0.0, srcdefn );
+
+    pj_plan_add_simple( plan, PJ_STEP_LAM_OFFSET,
+                        srcdefn->from_greenwich, NULL );
+
+/* -------------------------------------------------------------------- */
+/*      Datum shift.                                                    */
+/* -------------------------------------------------------------------- */
+    if( err == 0 )
+        err = pj_plan_add_datum( plan, srcdefn, dstdefn );
+
+/* -------------------------------------------------------------------- */
+/*      From lat/long on the destination datum.                         */
+/* -------------------------------------------------------------------- */
+    pj_plan_add_simple( plan, PJ_STEP_LAM_OFFSET,
+                        -dstdefn->from_greenwich, NULL );
+
+    if( dstdefn->is_geocent )
+    {
+        if( err == 0 )
+            err = pj_plan_add_geocentric( plan, PJ_STEP_TO_GEOCENTRIC,
+                                          dstdefn->a_orig, dstdefn->es_orig );
+        pj_plan_add_simple( plan, PJ_STEP_SCALE, dstdefn->fr_meter, NULL );
+    }
+    else if( !dstdefn->is_latlong )
+        pj_plan_add_simple( plan, PJ_STEP_FORWARD, 0.0, dstdefn );
+    else if( dstdefn->long_wrap_center != 0 )
+        pj_plan_add_simple( plan, PJ_STEP_LONG_WRAP,
+                            dstdefn->long_wrap_center, NULL );
+
+    if( err != 0 )
+    {
+        pj_ctx_set_errno( srcdefn->ctx, err );
+        pj_dalloc( plan );
+        return NULL;
+    }
+
+    pj_plan_fuse( plan );
+
+    return plan;
+}
+
+/************************************************************************/
+/*                            pj_plan_free()                            */
+/************************************************************************/
+
+void pj_plan_free( struct PJ_PLAN *plan )
+
+{
+    if( plan != NULL )
+        pj_dalloc( plan );
+}
+
+/************************************************************************/
+/*                            pj_plan_step()                            */
+/*                                                                      */
+/*      Run one step over the points.  Returns zero, or an error that   */
+/*      fails the whole batch.                                          */
+/************************************************************************/
+
+static int pj_plan_step( projCtx_t *ctx, PJ_PLAN_STEP *step,
+                         long point_count, int point_offset,
+                         double *x, double *y, double *z )
+
+{
+    long i, io;
+
+    switch( step->op )
+    {
+      case PJ_STEP_SCALE:
+        for( i = 0; i < point_count; i++ )
+        {
+            io = i * point_offset;
+            if( x[io] != HUGE_VAL )
+            {
+                x[io] *= step->value;
+                y[io] *= step->value;
+            }
+        }
+        break;
+
+      case PJ_STEP_LAM_OFFSET:
+        for( i = 0; i < point_count; i++ )
+        {
+            io = i * point_offset;
+            if( x[io] != HUGE_VAL )
+                x[io] += step->value;
+        }
+        break;
+
+      case PJ_STEP_INVERSE:
+        return pj_inv_points( ctx, step->P, point_count, point_offset, x, y );
+
+      case PJ_STEP_FORWARD:
+        return pj_fwd_points( ctx, step->P, point_count, point_offset, x, y );
+
+      case PJ_STEP_TO_GEODETIC:
+        for( i = 0; i < point_count; i++ )
+        {
+            io = i * point_offset;
+            if( x[io] != HUGE_VAL )
+                pj_Convert_Geocentric_To_Geodetic( &step->gi,
+                                                   x[io], y[io], z[io],
+                                                   y+io, x+io, z+io );
+        }
+        break;
+
+      case PJ_STEP_TO_GEOCENTRIC:
+        for( i = 0; i < point_count; i++ )
+        {
+            io = i * point_offset;
+            if( x[io] == HUGE_VAL )
+                continue;
+
+            if( pj_Convert_Geodetic_To_Geocentric( &step->gi,
+                                                   y[io], x[io], z[io],
+                                                   x+io, y+io, z+io ) != 0 )
+            {
+                ctx->last_errno = -14;
+                x[io] = y[io] = HUGE_VAL;
+            }
+        }
+        break;
+
+      case PJ_STEP_TO_WGS84:
+        pj_geocentric_to_wgs84( step->P, point_count, point_offset, x, y, z );
+        break;
+
+      case PJ_STEP_FROM_WGS84:
+        pj_geocentric_from_wgs84( step->P, point_count, point_offset,
+                                  x, y, z );
+        break;
+
+      case PJ_STEP_GRIDSHIFT:
+        pj_apply_gridshift( step->nadgrids, step->inverse,
+                            point_count, point_offset, x, y, z );
+        if( pj_datum_fatal( ctx->last_errno ) )
+            return ctx->last_errno;
+        break;
+
+      case PJ_STEP_LONG_WRAP:
+        for( i = 0; i < point_count; i++ )
+        {
+            io = i * point_offset;
+            if( x[io] == HUGE_VAL )
+                continue;
+
+            while( x[io] < step->value - HALFPI )
+                x[io] += PI;
+            while( x[io] > step->value + HALFPI )
+                x[io] -= PI;
+        }
+        break;
+
+      case PJ_STEP_DATUM_SHIFT:
+        pj_geodetic_datum_shift( step->a, step->es, step->P, step->from,
+                                 step->dst_a, step->dst_es,
+                                 point_count, point_offset, x, y, z );
+        if( pj_datum_fatal( ctx->last_errno ) )
+            return ctx->last_errno;
+        break;
+    }
+
+    return 0;
+}
+
+/************************************************************************/
+/*                        pj_plan_execute_ctx()                         */
+/*                                                                      */
+/*      Transform points as pj_transform_ctx() would.                   */
+/************************************************************************/
+
+int pj_plan_execute_ctx( projCtx ctx, struct PJ_PLAN *plan,
+                         long point_count, int point_offset,
+                         double *x, double *y, double *z )
+
+{
+    projCtx_t *prev;
+    double    *temp_z = NULL;
+    int       i, err = 0;
+
+    if( ctx == NULL )
+        ctx = pj_get_default_ctx();
+
+    if( point_offset == 0 )
+        point_offset = 1;
+
+    if( z == NULL && plan->needs_z )
+    {
+        ctx->last_errno = PJD_ERR_GEOCENTRIC;
+        return PJD_ERR_GEOCENTRIC;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      The datum shift works in three dimensions even when no          */
+/*      heights are passed in.                                          */
+/* -------------------------------------------------------------------- */
+    if( z == NULL && plan->uses_z && point_count > 0 )
+    {
+        size_t bytes = sizeof(double) * point_count * point_offset;
+
+        if( (temp_z = (double *) pj_malloc( bytes )) == NULL )
+        {
+            ctx->last_errno = ENOMEM;
+            return ENOMEM;
+        }
+        memset( temp_z, 0, bytes );
+        z = temp_z;
+    }
+
+    prev = pj_ctx_enter( ctx );
+    ctx->last_errno = 0;
+
+    for( i = 0; i < plan->step_count && err == 0; i++ )
+        err = pj_plan_step( ctx, plan->step + i,
+                            point_count, point_offset, x, y, z );
+
+    pj_ctx_leave( prev, ctx );
+
+    if( temp_z != NULL )
+        pj_dalloc( temp_z );
+
+    return err;
+}
+
+/************************************************************************/
+/*                          pj_plan_execute()                           */
+/************************************************************************/
+
+int pj_plan_execute( struct PJ_PLAN *plan,
+                     long point_count, int point_offset,
+                     double *x, double *y, double *z )
+
+{
+    return pj_plan_execute_ctx( plan->srcdefn->ctx, plan, point_count,
+                                point_offset, x, y, z );
+}
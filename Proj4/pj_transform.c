@@ -165,6 +165,10 @@ static const int transient_error[45] = {
     /* 30 to 39 */ 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 
     /* 40 to 44 */ 0, 0, 0, 0, 0 };
 
+static int transform_in_ctx( projCtx_t *ctx, PJ *srcdefn, PJ *dstdefn,
+                             long point_count, int point_offset,
+                             double *x, double *y, double *z );
+
 /************************************************************************/
 /*                            pj_transform()                            */
 /*                                                                      */
@@ -177,11 +181,52 @@ static const int transient_error[45] = {
 int pj_transform( PJ *srcdefn, PJ *dstdefn, long point_count, int point_offset,
                   double *x, double *y, double *z )
 
+{
+    return pj_transform_ctx( srcdefn->ctx, srcdefn, dstdefn,
+                             point_count, point_offset, x, y, z );
+}
+
+/************************************************************************/
+/*                          pj_transform_ctx()                          */
+/*                                                                      */
+/*      Same as pj_transform(), but errors are reported in, and grid    */
+/*      shift files are loaded through, the passed context rather       */
+/*      than the one of the source projection.  This allows one pair   */
+/*      of projections to be shared by threads each using their own    */
+/*      context.                                                        */
+/************************************************************************/
+
+int pj_transform_ctx( projCtx ctx, PJ *srcdefn, PJ *dstdefn,
+                      long point_count, int point_offset,
+                      double *x, double *y, double *z )
+
+{
+    projCtx_t *prev;
+    int       result;
+
+    if( ctx == NULL )
+        ctx = pj_get_default_ctx();
+
+    prev = pj_ctx_enter( ctx );
+    result = transform_in_ctx( ctx, srcdefn, dstdefn,
+                               point_count, point_offset, x, y, z );
+    pj_ctx_leave( prev, ctx );
+
+    return result;
+}
+
+/************************************************************************/
+/*                          transform_in_ctx()                          */
+/************************************************************************/
+
+static int transform_in_ctx( projCtx_t *ctx, PJ *srcdefn, PJ *dstdefn,
+                             long point_count, int point_offset,
+                             double *x, double *y, double *z )
+
 {
     long      i;
-    int       need_datum_shift;
 
-    pj_errno = 0;
+    ctx->last_errno = 0;
 
     if( point_offset == 0 )
         point_offset = 1;
@@ -193,7 +238,7 @@ int pj_transform( PJ *srcdefn, PJ *dstdefn, long point_count, int point_offset,
     {
         if( z == NULL )
         {
-            pj_errno = PJD_ERR_GEOCENTRIC;
+            ctx->last_errno = PJD_ERR_GEOCENTRIC;
             return PJD_ERR_GEOCENTRIC;
         }
 
@@ -212,7 +257,7 @@ int pj_transform( PJ *srcdefn, PJ *dstdefn, long point_count, int point_offset,
         if( pj_geocentric_to_geodetic( srcdefn->a_orig, srcdefn->es_orig,
                                        point_count, point_offset, 
                                        x, y, z ) != 0) 
-            return pj_errno;
+            return ctx->last_errno;
     }
 
 /* -------------------------------------------------------------------- */
@@ -223,43 +268,18 @@ int pj_transform( PJ *srcdefn, PJ *dstdefn, long point_count, int point_offset,
     {
         if( srcdefn->inv == NULL )
         {
-            pj_errno = -17; /* this isn't correct, we need a no inverse err */
+            ctx->last_errno = -17; /* this isn't correct, we need a no inverse err */
             if( getenv( "PROJ_DEBUG" ) != NULL )
             {
                 fprintf( stderr, 
                        "pj_transform(): source projection not invertable\n" );
             }
-            return pj_errno;
+            return ctx->last_errno;
         }
 
-        for( i = 0; i < point_count; i++ )
-        {
-            XY         projected_loc;
-            LP	       geodetic_loc;
-
-            projected_loc.u = x[point_offset*i];
-            projected_loc.v = y[point_offset*i];
-
-            if( projected_loc.u == HUGE_VAL )
-                continue;
-
-            geodetic_loc = pj_inv( projected_loc, srcdefn );
-            if( pj_errno != 0 )
-            {
-                if( (pj_errno != 33 /*EDOM*/ && pj_errno != 34 /*ERANGE*/ )
-                    && (pj_errno > 0 || pj_errno < -44 || point_count == 1
-                        || transient_error[-pj_errno] == 0 ) )
-                    return pj_errno;
-                else
-                {
-                    geodetic_loc.u = HUGE_VAL;
-                    geodetic_loc.v = HUGE_VAL;
-                }
-            }
-
-            x[point_offset*i] = geodetic_loc.u;
-            y[point_offset*i] = geodetic_loc.v;
-        }
+        if( pj_inv_points( ctx, srcdefn, point_count, point_offset,
+                           x, y ) != 0 )
+            return ctx->last_errno;
     }
 /* -------------------------------------------------------------------- */
 /*      But if they are already lat long, adjust for the prime          */
@@ -279,7 +299,7 @@ int pj_transform( PJ *srcdefn, PJ *dstdefn, long point_count, int point_offset,
 /* -------------------------------------------------------------------- */
     if( pj_datum_transform( srcdefn, dstdefn, point_count, point_offset, 
                             x, y, z ) != 0 )
-        return pj_errno;
+        return ctx->last_errno;
 
 /* -------------------------------------------------------------------- */
 /*      But if they are staying lat long, adjust for the prime          */
@@ -302,7 +322,7 @@ int pj_transform( PJ *srcdefn, PJ *dstdefn, long point_count, int point_offset,
     {
         if( z == NULL )
         {
-            pj_errno = PJD_ERR_GEOCENTRIC;
+            ctx->last_errno = PJD_ERR_GEOCENTRIC;
             return PJD_ERR_GEOCENTRIC;
         }
 
@@ -327,52 +347,162 @@ int pj_transform( PJ *srcdefn, PJ *dstdefn, long point_count, int point_offset,
 /*      desired.                                                        */
 /* -------------------------------------------------------------------- */
     else if( !dstdefn->is_latlong )
+    {
+        if( pj_fwd_points( ctx, dstdefn, point_count, point_offset,
+                           x, y ) != 0 )
+            return ctx->last_errno;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      If a wrapping center other than 0 is provided, rewrap around    */
+/*      the suggested center (for latlong coordinate systems only).     */
+/* -------------------------------------------------------------------- */
+    else if( dstdefn->is_latlong && dstdefn->long_wrap_center != 0 )
+    {
+        for( i = 0; i < point_count; i++ )
+        {
+            if( x[point_offset*i] == HUGE_VAL )
+                continue;
+
+            while( x[point_offset*i] < dstdefn->long_wrap_center - HALFPI )
+                x[point_offset*i] += PI;
+            while( x[point_offset*i] > dstdefn->long_wrap_center + HALFPI )
+                x[point_offset*i] -= PI;
+        }
+    }
+
+    return 0;
+}
+
+/************************************************************************/
+/*                         pj_transform_fatal()                         */
+/*                                                                      */
+/*      Is an error raised while projecting one of point_count points   */
+/*      a failure of the whole transformation, rather than of just      */
+/*      that point?                                                     */
+/************************************************************************/
+
+int pj_transform_fatal( int err, long point_count )
+
+{
+    return err != 0
+        && (err != 33 /*EDOM*/ && err != 34 /*ERANGE*/ )
+        && (err > 0 || err < -44 || point_count == 1
+            || transient_error[-err] == 0 );
+}
+
+/************************************************************************/
+/*                           pj_datum_fatal()                           */
+/*                                                                      */
+/*      Same for an error raised by a datum shift step.                 */
+/************************************************************************/
+
+int pj_datum_fatal( int err )
+
+{
+    return err != 0
+        && (err > 0 || err < -44 || transient_error[-err] == 0);
+}
+
+/************************************************************************/
+/*                           pj_inv_points()                            */
+/*                                                                      */
+/*      Inverse project points in place, failing just the points        */
+/*      with transient errors.  Returns zero, or a fatal error.         */
+/************************************************************************/
+
+int pj_inv_points( projCtx_t *ctx, PJ *srcdefn,
+                   long point_count, int point_offset, double *x, double *y )
+
+{
+    long      i;
+
+    if( point_offset == 1 )
+    {
+        /* contiguous coordinates, project them all in one call */
+        int err = pj_inv_array_ctx( ctx, srcdefn, point_count, x, y );
+
+        if( pj_transform_fatal( err, point_count ) )
+            return err;
+    }
+    else
     {
         for( i = 0; i < point_count; i++ )
         {
             XY         projected_loc;
             LP	       geodetic_loc;
 
-            geodetic_loc.u = x[point_offset*i];
-            geodetic_loc.v = y[point_offset*i];
+            projected_loc.u = x[point_offset*i];
+            projected_loc.v = y[point_offset*i];
 
-            if( geodetic_loc.u == HUGE_VAL )
+            if( projected_loc.u == HUGE_VAL )
                 continue;
 
-            projected_loc = pj_fwd( geodetic_loc, dstdefn );
-            if( pj_errno != 0 )
+            geodetic_loc = pj_inv_ctx( ctx, projected_loc, srcdefn );
+            if( ctx->last_errno != 0 )
             {
-                if( (pj_errno != 33 /*EDOM*/ && pj_errno != 34 /*ERANGE*/ )
-                    && (pj_errno > 0 || pj_errno < -44 || point_count == 1
-                        || transient_error[-pj_errno] == 0 ) )
-                    return pj_errno;
+                if( pj_transform_fatal( ctx->last_errno, point_count ) )
+                    return ctx->last_errno;
                 else
                 {
-                    projected_loc.u = HUGE_VAL;
-                    projected_loc.v = HUGE_VAL;
+                    geodetic_loc.u = HUGE_VAL;
+                    geodetic_loc.v = HUGE_VAL;
                 }
             }
 
-            x[point_offset*i] = projected_loc.u;
-            y[point_offset*i] = projected_loc.v;
+            x[point_offset*i] = geodetic_loc.u;
+            y[point_offset*i] = geodetic_loc.v;
         }
     }
 
-/* -------------------------------------------------------------------- */
-/*      If a wrapping center other than 0 is provided, rewrap around    */
-/*      the suggested center (for latlong coordinate systems only).     */
-/* -------------------------------------------------------------------- */
-    else if( dstdefn->is_latlong && dstdefn->long_wrap_center != 0 )
+    return 0;
+}
+
+/************************************************************************/
+/*                           pj_fwd_points()                            */
+/************************************************************************/
+
+int pj_fwd_points( projCtx_t *ctx, PJ *dstdefn,
+                   long point_count, int point_offset, double *x, double *y )
+
+{
+    long      i;
+
+    if( point_offset == 1 )
+    {
+        /* contiguous coordinates, project them all in one call */
+        int err = pj_fwd_array_ctx( ctx, dstdefn, point_count, x, y );
+
+        if( pj_transform_fatal( err, point_count ) )
+            return err;
+    }
+    else
     {
         for( i = 0; i < point_count; i++ )
         {
-            if( x[point_offset*i] == HUGE_VAL )
+            XY         projected_loc;
+            LP	       geodetic_loc;
+
+            geodetic_loc.u = x[point_offset*i];
+            geodetic_loc.v = y[point_offset*i];
+
+            if( geodetic_loc.u == HUGE_VAL )
                 continue;
 
-            while( x[point_offset*i] < dstdefn->long_wrap_center - HALFPI )
-                x[point_offset*i] += PI;
-            while( x[point_offset*i] > dstdefn->long_wrap_center + HALFPI )
-                x[point_offset*i] -= PI;
+            projected_loc = pj_fwd_ctx( ctx, geodetic_loc, dstdefn );
+            if( ctx->last_errno != 0 )
+            {
+                if( pj_transform_fatal( ctx->last_errno, point_count ) )
+                    return ctx->last_errno;
+                else
+                {
+                    projected_loc.u = HUGE_VAL;
+                    projected_loc.v = HUGE_VAL;
+                }
+            }
+
+            x[point_offset*i] = projected_loc.u;
+            y[point_offset*i] = projected_loc.v;
         }
     }
 
@@ -608,6 +738,87 @@ int pj_geocentric_from_wgs84( PJ *defn,
     return 0;
 }
 
+/************************************************************************/
+/*                      pj_geodetic_datum_shift()                       */
+/*                                                                      */
+/*      Geodetic coordinates on (src_a, src_es) to geodetic             */
+/*      coordinates on (dst_a, dst_es), through geocentric              */
+/*      coordinates and the towgs84 shifts of to_wgs84 and             */
+/*      from_wgs84 (either may be NULL).  This is the same as           */
+/*      pj_geodetic_to_geocentric(), pj_geocentric_to_wgs84(),          */
+/*      pj_geocentric_from_wgs84() and pj_geocentric_to_geodetic()      */
+/*      one after the other, calling the two shifts, with the same      */
+/*      results and errors, except that both ellipsoids are set up      */
+/*      once, before any point is converted.                            */
+/************************************************************************/
+
+int pj_geodetic_datum_shift( double src_a, double src_es,
+                             PJ *to_wgs84, PJ *from_wgs84,
+                             double dst_a, double dst_es,
+                             long point_count, int point_offset,
+                             double *x, double *y, double *z )
+
+{
+    GeocentricInfo src_gi, dst_gi;
+    long    i;
+
+    pj_errno = 0;
+
+    if( pj_Set_Geocentric_Parameters( &src_gi, src_a, src_es == 0.0
+                                      ? src_a : src_a * sqrt(1-src_es) ) != 0
+        || pj_Set_Geocentric_Parameters( &dst_gi, dst_a, dst_es == 0.0
+                                         ? dst_a : dst_a * sqrt(1-dst_es) ) != 0 )
+    {
+        pj_errno = PJD_ERR_GEOCENTRIC;
+        return pj_errno;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      To geocentric.                                                  */
+/* -------------------------------------------------------------------- */
+    for( i = 0; i < point_count; i++ )
+    {
+        long io = i * point_offset;
+
+        if( x[io] == HUGE_VAL )
+            continue;
+
+        if( pj_Convert_Geodetic_To_Geocentric( &src_gi, y[io], x[io], z[io],
+                                               x+io, y+io, z+io ) != 0 )
+        {
+            pj_errno = -14;
+            x[io] = y[io] = HUGE_VAL;
+        }
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Between datums.                                                 */
+/* -------------------------------------------------------------------- */
+    if( to_wgs84 != NULL )
+        pj_geocentric_to_wgs84( to_wgs84, point_count, point_offset,
+                                x, y, z );
+
+    if( from_wgs84 != NULL )
+        pj_geocentric_from_wgs84( from_wgs84, point_count, point_offset,
+                                  x, y, z );
+
+/* -------------------------------------------------------------------- */
+/*      Back to geodetic.                                               */
+/* -------------------------------------------------------------------- */
+    for( i = 0; i < point_count; i++ )
+    {
+        long io = i * point_offset;
+
+        if( x[io] == HUGE_VAL )
+            continue;
+
+        pj_Convert_Geocentric_To_Geodetic( &dst_gi, x[io], y[io], z[io],
+                                           y+io, x+io, z+io );
+    }
+
+    return pj_errno;
+}
+
 /************************************************************************/
 /*                         pj_datum_transform()                         */
 /*                                                                      */
@@ -659,7 +870,7 @@ int pj_datum_transform( PJ *srcdefn, PJ *dstdefn,
         z_is_temp = TRUE;
     }
 
-#define CHECK_RETURN {if( pj_errno != 0 && (pj_errno > 0 || transient_error[-pj_errno] == 0) ) { if( z_is_temp ) pj_dalloc(z); return pj_errno; }}
+#define CHECK_RETURN {if( pj_datum_fatal( pj_errno ) ) { if( z_is_temp ) pj_dalloc(z); return pj_errno; }}
 
 /* -------------------------------------------------------------------- */
 /*	If this datum requires grid shifts, then apply it to geodetic   */
@@ -691,34 +902,18 @@ int pj_datum_transform( PJ *srcdefn, PJ *dstdefn,
         || dstdefn->datum_type == PJD_7PARAM)
     {
 /* -------------------------------------------------------------------- */
-/*      Convert to geocentric coordinates.                              */
-/* -------------------------------------------------------------------- */
-        pj_geodetic_to_geocentric( src_a, src_es,
-                                   point_count, point_offset, x, y, z );
-        CHECK_RETURN;
-
-/* -------------------------------------------------------------------- */
-/*      Convert between datums.                                         */
-/* -------------------------------------------------------------------- */
-        if( srcdefn->datum_type == PJD_3PARAM 
-            || srcdefn->datum_type == PJD_7PARAM )
-        {
-            pj_geocentric_to_wgs84( srcdefn, point_count, point_offset,x,y,z);
-            CHECK_RETURN;
-        }
-
-        if( dstdefn->datum_type == PJD_3PARAM 
-            || dstdefn->datum_type == PJD_7PARAM )
-        {
-            pj_geocentric_from_wgs84( dstdefn, point_count,point_offset,x,y,z);
-            CHECK_RETURN;
-        }
-
-/* -------------------------------------------------------------------- */
-/*      Convert back to geodetic coordinates.                           */
-/* -------------------------------------------------------------------- */
-        pj_geocentric_to_geodetic( dst_a, dst_es,
-                                   point_count, point_offset, x, y, z );
+/*      Convert to geocentric coordinates, between datums and back      */
+/*      to geodetic coordinates.                                        */
+/* -------------------------------------------------------------------- */
+        pj_geodetic_datum_shift( src_a, src_es,
+                                 srcdefn->datum_type == PJD_3PARAM
+                                 || srcdefn->datum_type == PJD_7PARAM
+                                 ? srcdefn : NULL,
+                                 dstdefn->datum_type == PJD_3PARAM
+                                 || dstdefn->datum_type == PJD_7PARAM
+                                 ? dstdefn : NULL,
+                                 dst_a, dst_es,
+                                 point_count, point_offset, x, y, z );
         CHECK_RETURN;
     }
 
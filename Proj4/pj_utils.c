@@ -170,6 +170,6 @@ PJ *pj_latlong_from_proj( PJ *pj_in )
         sprintf( defn+strlen(defn), " +pm=%s", 
                  pj_param(pj_in->params,"spm").s );
 
-    return pj_init_plus( defn );
+    return pj_init_plus_ctx( pj_in->ctx, defn );
 }
 
@@ -22,6 +22,7 @@ static const char SCCSID[]="@(#)proj.c	4.12	95/09/23	GIE	REL";
 
 #define MAX_LINE 1000
 #define MAX_PARGS 100
+#define BIN_BATCH 65536	/* points per block in binary to binary mode */
 #define PJ_INVERS(P) (P->inv ? 1 : 0)
 	static PJ
 *Proj;
@@ -149,6 +150,36 @@ process(FILE *fid) {
 				(void)fputs("\t<* * * * * *>", stdout);
 		(void)fputs(bin_in ? "\n" : s, stdout);
 	}
+}
+	static void	/* binary to binary processing, a block at a time */
+bprocess(FILE *fid) {
+	static projUV data[BIN_BATCH];
+	static double x[BIN_BATCH], y[BIN_BATCH];
+	size_t count, i;
+
+	while ((count = fread(data, sizeof(projUV), BIN_BATCH, fid)) > 0) {
+		emess_dat.File_line += (int)count;
+		for (i = 0; i < count; ++i) {
+			x[i] = data[i].u;
+			y[i] = data[i].v;
+			if (prescale && x[i] != HUGE_VAL)
+				{ x[i] *= fscale; y[i] *= fscale; }
+		}
+		if (inverse)
+			(void)pj_inv_array(Proj, (long)count, x, y);
+		else
+			(void)pj_fwd_array(Proj, (long)count, x, y);
+		for (i = 0; i < count; ++i) {
+			if (data[i].u == HUGE_VAL) /* passed through as is */
+				continue;
+			if (postscale && x[i] != HUGE_VAL)
+				{ x[i] *= fscale; y[i] *= fscale; }
+			data[i].u = x[i];
+			data[i].v = y[i];
+		}
+		if (fwrite(data, sizeof(projUV), count, stdout) != count)
+			emess(2, "binary output");
+	}
 }
 	static void	/* file processing function --- verbosely */
 vprocess(FILE *fid) {
@@ -491,6 +522,8 @@ int main(int argc, char **argv) {
         emess_dat.File_line = 0;
         if (very_verby)
             vprocess(fid);
+        else if (bin_in && bin_out && !dofactors)
+            bprocess(fid);
         else
             process(fid);
         (void)fclose(fid);
@@ -100,15 +100,20 @@ extern char const pj_release[]; /* global release id string */
 #define DEG_TO_RAD	.0174532925199432958
 
 
-extern int pj_errno;	/* global error return code */
+/* error return code of the calling thread's current context */
+#define pj_errno (*pj_get_errno_ref())
 
 #if !defined(PROJECTS_H)
     typedef struct { double u, v; } projUV;
     typedef void *projPJ;
+    typedef void *projCtx;
+    typedef void *projPlan;
     #define projXY projUV
     #define projLP projUV
 #else
     typedef PJ *projPJ;
+    typedef struct projCtx_t *projCtx;
+    typedef struct PJ_PLAN *projPlan;
 #   define projXY	XY
 #   define projLP       LP
 #endif
@@ -118,8 +123,40 @@ extern int pj_errno;	/* global error return code */
 projXY pj_fwd(projLP, projPJ);
 projLP pj_inv(projXY, projPJ);
 
+/* In place projection of separate x (lam) and y (phi) arrays */
+int pj_fwd_array( projPJ, long count, double *lam, double *phi );
+int pj_inv_array( projPJ, long count, double *x, double *y );
+
 int pj_transform( projPJ src, projPJ dst, long point_count, int point_offset,
                   double *x, double *y, double *z );
+/* As pj_transform(), splitting large arrays across a pool of threads */
+int pj_transform_parallel( projPJ src, projPJ dst,
+                           long point_count, int point_offset,
+                           double *x, double *y, double *z );
+void pj_set_thread_count( int count );
+void pj_deallocate_thread_grids( void );
+
+/* A src/dst pair resolved once into a list of steps, for transforming
+   many batches between the same two coordinate systems */
+projPlan pj_plan_create( projPJ src, projPJ dst );
+int pj_plan_execute( projPlan, long point_count, int point_offset,
+                     double *x, double *y, double *z );
+int pj_plan_execute_ctx( projCtx, projPlan, long point_count, int point_offset,
+                         double *x, double *y, double *z );
+void pj_plan_free( projPlan );
+
+/* Shared, reference counted projections for +proj strings */
+typedef struct {
+    long lookups;           /* calls to pj_init_plus_cached() */
+    long hits;              /* ... answered from the cache */
+    long entries;           /* projections currently cached */
+    double init_seconds;    /* processor time spent initializing misses */
+} projCacheStats;
+
+projPJ pj_init_plus_cached( const char * );
+void pj_free_cached( projPJ );
+void pj_cache_get_stats( projCacheStats * );
+void pj_cache_purge( void );
 int pj_datum_transform( projPJ src, projPJ dst, long point_count, int point_offset,
                         double *x, double *y, double *z );
 int pj_geocentric_to_geodetic( double a, double es,
@@ -141,6 +178,8 @@ void pj_set_finder( const char *(*)(const char *) );
 void pj_set_searchpath ( int count, const char **path );
 projPJ pj_init(int, char **);
 projPJ pj_init_plus(const char *);
+projPJ pj_init_ctx( projCtx, int, char ** );
+projPJ pj_init_plus_ctx( projCtx, const char * );
 char *pj_get_def(projPJ, int);
 projPJ pj_latlong_from_proj( projPJ );
 void *pj_malloc(size_t);
@@ -149,6 +188,26 @@ char *pj_strerrno(int);
 int *pj_get_errno_ref(void);
 const char *pj_get_release(void);
 
+/* Thread contexts.  Each thread working with PROJ.4 concurrently should
+   use its own context with the _ctx() variants of the entry points. */
+projXY pj_fwd_ctx( projCtx, projLP, projPJ );
+projLP pj_inv_ctx( projCtx, projXY, projPJ );
+int pj_fwd_array_ctx( projCtx, projPJ, long count, double *lam, double *phi );
+int pj_inv_array_ctx( projCtx, projPJ, long count, double *x, double *y );
+int pj_transform_ctx( projCtx ctx, projPJ src, projPJ dst,
+                      long point_count, int point_offset,
+                      double *x, double *y, double *z );
+projCtx pj_get_default_ctx(void);
+projCtx pj_get_ctx( projPJ );
+void pj_set_ctx( projPJ, projCtx );
+projCtx pj_ctx_alloc(void);
+void pj_ctx_free( projCtx );
+int pj_ctx_get_errno( projCtx );
+void pj_ctx_set_errno( projCtx, int );
+void pj_ctx_set_finder( projCtx, const char *(*)(const char *) );
+void pj_ctx_set_searchpath( projCtx, int count, const char **path );
+void pj_ctx_deallocate_grids( projCtx );
+
 #ifdef __cplusplus
 }
 #endif
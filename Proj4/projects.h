@@ -288,6 +288,8 @@ typedef struct ARG_list {
 typedef struct PJconsts {
 	XY  (*fwd)(LP, struct PJconsts *);
 	LP  (*inv)(XY, struct PJconsts *);
+	void (*fwd_n)(long, double *, double *, struct PJconsts *); /* optional */
+	void (*inv_n)(long, double *, double *, struct PJconsts *); /* batch kernels */
 	void (*spc)(LP, struct PJconsts *, struct FACTORS *);
 	void (*pfree)(struct PJconsts *);
 	const char *descr;
@@ -314,6 +316,8 @@ typedef struct PJconsts {
         double  datum_params[7];
         double  from_greenwich; /* prime meridian offset (in radians) */
         double  long_wrap_center; /* 0.0 for -180 to 180, actually in radians*/
+
+        struct projCtx_t *ctx; /* context used by pj_fwd()/pj_inv() */
         
 #ifdef PROJ_PARMS__
 PROJ_PARMS__
@@ -368,6 +372,7 @@ extern struct PJ_PRIME_MERIDIANS pj_prime_meridians[];
 	C_NAMESPACE PJ *pj_##name(PJ *P) { if (!P) { \
 	if( (P = (PJ*) pj_malloc(sizeof(PJ))) != NULL) { \
 	P->pfree = freeup; P->fwd = 0; P->inv = 0; \
+	P->fwd_n = 0; P->inv_n = 0; \
 	P->spc = 0; P->descr = des_##name;
 #define ENTRYX } return P; } else {
 #define ENTRY0(name) ENTRYA(name) ENTRYX
@@ -380,6 +385,10 @@ extern struct PJ_PRIME_MERIDIANS pj_prime_meridians[];
 #define I_ERROR { pj_errno = -20; return(lp); }
 #define FORWARD(name) static XY name(LP lp, PJ *P) { XY xy = {0.0,0.0}
 #define INVERSE(name) static LP name(XY xy, PJ *P) { LP lp = {0.0,0.0}
+	/* batch kernels, see pj_fwd_array() and pj_inv_array() */
+#define FORWARD_N(name) static void name(long count, double *lam, double *phi, PJ *P)
+#define INVERSE_N(name) static void name(long count, double *x, double *y, PJ *P)
+#define N_ERROR(i, u, v) { u[i] = v[i] = HUGE_VAL; pj_errno = -20; continue; }
 #define FREEUP static void freeup(PJ *P) {
 #define SPECIAL(name) static void name(LP lp, PJ *P, struct FACTORS *fac)
 #endif
@@ -406,10 +415,54 @@ typedef struct _pj_gi {
 
     struct CTABLE *ct;
 
+    void  *map_base;  /* mapping holding ct->cvs, see pj_gridmap.c */
+    size_t map_size;
+
     struct _pj_gi *next;
     struct _pj_gi *child;
+    struct PJ_GRIDINDEX *child_index; /* index over the child list */
 } PJ_GRIDINFO;
 
+/* bucket index over the extents of a list of grids, see pj_gridlist.c */
+typedef struct PJ_GRIDINDEX {
+    LP    ll, ur;   /* corners of the indexed area */
+    LP    del;      /* size of a bucket */
+    ILP   lim;      /* number of buckets */
+    int  *first;    /* bucket b holds items[first[b]] to items[first[b+1]-1] */
+    PJ_GRIDINFO **items; /* grids overlapping each bucket, in list order */
+} PJ_GRIDINDEX;
+
+/* the grids named by one nadgrids string, see pj_gridlist.c */
+typedef struct PJ_GRIDLIST {
+    char         *nadgrids;
+    PJ_GRIDINFO **grids;    /* NULL terminated */
+    int           count, max;
+    PJ_GRIDINDEX *index;    /* over grids */
+
+    /* grid used for the last point, see pj_apply_gridshift.c */
+    PJ_GRIDINFO  *last_hit_top;
+    PJ_GRIDINFO  *last_hit;
+    int           last_hit_bucket;
+    int           last_hit_child_bucket;
+
+    struct PJ_GRIDLIST *next;
+} PJ_GRIDLIST;
+
+/* per thread state, see pj_ctx.c */
+typedef struct projCtx_t {
+    int     last_errno;             /* error code of the last call */
+
+    /* grid shift tables loaded through this context, and the grid
+       lists built from nadgrids strings, see pj_gridlist.c */
+    PJ_GRIDINFO  *grid_list;
+    PJ_GRIDLIST  *nadgrids_lists;   /* most recently used first */
+
+    /* file search rules, see pj_open_lib.c */
+    const char *(*finder)(const char *);
+    int     path_count;
+    char  **search_path;
+} projCtx_t;
+
 /* procedure prototypes */
 double dmstor(const char *, char **);
 void set_rtodms(int, int);
@@ -472,11 +525,37 @@ void nad_free(struct CTABLE *);
 /* higher level handling of datum grid shift files */
 
 PJ_GRIDINFO **pj_gridlist_from_nadgrids( const char *, int * );
+PJ_GRIDLIST *pj_gridlist_get( const char * );
+PJ_GRIDINDEX *pj_gridindex_build( PJ_GRIDINFO **, int );
+void pj_gridindex_free( PJ_GRIDINDEX * );
+int pj_gridindex_bucket( const PJ_GRIDINDEX *, LP );
 void pj_deallocate_grids();
 
+projCtx_t *pj_ctx_current(void);
+projCtx_t *pj_ctx_enter(projCtx_t *);
+void pj_ctx_leave(projCtx_t *, projCtx_t *);
+
+/* shared by pj_transform() and the compiled plans of pj_plan.c */
+int pj_transform_fatal( int, long );
+int pj_datum_fatal( int );
+int pj_inv_points( projCtx_t *, PJ *, long, int, double *, double * );
+int pj_fwd_points( projCtx_t *, PJ *, long, int, double *, double * );
+int pj_geocentric_to_wgs84( PJ *, long, int, double *, double *, double * );
+int pj_geocentric_from_wgs84( PJ *, long, int, double *, double *, double * );
+int pj_geodetic_datum_shift( double, double, PJ *, PJ *, double, double,
+                             long, int, double *, double *, double * );
+
 PJ_GRIDINFO *pj_gridinfo_init( const char * );
 int pj_gridinfo_load( PJ_GRIDINFO * );
 void pj_gridinfo_free( PJ_GRIDINFO * );
+int pj_gridinfo_read( PJ_GRIDINFO * );
+
+/* memory mapped grids, and native sidecars for NTv1/NTv2 grids */
+#define PJ_NATIVE_SUFFIX ".native"
+int pj_gridmap_ctable( PJ_GRIDINFO * );
+int pj_gridmap_native( PJ_GRIDINFO * );
+void pj_gridmap_release( PJ_GRIDINFO * );
+int pj_gridinfo_write_native( const char *gridname, const char *filename );
 
 void *proj_mdist_ini(double);
 double proj_mdist(double, double, double, const void *);